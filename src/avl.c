@@ -141,3 +141,37 @@ AVLNode *avl_del(AVLNode *node) {
     *from = successor;
     return root;
 }
+
+AVLNode *avl_first(AVLNode *node) {
+    while (node && node->left) {
+        node = node->left;
+    }
+    return node;
+}
+
+AVLNode *avl_last(AVLNode *node) {
+    while (node && node->right) {
+        node = node->right;
+    }
+    return node;
+}
+
+AVLNode *avl_next(AVLNode *node) {
+    if (node->right) {
+        return avl_first(node->right);
+    }
+    while (node->parent && node->parent->right == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+AVLNode *avl_prev(AVLNode *node) {
+    if (node->left) {
+        return avl_last(node->left);
+    }
+    while (node->parent && node->parent->left == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
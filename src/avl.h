@@ -33,4 +33,10 @@ inline uint32_t avl_cnt(AVLNode *node) {
 AVLNode *avl_fix(AVLNode *node);
 AVLNode *avl_del(AVLNode *node);
 
+// In-order walking, NULL past either end
+AVLNode *avl_first(AVLNode *node);
+AVLNode *avl_last(AVLNode *node);
+AVLNode *avl_next(AVLNode *node);
+AVLNode *avl_prev(AVLNode *node);
+
 #endif
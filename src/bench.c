@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include "common.h"
+#include "protocol.h"
+#include "latency.h"
+#include "myredis.h"
+
+// Load generator: many pipelined connections driving a GET/SET mix.
+// Every connection keeps up to `pipeline` requests in flight (closed loop).
+
+typedef struct BenchConfig {
+    const char *host;
+    uint16_t port;
+    const char *unixsocket;  // connect here instead of host:port if set
+    uint32_t clients;     // total connections
+    uint32_t threads;
+    uint64_t requests;    // total requests across all connections
+    uint32_t keyspace;    // keys are "key:<n>" with n in [0, keyspace)
+    uint32_t val_min;     // value sizes are uniform in [val_min, val_max]
+    uint32_t val_max;
+    uint32_t pipeline;
+    uint32_t get_weight;  // GET:SET ratio
+    uint32_t set_weight;
+    bool prefill;         // SET every key once before measuring
+    uint64_t seed;
+} BenchConfig;
+
+static BenchConfig g_cfg = {
+    .host = "127.0.0.1",
+    .port = 6379,
+    .unixsocket = NULL,
+    .clients = 50,
+    .threads = 1,
+    .requests = 100000,
+    .keyspace = 10000,
+    .val_min = 16,
+    .val_max = 16,
+    .pipeline = 1,
+    .get_weight = 1,
+    .set_weight = 1,
+    .prefill = false,
+    .seed = 1,
+};
+
+// Requests handed out so far, shared by all threads
+static uint64_t g_issued = 0;
+
+static char *g_value_pool = NULL;  // val_max bytes of filler
+
+typedef struct BenchConn {
+    MrConn *mr;
+    struct BenchThread *th;
+    uint64_t *sent_at;  // ring of send timestamps, one per in-flight request
+    uint32_t head;      // oldest in-flight request
+    uint32_t inflight;
+} BenchConn;
+
+typedef struct BenchThread {
+    pthread_t tid;
+    uint32_t n_conns;
+    BenchConn *conns;
+    uint64_t rng;
+    // results
+    LatHist hist;
+    uint64_t gets;
+    uint64_t sets;
+    uint64_t hits;
+    uint64_t errors;
+} BenchThread;
+
+static uint64_t rng_next(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+static bool take_request(void) {
+    return __atomic_fetch_add(&g_issued, 1, __ATOMIC_RELAXED) < g_cfg.requests;
+}
+
+static MrConn *connect_server(void) {
+    MrConn *mr = g_cfg.unixsocket ? mr_connect_unix(g_cfg.unixsocket)
+                                   : mr_connect(g_cfg.host, g_cfg.port);
+    if (!mr) {
+        die("connect()");
+    }
+    return mr;
+}
+
+static void on_reply(MrConn *mr, MrReader *reply, void *arg);
+
+static void send_req(BenchConn *conn, const char **cmd, const uint32_t *lens, size_t n_cmd) {
+    if (!mr_send(conn->mr, cmd, lens, n_cmd, on_reply, conn)) {
+        die(mr_error(conn->mr));
+    }
+}
+
+// Queue one random GET or SET; returns true if it was a GET
+static bool queue_request(BenchThread *th, BenchConn *conn) {
+    char key[32];
+    uint32_t k = (uint32_t)(rng_next(&th->rng) % g_cfg.keyspace);
+    uint32_t key_len = (uint32_t)snprintf(key, sizeof(key), "key:%u", k);
+    uint32_t pick = (uint32_t)(rng_next(&th->rng) % (g_cfg.get_weight + g_cfg.set_weight));
+    bool is_get = pick < g_cfg.get_weight;
+    if (is_get) {
+        const char *cmd[] = {"get", key};
+        uint32_t lens[] = {3, key_len};
+        send_req(conn, cmd, lens, 2);
+    } else {
+        uint32_t span = g_cfg.val_max - g_cfg.val_min + 1;
+        uint32_t val_len = g_cfg.val_min + (uint32_t)(rng_next(&th->rng) % span);
+        const char *cmd[] = {"set", key, g_value_pool};
+        uint32_t lens[] = {3, key_len, val_len};
+        send_req(conn, cmd, lens, 3);
+    }
+    uint32_t slot = (conn->head + conn->inflight) % g_cfg.pipeline;
+    conn->sent_at[slot] = lat_now();
+    conn->inflight++;
+    return is_get;
+}
+
+// Replies come back in request order, so the oldest send time is theirs
+static void on_reply(MrConn *mr, MrReader *reply, void *arg) {
+    (void)mr;
+    BenchConn *conn = (BenchConn *)arg;
+    BenchThread *th = conn->th;
+    if (!reply) {
+        return;  // closed at the end of the run
+    }
+    uint64_t now = lat_now();
+    lat_record(&th->hist, lat_ticks_to_ns(now - conn->sent_at[conn->head]));
+    conn->head = (conn->head + 1) % g_cfg.pipeline;
+    conn->inflight--;
+
+    uint8_t tag = reply->p < reply->end ? reply->p[0] : TAG_ERR;
+    th->errors += tag == TAG_ERR;
+    th->hits += tag == TAG_STR;
+}
+
+static void *thread_main(void *arg) {
+    BenchThread *th = (BenchThread *)arg;
+    struct pollfd *pfds = calloc(th->n_conns, sizeof(struct pollfd));
+    uint32_t active = th->n_conns;
+
+    while (active > 0) {
+        active = 0;
+        for (uint32_t i = 0; i < th->n_conns; i++) {
+            BenchConn *conn = &th->conns[i];
+            // keep the pipeline full
+            while (conn->inflight < g_cfg.pipeline && take_request()) {
+                if (queue_request(th, conn)) {
+                    th->gets++;
+                } else {
+                    th->sets++;
+                }
+            }
+            pfds[i].fd = mr_fd(conn->mr);
+            pfds[i].events = mr_events(conn->mr);
+            pfds[i].revents = 0;
+            if (conn->inflight > 0) {
+                active++;
+            }
+        }
+        if (active == 0) {
+            break;
+        }
+        if (poll(pfds, th->n_conns, 1000) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            die("poll()");
+        }
+        for (uint32_t i = 0; i < th->n_conns; i++) {
+            BenchConn *conn = &th->conns[i];
+            if (mr_handle(conn->mr, pfds[i].revents) < 0) {
+                die(mr_error(conn->mr));
+            }
+        }
+    }
+    free(pfds);
+    return NULL;
+}
+
+// SET every key once over a single pipelined connection
+static void prefill(void) {
+    BenchThread th = {0};
+    th.rng = g_cfg.seed;
+    BenchConn conn = {0};
+    conn.mr = connect_server();
+    conn.th = &th;
+    conn.sent_at = calloc(1024, sizeof(uint64_t));
+
+    uint32_t saved_pipeline = g_cfg.pipeline;
+    g_cfg.pipeline = 1024;
+    for (uint32_t k = 0; k < g_cfg.keyspace; k++) {
+        char key[32];
+        uint32_t key_len = (uint32_t)snprintf(key, sizeof(key), "key:%u", k);
+        const char *cmd[] = {"set", key, g_value_pool};
+        uint32_t lens[] = {3, key_len, g_cfg.val_max};
+        send_req(&conn, cmd, lens, 3);
+        conn.inflight++;
+        if (conn.inflight == g_cfg.pipeline || k + 1 == g_cfg.keyspace) {
+            if (mr_wait(conn.mr) < 0) {
+                die(mr_error(conn.mr));
+            }
+        }
+    }
+    g_cfg.pipeline = saved_pipeline;
+    if (th.errors) {
+        fprintf(stderr, "prefill: %llu errors\n", (unsigned long long)th.errors);
+    }
+    mr_close(conn.mr);
+    free(conn.sent_at);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -h HOST        server address (default 127.0.0.1)\n"
+        "  -p PORT        server port (default 6379)\n"
+        "  -s PATH        connect over this unix socket instead of TCP\n"
+        "  -c N           total connections (default 50)\n"
+        "  -t N           threads (default 1)\n"
+        "  -n N           total requests (default 100000)\n"
+        "  -r N           key space size (default 10000)\n"
+        "  -d N|MIN-MAX   value size in bytes, uniform in range (default 16)\n"
+        "  -P N           pipeline depth per connection (default 1)\n"
+        "  -m GET:SET     request mix (default 1:1)\n"
+        "  --prefill      SET every key before measuring\n"
+        "  --seed N       random seed (default 1)\n", prog);
+    exit(1);
+}
+
+static void parse_args(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "--prefill") == 0) {
+            g_cfg.prefill = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *val = argv[++i];
+        if (strcmp(opt, "-h") == 0) {
+            g_cfg.host = val;
+        } else if (strcmp(opt, "-p") == 0) {
+            g_cfg.port = (uint16_t)atoi(val);
+        } else if (strcmp(opt, "-s") == 0) {
+            g_cfg.unixsocket = val;
+        } else if (strcmp(opt, "-c") == 0) {
+            g_cfg.clients = (uint32_t)atoi(val);
+        } else if (strcmp(opt, "-t") == 0) {
+            g_cfg.threads = (uint32_t)atoi(val);
+        } else if (strcmp(opt, "-n") == 0) {
+            g_cfg.requests = strtoull(val, NULL, 10);
+        } else if (strcmp(opt, "-r") == 0) {
+            g_cfg.keyspace = (uint32_t)atoi(val);
+        } else if (strcmp(opt, "-d") == 0) {
+            if (sscanf(val, "%u-%u", &g_cfg.val_min, &g_cfg.val_max) != 2) {
+                g_cfg.val_min = g_cfg.val_max = (uint32_t)atoi(val);
+            }
+        } else if (strcmp(opt, "-P") == 0) {
+            g_cfg.pipeline = (uint32_t)atoi(val);
+        } else if (strcmp(opt, "-m") == 0) {
+            if (sscanf(val, "%u:%u", &g_cfg.get_weight, &g_cfg.set_weight) != 2) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(opt, "--seed") == 0) {
+            g_cfg.seed = strtoull(val, NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (g_cfg.clients == 0 || g_cfg.threads == 0 || g_cfg.keyspace == 0 || g_cfg.pipeline == 0 ||
+        g_cfg.val_min > g_cfg.val_max || g_cfg.get_weight + g_cfg.set_weight == 0) {
+        usage(argv[0]);
+    }
+    if (g_cfg.threads > g_cfg.clients) {
+        g_cfg.threads = g_cfg.clients;
+    }
+}
+
+int main(int argc, char **argv) {
+    parse_args(argc, argv);
+    lat_clock_init(LAT_CLOCK_MONOTONIC);
+
+    g_value_pool = malloc(g_cfg.val_max + 1);
+    memset(g_value_pool, 'x', g_cfg.val_max);
+    g_value_pool[g_cfg.val_max] = '\0';
+
+    if (g_cfg.prefill) {
+        prefill();
+    }
+
+    // Spread connections over threads as evenly as possible
+    BenchThread *threads = calloc(g_cfg.threads, sizeof(BenchThread));
+    for (uint32_t t = 0; t < g_cfg.threads; t++) {
+        BenchThread *th = &threads[t];
+        th->n_conns = g_cfg.clients / g_cfg.threads + (t < g_cfg.clients % g_cfg.threads);
+        th->conns = calloc(th->n_conns, sizeof(BenchConn));
+        th->rng = g_cfg.seed * 0x9E3779B97F4A7C15ull + t + 1;
+        for (uint32_t i = 0; i < th->n_conns; i++) {
+            BenchConn *conn = &th->conns[i];
+            conn->mr = connect_server();
+            conn->th = th;
+            conn->sent_at = calloc(g_cfg.pipeline, sizeof(uint64_t));
+        }
+    }
+
+    uint64_t t0 = lat_now();
+    for (uint32_t t = 0; t < g_cfg.threads; t++) {
+        pthread_create(&threads[t].tid, NULL, thread_main, &threads[t]);
+    }
+    LatHist *total = calloc(1, sizeof(LatHist));
+    uint64_t gets = 0, sets = 0, hits = 0, errors = 0;
+    for (uint32_t t = 0; t < g_cfg.threads; t++) {
+        BenchThread *th = &threads[t];
+        pthread_join(th->tid, NULL);
+        lat_merge(total, &th->hist);
+        gets += th->gets;
+        sets += th->sets;
+        hits += th->hits;
+        errors += th->errors;
+    }
+    double secs = (double)lat_ticks_to_ns(lat_now() - t0) / 1e9;
+
+    printf("requests:   %llu (%llu GET, %llu SET)\n", (unsigned long long)total->count,
+           (unsigned long long)gets, (unsigned long long)sets);
+    printf("setup:      %s, %u conns, %u threads, pipeline %u, keyspace %u, value %u-%u bytes\n",
+           g_cfg.unixsocket ? "unix socket" : "tcp", g_cfg.clients, g_cfg.threads, g_cfg.pipeline, g_cfg.keyspace, g_cfg.val_min, g_cfg.val_max);
+    printf("duration:   %.3f s\n", secs);
+    printf("throughput: %.0f req/s\n", (double)total->count / secs);
+    printf("get hits:   %.1f%%\n", gets ? 100.0 * (double)hits / (double)gets : 0.0);
+    printf("errors:     %llu\n", (unsigned long long)errors);
+    printf("latency (usec): p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+           (double)lat_percentile(total, 50.0) / 1000.0,
+           (double)lat_percentile(total, 90.0) / 1000.0,
+           (double)lat_percentile(total, 99.0) / 1000.0,
+           (double)lat_percentile(total, 99.9) / 1000.0,
+           (double)total->max / 1000.0);
+
+    for (uint32_t t = 0; t < g_cfg.threads; t++) {
+        for (uint32_t i = 0; i < threads[t].n_conns; i++) {
+            BenchConn *conn = &threads[t].conns[i];
+            mr_close(conn->mr);
+            free(conn->sent_at);
+        }
+        free(threads[t].conns);
+    }
+    free(threads);
+    free(total);
+    free(g_value_pool);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bitmap.h"
+#include "common.h"
+
+Bitmap *bm_new(void) {
+    Bitmap *bm = calloc(1, sizeof(Bitmap));
+    if (!bm) {
+        die("Memory allocation failed");
+    }
+    return bm;
+}
+
+void bm_free(Bitmap *bm) {
+    free(bm->bytes);
+    free(bm);
+}
+
+size_t bm_len(const Bitmap *bm) {
+    return bm->len;
+}
+
+size_t bm_mem(const Bitmap *bm) {
+    return sizeof(Bitmap) + bm->cap;
+}
+
+bool bm_get(const Bitmap *bm, uint64_t offset) {
+    uint64_t byte = offset >> 3;
+    if (byte >= bm->len) {
+        return false;
+    }
+    return (bm->bytes[byte] >> (7 - (offset & 7))) & 1;
+}
+
+bool bm_set(Bitmap *bm, uint64_t offset, bool bit) {
+    size_t byte = (size_t)(offset >> 3);
+    if (byte >= bm->len) {
+        if (byte >= bm->cap) {
+            size_t cap = bm->cap ? bm->cap * 2 : 16;
+            while (cap <= byte) {
+                cap *= 2;
+            }
+            bm->bytes = realloc(bm->bytes, cap);
+            if (!bm->bytes) {
+                die("Memory allocation failed");
+            }
+            bm->cap = cap;
+        }
+        memset(bm->bytes + bm->len, 0, byte + 1 - bm->len);
+        bm->len = byte + 1;
+    }
+    uint8_t mask = (uint8_t)(1u << (7 - (offset & 7)));
+    bool old = (bm->bytes[byte] & mask) != 0;
+    if (bit) {
+        bm->bytes[byte] |= mask;
+    } else {
+        bm->bytes[byte] &= (uint8_t)~mask;
+    }
+    return old;
+}
+
+// Four independent accumulators keep several popcounts in flight.
+// Built twice: the generic version falls back to a bit-twiddling
+// popcount, the other uses the POPCNT instruction where the CPU has it.
+#define POPCOUNT_WORDS_BODY                                         \
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;                        \
+    size_t i = 0;                                                   \
+    for (; i + 4 <= n; i += 4) {                                    \
+        uint64_t w[4];                                              \
+        memcpy(w, p + i * 8, sizeof(w));                            \
+        c0 += (uint64_t)__builtin_popcountll(w[0]);                 \
+        c1 += (uint64_t)__builtin_popcountll(w[1]);                 \
+        c2 += (uint64_t)__builtin_popcountll(w[2]);                 \
+        c3 += (uint64_t)__builtin_popcountll(w[3]);                 \
+    }                                                               \
+    for (; i < n; i++) {                                            \
+        uint64_t w;                                                 \
+        memcpy(&w, p + i * 8, 8);                                   \
+        c0 += (uint64_t)__builtin_popcountll(w);                    \
+    }                                                               \
+    return c0 + c1 + c2 + c3;
+
+// Set bits in n 64-bit words
+static uint64_t popcount_words_generic(const uint8_t *p, size_t n) {
+    POPCOUNT_WORDS_BODY
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("popcnt")))
+static uint64_t popcount_words_popcnt(const uint8_t *p, size_t n) {
+    POPCOUNT_WORDS_BODY
+}
+#endif
+
+static uint64_t popcount_words(const uint8_t *p, size_t n) {
+#if defined(__x86_64__) || defined(__i386__)
+    static int has_popcnt = -1;
+    if (has_popcnt < 0) {
+        __builtin_cpu_init();
+        has_popcnt = __builtin_cpu_supports("popcnt") ? 1 : 0;
+    }
+    if (has_popcnt) {
+        return popcount_words_popcnt(p, n);
+    }
+#endif
+    return popcount_words_generic(p, n);
+}
+
+uint64_t bm_count(const Bitmap *bm, size_t start, size_t end) {
+    if (start > end || start >= bm->len) {
+        return 0;
+    }
+    if (end >= bm->len) {
+        end = bm->len - 1;
+    }
+    const uint8_t *p = bm->bytes + start;
+    size_t n = end - start + 1;
+    uint64_t total = popcount_words(p, n / 8);
+    for (size_t i = n & ~(size_t)7; i < n; i++) {
+        total += (uint64_t)__builtin_popcount(p[i]);
+    }
+    return total;
+}
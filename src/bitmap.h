@@ -0,0 +1,29 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bitmap value type: a byte array grown on demand by SETBIT.
+// Bit 0 is the most significant bit of byte 0, as in Redis, so the
+// offsets users compute carry over.
+#define k_bitmap_max_bits (1ull << 32)
+
+typedef struct Bitmap {
+    uint8_t *bytes;
+    size_t len;  // bytes in use, the rest of the range reads as 0
+    size_t cap;
+} Bitmap;
+
+Bitmap *bm_new(void);
+void bm_free(Bitmap *bm);
+size_t bm_len(const Bitmap *bm);
+size_t bm_mem(const Bitmap *bm);  // estimated bytes, for maxmemory
+
+bool bm_get(const Bitmap *bm, uint64_t offset);
+bool bm_set(Bitmap *bm, uint64_t offset, bool bit);  // returns the old bit
+// Set bits in bytes start..end (inclusive, already clamped to the bitmap)
+uint64_t bm_count(const Bitmap *bm, size_t start, size_t end);
+
+#endif
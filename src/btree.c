@@ -0,0 +1,436 @@
+#include <stdlib.h>
+#include <string.h>
+#include "btree.h"
+#include "common.h"
+
+// Nodes other than the root keep at least half the fanout
+#define k_btree_min (k_btree_fanout / 2)
+
+void bt_init(BTree *tree, bt_cmp_fn cmp) {
+    tree->root = NULL;
+    tree->len = 0;
+    tree->bytes = 0;
+    tree->cmp = cmp;
+}
+
+static void node_free(BTNode *node) {
+    if (!node->leaf) {
+        BTInner *inner = (BTInner *)node;
+        for (uint32_t i = 0; i < node->n; i++) {
+            node_free(inner->children[i]);
+        }
+    }
+    free(node);
+}
+
+void bt_clear(BTree *tree) {
+    if (tree->root) {
+        node_free(tree->root);
+    }
+    bt_init(tree, tree->cmp);
+}
+
+size_t bt_len(const BTree *tree) {
+    return tree->len;
+}
+
+static BTLeaf *leaf_new(BTree *tree) {
+    BTLeaf *leaf = malloc(sizeof(BTLeaf));
+    if (!leaf) {
+        die("Memory allocation failed");
+    }
+    leaf->base.n = 0;
+    leaf->base.leaf = 1;
+    leaf->prev = leaf->next = NULL;
+    tree->bytes += sizeof(BTLeaf);
+    return leaf;
+}
+
+static BTInner *inner_new(BTree *tree) {
+    BTInner *inner = malloc(sizeof(BTInner));
+    if (!inner) {
+        die("Memory allocation failed");
+    }
+    inner->base.n = 0;
+    inner->base.leaf = 0;
+    tree->bytes += sizeof(BTInner);
+    return inner;
+}
+
+static void node_release(BTree *tree, BTNode *node) {
+    tree->bytes -= node->leaf ? sizeof(BTLeaf) : sizeof(BTInner);
+    free(node);
+}
+
+static uint32_t node_count(const BTNode *node) {
+    if (node->leaf) {
+        return node->n;
+    }
+    const BTInner *inner = (const BTInner *)node;
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < node->n; i++) {
+        total += inner->counts[i];
+    }
+    return total;
+}
+
+// --- Searching inside a node ---
+
+static int entry_cmp(const BTree *tree, const BTNode *node, uint32_t i,
+                     uint64_t key, const void *item) {
+    if (node->keys[i] != key) {
+        return node->keys[i] < key ? -1 : 1;
+    }
+    return tree->cmp(node->items[i], item);
+}
+
+// First entry > (key, item), or >= unless upper.
+// Counting the keys below and at the probe key is a branchless pass over
+// the key array, whose cache lines load in parallel; a binary search would
+// wait on each line in turn. Only entries with an equal key are then
+// ordered with the comparator.
+static uint32_t node_bound(const BTree *tree, const BTNode *node,
+                           uint64_t key, const void *item, bool upper) {
+    uint32_t lo = 0, hi = 0;
+    for (uint32_t i = 0; i < node->n; i++) {
+        lo += node->keys[i] < key;
+        hi += node->keys[i] <= key;
+    }
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        int rv = tree->cmp(node->items[mid], item);
+        if (rv < 0 || (upper && rv == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// The child whose range holds the position of the bound
+static uint32_t child_index(const BTree *tree, const BTNode *node,
+                            uint64_t key, const void *item, bool upper) {
+    uint32_t i = node_bound(tree, node, key, item, upper);
+    return i ? i - 1 : 0;
+}
+
+// --- Entry shuffling ---
+
+static void entries_move(BTNode *dst, uint32_t di, BTNode *src, uint32_t si, uint32_t n) {
+    memmove(&dst->keys[di], &src->keys[si], n * sizeof(uint64_t));
+    memmove(&dst->items[di], &src->items[si], n * sizeof(void *));
+    if (!dst->leaf) {
+        BTInner *d = (BTInner *)dst, *s = (BTInner *)src;
+        memmove(&d->counts[di], &s->counts[si], n * sizeof(uint32_t));
+        memmove(&d->children[di], &s->children[si], n * sizeof(BTNode *));
+    }
+}
+
+// Refresh the separator and count of child i after it changed
+static void child_sync(BTInner *inner, uint32_t i) {
+    BTNode *child = inner->children[i];
+    inner->base.keys[i] = child->keys[0];
+    inner->base.items[i] = child->items[0];
+    inner->counts[i] = node_count(child);
+}
+
+// --- Insert ---
+
+// Move the upper half of a full node into a new right sibling
+static BTNode *node_split(BTree *tree, BTNode *node) {
+    BTNode *right;
+    if (node->leaf) {
+        BTLeaf *l = (BTLeaf *)node, *r = leaf_new(tree);
+        r->next = l->next;
+        r->prev = l;
+        if (l->next) {
+            l->next->prev = r;
+        }
+        l->next = r;
+        right = &r->base;
+    } else {
+        right = &inner_new(tree)->base;
+    }
+    uint32_t half = node->n / 2;
+    entries_move(right, 0, node, half, node->n - half);
+    right->n = node->n - half;
+    node->n = half;
+    return right;
+}
+
+// Insert below node. Returns the new right sibling if node had to split.
+static BTNode *insert_rec(BTree *tree, BTNode *node, uint64_t key, void *item) {
+    if (node->leaf) {
+        BTNode *right = NULL;
+        uint32_t pos = node_bound(tree, node, key, item, true);
+        if (node->n == k_btree_fanout) {
+            right = node_split(tree, node);
+            if (pos > node->n) {
+                pos -= node->n;
+                node = right;
+            }
+        }
+        entries_move(node, pos + 1, node, pos, node->n - pos);
+        node->keys[pos] = key;
+        node->items[pos] = item;
+        node->n++;
+        return right;
+    }
+
+    BTInner *inner = (BTInner *)node;
+    uint32_t i = child_index(tree, node, key, item, true);
+    BTNode *split = insert_rec(tree, inner->children[i], key, item);
+    child_sync(inner, i);
+    if (!split) {
+        return NULL;
+    }
+
+    // link the new child after child i
+    BTNode *right = NULL;
+    uint32_t pos = i + 1;
+    if (node->n == k_btree_fanout) {
+        right = node_split(tree, node);
+        if (pos > node->n) {
+            pos -= node->n;
+            inner = (BTInner *)right;
+        }
+    }
+    entries_move(&inner->base, pos + 1, &inner->base, pos, inner->base.n - pos);
+    inner->children[pos] = split;
+    inner->base.n++;
+    child_sync(inner, pos);
+    return right;
+}
+
+void bt_insert(BTree *tree, uint64_t key, void *item) {
+    if (!tree->root) {
+        tree->root = &leaf_new(tree)->base;
+    }
+    BTNode *split = insert_rec(tree, tree->root, key, item);
+    if (split) {
+        // grow a level
+        BTInner *root = inner_new(tree);
+        root->children[0] = tree->root;
+        root->children[1] = split;
+        root->base.n = 2;
+        child_sync(root, 0);
+        child_sync(root, 1);
+        tree->root = &root->base;
+    }
+    tree->len++;
+}
+
+// --- Delete ---
+
+// Move n entries from the front of src to the back of dst
+static void shift_left(BTNode *dst, BTNode *src, uint32_t n) {
+    entries_move(dst, dst->n, src, 0, n);
+    dst->n += n;
+    entries_move(src, 0, src, n, src->n - n);
+    src->n -= n;
+}
+
+// Move one entry from the back of src to the front of dst
+static void shift_right(BTNode *src, BTNode *dst) {
+    entries_move(dst, 1, dst, 0, dst->n);
+    entries_move(dst, 0, src, src->n - 1, 1);
+    dst->n++;
+    src->n--;
+}
+
+// Child i fell below the minimum: borrow from a sibling, or merge with one
+static void child_fix(BTree *tree, BTInner *inner, uint32_t i) {
+    BTNode *child = inner->children[i];
+    BTNode *left = i > 0 ? inner->children[i - 1] : NULL;
+    BTNode *right = i + 1 < inner->base.n ? inner->children[i + 1] : NULL;
+    if (left && left->n > k_btree_min) {
+        shift_right(left, child);
+        child_sync(inner, i - 1);
+        child_sync(inner, i);
+        return;
+    }
+    if (right && right->n > k_btree_min) {
+        shift_left(child, right, 1);
+        child_sync(inner, i);
+        child_sync(inner, i + 1);
+        return;
+    }
+
+    // merge the pair into its left node and unlink the right one
+    if (!right) {
+        right = child;
+        i--;
+    }
+    left = inner->children[i];
+    shift_left(left, right, right->n);
+    if (left->leaf) {
+        BTLeaf *l = (BTLeaf *)left, *r = (BTLeaf *)right;
+        l->next = r->next;
+        if (r->next) {
+            r->next->prev = l;
+        }
+    }
+    node_release(tree, right);
+    entries_move(&inner->base, i + 1, &inner->base, i + 2, inner->base.n - i - 2);
+    inner->base.n--;
+    child_sync(inner, i);
+}
+
+static void *delete_rec(BTree *tree, BTNode *node, uint64_t key, const void *item) {
+    if (node->leaf) {
+        uint32_t pos = node_bound(tree, node, key, item, true);
+        if (pos == 0 || entry_cmp(tree, node, pos - 1, key, item) != 0) {
+            return NULL;
+        }
+        void *found = node->items[pos - 1];
+        entries_move(node, pos - 1, node, pos, node->n - pos);
+        node->n--;
+        return found;
+    }
+
+    // every separator up to child i is <= the item, so an equal
+    // entry, if any, is in child i
+    BTInner *inner = (BTInner *)node;
+    uint32_t i = child_index(tree, node, key, item, true);
+    void *found = delete_rec(tree, inner->children[i], key, item);
+    if (!found) {
+        return NULL;
+    }
+    if (inner->children[i]->n < k_btree_min && node->n > 1) {
+        child_fix(tree, inner, i);
+    } else if (inner->children[i]->n) {
+        child_sync(inner, i);
+    }
+    return found;
+}
+
+void *bt_delete(BTree *tree, uint64_t key, const void *item) {
+    if (!tree->root) {
+        return NULL;
+    }
+    void *found = delete_rec(tree, tree->root, key, item);
+    if (!found) {
+        return NULL;
+    }
+    tree->len--;
+    // shrink a level, or drop the last empty leaf
+    BTNode *root = tree->root;
+    if (!root->leaf && root->n == 1) {
+        tree->root = ((BTInner *)root)->children[0];
+        node_release(tree, root);
+    } else if (root->leaf && root->n == 0) {
+        tree->root = NULL;
+        node_release(tree, root);
+    }
+    return found;
+}
+
+// --- Lookups ---
+
+// Leaf position of the first entry >= (or >) the probe, with the number
+// of entries before it unless rank is NULL
+static BTIter seek_rank(const BTree *tree, uint64_t key, const void *item,
+                        bool upper, size_t *rank) {
+    BTIter it = {NULL, 0};
+    size_t before = 0;
+    BTNode *node = tree->root;
+    if (!node) {
+        if (rank) {
+            *rank = 0;
+        }
+        return it;
+    }
+    while (!node->leaf) {
+        BTInner *inner = (BTInner *)node;
+        // the bound is at or past the start of the last child whose
+        // first entry is below it
+        uint32_t i = child_index(tree, node, key, item, upper);
+        for (uint32_t j = 0; rank && j < i; j++) {
+            before += inner->counts[j];
+        }
+        node = inner->children[i];
+    }
+    uint32_t pos = node_bound(tree, node, key, item, upper);
+    if (rank) {
+        *rank = before + pos;
+    }
+    it.leaf = (BTLeaf *)node;
+    it.pos = pos;
+    if (pos == node->n) {
+        it.leaf = it.leaf->next;
+        it.pos = 0;
+    }
+    return it;
+}
+
+BTIter bt_seek(const BTree *tree, uint64_t key, const void *item, bool exclusive) {
+    return seek_rank(tree, key, item, exclusive, NULL);
+}
+
+void *bt_find(const BTree *tree, uint64_t key, const void *item) {
+    BTIter it = bt_seek(tree, key, item, false);
+    if (!bt_valid(&it) || entry_cmp(tree, &it.leaf->base, it.pos, key, item) != 0) {
+        return NULL;
+    }
+    return bt_item(&it);
+}
+
+size_t bt_rank(const BTree *tree, uint64_t key, const void *item) {
+    size_t rank;
+    seek_rank(tree, key, item, false, &rank);
+    return rank;
+}
+
+BTIter bt_at(const BTree *tree, size_t rank) {
+    BTIter it = {NULL, 0};
+    if (rank >= tree->len) {
+        return it;
+    }
+    BTNode *node = tree->root;
+    while (!node->leaf) {
+        BTInner *inner = (BTInner *)node;
+        uint32_t i = 0;
+        while (rank >= inner->counts[i]) {
+            rank -= inner->counts[i++];
+        }
+        node = inner->children[i];
+    }
+    it.leaf = (BTLeaf *)node;
+    it.pos = (uint32_t)rank;
+    return it;
+}
+
+BTIter bt_first(const BTree *tree) {
+    return bt_at(tree, 0);
+}
+
+BTIter bt_last(const BTree *tree) {
+    BTIter it = {NULL, 0};
+    BTNode *node = tree->root;
+    if (!node) {
+        return it;
+    }
+    while (!node->leaf) {
+        node = ((BTInner *)node)->children[node->n - 1];
+    }
+    it.leaf = (BTLeaf *)node;
+    it.pos = node->n - 1;
+    return it;
+}
+
+void bt_next(BTIter *it) {
+    if (++it->pos == it->leaf->base.n) {
+        it->leaf = it->leaf->next;
+        it->pos = 0;
+    }
+}
+
+void bt_prev(BTIter *it) {
+    if (it->pos == 0) {
+        it->leaf = it->leaf->prev;
+        it->pos = it->leaf ? it->leaf->base.n - 1 : 0;
+        return;
+    }
+    it->pos--;
+}
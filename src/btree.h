@@ -0,0 +1,89 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// B+tree of item pointers, an alternative to the AVL tree for large sorted
+// collections. An AVL lookup takes one dependent cache miss per level
+// (~24 levels at 10M items); here a node packs k_btree_fanout entries into
+// a few adjacent cache lines and the tree is ~5 levels deep.
+//
+// Each entry is a 64-bit key plus the item pointer. Keys are compared
+// inline; the comparator is only called on the items when two keys tie,
+// so the key should be an order-preserving prefix of the item (the first
+// bytes of a string, the bits of a score). Equal items are allowed.
+//
+// Inner nodes keep the item count of every child, for rank queries like
+// AVLNode.cnt, and the first entry of every child as its separator.
+// Leaves are linked both ways for range scans.
+#define k_btree_fanout 32
+
+typedef int (*bt_cmp_fn)(const void *a, const void *b);
+
+typedef struct BTNode {
+    uint32_t n;     // entries in use
+    uint32_t leaf;
+    uint64_t keys[k_btree_fanout];
+    void *items[k_btree_fanout];  // in inner nodes, the first item of each child
+} BTNode;
+
+typedef struct BTLeaf {
+    BTNode base;
+    struct BTLeaf *prev;
+    struct BTLeaf *next;
+} BTLeaf;
+
+typedef struct BTInner {
+    BTNode base;
+    uint32_t counts[k_btree_fanout];  // items under each child
+    BTNode *children[k_btree_fanout];
+} BTInner;
+
+typedef struct BTree {
+    BTNode *root;
+    size_t len;
+    size_t bytes;  // node allocations
+    bt_cmp_fn cmp;
+} BTree;
+
+// Position of one entry, invalidated by any insert or delete
+typedef struct BTIter {
+    BTLeaf *leaf;  // NULL past either end
+    uint32_t pos;
+} BTIter;
+
+void bt_init(BTree *tree, bt_cmp_fn cmp);
+void bt_clear(BTree *tree);  // frees the nodes, not the items
+size_t bt_len(const BTree *tree);
+
+void bt_insert(BTree *tree, uint64_t key, void *item);  // after any equal items
+// Remove one entry equal to (key, item), returning its item, NULL if none
+void *bt_delete(BTree *tree, uint64_t key, const void *item);
+void *bt_find(const BTree *tree, uint64_t key, const void *item);
+// Number of entries below (key, item)
+size_t bt_rank(const BTree *tree, uint64_t key, const void *item);
+
+// First entry >= (key, item), or > with exclusive
+BTIter bt_seek(const BTree *tree, uint64_t key, const void *item, bool exclusive);
+BTIter bt_at(const BTree *tree, size_t rank);  // invalid if rank >= len
+BTIter bt_first(const BTree *tree);
+BTIter bt_last(const BTree *tree);
+
+static inline bool bt_valid(const BTIter *it) {
+    return it->leaf != NULL;
+}
+
+static inline void *bt_item(const BTIter *it) {
+    return it->leaf->base.items[it->pos];
+}
+
+static inline uint64_t bt_key(const BTIter *it) {
+    return it->leaf->base.keys[it->pos];
+}
+
+void bt_next(BTIter *it);
+void bt_prev(BTIter *it);
+
+#endif
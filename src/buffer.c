@@ -25,12 +25,17 @@ void buf_reserve(Buffer *buf, size_t n) {
     size_t total_free_space = buf->capacity - buf_read_size(buf);
     if (total_free_space >= n) {
         // We have enough space, but it's fragmented
-        memmove(buf->data, buf_read_ptr(buf), buf_read_size(buf));
+        size_t size = buf_read_size(buf);
+        memmove(buf->data, buf_read_ptr(buf), size);
         buf->r_pos = 0;
-        buf->w_pos = buf_read_size(buf);
+        buf->w_pos = size;
     } else {
         // Buffer is too small, need to allocate more memory
-        size_t new_capacity = buf->capacity + n;
+        // Grow geometrically so a long run of small appends stays O(n)
+        size_t new_capacity = buf->capacity * 2;
+        if (new_capacity < buf->capacity + n) {
+            new_capacity = buf->capacity + n;
+        }
         uint8_t *new_data = realloc(buf->data, new_capacity);
         if (!new_data) {
             die("Memory allocation failed");
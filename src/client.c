@@ -2,43 +2,58 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <errno.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
+#include <strings.h>
+#include <stdbool.h>
 #include "common.h"
-
-#define k_max_msg 4096
-
-// --- Serialization Tags ---
-enum {
-    TAG_NIL = 0,
-    TAG_ERR = 1,
-    TAG_STR = 2,
-    TAG_INT = 3,
-    TAG_DBL = 4,
-    TAG_ARR = 5,
-};
+#include "myredis.h"
 
 // static int32_t query(int fd, const char *text);
-static int32_t send_req(int fd, const char **cmd, size_t n_cmd);
-static int32_t read_res(int fd);
-static int32_t print_response(const uint8_t *data, size_t size);
-
-int main() {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-        die("socket creation failed");
+static void send_req(MrConn *conn, const char **cmd, size_t n_cmd);
+static int run_sharded(char *servers, char **cmd, size_t n_cmd);
+
+// Set when a request fails or a reply is malformed
+static bool g_failed = false;
+
+// Usage: client [-h host] [-p port] [-s host:port,...] [cmd args...]
+// Without a command, runs the built-in pipelining demo.
+// -s shards the command over the listed servers, see run_sharded().
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = 6379;
+    char *servers = NULL;
+    int argi = 1;
+    while (argi + 1 < argc && argv[argi][0] == '-') {
+        if (strcmp(argv[argi], "-h") == 0) {
+            host = argv[argi + 1];
+        } else if (strcmp(argv[argi], "-p") == 0) {
+            port = atoi(argv[argi + 1]);
+        } else if (strcmp(argv[argi], "-s") == 0) {
+            servers = argv[argi + 1];
+        } else {
+            break;
+        }
+        argi += 2;
+    }
+    if (servers && argi < argc) {
+        return run_sharded(servers, &argv[argi], (size_t)(argc - argi));
     }
 
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(6379);
-    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // 127.0.0.1, defined in host byte order
-    int rv = connect(fd, (const struct sockaddr *)&addr, sizeof(addr));
-    if (rv < 0) {
+    MrConn *conn = mr_connect(host, (uint16_t)port);
+    if (!conn) {
         die("Connect failed");
     }
 
+    // One-shot mode: send the command given on the command line
+    if (argi < argc) {
+        send_req(conn, (const char **)&argv[argi], (size_t)(argc - argi));
+        int err = mr_wait(conn);
+        if (err) {
+            msg(mr_error(conn));
+        }
+        mr_close(conn);
+        return err || g_failed ? 1 : 0;
+    }
+
     /*
     // Multiple pipelined requests
     char *long_msg = malloc(k_max_msg + 1);
@@ -55,199 +70,121 @@ int main() {
     // --- PIPELINING STEP 1: SEND EVERYTHING ---
     printf("--- Sending requests ---\n");
     const char *cmd_set[] ={"set", "mykey", "123"};
-    send_req(fd, cmd_set, 3);
+    send_req(conn, cmd_set, 3);
 
     const char *cmd_set2[] = {"set", "otherkey", "hello"};
-    send_req(fd, cmd_set2, 3);
+    send_req(conn, cmd_set2, 3);
 
     const char *cmd_get[] = {"get", "mykey"};
-    send_req(fd, cmd_get, 2);
+    send_req(conn, cmd_get, 2);
 
     const char *cmd_keys[] = {"keys"};
-    send_req(fd, cmd_keys, 1);
+    send_req(conn, cmd_keys, 1);
 
     const char *cmd_del[] = {"del", "mykey"};
-    send_req(fd, cmd_del, 2);
+    send_req(conn, cmd_del, 2);
 
     const char *cmd_bad[] = {"fake_cmd"};
-    send_req(fd, cmd_bad, 1);
-
-    size_t query_count = 6;
+    send_req(conn, cmd_bad, 1);
 
     // --- PIPELINING STEP 2: READ EVERYTHING ---
+    // the six requests above leave in one write()
     printf("--- Waiting for responses ---\n");
-    for (size_t i = 0; i < query_count; i++) {
-        int32_t err = read_res(fd);
-        if (err) goto L_DONE;
+    if (mr_wait(conn)) {
+        msg(mr_error(conn));
     }
 
-L_DONE:
-    close(fd);
+    mr_close(conn);
     // free(long_msg);
     return 0;
 }
 
-static int32_t send_req(int fd, const char **cmd, size_t n_cmd) {
-    char wbuf[4 + k_max_msg];
-    char *ptr = wbuf + 4;
-
-    // 1. Write number of strings (nstr)
-    uint32_t n = (uint32_t)n_cmd;
-    memcpy(ptr, &n, 4);
-    ptr += 4;
-
-    // 2. Write each length-prefixed string [len][data]
-    for (size_t i = 0; i < n_cmd; i++) {
-        uint32_t len = (uint32_t)strlen(cmd[i]);
-        memcpy(ptr, &len, 4);
-        ptr += 4;
-        memcpy(ptr, cmd[i], len);
-        ptr += len;
-    }
-
-    // 3. Write header
-    uint32_t total_len = (uint32_t)(ptr - wbuf - 4);
-    memcpy(wbuf, &total_len, 4);
-
-    return write_all(fd, wbuf, 4 + total_len);
-}
-
-static int32_t print_response(const uint8_t *data, size_t size) {
-    if (size < 1) {
-        msg("bad response: size < 1");
-        return -1;
-    }
-
-    // Read the tag (first byte)
-    switch (data[0]) {
-        case TAG_NIL:
-            printf("(nil)\n");
-            return 1;
-        case TAG_ERR: {
-            if (size < 1 + 8) {
-                return -1;
-            }
-            int32_t code = 0;
-            uint32_t len = 0;
-            memcpy(&code, &data[1], 4);
-            memcpy(&len, &data[1 + 4], 4);
-            if (size < 1 + 8 + len) {
-                return -1;
-            }
-            printf("(err) %d %.*s\n", code, len, &data[1 + 8]);
-            return 1 + 8 + len;
-        }
-        case TAG_STR: {
-            if (size < 1 + 4) {
-                return -1;
-            }
-            uint32_t len = 0;
-            memcpy(&len, &data[1], 4);
-            if (size < 1 + 4 + len) {
-                return -1;
+static bool print_response(MrReader *r) {
+    MrValue v;
+    if (!mr_read(r, &v)) {
+        msg("bad response: truncated");
+        return false;
+    }
+    switch (v.type) {
+    case MR_NIL:
+        printf("(nil)\n");
+        return true;
+    case MR_ERR:
+        printf("(err) %d %.*s\n", (int)v.i, (int)v.len, v.str);
+        return true;
+    case MR_STR:
+        printf("(str) %.*s\n", (int)v.len, v.str);
+        return true;
+    case MR_INT:
+        printf("(int) %ld\n", v.i);
+        return true;
+    case MR_DBL:
+        printf("(dbl) %g\n", v.d);
+        return true;
+    case MR_ARR:
+        printf("(arr) len=%u\n", v.len);
+        // Arrays contain nested elements, so we recursively call print_response
+        for (uint32_t i = 0; i < v.len; i++) {
+            if (!print_response(r)) {
+                return false;
             }
-            printf("(str) %.*s\n", len, &data[1 + 4]);
-            return 1 + 4 + len;
         }
-        case TAG_INT: {
-            if (size < 1 + 8) {
-                return -1;
-            }
-            int64_t val = 0;
-            memcpy(&val, &data[1], 8);
-            printf("(int) %ld\n", val);
-            return 1 + 8;
-        }
-        case TAG_DBL: {
-            if (size < 1 + 8) {
-                return -1;
-            }
-            double val = 0;
-            memcpy(&val, &data[1], 8);
-            printf("(dbl) %g\n", val);
-            return 1 + 8;
-        }
-        case TAG_ARR: {
-            if (size < 1 + 4) {
-                return -1;
-            }
-            uint32_t len = 0;
-            memcpy(&len, &data[1], 4);
-            printf("(arr) len=%u\n", len);
-            size_t arr_bytes = 1 + 4;
-            // Arrays contain nested elements, so we recursively call print_response
-            for (uint32_t i = 0; i < len; i++) {
-                int32_t rv = print_response(&data[arr_bytes], size - arr_bytes);
-                if (rv < 0) {
-                    return rv;
-                }
-                arr_bytes += rv;
-            }
-            printf("(arr) end\n");
-            return (int32_t)arr_bytes;
-        }
-        default:
-            msg("bad response: unknown tag");
-            return -1;
+        printf("(arr) end\n");
+        return true;
     }
+    return false;
 }
 
-static int32_t read_res(int fd) {
-    char rbuf[4 + k_max_msg + 1];  // +1 for null terminator
-    errno = 0;
-
-    // Read header
-    int32_t err = read_full(fd, rbuf, 4);
-    if (err) {
-        msg(errno == 0 ? "EOF" : "read() error");
-        return err;
+static void on_reply(MrConn *conn, MrReader *reply, void *arg) {
+    (void)conn;
+    (void)arg;
+    if (!reply) {
+        g_failed = true;  // connection lost, reported by mr_wait()
+        return;
     }
-
-    // Parse length
-    uint32_t len = 0;
-    memcpy(&len, rbuf, 4);
-    if (len > k_max_msg) {
-        msg("response too long");
-        return -1;
+    if (!print_response(reply)) {
+        g_failed = true;
+    } else if (reply->p != reply->end) {
+        msg("bad response: size mismatch");
+        g_failed = true;
     }
+}
 
-    // Read body (status + message)
-    /*
-    err = read_full(fd, &rbuf[4], len);
-    if (err) {
-        msg(errno == 0 ? "EOF" : "read() error");
-        return err;
+static void send_req(MrConn *conn, const char **cmd, size_t n_cmd) {
+    if (!mr_send(conn, cmd, NULL, n_cmd, on_reply, NULL)) {
+        msg(mr_error(conn));
+        g_failed = true;
     }
+}
 
-    printf("Server says: %.*s\n", len, &rbuf[4]);
-    */
-    // Read the serialized payload
-    err = read_full(fd, &rbuf[4], len);
-    if (err) {
-        msg("read() error");
-        return err;
+// MGET and MSET are split over the servers and their replies merged,
+// anything else goes to the server that owns its first argument
+static int run_sharded(char *servers, char **cmd, size_t n_cmd) {
+    const char *addrs[64];
+    size_t n_addrs = 0;
+    for (char *tok = strtok(servers, ","); tok && n_addrs < 64; tok = strtok(NULL, ",")) {
+        addrs[n_addrs++] = tok;
+    }
+    MrShards *shards = mr_shards_new(addrs, n_addrs, 1);
+    if (!shards) {
+        die("Connect failed");
     }
 
-    /*
-    uint32_t status = 0;
-    memcpy(&status, &rbuf[4], 4);
-    if (status != 0) {
-        // Successfully received an error response
-        printf("Error: Server returned status %d. Msg: %.*s\n", status, len - 4, &rbuf[8]);
+    const char **args = (const char **)cmd + 1;
+    bool queued = false;
+    if (strcasecmp(cmd[0], "mget") == 0 && n_cmd >= 2) {
+        queued = mr_shards_fanout(shards, cmd[0], args, NULL, n_cmd - 1, 1, on_reply, NULL);
+    } else if (strcasecmp(cmd[0], "mset") == 0 && n_cmd >= 3 && n_cmd % 2 == 1) {
+        queued = mr_shards_fanout(shards, cmd[0], args, NULL, n_cmd - 1, 2, on_reply, NULL);
     } else {
-        printf("Server says: %.*s\n", len - 4, &rbuf[8]);
+        queued = mr_shards_send(shards, (const char **)cmd, NULL, n_cmd, on_reply, NULL);
     }
-
-    return 0;
-    */
-    // Delegate to the new tag-based parser
-    int32_t rv = print_response((uint8_t *)&rbuf[4], len);
-    if (rv > 0 && (uint32_t)rv !=  len) {
-        msg("bad response: size mismatch");
-        rv = -1;
+    int err = queued ? mr_shards_wait(shards) : -1;
+    if (err) {
+        msg(mr_shards_error(shards));
     }
-
-    return rv == -1 ? rv : 0;
+    mr_shards_free(shards);
+    return err || g_failed ? 1 : 0;
 }
 
 /*
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "cluster.h"
+#include "common.h"
+#include "buffer.h"
+#include "protocol.h"
+#include "kv.h"
+
+#define k_migrate_timeout_ms 1000
+// Keys in flight per round trip: their replies must fit in the socket
+// buffers, or the target stops reading while we are still writing
+#define k_migrate_batch 64
+
+static bool g_enabled = false;
+
+static ClusterNode g_nodes[CLUSTER_MAX_NODES];
+static size_t g_n_nodes = 0;
+
+// Per-slot node indexes. int8_t is enough for CLUSTER_MAX_NODES.
+static int8_t g_owner[CLUSTER_SLOTS];
+static int8_t g_migrating[CLUSTER_SLOTS];  // slot is leaving to this node
+static int8_t g_importing[CLUSTER_SLOTS];  // slot is arriving from this node
+
+void cluster_init(const char *host, uint16_t port) {
+    g_enabled = true;
+    g_n_nodes = 0;
+    cluster_node_intern(host, port);  // becomes CLUSTER_SELF
+    memset(g_owner, CLUSTER_NO_NODE, sizeof(g_owner));
+    memset(g_migrating, CLUSTER_NO_NODE, sizeof(g_migrating));
+    memset(g_importing, CLUSTER_NO_NODE, sizeof(g_importing));
+}
+
+bool cluster_enabled(void) {
+    return g_enabled;
+}
+
+uint16_t cluster_key_slot(const char *key) {
+    size_t len = strlen(key);
+    // Only hash the part between the first '{' and the next '}' if non-empty
+    const char *open = memchr(key, '{', len);
+    if (open) {
+        const char *close = memchr(open + 1, '}', len - (size_t)(open + 1 - key));
+        if (close && close > open + 1) {
+            key = open + 1;
+            len = (size_t)(close - key);
+        }
+    }
+    return (uint16_t)(kv_hash(key, len) & (CLUSTER_SLOTS - 1));
+}
+
+int cluster_node_intern(const char *host, uint16_t port) {
+    for (size_t i = 0; i < g_n_nodes; i++) {
+        if (g_nodes[i].port == port && strcmp(g_nodes[i].host, host) == 0) {
+            return (int)i;
+        }
+    }
+    if (g_n_nodes == CLUSTER_MAX_NODES || strlen(host) >= sizeof(g_nodes[0].host)) {
+        return CLUSTER_NO_NODE;
+    }
+    ClusterNode *node = &g_nodes[g_n_nodes];
+    strcpy(node->host, host);
+    node->port = port;
+    return (int)g_n_nodes++;
+}
+
+const ClusterNode *cluster_node(int idx) {
+    if (idx < 0 || (size_t)idx >= g_n_nodes) {
+        return NULL;
+    }
+    return &g_nodes[idx];
+}
+
+// "host:port"
+bool cluster_parse_addr(const char *s, char *host, size_t host_cap, uint16_t *port) {
+    const char *colon = strrchr(s, ':');
+    if (!colon || colon == s || (size_t)(colon - s) >= host_cap) {
+        return false;
+    }
+    char *end = NULL;
+    long p = strtol(colon + 1, &end, 10);
+    if (*end != '\0' || p <= 0 || p > 65535) {
+        return false;
+    }
+    memcpy(host, s, (size_t)(colon - s));
+    host[colon - s] = '\0';
+    *port = (uint16_t)p;
+    return true;
+}
+
+// "lo-hi" or a single slot "n"
+bool cluster_parse_range(const char *s, uint16_t *lo, uint16_t *hi) {
+    char *end = NULL;
+    long a = strtol(s, &end, 10);
+    long b = a;
+    if (*end == '-') {
+        b = strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || a < 0 || b < a || b >= CLUSTER_SLOTS) {
+        return false;
+    }
+    *lo = (uint16_t)a;
+    *hi = (uint16_t)b;
+    return true;
+}
+
+void cluster_assign(uint16_t lo, uint16_t hi, int node) {
+    for (uint32_t slot = lo; slot <= hi; slot++) {
+        g_owner[slot] = (int8_t)node;
+        g_migrating[slot] = CLUSTER_NO_NODE;
+        g_importing[slot] = CLUSTER_NO_NODE;
+    }
+}
+
+int cluster_slot_owner(uint16_t slot) {
+    return g_owner[slot];
+}
+
+int cluster_slot_migrating(uint16_t slot) {
+    return g_migrating[slot];
+}
+
+int cluster_slot_importing(uint16_t slot) {
+    return g_importing[slot];
+}
+
+void cluster_set_migrating(uint16_t slot, int node) {
+    g_migrating[slot] = (int8_t)node;
+}
+
+void cluster_set_importing(uint16_t slot, int node) {
+    g_importing[slot] = (int8_t)node;
+}
+
+void cluster_set_stable(uint16_t slot) {
+    g_migrating[slot] = CLUSTER_NO_NODE;
+    g_importing[slot] = CLUSTER_NO_NODE;
+}
+
+ClusterRoute cluster_route(const char *key, bool asking, uint16_t *slot, const ClusterNode **target) {
+    *slot = cluster_key_slot(key);
+    *target = NULL;
+    int owner = g_owner[*slot];
+
+    if (owner == CLUSTER_SELF) {
+        // While migrating, keys that already left (or never existed)
+        // are served by the destination node
+        int dst = g_migrating[*slot];
+        if (dst != CLUSTER_NO_NODE && !kv_find(key)) {
+            *target = &g_nodes[dst];
+            return ROUTE_ASK;
+        }
+        return ROUTE_SELF;
+    }
+    // The source node sent the client here with an ASK redirect
+    if (asking && g_importing[*slot] != CLUSTER_NO_NODE) {
+        return ROUTE_SELF;
+    }
+    if (owner == CLUSTER_NO_NODE) {
+        return ROUTE_DOWN;
+    }
+    *target = &g_nodes[owner];
+    return ROUTE_MOVED;
+}
+
+// --- Key migration (server acting as a client) ---
+
+static void append_req(Buffer *out, const char **cmd, size_t n_cmd) {
+    size_t header_pos = out->w_pos;
+    buf_append_u32(out, 0);
+    buf_append_u32(out, (uint32_t)n_cmd);
+    for (size_t i = 0; i < n_cmd; i++) {
+        uint32_t len = (uint32_t)strlen(cmd[i]);
+        buf_append_u32(out, len);
+        buf_append(out, (const uint8_t *)cmd[i], len);
+    }
+    uint32_t total = (uint32_t)(out->w_pos - header_pos - 4);
+    memcpy(out->data + header_pos, &total, 4);
+}
+
+static int connect_node(const ClusterNode *dst) {
+    char port[8];
+    snprintf(port, sizeof(port), "%u", dst->port);
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(dst->host, port, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, 0);
+    if (fd >= 0) {
+        // Never let a dead peer stall the event loop for long
+        struct timeval tv = {k_migrate_timeout_ms / 1000, (k_migrate_timeout_ms % 1000) * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        // a batch at a time: don't hold its tail back for a delayed ACK
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// Read one response and report whether it is an error.
+// -1 if the connection failed, -2 if the peer sent garbage.
+static int32_t read_reply(int fd, Buffer *in, char *err, size_t err_cap) {
+    uint32_t len = 0;
+    if (read_full(fd, (char *)&len, 4)) {
+        return -1;
+    }
+    if (len > k_max_msg) {
+        return -2;
+    }
+    in->r_pos = in->w_pos = 0;
+    buf_reserve(in, len);
+    if (len == 0 || read_full(fd, (char *)buf_write_ptr(in), len)) {
+        return -1;
+    }
+    const uint8_t *data = buf_write_ptr(in);
+    if (data[0] != TAG_ERR) {
+        return 0;
+    }
+    uint32_t msg_len = 0;
+    if (len >= 9) {
+        memcpy(&msg_len, data + 5, 4);
+        if (msg_len > len - 9) {
+            msg_len = len - 9;
+        }
+    }
+    snprintf(err, err_cap, "%.*s", (int)msg_len, (const char *)data + 9);
+    return 1;
+}
+
+int32_t cluster_migrate(const ClusterNode *dst, char **keys, char **payloads, size_t n,
+                        bool *done, char *err, size_t err_cap) {
+    memset(done, 0, n * sizeof(bool));
+    // A value goes out whole in one RESTORE, and the target refuses
+    // requests over k_max_msg: about 16 MB of value once hex-encoded
+    for (size_t i = 0; i < n; i++) {
+        size_t size = 4 + (4 + 7) + (4 + strlen(keys[i])) + (4 + strlen(payloads[i])) + (4 + 7);
+        if (size > k_max_msg) {
+            snprintf(err, err_cap, "value of '%.32s' too large to migrate (%zu byte payload)",
+                     keys[i], strlen(payloads[i]));
+            return -1;
+        }
+    }
+    int fd = connect_node(dst);
+    if (fd < 0) {
+        snprintf(err, err_cap, "cannot connect to %s:%u", dst->host, dst->port);
+        return -1;
+    }
+
+    // Pipeline a batch at a time: "asking" lets the importing node
+    // accept the key. A failure leaves done[] set for the keys
+    // acknowledged so far.
+    Buffer out;
+    buffer_init(&out, 4096);
+    int32_t moved = 0;
+    bool failed = false;
+    for (size_t start = 0; start < n && !failed; start += k_migrate_batch) {
+        size_t end = n - start < k_migrate_batch ? n : start + k_migrate_batch;
+        out.r_pos = out.w_pos = 0;
+        for (size_t i = start; i < end; i++) {
+            const char *asking[] = {"asking"};
+            const char *restore[] = {"restore", keys[i], payloads[i], "replace"};
+            append_req(&out, asking, 1);
+            append_req(&out, restore, 4);
+        }
+        if (write_all(fd, (char *)buf_read_ptr(&out), buf_read_size(&out)) != 0) {
+            snprintf(err, err_cap, "write to %s:%u failed", dst->host, dst->port);
+            break;
+        }
+        for (size_t i = start; i < end; i++) {
+            int32_t rv_ask = read_reply(fd, &out, err, err_cap);
+            int32_t rv_restore = rv_ask < 0 ? rv_ask : read_reply(fd, &out, err, err_cap);
+            if (rv_restore < 0) {
+                snprintf(err, err_cap, rv_restore == -1 ? "connection to %s:%u lost"
+                                                        : "bad reply from %s:%u",
+                         dst->host, dst->port);
+                failed = true;
+                break;
+            }
+            done[i] = (rv_ask == 0 && rv_restore == 0);
+            moved += done[i];
+        }
+    }
+
+    buffer_destroy(&out);
+    close(fd);
+    return moved;
+}
@@ -0,0 +1,59 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The key space is split into a fixed number of hash slots.
+// Every node owns some slot ranges and redirects requests for the others.
+#define CLUSTER_SLOTS 16384
+#define CLUSTER_MAX_NODES 64
+#define CLUSTER_NO_NODE (-1)
+#define CLUSTER_SELF 0  // node index 0 is always this server
+
+typedef struct ClusterNode {
+    char host[64];
+    uint16_t port;
+} ClusterNode;
+
+typedef enum {
+    ROUTE_SELF = 0,   // serve the key locally
+    ROUTE_MOVED = 1,  // the slot is owned by another node
+    ROUTE_ASK = 2,    // the slot is migrating and the key already left
+    ROUTE_DOWN = 3    // nobody serves the slot
+} ClusterRoute;
+
+void cluster_init(const char *host, uint16_t port);
+bool cluster_enabled(void);
+
+// Slot of a key, honoring "{tag}" so related keys can share a slot
+uint16_t cluster_key_slot(const char *key);
+
+// Node table (nodes are registered on first mention, never removed)
+int cluster_node_intern(const char *host, uint16_t port);
+const ClusterNode *cluster_node(int idx);
+bool cluster_parse_addr(const char *s, char *host, size_t host_cap, uint16_t *port);
+bool cluster_parse_range(const char *s, uint16_t *lo, uint16_t *hi);
+
+// Slot table
+void cluster_assign(uint16_t lo, uint16_t hi, int node);
+int cluster_slot_owner(uint16_t slot);
+int cluster_slot_migrating(uint16_t slot);
+int cluster_slot_importing(uint16_t slot);
+void cluster_set_migrating(uint16_t slot, int node);
+void cluster_set_importing(uint16_t slot, int node);
+void cluster_set_stable(uint16_t slot);
+
+// Decide who serves a key; *target is set for redirects
+ClusterRoute cluster_route(const char *key, bool asking, uint16_t *slot, const ClusterNode **target);
+
+// Copy keys to another node over one blocking connection, each as its
+// DUMP payload (see dump.h), replacing what the target holds.
+// done[i] is set for every key acknowledged by the target.
+// Returns the number of acknowledged keys, or -1 if nothing was sent:
+// the node is unreachable or a payload is over k_max_msg.
+int32_t cluster_migrate(const ClusterNode *dst, char **keys, char **payloads, size_t n,
+                        bool *done, char *err, size_t err_cap);
+
+#endif
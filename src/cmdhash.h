@@ -0,0 +1,271 @@
+// Generated by gen_cmdhash from commands.def, do not edit.
+// 71 commands in 256 slots.
+#ifndef CMDHASH_H
+#define CMDHASH_H
+
+#include <stdint.h>
+#include "commands.h"
+
+#define k_cmdhash_seed 173001u
+#define k_cmdhash_bits 8
+
+static const uint8_t k_cmdhash_slots[1 << k_cmdhash_bits] = {
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_RESTORE,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_GEODIST,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_XRANGE,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_EVALSHA,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_SCRIPT,
+    CMD_SET,
+    CMD_INCR,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_RPUSH,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_XREAD,
+    CMD_CONFIG,
+    CMD_UNKNOWN,
+    CMD_ASKING,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_XGROUP,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_EXEC,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_PUNSUBSCRIBE,
+    CMD_WATCH,
+    CMD_UNKNOWN,
+    CMD_MSET,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_HGETALL,
+    CMD_GEOPOS,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_HSET,
+    CMD_MEMORY,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_PING,
+    CMD_HGET,
+    CMD_XREADGROUP,
+    CMD_CLUSTER,
+    CMD_UNKNOWN,
+    CMD_UNSUBSCRIBE,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_XLEN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_PUBLISH,
+    CMD_XPENDING,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_PFCOUNT,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_BRPOP,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_HDEL,
+    CMD_UNKNOWN,
+    CMD_SETBIT,
+    CMD_GEOADD,
+    CMD_RPOP,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_INFO,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_DECR,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_HLEN,
+    CMD_BITCOUNT,
+    CMD_UNKNOWN,
+    CMD_RANGE,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_DUMP,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_LATENCY,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_COMMAND,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_XADD,
+    CMD_UNKNOWN,
+    CMD_ECHO,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_SLOWLOG,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_MULTI,
+    CMD_UNKNOWN,
+    CMD_GET,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_EVAL,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_PSUBSCRIBE,
+    CMD_UNKNOWN,
+    CMD_SUBSCRIBE,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_LPOP,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_BLPOP,
+    CMD_KEYS,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_LLEN,
+    CMD_UNWATCH,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_LRANGE,
+    CMD_DISCARD,
+    CMD_GETBIT,
+    CMD_UNKNOWN,
+    CMD_LINDEX,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_LPUSH,
+    CMD_UNKNOWN,
+    CMD_DECRBY,
+    CMD_XACK,
+    CMD_UNKNOWN,
+    CMD_HELLO,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_PREFIX,
+    CMD_UNKNOWN,
+    CMD_MIGRATE,
+    CMD_INCRBY,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_PFMERGE,
+    CMD_PFADD,
+    CMD_DEL,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_GEOSEARCH,
+    CMD_MGET,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+    CMD_UNKNOWN,
+};
+
+#endif
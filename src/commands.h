@@ -0,0 +1,65 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stdint.h>
+
+// What the server knows about each command before running it: how many
+// arguments it takes, where its keys are and what it may do. do_request()
+// checks all of it in one place, the handlers only parse what is left.
+
+// CmdSpec flags
+enum {
+    CMDF_WRITE = 1 << 0,        // may modify the keyspace
+    CMDF_READONLY = 1 << 1,     // reads keys, never writes them
+    CMDF_ADMIN = 1 << 2,        // server administration
+    CMDF_PUBSUB = 1 << 3,       // allowed while subscribed. Unless the handler says
+                                // otherwise, one reply per channel
+    CMDF_NOSCRIPT = 1 << 4,     // refused inside scripts
+    CMDF_NOMULTI = 1 << 5,      // refused between MULTI and EXEC
+    CMDF_TXN = 1 << 6,          // runs right away between MULTI and EXEC
+    CMDF_MOVABLEKEYS = 1 << 7,  // keys depend on other arguments, found by the handler
+    CMDF_OK = 1 << 8,           // replies nil for success ("+OK" in RESP)
+    CMDF_MAP = 1 << 9,          // replies key/value pairs (a map in RESP3)
+    CMDF_EXISTS = 1 << 10,      // replies RES_OK or RES_NX (1 or 0 in RESP)
+};
+
+typedef struct CmdSpec {
+    const char *name;
+    int arity;      // argument count with the name, -n for "at least n"
+    uint32_t flags;
+    int first_key;  // 0: no keys at fixed positions
+    int last_key;   // negative counts from the end, -1 is the last argument
+    int key_step;
+} CmdSpec;
+
+// Command ids, used to index k_cmds and per-command stats
+enum {
+#define CMD(id, name, arity, flags, first_key, last_key, key_step) id,
+#include "commands.def"
+#undef CMD
+    CMD_UNKNOWN,  // keep last
+    CMD_COUNT
+};
+
+static const CmdSpec k_cmds[CMD_COUNT] = {
+#define CMD(id, name, arity, flags, first_key, last_key, key_step) \
+    [id] = {name, arity, flags, first_key, last_key, key_step},
+#include "commands.def"
+#undef CMD
+    [CMD_UNKNOWN] = {"unknown", 0, 0, 0, 0, 0},
+};
+
+// FNV-1a over the lowercased name, finished with a multiply-xorshift so
+// the low bits are usable as a slot. gen_cmdhash picks the seed under
+// which every name in commands.def lands in a slot of its own.
+static inline uint32_t cmd_hash(const char *name, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (const char *p = name; *p; p++) {
+        h = (h ^ (uint8_t)(*p | 0x20)) * 16777619u;  // names are letters only
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    return h ^ (h >> 13);
+}
+
+#endif
@@ -0,0 +1,534 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dump.h"
+#include "buffer.h"
+#include "common.h"
+#include "hash.h"
+#include "quicklist.h"
+#include "stream.h"
+#include "bitmap.h"
+#include "hll.h"
+#include "zset.h"
+
+// --- Encoding ---
+
+static void put_u64(Buffer *b, uint64_t v) {
+    buf_append_i64(b, (int64_t)v);
+}
+
+static void put_str(Buffer *b, const char *s, uint32_t len) {
+    buf_append_u32(b, len);
+    buf_append(b, (const uint8_t *)s, len);
+}
+
+static void put_cstr(Buffer *b, const char *s) {
+    put_str(b, s, (uint32_t)strlen(s));
+}
+
+static void put_id(Buffer *b, const StreamID *id) {
+    put_u64(b, id->ms);
+    put_u64(b, id->seq);
+}
+
+static bool cb_dump_field(const char *field, uint32_t field_len, const char *val,
+                          uint32_t val_len, void *arg) {
+    put_str((Buffer *)arg, field, field_len);
+    put_str((Buffer *)arg, val, val_len);
+    return true;
+}
+
+static bool cb_dump_elem(const char *s, uint32_t len, void *arg) {
+    put_str((Buffer *)arg, s, len);
+    return true;
+}
+
+static bool cb_dump_entry(const StreamEntry *e, void *arg) {
+    Buffer *b = (Buffer *)arg;
+    put_id(b, &e->id);
+    buf_append_u32(b, e->n_strs);
+    const uint8_t *p = e->strs;
+    for (uint32_t i = 0; i < e->n_strs; i++) {
+        const char *s = NULL;
+        uint32_t len = 0;
+        p = stream_next_str(p, &s, &len);
+        put_str(b, s, len);
+    }
+    return true;
+}
+
+static bool cb_dump_pending(StreamPending *p, void *arg) {
+    Buffer *b = (Buffer *)arg;
+    put_id(b, &p->id);
+    put_cstr(b, p->consumer->name);
+    put_u64(b, p->delivery_ms);
+    buf_append_u32(b, p->deliveries);
+    return true;
+}
+
+// Entries, then each group with its consumers and pending entries
+static void dump_stream(Stream *s, Buffer *b) {
+    static const StreamID k_min = {0, 0};
+    static const StreamID k_max = {UINT64_MAX, UINT64_MAX};
+    put_id(b, &s->last_id);
+    put_u64(b, s->length);
+    stream_range(s, &k_min, &k_max, 0, cb_dump_entry, b);
+    buf_append_u32(b, (uint32_t)s->n_groups);
+    for (size_t i = 0; i < s->n_groups; i++) {
+        StreamGroup *g = s->groups[i];
+        put_cstr(b, g->name);
+        put_id(b, &g->last_delivered);
+        buf_append_u32(b, (uint32_t)g->n_consumers);
+        for (size_t j = 0; j < g->n_consumers; j++) {
+            put_cstr(b, g->consumers[j]->name);
+            put_u64(b, g->consumers[j]->seen_ms);
+        }
+        put_u64(b, g->pel_count);
+        stream_pel_range(g, &k_min, &k_max, 0, NULL, cb_dump_pending, b);
+    }
+}
+
+// Only the non-zero registers, as (index << 8) | value
+static void dump_hll(const HLL *h, Buffer *b) {
+    uint8_t *raw = calloc(k_hll_registers, 1);
+    if (!raw) {
+        die("Memory allocation failed");
+    }
+    hll_max_into(h, raw);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < k_hll_registers; i++) {
+        n += raw[i] != 0;
+    }
+    buf_append_u32(b, n);
+    for (uint32_t i = 0; i < k_hll_registers; i++) {
+        if (raw[i]) {
+            buf_append_u32(b, (i << 8) | raw[i]);
+        }
+    }
+    free(raw);
+}
+
+static void dump_body(const Entry *ent, Buffer *b) {
+    switch (ent->type) {
+    case T_STR: {
+        char ibuf[KV_INT_BUFSIZE];
+        put_cstr(b, kv_entry_str(ent, ibuf));
+        break;
+    }
+    case T_HASH:
+        buf_append_u32(b, (uint32_t)hash_len(ent->hash));
+        hash_foreach(ent->hash, cb_dump_field, b);
+        break;
+    case T_LIST: {
+        size_t len = ql_len(ent->list);
+        buf_append_u32(b, (uint32_t)len);
+        if (len) {
+            ql_range(ent->list, 0, len - 1, cb_dump_elem, b);
+        }
+        break;
+    }
+    case T_STREAM:
+        dump_stream(ent->stream, b);
+        break;
+    case T_BITMAP:
+        put_str(b, (const char *)ent->bitmap->bytes, (uint32_t)ent->bitmap->len);
+        break;
+    case T_HLL:
+        dump_hll(ent->hll, b);
+        break;
+    case T_ZSET:
+        buf_append_u32(b, (uint32_t)zset_len(ent->zset));
+        ZIter it;
+        for (ZNode *node = zset_seekge(ent->zset, -INFINITY, "", 0, &it); node; node = zset_next(&it)) {
+            uint64_t bits = 0;
+            memcpy(&bits, &node->score, 8);
+            put_str(b, node->name, (uint32_t)node->len);
+            put_u64(b, bits);
+        }
+        break;
+    }
+}
+
+char *dump_value(const Entry *ent) {
+    static const char k_hex[] = "0123456789abcdef";
+    Buffer b;
+    buffer_init(&b, 256);
+    buf_append_u8(&b, k_dump_version);
+    buf_append_u8(&b, (uint8_t)ent->type);
+    dump_body(ent, &b);
+
+    size_t len = buf_read_size(&b);
+    const uint8_t *data = buf_read_ptr(&b);
+    char *hex = malloc(2 * len + 1);
+    if (!hex) {
+        die("Memory allocation failed");
+    }
+    for (size_t i = 0; i < len; i++) {
+        hex[2 * i] = k_hex[data[i] >> 4];
+        hex[2 * i + 1] = k_hex[data[i] & 0xF];
+    }
+    hex[2 * len] = '\0';
+    buffer_destroy(&b);
+    return hex;
+}
+
+// --- Decoding ---
+
+typedef struct Reader {
+    const uint8_t *p;
+    const uint8_t *end;
+} Reader;
+
+static bool get_bytes(Reader *r, void *dst, size_t n) {
+    if ((size_t)(r->end - r->p) < n) {
+        return false;
+    }
+    memcpy(dst, r->p, n);
+    r->p += n;
+    return true;
+}
+
+static bool get_u32(Reader *r, uint32_t *v) {
+    return get_bytes(r, v, 4);
+}
+
+static bool get_u64(Reader *r, uint64_t *v) {
+    return get_bytes(r, v, 8);
+}
+
+static bool get_id(Reader *r, StreamID *id) {
+    return get_u64(r, &id->ms) && get_u64(r, &id->seq);
+}
+
+// A view into the payload. Values are NUL-free, as every string the
+// commands store is.
+static bool get_str(Reader *r, const char **s, uint32_t *len) {
+    if (!get_u32(r, len) || (size_t)(r->end - r->p) < *len || memchr(r->p, '\0', *len)) {
+        return false;
+    }
+    *s = (const char *)r->p;
+    r->p += *len;
+    return true;
+}
+
+// Same, copied and NUL-terminated
+static char *get_cstr(Reader *r) {
+    const char *s = NULL;
+    uint32_t len = 0;
+    if (!get_str(r, &s, &len)) {
+        return NULL;
+    }
+    char *copy = malloc((size_t)len + 1);
+    if (!copy) {
+        die("Memory allocation failed");
+    }
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+// A key never holds an empty hash, list or sorted set: the commands
+// delete it with its last element, and the readers rely on that.
+static bool restore_hash(Reader *r, Hash *hash) {
+    uint32_t n = 0;
+    if (!get_u32(r, &n) || n == 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const char *field = NULL, *val = NULL;
+        uint32_t field_len = 0, val_len = 0;
+        if (!get_str(r, &field, &field_len) || !get_str(r, &val, &val_len)) {
+            return false;
+        }
+        hash_set(hash, field, field_len, val, val_len);
+    }
+    return hash_len(hash) == n;  // no repeated fields
+}
+
+static bool restore_list(Reader *r, QuickList *ql) {
+    uint32_t n = 0;
+    if (!get_u32(r, &n) || n == 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const char *s = NULL;
+        uint32_t len = 0;
+        if (!get_str(r, &s, &len)) {
+            return false;
+        }
+        ql_push(ql, false, s, len);
+    }
+    return true;
+}
+
+static bool restore_entry(Reader *r, Stream *s) {
+    StreamID id;
+    uint32_t n_strs = 0;
+    // field-value pairs, at least one as XADD requires
+    if (!get_id(r, &id) || !get_u32(r, &n_strs) || n_strs == 0 || n_strs % 2
+        || n_strs > (size_t)(r->end - r->p) / 4) {
+        return false;
+    }
+    char **strs = calloc(n_strs ? n_strs : 1, sizeof(char *));
+    if (!strs) {
+        die("Memory allocation failed");
+    }
+    bool ok = true;
+    for (uint32_t i = 0; i < n_strs && ok; i++) {
+        strs[i] = get_cstr(r);
+        ok = strs[i] != NULL;
+    }
+    StreamID added;
+    ok = ok && stream_add(s, &id, 0, strs, n_strs, &added);
+    for (uint32_t i = 0; i < n_strs; i++) {
+        free(strs[i]);
+    }
+    free(strs);
+    return ok;
+}
+
+static bool restore_group(Reader *r, Stream *s) {
+    char *name = get_cstr(r);
+    StreamID last;
+    StreamGroup *g = name && get_id(r, &last) ? stream_group_create(s, name, &last) : NULL;
+    free(name);
+    uint32_t n_consumers = 0;
+    if (!g || !get_u32(r, &n_consumers)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < n_consumers; i++) {
+        char *cname = get_cstr(r);
+        uint64_t seen_ms = 0;
+        if (!cname || !get_u64(r, &seen_ms)) {
+            free(cname);
+            return false;
+        }
+        stream_consumer_get(s, g, cname, seen_ms);
+        free(cname);
+    }
+    uint64_t n_pending = 0;
+    if (!get_u64(r, &n_pending)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < n_pending; i++) {
+        StreamID id;
+        char *cname = NULL;
+        uint64_t delivery_ms = 0;
+        uint32_t deliveries = 0;
+        bool ok = get_id(r, &id) && (cname = get_cstr(r)) != NULL
+               && get_u64(r, &delivery_ms) && get_u32(r, &deliveries);
+        StreamConsumer *c = NULL;
+        for (size_t j = 0; ok && j < g->n_consumers && !c; j++) {
+            if (strcmp(g->consumers[j]->name, cname) == 0) {
+                c = g->consumers[j];
+            }
+        }
+        free(cname);
+        if (!c) {
+            return false;
+        }
+        stream_pel_add(s, g, c, &id, delivery_ms);
+        stream_pel_find(g, &id)->deliveries = deliveries;
+    }
+    return true;
+}
+
+static bool restore_stream(Reader *r, Stream *s) {
+    StreamID last_id;
+    uint64_t length = 0;
+    if (!get_id(r, &last_id) || !get_u64(r, &length)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < length; i++) {
+        if (!restore_entry(r, s)) {
+            return false;
+        }
+    }
+    if (s->length && stream_id_cmp(&last_id, &s->last_id) < 0) {
+        return false;
+    }
+    s->last_id = last_id;  // new IDs must stay above it
+
+    uint32_t n_groups = 0;
+    if (!get_u32(r, &n_groups)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < n_groups; i++) {
+        if (!restore_group(r, s)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool restore_bitmap(Reader *r, Bitmap *bm) {
+    const uint8_t *bytes = NULL;
+    uint32_t len = 0;
+    if (!get_u32(r, &len) || (size_t)(r->end - r->p) < len) {
+        return false;
+    }
+    bytes = r->p;
+    r->p += len;
+    if (len) {
+        bm->bytes = malloc(len);
+        if (!bm->bytes) {
+            die("Memory allocation failed");
+        }
+        memcpy(bm->bytes, bytes, len);
+        bm->len = bm->cap = len;
+    }
+    return true;
+}
+
+static bool restore_hll(Reader *r, HLL *h) {
+    uint32_t n = 0;
+    if (!get_u32(r, &n) || n > k_hll_registers) {
+        return false;
+    }
+    uint8_t *raw = calloc(k_hll_registers, 1);
+    if (!raw) {
+        die("Memory allocation failed");
+    }
+    bool ok = true;
+    for (uint32_t i = 0; i < n && ok; i++) {
+        uint32_t reg = 0;
+        ok = get_u32(r, &reg) && (reg >> 8) < k_hll_registers;
+        // a run of 1..k_hll_q + 1, which the estimator's histogram covers
+        uint32_t val = reg & 0xFF;
+        ok = ok && val >= 1 && val <= k_hll_q + 1;
+        if (ok) {
+            raw[reg >> 8] = (uint8_t)val;
+        }
+    }
+    if (ok) {
+        hll_load_raw(h, raw);
+    }
+    free(raw);
+    return ok;
+}
+
+static bool restore_zset(Reader *r, ZSet *zset) {
+    uint32_t n = 0;
+    if (!get_u32(r, &n) || n == 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const char *name = NULL;
+        uint32_t len = 0;
+        uint64_t bits = 0;
+        double score = 0;
+        if (!get_str(r, &name, &len) || !get_u64(r, &bits)) {
+            return false;
+        }
+        memcpy(&score, &bits, 8);
+        if (isnan(score)) {
+            return false;
+        }
+        zset_add(zset, name, len, score);
+    }
+    return zset_len(zset) == n;  // no repeated members
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool restore_value(const char *payload, uint32_t *type, void **value) {
+    size_t hex_len = strlen(payload);
+    if (hex_len < 4 || hex_len % 2) {
+        return false;
+    }
+    size_t len = hex_len / 2;
+    uint8_t *data = malloc(len);
+    if (!data) {
+        die("Memory allocation failed");
+    }
+    for (size_t i = 0; i < len; i++) {
+        int hi = hex_digit(payload[2 * i]);
+        int lo = hex_digit(payload[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            free(data);
+            return false;
+        }
+        data[i] = (uint8_t)(hi << 4 | lo);
+    }
+
+    Reader r = {data + 2, data + len};
+    *type = data[1];
+    *value = NULL;
+    bool ok = data[0] == k_dump_version;
+    switch (ok ? *type : UINT32_MAX) {
+    case T_STR:
+        *value = get_cstr(&r);
+        ok = *value != NULL;
+        break;
+    case T_HASH:
+        *value = hash_new();
+        ok = restore_hash(&r, *value);
+        break;
+    case T_LIST:
+        *value = ql_new();
+        ok = restore_list(&r, *value);
+        break;
+    case T_STREAM:
+        *value = stream_new();
+        ok = restore_stream(&r, *value);
+        break;
+    case T_BITMAP:
+        *value = bm_new();
+        ok = restore_bitmap(&r, *value);
+        break;
+    case T_HLL:
+        *value = hll_new();
+        ok = restore_hll(&r, *value);
+        break;
+    case T_ZSET:
+        *value = zset_new();
+        ok = restore_zset(&r, *value);
+        break;
+    default:
+        ok = false;
+    }
+    ok = ok && r.p == r.end;
+    if (!ok && *value) {
+        restore_free(*type, *value);
+        *value = NULL;
+    }
+    free(data);
+    return ok;
+}
+
+void restore_free(uint32_t type, void *value) {
+    switch (type) {
+    case T_STR:
+        free(value);
+        break;
+    case T_HASH:
+        hash_free(value);
+        break;
+    case T_LIST:
+        ql_free(value);
+        break;
+    case T_STREAM:
+        stream_free(value);
+        break;
+    case T_BITMAP:
+        bm_free(value);
+        break;
+    case T_HLL:
+        hll_free(value);
+        break;
+    case T_ZSET:
+        zset_free(value);
+        break;
+    }
+}
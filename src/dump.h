@@ -0,0 +1,27 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "kv.h"
+
+// DUMP/RESTORE payloads: the value of a key, of any type, as one string,
+// so MIGRATE can recreate it on another node.
+//   [u8 version][u8 type][body of the type]
+// Strings in the body are u32 length + bytes, numbers are little-endian as
+// on the wire. The whole payload is hex-encoded: command arguments are
+// NUL-terminated, and bitmaps and registers are full of zero bytes.
+#define k_dump_version 1
+
+// malloc'd, NUL-terminated
+char *dump_value(const Entry *ent);
+
+// Decode a payload into a new value of *type: a malloc'd string for T_STR,
+// else the value object, ready for kv_insert(). False if the payload is
+// malformed or from another version.
+bool restore_value(const char *payload, uint32_t *type, void **value);
+// Free a value restore_value() made, when it cannot be inserted
+void restore_free(uint32_t type, void *value);
+
+#endif
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "commands.h"
+
+// Build-time generator for src/cmdhash.h: a perfect hash from command
+// names to CMD_* ids. It tries seeds for cmd_hash() until every name in
+// commands.def gets a slot of its own, growing the table when no seed
+// works. The server's lookup is then one hash, one load and one
+// strcasecmp() to reject names that are not commands.
+
+#define k_min_bits 6
+#define k_max_bits 12
+// Seeds tried per table size
+#define k_max_seeds (1u << 20)
+
+static const char *k_cmd_ids[CMD_UNKNOWN] = {
+#define CMD(id, name, arity, flags, first_key, last_key, key_step) [id] = #id,
+#include "commands.def"
+#undef CMD
+};
+
+_Static_assert(CMD_COUNT <= 256, "slots hold command ids in one byte");
+
+static uint8_t g_slots[1 << k_max_bits];
+
+static bool try_seed(uint32_t seed, uint32_t mask) {
+    memset(g_slots, CMD_UNKNOWN, mask + 1);
+    for (int id = 0; id < CMD_UNKNOWN; id++) {
+        uint32_t slot = cmd_hash(k_cmds[id].name, seed) & mask;
+        if (g_slots[slot] != CMD_UNKNOWN) {
+            return false;
+        }
+        g_slots[slot] = (uint8_t)id;
+    }
+    return true;
+}
+
+static void print_table(uint32_t seed, int bits) {
+    printf("// Generated by gen_cmdhash from commands.def, do not edit.\n");
+    printf("// %d commands in %d slots.\n", CMD_UNKNOWN, 1 << bits);
+    printf("#ifndef CMDHASH_H\n#define CMDHASH_H\n\n");
+    printf("#include <stdint.h>\n#include \"commands.h\"\n\n");
+    printf("#define k_cmdhash_seed %uu\n", seed);
+    printf("#define k_cmdhash_bits %d\n\n", bits);
+    printf("static const uint8_t k_cmdhash_slots[1 << k_cmdhash_bits] = {\n");
+    for (int slot = 0; slot < 1 << bits; slot++) {
+        const char *id = g_slots[slot] == CMD_UNKNOWN ? "CMD_UNKNOWN" : k_cmd_ids[g_slots[slot]];
+        printf("    %s,\n", id);
+    }
+    printf("};\n\n#endif\n");
+}
+
+int main(void) {
+    for (int bits = k_min_bits; bits <= k_max_bits; bits++) {
+        uint32_t mask = (1u << bits) - 1;
+        if (mask + 1 < CMD_UNKNOWN) {
+            continue;
+        }
+        for (uint32_t seed = 0; seed < k_max_seeds; seed++) {
+            if (try_seed(seed, mask)) {
+                print_table(seed, bits);
+                return 0;
+            }
+        }
+    }
+    fprintf(stderr, "gen_cmdhash: no perfect hash found, duplicate command names?\n");
+    return 1;
+}
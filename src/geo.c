@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <math.h>
+#include "geo.h"
+
+// Same earth radius as Redis, so distances agree
+#define k_earth_radius_m 6372797.560856
+#define k_mercator_max 20037726.37
+
+static double deg_rad(double deg) {
+    return deg * (M_PI / 180.0);
+}
+
+static double rad_deg(double rad) {
+    return rad * (180.0 / M_PI);
+}
+
+bool geo_valid(double lon, double lat) {
+    return lon >= k_geo_lon_min && lon <= k_geo_lon_max
+        && lat >= k_geo_lat_min && lat <= k_geo_lat_max;
+}
+
+// Spread the low 32 bits of v to the even bit positions
+static uint64_t spread(uint32_t v) {
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+// Inverse of spread(): gather the even bits
+static uint32_t squash(uint64_t x) {
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+    return (uint32_t)x;
+}
+
+// Latitude bits on even positions, longitude bits on odd ones
+static uint64_t interleave(uint32_t lat_bits, uint32_t lon_bits) {
+    return spread(lat_bits) | (spread(lon_bits) << 1);
+}
+
+static uint32_t quantize(double v, double min, double max) {
+    double cells = (double)(1u << k_geo_step_max);
+    double q = (v - min) / (max - min) * cells;
+    if (q >= cells) {
+        q = cells - 1;
+    }
+    return (uint32_t)(q < 0 ? 0 : q);
+}
+
+uint64_t geo_encode(double lon, double lat) {
+    return interleave(quantize(lat, k_geo_lat_min, k_geo_lat_max),
+                      quantize(lon, k_geo_lon_min, k_geo_lon_max));
+}
+
+void geo_decode(uint64_t hash, double *lon, double *lat) {
+    double cells = (double)(1u << k_geo_step_max);
+    uint32_t lat_bits = squash(hash);
+    uint32_t lon_bits = squash(hash >> 1);
+    *lat = k_geo_lat_min + (lat_bits + 0.5) * (k_geo_lat_max - k_geo_lat_min) / cells;
+    *lon = k_geo_lon_min + (lon_bits + 0.5) * (k_geo_lon_max - k_geo_lon_min) / cells;
+}
+
+// Haversine
+double geo_distance(double lon1, double lat1, double lon2, double lat2) {
+    double lat1r = deg_rad(lat1), lat2r = deg_rad(lat2);
+    double u = sin((lat2r - lat1r) / 2);
+    double v = sin(deg_rad(lon2 - lon1) / 2);
+    double a = u * u + cos(lat1r) * cos(lat2r) * v * v;
+    return 2.0 * k_earth_radius_m * asin(sqrt(a));
+}
+
+// The finest grid whose cells are still about as large as the search
+// radius (at most 26, at least 1)
+static int estimate_step(double radius_m, double lat) {
+    if (radius_m == 0) {
+        return k_geo_step_max;
+    }
+    int step = 1;
+    while (radius_m < k_mercator_max) {
+        radius_m *= 2;
+        step++;
+    }
+    step -= 2;  // a bit coarser, so the 9 cells cover the area
+    if (lat > 66 || lat < -66) {  // cells shrink east-west toward the poles
+        step--;
+        if (lat > 80 || lat < -80) {
+            step--;
+        }
+    }
+    if (step < 1) {
+        step = 1;
+    }
+    return step > k_geo_step_max ? k_geo_step_max : step;
+}
+
+static int cmp_range(const void *a, const void *b) {
+    const GeoRange *l = (const GeoRange *)a, *r = (const GeoRange *)b;
+    return l->min < r->min ? -1 : l->min > r->min;
+}
+
+size_t geo_area_ranges(double lon, double lat, double half_width_m, double half_height_m,
+                       GeoRange out[9]) {
+    // Bounding box in degrees. Longitude is left unwrapped past +-180.
+    // Parallels shrink toward the poles, so the east-west extent is taken
+    // on the edge of the box nearest to a pole: both a circle and a box
+    // measured along each point's parallel are widest in degrees there.
+    double dlat = rad_deg(half_height_m / k_earth_radius_m);
+    double cos_edge = cos(deg_rad(fmin(fabs(lat) + dlat, 90.0)));
+    double arc = half_width_m / k_earth_radius_m;
+    double dlon = 180.0;
+    double s_circle = sin(fmin(arc, M_PI / 2)) / cos_edge;
+    double s_box = sin(fmin(arc / 2, M_PI / 2)) / cos_edge;
+    if (cos_edge > 1e-9 && arc < M_PI / 2 && s_circle < 1.0 && s_box < 1.0) {
+        dlon = fmin(rad_deg(fmax(asin(s_circle), 2 * asin(s_box))), 180.0);
+    }
+    double lat_lo = fmax(lat - dlat, k_geo_lat_min);
+    double lat_hi = fmin(lat + dlat, k_geo_lat_max);
+
+    // Coarsen until the center cell and its neighbours contain the box
+    int step = estimate_step(fmax(half_width_m, half_height_m), lat);
+    int64_t n_cells = 0, cx = 0, cy = 0;
+    double cell_w = 0, cell_h = 0;
+    for (; ; step--) {
+        n_cells = 1ll << step;
+        cell_w = (k_geo_lon_max - k_geo_lon_min) / (double)n_cells;
+        cell_h = (k_geo_lat_max - k_geo_lat_min) / (double)n_cells;
+        cx = (int64_t)floor((lon - k_geo_lon_min) / cell_w);
+        cy = (int64_t)floor((lat - k_geo_lat_min) / cell_h);
+        cx = cx >= n_cells ? n_cells - 1 : cx;
+        cy = cy >= n_cells ? n_cells - 1 : cy;
+        int64_t x_lo = (int64_t)floor((lon - dlon - k_geo_lon_min) / cell_w);
+        int64_t x_hi = (int64_t)floor((lon + dlon - k_geo_lon_min) / cell_w);
+        int64_t y_lo = (int64_t)floor((lat_lo - k_geo_lat_min) / cell_h);
+        int64_t y_hi = (int64_t)floor((lat_hi - k_geo_lat_min) / cell_h);
+        if (step == 1 || (x_lo >= cx - 1 && x_hi <= cx + 1 && y_lo >= cy - 1 && y_hi <= cy + 1)) {
+            break;
+        }
+    }
+
+    // The 3x3 block, skipping cells outside the grid or the box
+    size_t n = 0;
+    int shift = 2 * (k_geo_step_max - step);
+    for (int64_t y = cy - 1; y <= cy + 1; y++) {
+        if (y < 0 || y >= n_cells) {
+            continue;
+        }
+        double cell_lat_lo = k_geo_lat_min + (double)y * cell_h;
+        if (cell_lat_lo > lat_hi || cell_lat_lo + cell_h < lat_lo) {
+            continue;
+        }
+        for (int64_t x = cx - 1; x <= cx + 1; x++) {
+            double cell_lon_lo = k_geo_lon_min + (double)x * cell_w;
+            if (cell_lon_lo > lon + dlon || cell_lon_lo + cell_w < lon - dlon) {
+                continue;
+            }
+            int64_t wx = (x % n_cells + n_cells) % n_cells;  // wrap around the date line
+            uint64_t cell = interleave((uint32_t)y, (uint32_t)wx);
+            out[n].min = cell << shift;
+            out[n].max = (cell + 1) << shift;
+            n++;
+        }
+    }
+
+    // Sort, then merge duplicates (small grids wrap onto themselves) and
+    // neighbours that happen to be adjacent in geohash order
+    qsort(out, n, sizeof(GeoRange), cmp_range);
+    size_t merged = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (merged && out[i].min <= out[merged - 1].max) {
+            if (out[i].max > out[merged - 1].max) {
+                out[merged - 1].max = out[i].max;
+            }
+        } else {
+            out[merged++] = out[i];
+        }
+    }
+    return merged;
+}
@@ -0,0 +1,34 @@
+#ifndef GEO_H
+#define GEO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Geohashes: longitude and latitude quantized to 26 bits each and
+// interleaved bit by bit into a 52-bit integer, which a double holds
+// exactly, so it can serve as a sorted-set score.
+// Points sharing a prefix of 2*s bits lie in the same cell of a 2^s x 2^s
+// grid, and a cell is a contiguous score range: an area search is a scan
+// of the cell holding the center and its 8 neighbours.
+#define k_geo_step_max 26
+#define k_geo_lon_min -180.0
+#define k_geo_lon_max 180.0
+#define k_geo_lat_min -85.05112878  // the Web Mercator limits
+#define k_geo_lat_max 85.05112878
+
+typedef struct GeoRange {
+    uint64_t min;  // inclusive
+    uint64_t max;  // exclusive
+} GeoRange;
+
+bool geo_valid(double lon, double lat);
+uint64_t geo_encode(double lon, double lat);
+void geo_decode(uint64_t hash, double *lon, double *lat);  // center of the cell
+double geo_distance(double lon1, double lat1, double lon2, double lat2);  // meters
+// Score ranges that together cover every point within half_width_m east/west
+// and half_height_m north/south of (lon, lat). Returns how many (at most 9).
+size_t geo_area_ranges(double lon, double lat, double half_width_m, double half_height_m,
+                       GeoRange out[9]);
+
+#endif
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "listpack.h"
+#include "kv.h"
+#include "common.h"
+
+#define container_of(ptr, T, member) \
+    ((T *)( (char *)ptr - offsetof(T, member) ))
+
+Hash *hash_new(void) {
+    Hash *hash = calloc(1, sizeof(Hash));
+    if (!hash) {
+        die("Memory allocation failed");
+    }
+    hash->enc = HASH_LISTPACK;
+    hash->lp = lp_new();
+    return hash;
+}
+
+// --- HASH_MAP helpers ---
+
+static bool field_eq(HNode *lhs, HNode *rhs) {
+    HashField *l = container_of(lhs, HashField, node);
+    HashField *r = container_of(rhs, HashField, node);
+    return l->field_len == r->field_len && memcmp(l->field, r->field, l->field_len) == 0;
+}
+
+static size_t field_mem(uint32_t field_len, uint32_t val_len) {
+    return sizeof(HashField) + field_len + 1 + val_len + 1;
+}
+
+static char *dup_bytes(const char *s, uint32_t len) {
+    char *out = malloc(len + 1);
+    if (!out) {
+        die("Memory allocation failed");
+    }
+    memcpy(out, s, len);
+    out[len] = '\0';
+    return out;
+}
+
+// Field name is stored inline after the struct: one allocation per field
+static HashField *field_new(const char *field, uint32_t field_len, const char *val, uint32_t val_len) {
+    HashField *hf = malloc(sizeof(HashField) + field_len + 1);
+    if (!hf) {
+        die("Memory allocation failed");
+    }
+    hf->field = (char *)(hf + 1);
+    memcpy(hf->field, field, field_len);
+    hf->field[field_len] = '\0';
+    hf->field_len = field_len;
+    hf->val = dup_bytes(val, val_len);
+    hf->val_len = val_len;
+    hf->node.next = NULL;
+    hf->node.hcode = kv_hash(field, field_len);
+    return hf;
+}
+
+static HashField *map_lookup(Hash *hash, const char *field, uint32_t field_len) {
+    HashField probe;
+    probe.field = (char *)field;
+    probe.field_len = field_len;
+    probe.node.hcode = kv_hash(field, field_len);
+    HNode *node = hm_lookup(&hash->map, &probe.node, field_eq);
+    return node ? container_of(node, HashField, node) : NULL;
+}
+
+static bool cb_free_field(HNode *node, void *arg) {
+    (void)arg;
+    HashField *hf = container_of(node, HashField, node);
+    free(hf->val);
+    free(hf);
+    return true;
+}
+
+// Move every field of the listpack into a nested HMap
+static void convert_to_map(Hash *hash) {
+    uint8_t *lp = hash->lp;
+    HMap map = {0};
+    size_t bytes = 0;
+    for (uint8_t *p = lp_first(lp); p; ) {
+        uint32_t field_len = 0, val_len = 0;
+        const char *field = lp_get(p, &field_len);
+        p = lp_next(lp, p);
+        const char *val = lp_get(p, &val_len);
+        p = lp_next(lp, p);
+        hm_insert(&map, &field_new(field, field_len, val, val_len)->node);
+        bytes += field_mem(field_len, val_len);
+    }
+    lp_free(lp);
+    hash->enc = HASH_MAP;
+    hash->map = map;
+    hash->map_bytes = bytes;
+}
+
+// --- Public interface ---
+
+void hash_free(Hash *hash) {
+    if (hash->enc == HASH_LISTPACK) {
+        lp_free(hash->lp);
+    } else {
+        hm_foreach(&hash->map, cb_free_field, NULL);
+        hm_clear(&hash->map);
+    }
+    free(hash);
+}
+
+size_t hash_len(Hash *hash) {
+    if (hash->enc == HASH_LISTPACK) {
+        return lp_count(hash->lp) / 2;
+    }
+    return hm_size(&hash->map);
+}
+
+size_t hash_mem(Hash *hash) {
+    if (hash->enc == HASH_LISTPACK) {
+        return sizeof(Hash) + lp_bytes(hash->lp);
+    }
+    size_t slots = (hash->map.newer.table ? hash->map.newer.mask + 1 : 0)
+                 + (hash->map.older.table ? hash->map.older.mask + 1 : 0);
+    return sizeof(Hash) + hash->map_bytes + slots * sizeof(HNode *);
+}
+
+const char *hash_get(Hash *hash, const char *field, uint32_t field_len, uint32_t *val_len) {
+    if (hash->enc == HASH_LISTPACK) {
+        uint8_t *p = lp_find(hash->lp, lp_first(hash->lp), field, field_len, 2);
+        if (!p) {
+            return NULL;
+        }
+        return lp_get(lp_next(hash->lp, p), val_len);
+    }
+    HashField *hf = map_lookup(hash, field, field_len);
+    if (!hf) {
+        return NULL;
+    }
+    *val_len = hf->val_len;
+    return hf->val;
+}
+
+bool hash_set(Hash *hash, const char *field, uint32_t field_len, const char *val, uint32_t val_len) {
+    if (hash->enc == HASH_LISTPACK) {
+        uint8_t *p = lp_find(hash->lp, lp_first(hash->lp), field, field_len, 2);
+        if (p) {
+            p = lp_next(hash->lp, p);
+            hash->lp = lp_replace(hash->lp, &p, val, val_len);
+            return false;
+        }
+        bool too_big = field_len > k_hash_max_listpack_value || val_len > k_hash_max_listpack_value
+                    || hash_len(hash) + 1 > k_hash_max_listpack_entries;
+        if (!too_big) {
+            hash->lp = lp_append(hash->lp, field, field_len);
+            hash->lp = lp_append(hash->lp, val, val_len);
+            return true;
+        }
+        convert_to_map(hash);
+    }
+
+    HashField *hf = map_lookup(hash, field, field_len);
+    if (hf) {
+        hash->map_bytes -= hf->val_len;
+        hash->map_bytes += val_len;
+        free(hf->val);
+        hf->val = dup_bytes(val, val_len);
+        hf->val_len = val_len;
+        return false;
+    }
+    hm_insert(&hash->map, &field_new(field, field_len, val, val_len)->node);
+    hash->map_bytes += field_mem(field_len, val_len);
+    return true;
+}
+
+bool hash_del(Hash *hash, const char *field, uint32_t field_len) {
+    if (hash->enc == HASH_LISTPACK) {
+        uint8_t *p = lp_find(hash->lp, lp_first(hash->lp), field, field_len, 2);
+        if (!p) {
+            return false;
+        }
+        hash->lp = lp_delete(hash->lp, &p);  // field, p now points at its value
+        hash->lp = lp_delete(hash->lp, &p);
+        return true;
+    }
+    HashField probe;
+    probe.field = (char *)field;
+    probe.field_len = field_len;
+    probe.node.hcode = kv_hash(field, field_len);
+    HNode *node = hm_delete(&hash->map, &probe.node, field_eq);
+    if (!node) {
+        return false;
+    }
+    HashField *hf = container_of(node, HashField, node);
+    hash->map_bytes -= field_mem(hf->field_len, hf->val_len);
+    free(hf->val);
+    free(hf);
+    return true;
+}
+
+struct hash_cb_arg {
+    bool (*cb)(const char *, uint32_t, const char *, uint32_t, void *);
+    void *arg;
+};
+
+static bool cb_map_field(HNode *node, void *arg) {
+    struct hash_cb_arg *wrap = (struct hash_cb_arg *)arg;
+    HashField *hf = container_of(node, HashField, node);
+    return wrap->cb(hf->field, hf->field_len, hf->val, hf->val_len, wrap->arg);
+}
+
+void hash_foreach(Hash *hash,
+                  bool (*cb)(const char *field, uint32_t field_len,
+                             const char *val, uint32_t val_len, void *arg),
+                  void *arg) {
+    if (hash->enc == HASH_LISTPACK) {
+        for (uint8_t *p = lp_first(hash->lp); p; ) {
+            uint32_t field_len = 0, val_len = 0;
+            const char *field = lp_get(p, &field_len);
+            p = lp_next(hash->lp, p);
+            const char *val = lp_get(p, &val_len);
+            p = lp_next(hash->lp, p);
+            if (!cb(field, field_len, val, val_len, arg)) {
+                return;
+            }
+        }
+        return;
+    }
+    struct hash_cb_arg wrap = {cb, arg};
+    hm_foreach(&hash->map, cb_map_field, &wrap);
+}
@@ -0,0 +1,54 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hashtable.h"
+
+// Hash value type (field -> value).
+// Small hashes are a listpack of alternating field/value entries; once a
+// hash holds more than k_hash_max_listpack_entries fields or any string
+// longer than k_hash_max_listpack_value, it is converted to a nested HMap.
+#define k_hash_max_listpack_entries 64
+#define k_hash_max_listpack_value 64
+
+enum {
+    HASH_LISTPACK = 0,
+    HASH_MAP = 1
+};
+
+// one field of a HASH_MAP hash
+typedef struct HashField {
+    HNode node;
+    char *field;
+    char *val;
+    uint32_t field_len;
+    uint32_t val_len;
+} HashField;
+
+typedef struct Hash {
+    uint8_t enc;      // HASH_LISTPACK or HASH_MAP
+    size_t map_bytes; // HASH_MAP: bytes held by the fields
+    union {
+        uint8_t *lp;
+        HMap map;
+    };
+} Hash;
+
+Hash *hash_new(void);
+void hash_free(Hash *hash);
+size_t hash_len(Hash *hash);
+size_t hash_mem(Hash *hash);  // estimated bytes, for maxmemory
+
+// Returns a pointer to the value (not NUL-terminated) or NULL
+const char *hash_get(Hash *hash, const char *field, uint32_t field_len, uint32_t *val_len);
+// Returns true if the field is new
+bool hash_set(Hash *hash, const char *field, uint32_t field_len, const char *val, uint32_t val_len);
+bool hash_del(Hash *hash, const char *field, uint32_t field_len);
+void hash_foreach(Hash *hash,
+                  bool (*cb)(const char *field, uint32_t field_len,
+                             const char *val, uint32_t val_len, void *arg),
+                  void *arg);
+
+#endif
@@ -56,7 +56,9 @@ static HNode *h_detach(HTable *htable, HNode **target) {
 static void h_foreach(HTable *htable, bool (*cb)(HNode *, void *), void *arg) {
     if (!htable->table) return;
     for (size_t i = 0; i <= htable->mask; i++) {
-        for (HNode *node = htable->table[i]; node != NULL; node = node->next) {
+        // read next first so the callback may free the node
+        for (HNode *node = htable->table[i], *next = NULL; node != NULL; node = next) {
+            next = node->next;
             if (!cb(node, arg)) {
                 return; // Stop early if callback returns false
             }
@@ -141,9 +143,56 @@ size_t hm_size(HMap *hmap) {
     return hmap->newer.size + hmap->older.size;
 }
 
+void hm_prefetch_slot(HMap *hmap, uint64_t hcode) {
+    if (hmap->newer.table) {
+        __builtin_prefetch(&hmap->newer.table[hcode & hmap->newer.mask]);
+    }
+}
+
+HNode *hm_slot_head(HMap *hmap, uint64_t hcode) {
+    return hmap->newer.table ? hmap->newer.table[hcode & hmap->newer.mask] : NULL;
+}
+
 // Iterate over all nodes in the hash map, calling the callback function for each node.
 // The callback function extracts the string from the HNode and appends it to the Buffer (*arg).
 void hm_foreach(HMap *hmap, bool (*cb)(HNode *, void *), void *arg) {
     h_foreach(&hmap->newer, cb, arg);
     h_foreach(&hmap->older, cb, arg);
 }
+
+// Random node from one table: start at a random slot, take the first
+// non-empty chain, then a random position inside that chain.
+// Chains are short (load factor <= 8), so the bias is small.
+static HNode *h_random(HTable *htable, uint64_t rnd) {
+    size_t start = (size_t)rnd & htable->mask;
+    for (size_t i = 0; i <= htable->mask; i++) {
+        HNode *head = htable->table[(start + i) & htable->mask];
+        if (!head) {
+            continue;
+        }
+        size_t len = 0;
+        for (HNode *node = head; node; node = node->next) {
+            len++;
+        }
+        size_t pos = (size_t)(rnd >> 32) % len;
+        while (pos--) {
+            head = head->next;
+        }
+        return head;
+    }
+    return NULL;
+}
+
+// Used for sampling, e.g. picking eviction candidates
+HNode *hm_random(HMap *hmap, uint64_t rnd) {
+    size_t total = hm_size(hmap);
+    if (total == 0) {
+        return NULL;
+    }
+    // choose a table proportionally to the number of keys it holds
+    HTable *htable = &hmap->newer;
+    if ((size_t)(rnd >> 16) % total < hmap->older.size) {
+        htable = &hmap->older;
+    }
+    return h_random(htable, rnd);
+}
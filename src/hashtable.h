@@ -42,5 +42,16 @@ HNode *hm_delete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
 void hm_clear(HMap *hmap);
 size_t hm_size(HMap *hmap);
 void hm_foreach(HMap *hmap, bool (*cb)(HNode *, void *), void *arg);  // *cb is similar to *eq
+// pick a pseudo-random node using the random bits in rnd, NULL if empty
+HNode *hm_random(HMap *hmap, uint64_t rnd);
+
+// Batched lookups hide memory latency by issuing the loads of many keys
+// before using any of them (group prefetching):
+//   stage 1: hm_prefetch_slot() for every key of the group
+//   stage 2: hm_slot_head() (now cached) and prefetch the node it returns
+//   stage 3: the real hm_lookup(), which mostly hits the cache
+// Both only look at the newer table; lookups still check both.
+void hm_prefetch_slot(HMap *hmap, uint64_t hcode);
+HNode *hm_slot_head(HMap *hmap, uint64_t hcode);
 
 #endif
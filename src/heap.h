@@ -0,0 +1,19 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary min-heap stored in a plain array, used by the event loop timers.
+// Each item points back at a size_t owned by its payload, which is kept
+// equal to the item's current position so the payload can find (and
+// remove) its own item in O(log n).
+typedef struct HeapItem {
+    uint64_t val;  // ordering key, e.g. a deadline in ms
+    size_t *ref;   // *ref == index of this item in the array
+} HeapItem;
+
+// Restore the heap property after a[pos] was added or changed
+void heap_update(HeapItem *a, size_t pos, size_t len);
+
+#endif
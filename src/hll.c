@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hll.h"
+#include "common.h"
+
+HLL *hll_new(void) {
+    HLL *h = calloc(1, sizeof(HLL));
+    if (!h) {
+        die("Memory allocation failed");
+    }
+    h->card_valid = true;  // empty: 0
+    return h;
+}
+
+void hll_free(HLL *h) {
+    free(h->sparse);
+    free(h->regs);
+    free(h);
+}
+
+size_t hll_mem(const HLL *h) {
+    return sizeof(HLL) + (h->dense ? k_hll_dense_bytes : h->cap_sparse * sizeof(uint32_t));
+}
+
+// MurmurHash64A: the 64 bits must be well mixed, 14 pick the register
+// and the rest give the run length
+static uint64_t murmur64(const void *key, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+    uint64_t h = seed ^ (len * m);
+    const uint8_t *data = (const uint8_t *)key;
+    const uint8_t *end = data + (len - (len & 7));
+    while (data != end) {
+        uint64_t k;
+        memcpy(&k, data, 8);
+        data += 8;
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    switch (len & 7) {
+    case 7: h ^= (uint64_t)data[6] << 48; // fallthrough
+    case 6: h ^= (uint64_t)data[5] << 40; // fallthrough
+    case 5: h ^= (uint64_t)data[4] << 32; // fallthrough
+    case 4: h ^= (uint64_t)data[3] << 24; // fallthrough
+    case 3: h ^= (uint64_t)data[2] << 16; // fallthrough
+    case 2: h ^= (uint64_t)data[1] << 8;  // fallthrough
+    case 1: h ^= (uint64_t)data[0];
+            h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+// --- Dense registers, 6 bits each, little-endian bit order ---
+
+static uint8_t dense_get(const uint8_t *regs, uint32_t i) {
+    uint32_t bit = i * 6;
+    uint32_t byte = bit >> 3, shift = bit & 7;
+    uint32_t v = regs[byte] >> shift;
+    if (shift > 2) {  // straddles into the next byte
+        v |= (uint32_t)regs[byte + 1] << (8 - shift);
+    }
+    return (uint8_t)(v & 63);
+}
+
+static void dense_set(uint8_t *regs, uint32_t i, uint8_t val) {
+    uint32_t bit = i * 6;
+    uint32_t byte = bit >> 3, shift = bit & 7;
+    regs[byte] = (uint8_t)((regs[byte] & ~(63u << shift)) | ((uint32_t)val << shift));
+    if (shift > 2) {
+        uint32_t hi = 8 - shift;
+        regs[byte + 1] = (uint8_t)((regs[byte + 1] & ~(63u >> hi)) | (val >> hi));
+    }
+}
+
+static void to_dense(HLL *h) {
+    h->regs = calloc(1, k_hll_dense_bytes);
+    if (!h->regs) {
+        die("Memory allocation failed");
+    }
+    for (uint32_t i = 0; i < h->n_sparse; i++) {
+        dense_set(h->regs, h->sparse[i] >> 8, (uint8_t)(h->sparse[i] & 0xFF));
+    }
+    free(h->sparse);
+    h->sparse = NULL;
+    h->n_sparse = h->cap_sparse = 0;
+    h->dense = true;
+}
+
+// Raise register idx to at least val, true if it changed
+static bool reg_max(HLL *h, uint32_t idx, uint8_t val) {
+    if (h->dense) {
+        if (dense_get(h->regs, idx) >= val) {
+            return false;
+        }
+        dense_set(h->regs, idx, val);
+        return true;
+    }
+
+    // binary search for the first pair with index >= idx
+    uint32_t lo = 0, hi = h->n_sparse;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if ((h->sparse[mid] >> 8) < idx) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < h->n_sparse && (h->sparse[lo] >> 8) == idx) {
+        if ((h->sparse[lo] & 0xFF) >= val) {
+            return false;
+        }
+        h->sparse[lo] = (idx << 8) | val;
+        return true;
+    }
+    if ((h->n_sparse + 1) * sizeof(uint32_t) > k_hll_sparse_max) {
+        to_dense(h);
+        dense_set(h->regs, idx, val);
+        return true;
+    }
+    if (h->n_sparse == h->cap_sparse) {
+        h->cap_sparse = h->cap_sparse ? h->cap_sparse * 2 : 8;
+        h->sparse = realloc(h->sparse, h->cap_sparse * sizeof(uint32_t));
+        if (!h->sparse) {
+            die("Memory allocation failed");
+        }
+    }
+    memmove(&h->sparse[lo + 1], &h->sparse[lo], (h->n_sparse - lo) * sizeof(uint32_t));
+    h->sparse[lo] = (idx << 8) | val;
+    h->n_sparse++;
+    return true;
+}
+
+bool hll_add(HLL *h, const char *s, size_t len) {
+    uint64_t hash = murmur64(s, len, 0xadc83b19ull);
+    uint32_t idx = (uint32_t)(hash & (k_hll_registers - 1));
+    // a sentinel bit caps the run at k_hll_q
+    uint64_t rest = (hash >> k_hll_p) | (1ull << k_hll_q);
+    uint8_t run = (uint8_t)(__builtin_ctzll(rest) + 1);
+    if (!reg_max(h, idx, run)) {
+        return false;
+    }
+    h->card_valid = false;
+    return true;
+}
+
+void hll_max_into(const HLL *h, uint8_t *raw) {
+    if (h->dense) {
+        for (uint32_t i = 0; i < k_hll_registers; i++) {
+            uint8_t v = dense_get(h->regs, i);
+            if (v > raw[i]) {
+                raw[i] = v;
+            }
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < h->n_sparse; i++) {
+        uint32_t idx = h->sparse[i] >> 8;
+        uint8_t v = (uint8_t)(h->sparse[i] & 0xFF);
+        if (v > raw[idx]) {
+            raw[idx] = v;
+        }
+    }
+}
+
+void hll_load_raw(HLL *h, const uint8_t *raw) {
+    free(h->sparse);
+    free(h->regs);
+    memset(h, 0, sizeof(HLL));
+    for (uint32_t i = 0; i < k_hll_registers; i++) {
+        if (raw[i]) {
+            reg_max(h, i, raw[i]);  // converts to dense when it fills up
+        }
+    }
+}
+
+// --- Estimation ---
+// Ertl's improved estimator ("New cardinality estimation algorithms for
+// HyperLogLog sketches", 2017): works from the histogram of register
+// values and needs no bias tables or range switches.
+
+static double hll_sigma(double x) {
+    if (x == 1.0) {
+        return INFINITY;
+    }
+    double y = 1.0, z = x, prev;
+    do {
+        x *= x;
+        prev = z;
+        z += x * y;
+        y += y;
+    } while (z != prev);
+    return z;
+}
+
+static double hll_tau(double x) {
+    if (x == 0.0 || x == 1.0) {
+        return 0.0;
+    }
+    double y = 1.0, z = 1 - x, prev;
+    do {
+        x = sqrt(x);
+        prev = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (z != prev);
+    return z / 3;
+}
+
+static uint64_t estimate(const uint32_t hist[k_hll_q + 2]) {
+    double m = k_hll_registers;
+    double z = m * hll_tau((m - hist[k_hll_q + 1]) / m);
+    for (int k = k_hll_q; k >= 1; k--) {
+        z = 0.5 * (z + hist[k]);
+    }
+    z += m * hll_sigma(hist[0] / m);
+    // Registers near the cap (only a restored value gets there) would
+    // overflow the int64 reply, and z is 0 once they are all at it
+    double est = 0.5 / log(2) * m * m / z;
+    return est < (double)INT64_MAX ? (uint64_t)llround(est) : INT64_MAX;
+}
+
+uint64_t hll_count_raw(const uint8_t *raw) {
+    uint32_t hist[k_hll_q + 2] = {0};
+    for (uint32_t i = 0; i < k_hll_registers; i++) {
+        hist[raw[i]]++;
+    }
+    return estimate(hist);
+}
+
+uint64_t hll_count(HLL *h) {
+    if (h->card_valid) {
+        return h->card;
+    }
+    uint32_t hist[k_hll_q + 2] = {0};
+    if (h->dense) {
+        for (uint32_t i = 0; i < k_hll_registers; i++) {
+            hist[dense_get(h->regs, i)]++;
+        }
+    } else {
+        hist[0] = k_hll_registers - h->n_sparse;
+        for (uint32_t i = 0; i < h->n_sparse; i++) {
+            hist[h->sparse[i] & 0xFF]++;
+        }
+    }
+    h->card = estimate(hist);
+    h->card_valid = true;
+    return h->card;
+}
@@ -0,0 +1,75 @@
+#include <string.h>
+#include "keyindex.h"
+
+// The first 8 bytes, big endian and zero padded: ordered like strcmp()
+// as long as keys hold no NUL
+static uint64_t key_prefix(const char *key) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v <<= 8;
+        if (*key) {
+            v |= (uint8_t)*key++;
+        }
+    }
+    return v;
+}
+
+static int key_cmp(const void *a, const void *b) {
+    return strcmp((const char *)a, (const char *)b);
+}
+
+void keyidx_init(KeyIndex *idx) {
+    bt_init(&idx->tree, key_cmp);
+}
+
+void keyidx_insert(KeyIndex *idx, const char *key) {
+    bt_insert(&idx->tree, key_prefix(key), (void *)key);
+}
+
+void keyidx_remove(KeyIndex *idx, const char *key) {
+    bt_delete(&idx->tree, key_prefix(key), key);
+}
+
+size_t keyidx_len(const KeyIndex *idx) {
+    return bt_len(&idx->tree);
+}
+
+// First entry at or after the bound
+static BTIter seek(const KeyIndex *idx, const KeyBound *start) {
+    if (!start->key) {
+        return bt_first(&idx->tree);
+    }
+    return bt_seek(&idx->tree, key_prefix(start->key), start->key, start->exclusive);
+}
+
+static bool before_end(const char *key, const KeyBound *end) {
+    if (!end->key) {
+        return true;
+    }
+    int rv = strcmp(key, end->key);
+    return rv < 0 || (rv == 0 && !end->exclusive);
+}
+
+void keyidx_range(const KeyIndex *idx, const KeyBound *start, const KeyBound *end, size_t count,
+                  bool (*cb)(const char *key, void *arg), void *arg) {
+    size_t n = 0;
+    for (BTIter it = seek(idx, start); bt_valid(&it); bt_next(&it)) {
+        const char *key = bt_item(&it);
+        if (!before_end(key, end) || !cb(key, arg) || ++n == count) {
+            return;
+        }
+    }
+}
+
+void keyidx_prefix(const KeyIndex *idx, const char *prefix, size_t count,
+                   bool (*cb)(const char *key, void *arg), void *arg) {
+    // keys sharing the prefix are contiguous, starting at the prefix itself
+    KeyBound start = {prefix, false};
+    size_t len = strlen(prefix), n = 0;
+    for (BTIter it = seek(idx, &start); bt_valid(&it); bt_next(&it)) {
+        const char *key = bt_item(&it);
+        if (strncmp(key, prefix, len) != 0 || !cb(key, arg) || ++n == count) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef KEYINDEX_H
+#define KEYINDEX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "btree.h"
+
+// Ordered index over the keyspace, kept next to the hashtable when the
+// server runs with --ordered-index. The hashtable still serves point
+// lookups; the index only adds sorted iteration: a range or prefix scan
+// seeks to its first key in O(log n) and walks forward from there.
+// It is a B+tree keyed by the first 8 bytes of each key, so most
+// comparisons never touch the key strings. Entries borrow the key string
+// of their Entry, so a key must leave the index before its Entry is freed.
+typedef struct KeyIndex {
+    BTree tree;
+} KeyIndex;
+
+// Estimated bytes per key: a 16-byte entry in leaves that are 50-100% full
+#define k_keyidx_key_mem 24
+
+// A bound of a key range, NULL key = unbounded on that side
+typedef struct KeyBound {
+    const char *key;
+    bool exclusive;
+} KeyBound;
+
+void keyidx_init(KeyIndex *idx);
+void keyidx_insert(KeyIndex *idx, const char *key);  // key must not be present
+void keyidx_remove(KeyIndex *idx, const char *key);
+size_t keyidx_len(const KeyIndex *idx);
+// Visit keys within [start, end] in order, at most count (0 = all).
+// The callback returns false to stop.
+void keyidx_range(const KeyIndex *idx, const KeyBound *start, const KeyBound *end, size_t count,
+                  bool (*cb)(const char *key, void *arg), void *arg);
+void keyidx_prefix(const KeyIndex *idx, const char *prefix, size_t count,
+                   bool (*cb)(const char *key, void *arg), void *arg);
+
+#endif
@@ -1,7 +1,15 @@
 #include "kv.h"
+#include "hash.h"
+#include "quicklist.h"
+#include "stream.h"
+#include "bitmap.h"
+#include "hll.h"
+#include "zset.h"
+#include "keyindex.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 #define container_of(ptr, T, member) \
     ((T *)( (char *)ptr - offsetof(T, member) ))
@@ -12,16 +20,45 @@
 // Global hashtable
 static HMap g_data;
 
+// Optional ordered index over the same keys, see kv_enable_index()
+static bool g_index_enabled = false;
+static KeyIndex g_index;
+
+// --- Memory accounting and eviction state ---
+#define k_lfu_init_val 5      // new keys start warm so they survive a little
+#define k_lfu_log_factor 10   // higher = counter saturates more slowly
+#define k_lfu_decay_minutes 1 // one counter step lost per idle minute
+
+// Keys whose lookups are overlapped by kv_find_many()/kv_put_many().
+// Enough to cover memory latency, few enough that prefetched lines are
+// not evicted before use.
+#define k_prefetch_group 16
+
+static size_t g_used_memory = 0;
+static size_t g_maxmemory = 0;
+static EvictPolicy g_policy = EVICT_NONE;
+static uint32_t g_samples = 5;
+static uint64_t g_evicted_keys = 0;
+static uint64_t g_rejected_writes = 0;
+
+static uint32_t g_clock_sec = 0;   // cached by kv_clock_tick()
+static uint32_t g_version = 0;     // last Entry.version handed out
+static uint64_t g_rng = 0x9E3779B97F4A7C15ull;
+
 // FNV Hash
-static uint64_t str_hash(const char *data) {
+// Also used by the cluster layer to map keys to hash slots
+uint64_t kv_hash(const char *data, size_t len) {
     uint32_t h = 0x811C9DC5;
-    size_t len = strlen(data);
     for (size_t i =  0; i < len; i++) {
         h = (h + data[i]) * 0x01000193;
     }
     return h;
 }
 
+static uint64_t str_hash(const char *data) {
+    return kv_hash(data, strlen(data));
+}
+
 // Check if two entries are equal
 // called by hashtable
 static bool entry_eq(HNode *lhs, HNode *rhs) {
@@ -30,17 +67,281 @@ static bool entry_eq(HNode *lhs, HNode *rhs) {
     return strcmp(l->key, r->key) == 0;
 }
 
+// xorshift64*, good enough for sampling
+static uint64_t rng_next(void) {
+    g_rng ^= g_rng >> 12;
+    g_rng ^= g_rng << 25;
+    g_rng ^= g_rng >> 27;
+    return g_rng * 0x2545F4914F6CDD1Dull;
+}
+
+// Per-key cost before the value: the Entry, the key, its index node
+static size_t key_mem(const char *key) {
+    return sizeof(Entry) + strlen(key) + 1 + (g_index_enabled ? k_keyidx_key_mem : 0);
+}
+
+// Worst case for kv_put(): a new key holding a raw string
+static size_t str_entry_mem(const char *key, const char *val) {
+    return key_mem(key) + strlen(val) + 1;
+}
+
+// Only strings that format back to themselves qualify ("12", "-7"),
+// so GET returns exactly what SET stored
+bool kv_parse_int(const char *s, int64_t *out) {
+    size_t len = strlen(s);
+    if (len == 0 || len >= KV_INT_BUFSIZE) {
+        return false;
+    }
+    const char *digits = s[0] == '-' ? s + 1 : s;
+    if (digits[0] < '0' || digits[0] > '9' || (digits[0] == '0' && (len > 1))) {
+        return false;  // sign alone, junk, leading zeros, "-0"
+    }
+    uint64_t v = 0;
+    for (const char *p = digits; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        uint64_t d = (uint64_t)(*p - '0');
+        if (v > (UINT64_MAX - d) / 10) {
+            return false;
+        }
+        v = v * 10 + d;
+    }
+    if (s[0] == '-') {
+        if (v > (uint64_t)INT64_MAX + 1) {
+            return false;
+        }
+        *out = (int64_t)(0 - v);
+    } else {
+        if (v > (uint64_t)INT64_MAX) {
+            return false;
+        }
+        *out = (int64_t)v;
+    }
+    return true;
+}
+
+// Store a string value, inline when it is an integer
+static void str_set(Entry *ent, const char *val) {
+    ent->type = T_STR;
+    if (kv_parse_int(val, &ent->ival)) {
+        ent->enc = ENC_INT;
+    } else {
+        ent->enc = ENC_RAW;
+        ent->val = strdup(val);
+    }
+}
+
+const char *kv_entry_str(const Entry *ent, char ibuf[KV_INT_BUFSIZE]) {
+    if (ent->enc == ENC_INT) {
+        snprintf(ibuf, KV_INT_BUFSIZE, "%lld", (long long)ent->ival);
+        return ibuf;
+    }
+    return ent->val;
+}
+
+size_t kv_entry_mem(const Entry *ent) {
+    size_t base = key_mem(ent->key);
+    switch (ent->type) {
+    case T_HASH:
+        return base + hash_mem(ent->hash);
+    case T_LIST:
+        return base + ql_mem(ent->list);
+    case T_STREAM:
+        return base + stream_mem(ent->stream);
+    case T_BITMAP:
+        return base + bm_mem(ent->bitmap);
+    case T_HLL:
+        return base + hll_mem(ent->hll);
+    case T_ZSET:
+        return base + zset_mem(ent->zset);
+    default:
+        return ent->enc == ENC_INT ? base : base + strlen(ent->val) + 1;
+    }
+}
+
+static void value_free(Entry *ent) {
+    switch (ent->type) {
+    case T_HASH:
+        hash_free(ent->hash);
+        break;
+    case T_LIST:
+        ql_free(ent->list);
+        break;
+    case T_STREAM:
+        stream_free(ent->stream);
+        break;
+    case T_BITMAP:
+        bm_free(ent->bitmap);
+        break;
+    case T_HLL:
+        hll_free(ent->hll);
+        break;
+    case T_ZSET:
+        zset_free(ent->zset);
+        break;
+    default:
+        if (ent->enc == ENC_RAW) {
+            free(ent->val);
+        }
+    }
+}
+
+// --- LRU / LFU access clock ---
+
+void kv_clock_tick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    g_clock_sec = (uint32_t)ts.tv_sec;
+}
+
+static uint32_t lru_clock(void) {
+    return g_clock_sec & 0xFFFFFF;
+}
+
+static uint32_t lfu_minutes(void) {
+    return (g_clock_sec / 60) & 0xFFFF;
+}
+
+static uint32_t lru_idle(const Entry *ent) {
+    return (lru_clock() - ent->access) & 0xFFFFFF;  // modular, survives wrap-around
+}
+
+// Counter after decaying for the minutes elapsed since its last decrement
+static uint32_t lfu_decayed(const Entry *ent) {
+    uint32_t counter = ent->access & 0xFF;
+    uint32_t elapsed = (lfu_minutes() - (ent->access >> 8)) & 0xFFFF;
+    uint32_t periods = elapsed / k_lfu_decay_minutes;
+    return periods > counter ? 0 : counter - periods;
+}
+
+// Logarithmic counter: the more hits it has, the less likely it grows
+static uint32_t lfu_log_incr(uint32_t counter) {
+    if (counter == 255) {
+        return counter;
+    }
+    double base = counter > k_lfu_init_val ? counter - k_lfu_init_val : 0;
+    double p = 1.0 / (base * k_lfu_log_factor + 1);
+    if ((double)(rng_next() >> 11) / (double)(1ull << 53) < p) {
+        counter++;
+    }
+    return counter;
+}
+
+static void entry_touch(Entry *ent) {
+    if (g_policy == EVICT_ALLKEYS_LFU) {
+        ent->access = (lfu_minutes() << 8) | lfu_log_incr(lfu_decayed(ent));
+    } else {
+        ent->access = lru_clock();
+    }
+}
+
+static void entry_init_access(Entry *ent) {
+    if (g_policy == EVICT_ALLKEYS_LFU) {
+        ent->access = (lfu_minutes() << 8) | k_lfu_init_val;
+    } else {
+        ent->access = lru_clock();
+    }
+}
+
+// Higher score = better eviction candidate
+static uint64_t evict_score(const Entry *ent) {
+    if (g_policy == EVICT_ALLKEYS_LFU) {
+        return 255 - lfu_decayed(ent);
+    }
+    if (g_policy == EVICT_ALLKEYS_LRU) {
+        return lru_idle(ent);
+    }
+    return 0;  // random: the first sample wins
+}
+
+static void entry_free(Entry *ent) {
+    g_used_memory -= kv_entry_mem(ent);
+    if (g_index_enabled) {
+        keyidx_remove(&g_index, ent->key);
+    }
+    value_free(ent);
+    free(ent->key);
+    free(ent);
+}
+
+// Sample a few keys and drop the best candidate.
+// Returns false if there is nothing left to evict.
+static bool evict_one(void) {
+    Entry *victim = NULL;
+    uint64_t best = 0;
+    for (uint32_t i = 0; i < g_samples; i++) {
+        HNode *node = hm_random(&g_data, rng_next());
+        if (!node) {
+            return false;
+        }
+        Entry *ent = container_of(node, Entry, node);
+        uint64_t score = evict_score(ent);
+        if (!victim || score > best) {
+            victim = ent;
+            best = score;
+        }
+        if (g_policy == EVICT_ALLKEYS_RANDOM) {
+            break;
+        }
+    }
+    hm_delete(&g_data, &victim->node, entry_eq);
+    entry_free(victim);
+    g_evicted_keys++;
+    return true;
+}
+
+// Make room for `incoming` more bytes
+bool kv_reserve(size_t incoming) {
+    if (g_maxmemory == 0) {
+        return true;
+    }
+    while (g_used_memory + incoming > g_maxmemory) {
+        if (g_policy == EVICT_NONE || !evict_one()) {
+            g_rejected_writes++;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every write gives the entry a version no other write has used
+// (until the counter wraps), skipping 0, which means "missing"
+static void entry_bump(Entry *ent) {
+    if (++g_version == 0) {
+        g_version = 1;
+    }
+    ent->version = g_version;
+}
+
+// Allocate and link a new key. The caller sets the value, then adds
+// kv_entry_mem() to the used memory.
+static Entry *entry_new(const char *key, uint64_t hcode) {
+    Entry *ent = malloc(sizeof(Entry));
+    ent->key = strdup(key);
+    ent->node.hcode = hcode;
+    ent->node.next = NULL;
+    entry_init_access(ent);
+    entry_bump(ent);
+    hm_insert(&g_data, &ent->node);
+    if (g_index_enabled) {
+        keyidx_insert(&g_index, ent->key);
+    }
+    return ent;
+}
+
 size_t kv_size(void) {
     return hm_size(&g_data);
 }
 
-// PUT: Insert or Update
-void kv_put(const char *key, const char *val) {
+// Insert or update a string whose hash is already known.
+// The caller has made room with kv_reserve().
+static void put_hashed(const char *key, uint64_t hcode, const char *val) {
     // Construct a "Dummy" Entry just for the lookup
     // We only need the key pointer and the calculated hash
     Entry key_dummy;
     key_dummy.key = (char *)key;
-    key_dummy.node.hcode = str_hash(key);
+    key_dummy.node.hcode = hcode;
 
     // Look it up
     HNode *node = hm_lookup(&g_data, &key_dummy.node, entry_eq);
@@ -48,26 +349,74 @@ void kv_put(const char *key, const char *val) {
     if (node) {
         // CASE A: Found! Update existing value.
         Entry *ent = container_of(node, Entry, node);
-        free(ent->val);
-        ent->val = strdup(val);
+        g_used_memory -= kv_entry_mem(ent);
+        value_free(ent);
+        str_set(ent, val);
+        g_used_memory += kv_entry_mem(ent);
+        entry_touch(ent);
+        entry_bump(ent);
     } else {
         // CASE B: Not Found! Allocate and Insert.
-        Entry *ent = malloc(sizeof(Entry));
-        ent->key = strdup(key);
-        ent->val = strdup(val);
-        ent->node.hcode = key_dummy.node.hcode; // Copy the hash we already calculated
-        ent->node.next = NULL;
+        Entry *ent = entry_new(key, key_dummy.node.hcode); // Reuse the hash we already calculated
+        str_set(ent, val);
+        g_used_memory += kv_entry_mem(ent);
+    }
+}
 
-        hm_insert(&g_data, &ent->node);
+// PUT: Insert or Update
+bool kv_put(const char *key, const char *val) {
+    // Evict before the lookup so we never hold a pointer to an evicted entry.
+    // Assumes the worst case (a new key); updates may evict slightly early.
+    if (!kv_reserve(str_entry_mem(key, val))) {
+        return false;
     }
+    put_hashed(key, str_hash(key), val);
+    return true;
 }
 
 // GET: Retrieve Value
-char *kv_get(const char *key) {
+const char *kv_get(const char *key, char ibuf[KV_INT_BUFSIZE]) {
+    Entry *ent = kv_find(key);
+    return ent && ent->type == T_STR ? kv_entry_str(ent, ibuf) : NULL;
+}
+
+// Counters stay ENC_INT, so an update is an in-place add: no allocation,
+// and nothing to reserve. Only a new counter needs room.
+IncrStatus kv_incr(const char *key, int64_t delta, int64_t *result) {
+    Entry *ent = kv_find(key);
+    if (!ent) {
+        // No entry pointer is held across the eviction
+        if (!kv_reserve(key_mem(key))) {
+            return INCR_OOM;
+        }
+        ent = entry_new(key, str_hash(key));
+        ent->type = T_STR;
+        ent->enc = ENC_INT;
+        ent->ival = 0;
+        g_used_memory += kv_entry_mem(ent);
+    }
+    if (ent->type != T_STR) {
+        return INCR_WRONGTYPE;
+    }
+    // every canonical integer is stored ENC_INT, so raw strings are not numbers
+    if (ent->enc != ENC_INT) {
+        return INCR_NOT_INT;
+    }
+    int64_t cur = ent->ival;
+    if ((delta > 0 && cur > INT64_MAX - delta) || (delta < 0 && cur < INT64_MIN - delta)) {
+        return INCR_OVERFLOW;
+    }
+    ent->ival = cur + delta;
+    entry_bump(ent);
+    *result = ent->ival;
+    return INCR_OK;
+}
+
+static Entry *find_hashed(const char *key, uint64_t hcode) {
     // Construct Dummy
     Entry key_dummy;
     key_dummy.key = (char *)key;
-    key_dummy.node.hcode = str_hash(key);
+    key_dummy.node.hcode = hcode;
 
     // Lookup
     HNode *node = hm_lookup(&g_data, &key_dummy.node, entry_eq);
@@ -76,9 +425,92 @@ char *kv_get(const char *key) {
         return NULL;
     }
 
-    // Recover Entry and return value
+    // Recover Entry
     Entry *ent = container_of(node, Entry, node);
-    return ent->val;
+    entry_touch(ent);
+    return ent;
+}
+
+Entry *kv_find(const char *key) {
+    return find_hashed(key, str_hash(key));
+}
+
+// Hash a group of keys and start loading what their lookups will touch:
+// the table slot, then the first entry of the chain, then its key string.
+// Each stage only reads what the previous stage already requested, so the
+// cache misses of the whole group are in flight at the same time.
+static void prefetch_group(const char *const *keys, size_t m, uint64_t *hcodes) {
+    for (size_t i = 0; i < m; i++) {
+        hcodes[i] = str_hash(keys[i]);
+        hm_prefetch_slot(&g_data, hcodes[i]);
+    }
+    for (size_t i = 0; i < m; i++) {
+        HNode *head = hm_slot_head(&g_data, hcodes[i]);
+        if (head) {
+            __builtin_prefetch(container_of(head, Entry, node));
+        }
+    }
+    for (size_t i = 0; i < m; i++) {
+        HNode *head = hm_slot_head(&g_data, hcodes[i]);
+        if (head && head->hcode == hcodes[i]) {
+            __builtin_prefetch(container_of(head, Entry, node)->key);
+        }
+    }
+}
+
+void kv_find_many(const char *const *keys, size_t n, Entry **out) {
+    uint64_t hcodes[k_prefetch_group];
+    for (size_t base = 0; base < n; base += k_prefetch_group) {
+        size_t m = n - base < k_prefetch_group ? n - base : k_prefetch_group;
+        prefetch_group(keys + base, m, hcodes);
+        for (size_t i = 0; i < m; i++) {
+            out[base + i] = find_hashed(keys[base + i], hcodes[i]);
+        }
+    }
+}
+
+bool kv_put_many(const char *const *keys, const char *const *vals, size_t n) {
+    size_t incoming = 0;
+    for (size_t i = 0; i < n; i++) {
+        incoming += str_entry_mem(keys[i], vals[i]);
+    }
+    // all or nothing: room for every key is made before the first write
+    if (!kv_reserve(incoming)) {
+        return false;
+    }
+    uint64_t hcodes[k_prefetch_group];
+    for (size_t base = 0; base < n; base += k_prefetch_group) {
+        size_t m = n - base < k_prefetch_group ? n - base : k_prefetch_group;
+        prefetch_group(keys + base, m, hcodes);
+        for (size_t i = 0; i < m; i++) {
+            put_hashed(keys[base + i], hcodes[i], vals[base + i]);
+        }
+    }
+    return true;
+}
+
+Entry *kv_insert(const char *key, uint32_t type, void *value) {
+    Entry *ent = entry_new(key, str_hash(key));
+    ent->type = type;
+    ent->enc = ENC_RAW;
+    ent->val = value;  // the pointer members share this slot
+    g_used_memory += kv_entry_mem(ent);
+    return ent;
+}
+
+void kv_entry_changed(Entry *ent, size_t old_mem) {
+    g_used_memory -= old_mem;
+    g_used_memory += kv_entry_mem(ent);
+    entry_bump(ent);
+}
+
+// Unlike kv_find(), not an access: watching a key must not keep it alive
+uint32_t kv_version(const char *key) {
+    Entry key_dummy;
+    key_dummy.key = (char *)key;
+    key_dummy.node.hcode = str_hash(key);
+    HNode *node = hm_lookup(&g_data, &key_dummy.node, entry_eq);
+    return node ? container_of(node, Entry, node)->version : 0;
 }
 
 // DEL: Remove and Free
@@ -93,15 +525,18 @@ bool kv_del(const char *key) {
 
     if (node) {
         // If it existed, we must free the memory!
-        Entry *ent = container_of(node, Entry, node);
-        free(ent->key);
-        free(ent->val);
-        free(ent);
+        entry_free(container_of(node, Entry, node));
         return true;
     }
     return false;
 }
 
+static bool cb_index_key(HNode *node, void *arg) {
+    (void)arg;
+    keyidx_insert(&g_index, container_of(node, Entry, node)->key);
+    return true;
+}
+
 // A wrapper struct to pass two things through the single void* argument
 struct kv_cb_arg {
     bool (*user_cb)(const char *key, void *arg);
@@ -117,6 +552,87 @@ static bool internal_kv_cb(HNode *node, void *arg) {
 }
 
 void kv_foreach(bool (*cb)(const char *key, void *arg), void *arg) {
+    if (g_index_enabled) {
+        KeyBound all = {NULL, false};
+        keyidx_range(&g_index, &all, &all, 0, cb, arg);
+        return;
+    }
     struct kv_cb_arg wrap = {cb, arg};
     hm_foreach(&g_data, internal_kv_cb, &wrap);
 }
+
+void kv_enable_index(void) {
+    if (g_index_enabled) {
+        return;
+    }
+    // index what is already there, with the memory it costs
+    g_index_enabled = true;
+    keyidx_init(&g_index);
+    hm_foreach(&g_data, cb_index_key, NULL);
+    g_used_memory += hm_size(&g_data) * k_keyidx_key_mem;
+}
+
+bool kv_index_enabled(void) {
+    return g_index_enabled;
+}
+
+void kv_scan_range(const KeyBound *start, const KeyBound *end, size_t count,
+                   bool (*cb)(const char *key, void *arg), void *arg) {
+    keyidx_range(&g_index, start, end, count, cb, arg);
+}
+
+void kv_scan_prefix(const char *prefix, size_t count,
+                    bool (*cb)(const char *key, void *arg), void *arg) {
+    keyidx_prefix(&g_index, prefix, count, cb, arg);
+}
+
+void kv_set_maxmemory(size_t bytes, EvictPolicy policy, uint32_t samples) {
+    g_maxmemory = bytes;
+    g_policy = policy;
+    g_samples = samples ? samples : 1;
+    kv_clock_tick();
+}
+
+static const char *k_policy_names[] = {
+    [EVICT_NONE] = "noeviction",
+    [EVICT_ALLKEYS_LRU] = "allkeys-lru",
+    [EVICT_ALLKEYS_LFU] = "allkeys-lfu",
+    [EVICT_ALLKEYS_RANDOM] = "allkeys-random",
+};
+
+bool kv_parse_policy(const char *name, EvictPolicy *policy) {
+    for (size_t i = 0; i < sizeof(k_policy_names) / sizeof(k_policy_names[0]); i++) {
+        if (strcmp(name, k_policy_names[i]) == 0) {
+            *policy = (EvictPolicy)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *kv_policy_name(EvictPolicy policy) {
+    return k_policy_names[policy];
+}
+
+size_t kv_mem_usage(const char *key) {
+    Entry key_dummy;
+    key_dummy.key = (char *)key;
+    key_dummy.node.hcode = str_hash(key);
+    HNode *node = hm_lookup(&g_data, &key_dummy.node, entry_eq);
+    if (!node) {
+        return 0;
+    }
+    return kv_entry_mem(container_of(node, Entry, node));
+}
+
+void kv_stats(KVStats *out) {
+    out->keys = hm_size(&g_data);
+    out->table_capacity = g_data.newer.table ? g_data.newer.mask + 1 : 0;
+    out->table_old_capacity = g_data.older.table ? g_data.older.mask + 1 : 0;
+    out->rehashing = g_data.older.table != NULL;
+    out->migrate_pos = g_data.migrate_pos;
+    out->used_memory = g_used_memory;
+    out->maxmemory = g_maxmemory;
+    out->evicted_keys = g_evicted_keys;
+    out->rejected_writes = g_rejected_writes;
+}
@@ -4,18 +4,133 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "hashtable.h"
+#include "keyindex.h"
+
+// Value types
+enum {
+    T_STR = 0,
+    T_HASH = 1,
+    T_LIST = 2,
+    T_STREAM = 3,
+    T_BITMAP = 4,
+    T_HLL = 5,
+    T_ZSET = 6,  // used by the geo commands
+};
+
+// Encodings of T_STR values
+enum {
+    ENC_RAW = 0,  // heap string in val
+    ENC_INT = 1,  // canonical int64 stored inline in ival, no allocation
+};
+
+// Room to format any int64 plus the NUL
+#define KV_INT_BUFSIZE 24
+
+struct Hash;
+struct QuickList;
+struct Stream;
+struct Bitmap;
+struct HLL;
+struct ZSet;
 
 // Key-Value Store (simply linked list)
 typedef struct Entry {
     HNode node;  // intrusive hashtable hook
     char *key;
-    char *val;
+    union {
+        char *val;           // T_STR, ENC_RAW
+        int64_t ival;        // T_STR, ENC_INT
+        struct Hash *hash;   // T_HASH
+        struct QuickList *list;  // T_LIST
+        struct Stream *stream;   // T_STREAM
+        struct Bitmap *bitmap;   // T_BITMAP
+        struct HLL *hll;         // T_HLL
+        struct ZSet *zset;       // T_ZSET
+    };
+    uint32_t type : 4;
+    uint32_t enc : 4;
+    // Eviction metadata
+    // LRU: last access time in seconds (wraps every ~194 days)
+    // LFU: last decrement time in minutes (16 bits) + log access counter (8 bits)
+    uint32_t access : 24;
+    // Bumped from a global counter on every write, for WATCH. Fits in the
+    // padding after the bit-fields, so Entry does not grow.
+    uint32_t version;
 } Entry;
 
+// What to do when a write would exceed maxmemory
+typedef enum {
+    EVICT_NONE = 0,     // reject the write
+    EVICT_ALLKEYS_LRU,  // evict the least recently used of a few sampled keys
+    EVICT_ALLKEYS_LFU,  // evict the least frequently used of a few sampled keys
+    EVICT_ALLKEYS_RANDOM
+} EvictPolicy;
+
+typedef struct KVStats {
+    size_t keys;
+    size_t table_capacity;      // slots in the newer table
+    size_t table_old_capacity;  // slots in the older table, 0 unless rehashing
+    bool rehashing;
+    size_t migrate_pos;         // progressive rehashing cursor in the older table
+    size_t used_memory;     // estimated bytes held by entries
+    size_t maxmemory;       // 0 means unlimited
+    uint64_t evicted_keys;
+    uint64_t rejected_writes;  // writes refused for lack of memory
+} KVStats;
+
+uint64_t kv_hash(const char *data, size_t len);
 size_t kv_size(void);
-void kv_put(const char *key, const char *val);
-char *kv_get(const char *key);
+bool kv_put(const char *key, const char *val);  // false when out of memory
+// NULL if missing or not a string. Integers are formatted into ibuf.
+const char *kv_get(const char *key, char ibuf[KV_INT_BUFSIZE]);
+const char *kv_entry_str(const Entry *ent, char ibuf[KV_INT_BUFSIZE]);
+
+// INCRBY: a missing key counts as 0
+typedef enum {
+    INCR_OK = 0,
+    INCR_OOM,
+    INCR_WRONGTYPE,
+    INCR_NOT_INT,
+    INCR_OVERFLOW
+} IncrStatus;
+IncrStatus kv_incr(const char *key, int64_t delta, int64_t *result);
+bool kv_parse_int(const char *s, int64_t *out);  // canonical form only
 bool kv_del(const char *key);
+// In key order when the index is enabled, table order otherwise
 void kv_foreach(bool (*cb)(const char *key, void *arg), void *arg);
 
+// Ordered key index (--ordered-index). Costs one tree node per key and
+// O(log n) per insert/delete; the scans need it enabled.
+void kv_enable_index(void);
+bool kv_index_enabled(void);
+void kv_scan_range(const KeyBound *start, const KeyBound *end, size_t count,
+                   bool (*cb)(const char *key, void *arg), void *arg);
+void kv_scan_prefix(const char *prefix, size_t count,
+                    bool (*cb)(const char *key, void *arg), void *arg);
+
+// Typed access for the non-string commands. A write looks like:
+//   kv_reserve(bytes) -> kv_find(key) or kv_insert(...) -> old = kv_entry_mem(ent)
+//   -> modify the value -> kv_entry_changed(ent, old)
+// kv_reserve() may evict, so it must come before any Entry pointer is held.
+Entry *kv_find(const char *key);  // any type, NULL if missing
+// Batched kv_find()/kv_put() with the lookups of a group of keys overlapped.
+// Duplicate keys are fine: the later value wins.
+void kv_find_many(const char *const *keys, size_t n, Entry **out);
+bool kv_put_many(const char *const *keys, const char *const *vals, size_t n);
+bool kv_reserve(size_t incoming);  // false when out of memory
+Entry *kv_insert(const char *key, uint32_t type, void *value);  // key must not exist, ENC_RAW
+size_t kv_entry_mem(const Entry *ent);
+void kv_entry_changed(Entry *ent, size_t old_mem);
+// Version of a key for WATCH, 0 if missing. A key that is deleted and
+// created again gets a new version, never its old one.
+uint32_t kv_version(const char *key);
+
+// Memory limit and eviction
+void kv_set_maxmemory(size_t bytes, EvictPolicy policy, uint32_t samples);
+bool kv_parse_policy(const char *name, EvictPolicy *policy);
+const char *kv_policy_name(EvictPolicy policy);
+void kv_clock_tick(void);  // refresh the cached access clock
+size_t kv_mem_usage(const char *key);  // 0 if the key does not exist
+void kv_stats(KVStats *out);
+
 #endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "latency.h"
+
+LatClock g_lat_clock = LAT_CLOCK_MONOTONIC;
+uint64_t g_tsc_mult = 1ull << 32;
+
+// --- Timing ---
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void lat_clock_init(LatClock clock) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (clock == LAT_CLOCK_TSC) {
+        // Calibrate ticks against the monotonic clock over ~10ms
+        uint64_t ns0 = mono_ns();
+        uint64_t tsc0 = __builtin_ia32_rdtsc();
+        struct timespec pause = {0, 10 * 1000 * 1000};
+        nanosleep(&pause, NULL);
+        uint64_t ns1 = mono_ns();
+        uint64_t tsc1 = __builtin_ia32_rdtsc();
+        if (tsc1 > tsc0) {
+            g_tsc_mult = ((ns1 - ns0) << 32) / (tsc1 - tsc0);
+            g_lat_clock = LAT_CLOCK_TSC;
+            return;
+        }
+    }
+#endif
+    g_lat_clock = clock == LAT_CLOCK_TSC ? LAT_CLOCK_MONOTONIC : clock;
+}
+
+static const char *k_clock_names[] = {
+    [LAT_CLOCK_MONOTONIC] = "monotonic",
+    [LAT_CLOCK_COARSE] = "coarse",
+    [LAT_CLOCK_TSC] = "tsc",
+};
+
+bool lat_parse_clock(const char *name, LatClock *clock) {
+    for (size_t i = 0; i < sizeof(k_clock_names) / sizeof(k_clock_names[0]); i++) {
+        if (strcmp(name, k_clock_names[i]) == 0) {
+            *clock = (LatClock)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *lat_clock_name(LatClock clock) {
+    return k_clock_names[clock];
+}
+
+// --- Histogram ---
+
+static size_t bucket_index(uint64_t v) {
+    if (v < (1u << LAT_SUB_BITS)) {
+        return (size_t)v;
+    }
+    if (v >> LAT_MAX_BITS) {
+        return LAT_BUCKETS - 1;  // clamp
+    }
+    uint32_t e = 63 - (uint32_t)__builtin_clzll(v);  // position of the top bit
+    uint64_t sub = (v >> (e - LAT_SUB_BITS)) & ((1u << LAT_SUB_BITS) - 1);
+    return ((size_t)(e - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + (size_t)sub;
+}
+
+// Highest value that maps to the bucket
+static uint64_t bucket_value(size_t idx) {
+    if (idx < (1u << LAT_SUB_BITS)) {
+        return idx;
+    }
+    uint32_t e = (uint32_t)(idx >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    uint64_t sub = idx & ((1u << LAT_SUB_BITS) - 1);
+    uint64_t lower = ((1ull << LAT_SUB_BITS) + sub) << (e - LAT_SUB_BITS);
+    return lower + (1ull << (e - LAT_SUB_BITS)) - 1;
+}
+
+void lat_record(LatHist *hist, uint64_t ns) {
+    hist->buckets[bucket_index(ns)]++;
+    hist->count++;
+    if (ns > hist->max) {
+        hist->max = ns;
+    }
+}
+
+uint64_t lat_percentile(const LatHist *hist, double pct) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    // rank of the wanted sample, 1-based
+    uint64_t rank = (uint64_t)((pct / 100.0) * (double)hist->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LAT_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = bucket_value(i);
+            return v < hist->max ? v : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+void lat_merge(LatHist *dst, const LatHist *src) {
+    for (size_t i = 0; i < LAT_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+void lat_reset(LatHist *hist) {
+    memset(hist, 0, sizeof(LatHist));
+}
+
+// --- Slow log ---
+
+static SlowlogEntry *g_slowlog = NULL;  // ring buffer
+static size_t g_slowlog_cap = 0;
+static size_t g_slowlog_head = 0;       // next slot to write
+static size_t g_slowlog_len = 0;
+static uint64_t g_slowlog_next_id = 0;
+static uint64_t g_slowlog_threshold_ns = 0;
+
+void slowlog_init(uint64_t threshold_us, size_t max_len) {
+    slowlog_reset();
+    free(g_slowlog);
+    g_slowlog_cap = max_len;
+    g_slowlog = max_len ? calloc(max_len, sizeof(SlowlogEntry)) : NULL;
+    g_slowlog_threshold_ns = threshold_us * 1000;
+}
+
+static void entry_clear(SlowlogEntry *ent) {
+    for (uint32_t i = 0; i < ent->n_saved; i++) {
+        free(ent->argv[i]);
+    }
+    ent->n_saved = 0;
+}
+
+void slowlog_maybe_add(uint64_t duration_ns, char **argv, size_t argc) {
+    if (duration_ns < g_slowlog_threshold_ns || g_slowlog_cap == 0) {
+        return;
+    }
+    SlowlogEntry *ent = &g_slowlog[g_slowlog_head];
+    entry_clear(ent);  // overwrite the oldest entry once full
+    ent->id = g_slowlog_next_id++;
+    ent->timestamp = (int64_t)time(NULL);
+    ent->duration_ns = duration_ns;
+    ent->argc = (uint32_t)argc;
+    ent->n_saved = argc < SLOWLOG_MAX_ARGS ? (uint32_t)argc : SLOWLOG_MAX_ARGS;
+    for (uint32_t i = 0; i < ent->n_saved; i++) {
+        ent->argv[i] = strndup(argv[i], SLOWLOG_MAX_ARG_LEN);
+    }
+
+    g_slowlog_head = (g_slowlog_head + 1) % g_slowlog_cap;
+    if (g_slowlog_len < g_slowlog_cap) {
+        g_slowlog_len++;
+    }
+}
+
+size_t slowlog_len(void) {
+    return g_slowlog_len;
+}
+
+const SlowlogEntry *slowlog_at(size_t i) {
+    if (i >= g_slowlog_len) {
+        return NULL;
+    }
+    size_t pos = (g_slowlog_head + g_slowlog_cap - 1 - i) % g_slowlog_cap;
+    return &g_slowlog[pos];
+}
+
+void slowlog_reset(void) {
+    for (size_t i = 0; i < g_slowlog_cap; i++) {
+        entry_clear(&g_slowlog[i]);
+    }
+    g_slowlog_head = 0;
+    g_slowlog_len = 0;
+}
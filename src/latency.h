@@ -0,0 +1,84 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+// --- Timing ---
+
+typedef enum {
+    LAT_CLOCK_MONOTONIC = 0,  // clock_gettime(CLOCK_MONOTONIC), vDSO, ~20ns
+    LAT_CLOCK_COARSE,         // CLOCK_MONOTONIC_COARSE, cheapest but ms resolution
+    LAT_CLOCK_TSC             // rdtsc, calibrated at startup (x86 only)
+} LatClock;
+
+extern LatClock g_lat_clock;
+extern uint64_t g_tsc_mult;  // ns per tick, 32.32 fixed point
+
+void lat_clock_init(LatClock clock);  // falls back to MONOTONIC without a TSC
+bool lat_parse_clock(const char *name, LatClock *clock);
+const char *lat_clock_name(LatClock clock);
+
+// Raw timestamp in clock-specific ticks.
+// Inline so the timed region is not skewed by call overhead.
+static inline uint64_t lat_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (g_lat_clock == LAT_CLOCK_TSC) {
+        return __builtin_ia32_rdtsc();
+    }
+#endif
+    struct timespec ts;
+    clock_gettime(g_lat_clock == LAT_CLOCK_COARSE ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t lat_ticks_to_ns(uint64_t ticks) {
+    if (g_lat_clock != LAT_CLOCK_TSC) {
+        return ticks;
+    }
+    return (uint64_t)(((unsigned __int128)ticks * g_tsc_mult) >> 32);
+}
+
+// --- Log-linear histogram (HDR style) ---
+// Values below 2^LAT_SUB_BITS get exact buckets. Above that, every power of
+// two is split into 2^LAT_SUB_BITS linear sub-buckets, so any recorded value
+// is reported within 1/32 (~3%) of the truth, from 1ns up to 2^40ns (~18min).
+#define LAT_SUB_BITS 5
+#define LAT_MAX_BITS 40
+#define LAT_BUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+
+typedef struct LatHist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[LAT_BUCKETS];
+} LatHist;
+
+void lat_record(LatHist *hist, uint64_t ns);
+uint64_t lat_percentile(const LatHist *hist, double pct);  // pct in [0, 100]
+void lat_merge(LatHist *dst, const LatHist *src);
+void lat_reset(LatHist *hist);
+
+// --- Slow log ---
+// Ring of the most recent requests slower than a threshold
+
+#define SLOWLOG_MAX_ARGS 8     // arguments kept per entry
+#define SLOWLOG_MAX_ARG_LEN 64 // bytes kept per argument
+
+typedef struct SlowlogEntry {
+    uint64_t id;
+    int64_t timestamp;   // unix seconds
+    uint64_t duration_ns;
+    uint32_t argc;       // original argument count
+    uint32_t n_saved;    // arguments kept in argv
+    char *argv[SLOWLOG_MAX_ARGS];
+} SlowlogEntry;
+
+void slowlog_init(uint64_t threshold_us, size_t max_len);
+void slowlog_maybe_add(uint64_t duration_ns, char **argv, size_t argc);
+size_t slowlog_len(void);
+const SlowlogEntry *slowlog_at(size_t i);  // 0 is the newest
+void slowlog_reset(void);
+
+#endif
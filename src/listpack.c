@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+#include "listpack.h"
+#include "common.h"
+
+#define LP_HEADER 8  // total bytes + count
+
+static uint32_t rd32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static void wr32(uint8_t *p, uint32_t v) {
+    memcpy(p, &v, 4);
+}
+
+static void set_header(uint8_t *lp, size_t total, uint32_t count) {
+    wr32(lp, (uint32_t)total);
+    wr32(lp + 4, count);
+}
+
+static size_t varlen_size(size_t v) {
+    return v < 128 ? 1 : 5;
+}
+
+// Bytes taken by an entry holding `len` bytes of data
+static size_t entry_size(uint32_t len) {
+    size_t head = varlen_size(len) + len;
+    return head + varlen_size(head);
+}
+
+// Size of the entry starting at p
+static size_t entry_total(const uint8_t *p) {
+    uint32_t len = 0;
+    lp_get(p, &len);
+    return entry_size(len);
+}
+
+static void write_entry(uint8_t *dst, const char *s, uint32_t len) {
+    size_t i = 0;
+    if (len < 128) {
+        dst[i++] = (uint8_t)len;
+    } else {
+        dst[i++] = 0x80;
+        wr32(dst + i, len);
+        i += 4;
+    }
+    memcpy(dst + i, s, len);
+    i += len;
+    size_t head = i;
+    if (head < 128) {
+        dst[i] = (uint8_t)head;
+    } else {
+        // the marker goes last so a backward reader sees it first
+        wr32(dst + i, (uint32_t)head);
+        dst[i + 4] = 0x80;
+    }
+}
+
+uint8_t *lp_new(void) {
+    uint8_t *lp = malloc(LP_HEADER);
+    if (!lp) {
+        die("Memory allocation failed");
+    }
+    set_header(lp, LP_HEADER, 0);
+    return lp;
+}
+
+void lp_free(uint8_t *lp) {
+    free(lp);
+}
+
+size_t lp_bytes(const uint8_t *lp) {
+    return rd32(lp);
+}
+
+uint32_t lp_count(const uint8_t *lp) {
+    return rd32(lp + 4);
+}
+
+const char *lp_get(const uint8_t *p, uint32_t *len) {
+    if (p[0] < 128) {
+        *len = p[0];
+        return (const char *)p + 1;
+    }
+    *len = rd32(p + 1);
+    return (const char *)p + 5;
+}
+
+uint8_t *lp_first(uint8_t *lp) {
+    return lp_count(lp) ? lp + LP_HEADER : NULL;
+}
+
+uint8_t *lp_next(uint8_t *lp, uint8_t *p) {
+    uint8_t *next = p + entry_total(p);
+    return next < lp + lp_bytes(lp) ? next : NULL;
+}
+
+// Step back over the entry that ends right before `end`
+static uint8_t *entry_before(uint8_t *end) {
+    const uint8_t *q = end - 1;
+    size_t head = 0, back = 1;
+    if (*q < 128) {
+        head = *q;
+    } else {
+        head = rd32(q - 4);
+        back = 5;
+    }
+    return end - back - head;
+}
+
+uint8_t *lp_last(uint8_t *lp) {
+    return lp_count(lp) ? entry_before(lp + lp_bytes(lp)) : NULL;
+}
+
+uint8_t *lp_prev(uint8_t *lp, uint8_t *p) {
+    return p > lp + LP_HEADER ? entry_before(p) : NULL;
+}
+
+uint8_t *lp_seek(uint8_t *lp, int64_t index) {
+    int64_t count = lp_count(lp);
+    if (index < 0) {
+        index += count;
+    }
+    if (index < 0 || index >= count) {
+        return NULL;
+    }
+    // walk from the nearer end
+    uint8_t *p = NULL;
+    if (index < count / 2) {
+        p = lp_first(lp);
+        while (index--) {
+            p = lp_next(lp, p);
+        }
+    } else {
+        p = lp_last(lp);
+        for (int64_t i = count - 1; i > index; i--) {
+            p = lp_prev(lp, p);
+        }
+    }
+    return p;
+}
+
+uint8_t *lp_find(uint8_t *lp, uint8_t *p, const char *s, uint32_t len, uint32_t step) {
+    uint8_t *end = lp + lp_bytes(lp);
+    while (p && p < end) {
+        uint32_t plen = 0;
+        const char *data = lp_get(p, &plen);
+        if (plen == len && memcmp(data, s, len) == 0) {
+            return p;
+        }
+        for (uint32_t i = 0; i < step && p; i++) {
+            p = lp_next(lp, p);
+        }
+    }
+    return NULL;
+}
+
+// Replace `old_size` bytes at offset `off` by room for `new_size` bytes
+static uint8_t *splice(uint8_t *lp, size_t off, size_t old_size, size_t new_size) {
+    size_t total = lp_bytes(lp);
+    size_t new_total = total - old_size + new_size;
+    if (new_size > old_size) {
+        lp = realloc(lp, new_total);
+        if (!lp) {
+            die("Memory allocation failed");
+        }
+    }
+    memmove(lp + off + new_size, lp + off + old_size, total - off - old_size);
+    if (new_size < old_size) {
+        uint8_t *shrunk = realloc(lp, new_total);
+        lp = shrunk ? shrunk : lp;
+    }
+    wr32(lp, (uint32_t)new_total);
+    return lp;
+}
+
+uint8_t *lp_insert(uint8_t *lp, uint8_t **p, const char *s, uint32_t len) {
+    size_t off = *p ? (size_t)(*p - lp) : lp_bytes(lp);
+    size_t size = entry_size(len);
+    lp = splice(lp, off, 0, size);
+    write_entry(lp + off, s, len);
+    wr32(lp + 4, lp_count(lp) + 1);
+    *p = lp + off;
+    return lp;
+}
+
+uint8_t *lp_append(uint8_t *lp, const char *s, uint32_t len) {
+    uint8_t *p = NULL;
+    return lp_insert(lp, &p, s, len);
+}
+
+uint8_t *lp_prepend(uint8_t *lp, const char *s, uint32_t len) {
+    uint8_t *p = lp + LP_HEADER;
+    return lp_insert(lp, &p, s, len);
+}
+
+uint8_t *lp_replace(uint8_t *lp, uint8_t **p, const char *s, uint32_t len) {
+    size_t off = (size_t)(*p - lp);
+    lp = splice(lp, off, entry_total(*p), entry_size(len));
+    write_entry(lp + off, s, len);
+    *p = lp + off;
+    return lp;
+}
+
+uint8_t *lp_delete(uint8_t *lp, uint8_t **p) {
+    size_t off = (size_t)(*p - lp);
+    lp = splice(lp, off, entry_total(*p), 0);
+    wr32(lp + 4, lp_count(lp) - 1);
+    *p = off < lp_bytes(lp) ? lp + off : NULL;
+    return lp;
+}
@@ -0,0 +1,43 @@
+#ifndef LISTPACK_H
+#define LISTPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A listpack is one contiguous allocation holding a sequence of strings:
+//
+//   [total bytes: u32][count: u32] [entry] [entry] ...
+//   entry = [len: 1 or 5 bytes] [data] [backlen: 1 or 5 bytes]
+//
+// len/backlen take 1 byte below 128, otherwise a 0x80 marker plus a u32.
+// backlen (the size of len + data) lets us walk backwards from the end.
+// Small collections are scanned linearly, which beats hashing: no pointer
+// chasing and the whole thing usually sits in a few cache lines.
+
+uint8_t *lp_new(void);
+void lp_free(uint8_t *lp);
+size_t lp_bytes(const uint8_t *lp);
+uint32_t lp_count(const uint8_t *lp);
+
+// Iteration. Positions are pointers into the listpack and are invalidated
+// by any call that returns a new listpack pointer.
+uint8_t *lp_first(uint8_t *lp);                 // NULL if empty
+uint8_t *lp_last(uint8_t *lp);                  // NULL if empty
+uint8_t *lp_next(uint8_t *lp, uint8_t *p);      // NULL at the end
+uint8_t *lp_prev(uint8_t *lp, uint8_t *p);      // NULL at the start
+uint8_t *lp_seek(uint8_t *lp, int64_t index);   // negative counts from the end
+const char *lp_get(const uint8_t *p, uint32_t *len);
+
+// Find the first entry equal to s, checking every `step`-th entry from p
+uint8_t *lp_find(uint8_t *lp, uint8_t *p, const char *s, uint32_t len, uint32_t step);
+
+// Mutation; each may move the listpack and returns its new address.
+// *p (if given) is updated to the inserted/replaced entry or, for
+// deletion, to the entry that followed the deleted one (NULL if none).
+uint8_t *lp_insert(uint8_t *lp, uint8_t **p, const char *s, uint32_t len);  // before *p, or append if *p is NULL
+uint8_t *lp_append(uint8_t *lp, const char *s, uint32_t len);
+uint8_t *lp_prepend(uint8_t *lp, const char *s, uint32_t len);
+uint8_t *lp_replace(uint8_t *lp, uint8_t **p, const char *s, uint32_t len);
+uint8_t *lp_delete(uint8_t *lp, uint8_t **p);
+
+#endif
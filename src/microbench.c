@@ -0,0 +1,539 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "hashtable.h"
+#include "avl.h"
+#include "btree.h"
+#include "buffer.h"
+#include "kv.h"
+#include "quicklist.h"
+#include "bitmap.h"
+#include "hll.h"
+
+// Microbenchmarks for the data structure layers.
+// Prints one JSON document on stdout, progress on stderr:
+// {"benchmarks": [{"name": ..., "size": ..., "ops": ..., "ns_per_op": ...,
+//                  "cache_misses_per_op": ... or null}, ...]}
+
+#define container_of(ptr, T, member) \
+    ((T *)( (char *)ptr - offsetof(T, member) ))
+
+// --- Measurement ---
+
+static int g_perf_fd = -1;  // hardware cache-miss counter, -1 if unavailable
+static bool g_first_result = true;
+
+static void perf_init(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // this thread, any CPU
+    g_perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (g_perf_fd < 0) {
+        fprintf(stderr, "perf_event_open unavailable, cache misses not reported\n");
+    }
+}
+
+typedef struct Timer {
+    struct timespec start;
+} Timer;
+
+static void timer_start(Timer *t) {
+    if (g_perf_fd >= 0) {
+        ioctl(g_perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(g_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+// Stop the clock and emit one JSON result
+static void timer_report(Timer *t, const char *name, size_t size, uint64_t ops) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long misses = -1;
+    if (g_perf_fd >= 0) {
+        ioctl(g_perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(g_perf_fd, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = -1;
+        }
+    }
+    double ns = (double)(end.tv_sec - t->start.tv_sec) * 1e9 + (double)(end.tv_nsec - t->start.tv_nsec);
+    if (ops == 0) {
+        ops = 1;
+    }
+
+    printf("%s\n    {\"name\": \"%s\", \"size\": %zu, \"ops\": %llu, \"ns_per_op\": %.2f, ",
+           g_first_result ? "" : ",", name, size, (unsigned long long)ops, ns / (double)ops);
+    if (misses >= 0) {
+        printf("\"cache_misses_per_op\": %.3f}", (double)misses / (double)ops);
+    } else {
+        printf("\"cache_misses_per_op\": null}");
+    }
+    g_first_result = false;
+    fprintf(stderr, "%-24s size=%-8zu %10.2f ns/op\n", name, size, ns / (double)ops);
+}
+
+static uint64_t g_rng = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng_next(void) {
+    g_rng ^= g_rng >> 12;
+    g_rng ^= g_rng << 25;
+    g_rng ^= g_rng >> 27;
+    return g_rng * 0x2545F4914F6CDD1Dull;
+}
+
+// Keep the optimizer from deleting benchmark loops
+static volatile uint64_t g_sink;
+
+// --- Hashtable ---
+
+typedef struct HKey {
+    HNode node;
+    uint64_t key;
+} HKey;
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+}
+
+static bool hkey_eq(HNode *lhs, HNode *rhs) {
+    return container_of(lhs, HKey, node)->key == container_of(rhs, HKey, node)->key;
+}
+
+static void bench_hashtable(size_t n) {
+    HMap map = {0};
+    HKey *nodes = malloc(n * sizeof(HKey));
+    for (size_t i = 0; i < n; i++) {
+        nodes[i].key = i;
+        nodes[i].node.hcode = mix64(i);
+    }
+
+    Timer t;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        hm_insert(&map, &nodes[i].node);
+    }
+    timer_report(&t, "hm_insert", n, n);
+
+    HKey probe;
+    uint64_t found = 0;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        probe.key = rng_next() % n;
+        probe.node.hcode = mix64(probe.key);
+        found += hm_lookup(&map, &probe.node, hkey_eq) != NULL;
+    }
+    timer_report(&t, "hm_lookup_hit", n, n);
+
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        probe.key = n + rng_next() % n;
+        probe.node.hcode = mix64(probe.key);
+        found += hm_lookup(&map, &probe.node, hkey_eq) != NULL;
+    }
+    timer_report(&t, "hm_lookup_miss", n, n);
+
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        probe.key = i;
+        probe.node.hcode = nodes[i].node.hcode;
+        found += hm_delete(&map, &probe.node, hkey_eq) != NULL;
+    }
+    timer_report(&t, "hm_delete", n, n);
+
+    g_sink = found;
+    hm_clear(&map);
+    free(nodes);
+}
+
+// --- AVL ---
+
+typedef struct AVLKey {
+    AVLNode node;
+    uint32_t val;
+} AVLKey;
+
+static void bench_avl(size_t n) {
+    AVLKey *items = malloc(n * sizeof(AVLKey));
+    AVLNode *root = NULL;
+
+    Timer t;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        AVLKey *item = &items[i];
+        avl_init(&item->node);
+        item->val = (uint32_t)rng_next();
+        AVLNode *cur = NULL;
+        AVLNode **from = &root;
+        while (*from) {
+            cur = *from;
+            from = item->val < container_of(cur, AVLKey, node)->val ? &cur->left : &cur->right;
+        }
+        *from = &item->node;
+        item->node.parent = cur;
+        root = avl_fix(&item->node);
+    }
+    timer_report(&t, "avl_fix_insert", n, n);
+
+    // point lookups and rank queries, the operations the B+tree targets.
+    // Probes come from a separate array: reading them out of the nodes
+    // would warm the very node the search ends on.
+    uint32_t *vals = malloc(n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        vals[i] = items[i].val;
+    }
+    uint64_t found = 0;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t val = vals[rng_next() % n];
+        AVLNode *cur = root;
+        while (cur && container_of(cur, AVLKey, node)->val != val) {
+            cur = val < container_of(cur, AVLKey, node)->val ? cur->left : cur->right;
+        }
+        found += cur != NULL;
+    }
+    timer_report(&t, "avl_lookup", n, n);
+
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t val = (uint32_t)rng_next();
+        uint64_t rank = 0;
+        for (AVLNode *cur = root; cur; ) {
+            if (container_of(cur, AVLKey, node)->val < val) {
+                rank += avl_cnt(cur->left) + 1;
+                cur = cur->right;
+            } else {
+                cur = cur->left;
+            }
+        }
+        found += rank;
+    }
+    timer_report(&t, "avl_rank", n, n);
+    g_sink = found;
+    free(vals);
+
+    // delete in a shuffled order
+    size_t *order = malloc(n * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (size_t i = n; i > 1; i--) {
+        size_t j = rng_next() % i;
+        size_t tmp = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = tmp;
+    }
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        root = avl_del(&items[order[i]].node);
+    }
+    timer_report(&t, "avl_del", n, n);
+
+    g_sink = (uint64_t)(uintptr_t)root;
+    free(order);
+    free(items);
+}
+
+// --- B+tree ---
+
+// Same workload as bench_avl(), keyed by the value itself
+static int cmp_ptr(const void *a, const void *b) {
+    uintptr_t l = (uintptr_t)a, r = (uintptr_t)b;
+    return l < r ? -1 : l > r;
+}
+
+static void bench_btree(size_t n) {
+    uint32_t *vals = malloc(n * sizeof(uint32_t));
+    BTree tree;
+    bt_init(&tree, cmp_ptr);
+
+    Timer t;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        vals[i] = (uint32_t)rng_next();
+        bt_insert(&tree, vals[i], (void *)(uintptr_t)vals[i]);
+    }
+    timer_report(&t, "bt_insert", n, n);
+
+    uint64_t found = 0;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t val = vals[rng_next() % n];
+        found += bt_find(&tree, val, (void *)(uintptr_t)val) != NULL;
+    }
+    timer_report(&t, "bt_lookup", n, n);
+
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t val = (uint32_t)rng_next();
+        found += bt_rank(&tree, val, (void *)(uintptr_t)val);
+    }
+    timer_report(&t, "bt_rank", n, n);
+
+    for (size_t i = n; i > 1; i--) {
+        size_t j = rng_next() % i;
+        uint32_t tmp = vals[i - 1];
+        vals[i - 1] = vals[j];
+        vals[j] = tmp;
+    }
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        found += bt_delete(&tree, vals[i], (void *)(uintptr_t)vals[i]) != NULL;
+    }
+    timer_report(&t, "bt_delete", n, n);
+
+    g_sink = found;
+    bt_clear(&tree);
+    free(vals);
+}
+
+// --- Buffer ---
+
+static void bench_buffer(size_t n) {
+    Buffer buf;
+    uint8_t chunk[4096];
+    memset(chunk, 'x', sizeof(chunk));
+
+    // Request/response style: small appends drained as they come
+    buffer_init(&buf, 4096);
+    Timer t;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        buf_append(&buf, chunk, 24);
+        if (buf_read_size(&buf) >= 2048) {
+            buf_consume(&buf, buf_read_size(&buf) - 16);  // leave a partial message
+        }
+    }
+    timer_report(&t, "buf_append_small_drain", n, n);
+    buffer_destroy(&buf);
+
+    // Serializer style: many tiny typed appends
+    buffer_init(&buf, 4096);
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        buf_append_u8(&buf, 2);
+        buf_append_u32(&buf, (uint32_t)i);
+        if (buf_read_size(&buf) >= 64 * 1024) {
+            buf_consume(&buf, buf_read_size(&buf));
+        }
+    }
+    timer_report(&t, "buf_append_u8_u32", n, n);
+    buffer_destroy(&buf);
+
+    // Growth: large appends never consumed
+    size_t n_big = n / 64 ? n / 64 : 1;
+    buffer_init(&buf, 4096);
+    timer_start(&t);
+    for (size_t i = 0; i < n_big; i++) {
+        buf_append(&buf, chunk, sizeof(chunk));
+    }
+    timer_report(&t, "buf_append_4k_grow", n_big, n_big);
+    buffer_destroy(&buf);
+}
+
+// --- KV ---
+
+static void bench_kv(size_t n) {
+    char key[32];
+    char val[32];
+    snprintf(val, sizeof(val), "value-0123456789");
+
+    Timer t;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "key:%zu", i);
+        kv_put(key, val);
+    }
+    timer_report(&t, "kv_put_new", n, n);
+
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "key:%zu", (size_t)(rng_next() % n));
+        kv_put(key, val);
+    }
+    timer_report(&t, "kv_put_overwrite", n, n);
+
+    uint64_t hits = 0;
+    char ibuf[KV_INT_BUFSIZE];
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "key:%zu", (size_t)(rng_next() % n));
+        hits += kv_get(key, ibuf) != NULL;
+    }
+    timer_report(&t, "kv_get_hit", n, n);
+
+    // Random hits again, one by one vs MGET-sized batches with prefetching.
+    // Keys are formatted up front so only the lookups are timed.
+    size_t batch = 1000;
+    char (*names)[32] = malloc(n * sizeof(*names));
+    const char **keys = malloc(n * sizeof(char *));
+    Entry **ents = malloc(batch * sizeof(Entry *));
+    for (size_t i = 0; i < n; i++) {
+        snprintf(names[i], sizeof(names[i]), "key:%zu", (size_t)(rng_next() % n));
+        keys[i] = names[i];
+    }
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        hits += kv_find(keys[i]) != NULL;
+    }
+    timer_report(&t, "kv_find_preformatted", n, n);
+
+    timer_start(&t);
+    for (size_t i = 0; i + batch <= n; i += batch) {
+        kv_find_many(keys + i, batch, ents);
+        hits += ents[0] != NULL;
+    }
+    timer_report(&t, "kv_find_many_1000", n, n - n % batch);
+    free(names);
+    free(keys);
+    free(ents);
+
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "nokey:%zu", i);
+        hits += kv_get(key, ibuf) != NULL;
+    }
+    timer_report(&t, "kv_get_miss", n, n);
+
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "key:%zu", i);
+        hits += kv_del(key);
+    }
+    timer_report(&t, "kv_del", n, n);
+
+    // Counters: in-place updates of int-encoded values
+    size_t n_counters = 1000;
+    int64_t result = 0;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "counter:%zu", (size_t)(rng_next() % n_counters));
+        hits += kv_incr(key, 1, &result) == INCR_OK;
+    }
+    timer_report(&t, "kv_incr", n_counters, n);
+    g_sink = hits;
+}
+
+// --- Quicklist ---
+
+static bool cb_count(const char *s, uint32_t len, void *arg) {
+    (void)s;
+    *(uint64_t *)arg += len;
+    return true;
+}
+
+static void bench_quicklist(size_t n) {
+    QuickList *ql = ql_new();
+    char val[32];
+
+    Timer t;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        int len = snprintf(val, sizeof(val), "job:%zu", i);
+        ql_push(ql, false, val, (uint32_t)len);
+    }
+    timer_report(&t, "ql_push_tail", n, n);
+
+    uint64_t bytes = 0;
+    timer_start(&t);
+    ql_range(ql, 0, n - 1, cb_count, &bytes);
+    timer_report(&t, "ql_range_all", n, n);
+
+    size_t n_index = n < 100000 ? n : 100000;
+    uint32_t len = 0;
+    timer_start(&t);
+    for (size_t i = 0; i < n_index; i++) {
+        bytes += ql_index(ql, (int64_t)(rng_next() % n), &len) != NULL;
+    }
+    timer_report(&t, "ql_index_random", n, n_index);
+
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        bytes += ql_peek(ql, true, &len) != NULL;
+        ql_pop(ql, true);
+    }
+    timer_report(&t, "ql_pop_head", n, n);
+
+    g_sink = bytes;
+    ql_free(ql);
+}
+
+// BITCOUNT over a whole bitmap of `bytes` bytes, and HLL adds
+static void bench_bitmap_hll(size_t bytes) {
+    Bitmap *bm = bm_new();
+    for (size_t i = 0; i < bytes * 8; i += 3) {
+        bm_set(bm, i, true);
+    }
+    size_t rounds = (64 << 20) / bytes;
+    uint64_t total = 0;
+    Timer t;
+    timer_start(&t);
+    for (size_t i = 0; i < rounds; i++) {
+        total += bm_count(bm, 0, bytes - 1);
+    }
+    timer_report(&t, "bm_count_bytes", bytes, rounds * bytes);
+    bm_free(bm);
+
+    HLL *h = hll_new();
+    char val[32];
+    size_t n = bytes;
+    timer_start(&t);
+    for (size_t i = 0; i < n; i++) {
+        int len = snprintf(val, sizeof(val), "user:%zu", i);
+        total += hll_add(h, val, (size_t)len);
+    }
+    timer_report(&t, "hll_add", n, n);
+    total += hll_count(h);
+    g_sink = total;
+    hll_free(h);
+}
+
+int main(int argc, char **argv) {
+    // --quick: small sizes only, for smoke testing
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    perf_init();
+
+    // The hashtable doubles when size > 8 * slots, starting from 4 slots:
+    // 32768 and 262144 sit exactly on a threshold, +1 triggers the rehash.
+    size_t hm_sizes[] = {1000, 32768, 32769, 262144, 262145, 1000000};
+    size_t avl_sizes[] = {1000, 100000, 1000000, 10000000};
+    size_t n_hm = quick ? 2 : sizeof(hm_sizes) / sizeof(hm_sizes[0]);
+    size_t n_avl = quick ? 1 : sizeof(avl_sizes) / sizeof(avl_sizes[0]);
+    size_t buf_ops = quick ? 100000 : 10000000;
+    size_t kv_keys = quick ? 10000 : 1000000;
+    size_t ql_items = quick ? 10000 : 1000000;
+
+    printf("{\"benchmarks\": [");
+    for (size_t i = 0; i < n_hm; i++) {
+        bench_hashtable(hm_sizes[i]);
+    }
+    for (size_t i = 0; i < n_avl; i++) {
+        bench_avl(avl_sizes[i]);
+        bench_btree(avl_sizes[i]);
+    }
+    bench_buffer(buf_ops);
+    bench_kv(kv_keys);
+    bench_quicklist(ql_items);
+    bench_bitmap_hll(quick ? 4096 : 1 << 20);
+    printf("\n]}\n");
+
+    if (g_perf_fd >= 0) {
+        close(g_perf_fd);
+    }
+    return 0;
+}
@@ -0,0 +1,724 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "myredis.h"
+#include "buffer.h"
+#include "common.h"
+#include "protocol.h"
+
+// Initial size of the connection buffers, they grow on demand
+#define k_buf_init (64 << 10)
+// Bytes asked of each read()
+#define k_read_chunk (64 << 10)
+
+// A request waiting for its reply
+typedef struct Pending {
+    mr_reply_fn cb;
+    void *arg;
+} Pending;
+
+struct MrConn {
+    int fd;
+    Buffer wbuf;
+    Buffer rbuf;
+    // ring of callbacks, in request order
+    Pending *pending;
+    size_t head;
+    size_t n_pending;
+    size_t cap_pending;  // a power of two
+    bool failed;
+    char err[128];
+};
+
+// --- Replies ---
+
+static bool take(MrReader *r, void *dst, size_t n) {
+    if ((size_t)(r->end - r->p) < n) {
+        return false;
+    }
+    memcpy(dst, r->p, n);
+    r->p += n;
+    return true;
+}
+
+bool mr_read(MrReader *r, MrValue *v) {
+    uint8_t tag = 0;
+    if (!take(r, &tag, 1)) {
+        return false;
+    }
+    memset(v, 0, sizeof(*v));
+    switch (tag) {
+    case TAG_NIL:
+        v->type = MR_NIL;
+        return true;
+    case TAG_ERR: {
+        int32_t code = 0;
+        v->type = MR_ERR;
+        if (!take(r, &code, 4) || !take(r, &v->len, 4) || (size_t)(r->end - r->p) < v->len) {
+            return false;
+        }
+        v->i = code;
+        v->str = (const char *)r->p;
+        r->p += v->len;
+        return true;
+    }
+    case TAG_STR:
+        v->type = MR_STR;
+        if (!take(r, &v->len, 4) || (size_t)(r->end - r->p) < v->len) {
+            return false;
+        }
+        v->str = (const char *)r->p;
+        r->p += v->len;
+        return true;
+    case TAG_INT:
+        v->type = MR_INT;
+        return take(r, &v->i, 8);
+    case TAG_DBL:
+        v->type = MR_DBL;
+        return take(r, &v->d, 8);
+    case TAG_ARR:
+        v->type = MR_ARR;
+        return take(r, &v->len, 4);
+    }
+    return false;
+}
+
+bool mr_skip(MrReader *r) {
+    MrValue v;
+    if (!mr_read(r, &v)) {
+        return false;
+    }
+    for (uint32_t i = 0; v.type == MR_ARR && i < v.len; i++) {
+        if (!mr_skip(r)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// --- Connection ---
+
+static int fail(MrConn *conn, const char *what) {
+    if (errno) {
+        snprintf(conn->err, sizeof(conn->err), "%s: %s", what, strerror(errno));
+    } else {
+        snprintf(conn->err, sizeof(conn->err), "%s", what);
+    }
+    conn->failed = true;
+    return -1;
+}
+
+// Blocking connect(), -1 with errno set on failure
+static int connect_to(int family, const struct sockaddr *addr, socklen_t addrlen) {
+    int fd = socket(family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, addr, addrlen) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static MrConn *conn_new(int fd) {
+    fd_set_nb(fd);
+    MrConn *conn = calloc(1, sizeof(MrConn));
+    if (!conn) {
+        die("Memory allocation failed");
+    }
+    conn->fd = fd;
+    buffer_init(&conn->wbuf, k_buf_init);
+    buffer_init(&conn->rbuf, k_buf_init);
+    return conn;
+}
+
+MrConn *mr_connect(const char *host, uint16_t port) {
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    int fd = connect_to(AF_INET, (const struct sockaddr *)&addr, sizeof(addr));
+    if (fd < 0) {
+        return NULL;
+    }
+    // requests are coalesced here, not by Nagle's algorithm
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return conn_new(fd);
+}
+
+MrConn *mr_connect_unix(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = connect_to(AF_UNIX, (const struct sockaddr *)&addr, sizeof(addr));
+    return fd < 0 ? NULL : conn_new(fd);
+}
+
+void mr_close(MrConn *conn) {
+    if (!conn) {
+        return;
+    }
+    close(conn->fd);
+    conn->failed = true;  // callbacks below cannot queue more
+    while (conn->n_pending > 0) {
+        Pending p = conn->pending[conn->head];
+        conn->head = (conn->head + 1) & (conn->cap_pending - 1);
+        conn->n_pending--;
+        p.cb(conn, NULL, p.arg);
+    }
+    buffer_destroy(&conn->wbuf);
+    buffer_destroy(&conn->rbuf);
+    free(conn->pending);
+    free(conn);
+}
+
+int mr_fd(const MrConn *conn) {
+    return conn->fd;
+}
+
+size_t mr_pending(const MrConn *conn) {
+    return conn->n_pending;
+}
+
+const char *mr_error(const MrConn *conn) {
+    return conn->err;
+}
+
+static void push_pending(MrConn *conn, mr_reply_fn cb, void *arg) {
+    if (conn->n_pending == conn->cap_pending) {
+        size_t cap = conn->cap_pending ? conn->cap_pending * 2 : 64;
+        Pending *ring = malloc(cap * sizeof(Pending));
+        if (!ring) {
+            die("Memory allocation failed");
+        }
+        for (size_t i = 0; i < conn->n_pending; i++) {  // unwrap into the new ring
+            ring[i] = conn->pending[(conn->head + i) & (conn->cap_pending - 1)];
+        }
+        free(conn->pending);
+        conn->pending = ring;
+        conn->head = 0;
+        conn->cap_pending = cap;
+    }
+    conn->pending[(conn->head + conn->n_pending) & (conn->cap_pending - 1)] = (Pending){cb, arg};
+    conn->n_pending++;
+}
+
+bool mr_send(MrConn *conn, const char **argv, const uint32_t *lens, size_t argc,
+             mr_reply_fn cb, void *arg) {
+    if (conn->failed) {
+        return false;
+    }
+    size_t total = 4;
+    for (size_t i = 0; i < argc; i++) {
+        total += 4 + (lens ? lens[i] : strlen(argv[i]));
+    }
+    if (total > k_max_msg || argc > k_max_args) {
+        snprintf(conn->err, sizeof(conn->err), "request too long");
+        return false;
+    }
+    buf_reserve(&conn->wbuf, 4 + total);
+    buf_append_u32(&conn->wbuf, (uint32_t)total);
+    buf_append_u32(&conn->wbuf, (uint32_t)argc);
+    for (size_t i = 0; i < argc; i++) {
+        uint32_t len = lens ? lens[i] : (uint32_t)strlen(argv[i]);
+        buf_append_u32(&conn->wbuf, len);
+        buf_append(&conn->wbuf, (const uint8_t *)argv[i], len);
+    }
+    push_pending(conn, cb, arg);
+    return true;
+}
+
+int64_t mr_flush(MrConn *conn) {
+    while (buf_read_size(&conn->wbuf) > 0) {
+        ssize_t rv = write(conn->fd, buf_read_ptr(&conn->wbuf), buf_read_size(&conn->wbuf));
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv < 0 && errno == EAGAIN) {
+            break;
+        }
+        if (rv <= 0) {
+            return fail(conn, "write()");
+        }
+        buf_consume(&conn->wbuf, (size_t)rv);
+    }
+    return (int64_t)buf_read_size(&conn->wbuf);
+}
+
+// Run the callbacks of the complete replies in rbuf
+static int64_t dispatch(MrConn *conn) {
+    int64_t n = 0;
+    while (buf_read_size(&conn->rbuf) >= 4) {
+        uint32_t len = 0;
+        memcpy(&len, buf_read_ptr(&conn->rbuf), 4);
+        if (len > k_max_msg) {
+            errno = 0;
+            return fail(conn, "reply too long");
+        }
+        if (buf_read_size(&conn->rbuf) < 4 + (size_t)len) {
+            break;
+        }
+        if (conn->n_pending == 0) {
+            errno = 0;
+            return fail(conn, "reply without a request");
+        }
+        Pending p = conn->pending[conn->head];
+        conn->head = (conn->head + 1) & (conn->cap_pending - 1);
+        conn->n_pending--;
+        // the callback may queue requests: that only touches wbuf, the
+        // reply stays put until it returns
+        const uint8_t *data = buf_read_ptr(&conn->rbuf) + 4;
+        MrReader reply = {data, data + len};
+        p.cb(conn, &reply, p.arg);
+        buf_consume(&conn->rbuf, 4 + (size_t)len);
+        n++;
+    }
+    return n;
+}
+
+int64_t mr_read_replies(MrConn *conn) {
+    int64_t n = 0;
+    for (;;) {
+        buf_reserve(&conn->rbuf, k_read_chunk);
+        size_t space = buf_write_space(&conn->rbuf);
+        ssize_t rv = read(conn->fd, buf_write_ptr(&conn->rbuf), space);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv < 0 && errno == EAGAIN) {
+            return n;
+        }
+        if (rv == 0) {
+            errno = 0;
+            return fail(conn, "server closed the connection");
+        }
+        if (rv < 0) {
+            return fail(conn, "read()");
+        }
+        conn->rbuf.w_pos += (size_t)rv;
+        int64_t got = dispatch(conn);
+        if (got < 0) {
+            return -1;
+        }
+        n += got;
+        if ((size_t)rv < space) {
+            return n;  // drained, skip the read() that would say EAGAIN
+        }
+    }
+}
+
+short mr_events(const MrConn *conn) {
+    short events = 0;
+    if (conn->n_pending > 0) {
+        events |= POLLIN;
+    }
+    if (conn->wbuf.w_pos > conn->wbuf.r_pos) {
+        events |= POLLOUT;
+    }
+    return events;
+}
+
+int mr_handle(MrConn *conn, short revents) {
+    if ((revents & POLLOUT) && mr_flush(conn) < 0) {
+        return -1;
+    }
+    if ((revents & (POLLIN | POLLHUP | POLLERR)) && mr_read_replies(conn) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int mr_wait(MrConn *conn) {
+    if (mr_flush(conn) < 0) {
+        return -1;
+    }
+    while (conn->n_pending > 0) {
+        struct pollfd pfd = {conn->fd, mr_events(conn), 0};
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return fail(conn, "poll()");
+        }
+        if (mr_handle(conn, pfd.revents) < 0) {
+            return -1;
+        }
+        if (mr_flush(conn) < 0) {  // callbacks may have queued more
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// --- Sharding ---
+
+struct MrShards {
+    size_t n_servers;
+    size_t pool_size;
+    MrConn **conns;   // pool_size per server, server by server
+    struct pollfd *pfds;
+    const char *err;  // why the last call failed
+};
+
+// Lamping & Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm"
+static size_t jump_hash(uint64_t key, size_t n_buckets) {
+    int64_t b = -1, j = 0;
+    while (j < (int64_t)n_buckets) {
+        b = j;
+        key = key * 2862933555777941757ull + 1;
+        j = (int64_t)((double)(b + 1) * ((double)(1ll << 31) / (double)((key >> 33) + 1)));
+    }
+    return (size_t)b;
+}
+
+static uint64_t fnv1a64(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)s[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+size_t mr_shards_pick(const MrShards *shards, const char *key, size_t len) {
+    // hash tags, as cluster_key_slot() does on the server
+    const char *open = memchr(key, '{', len);
+    if (open) {
+        const char *close = memchr(open + 1, '}', len - (size_t)(open + 1 - key));
+        if (close && close > open + 1) {
+            key = open + 1;
+            len = (size_t)(close - key);
+        }
+    }
+    return jump_hash(fnv1a64(key, len), shards->n_servers);
+}
+
+MrShards *mr_shards_new(const char **addrs, size_t n_addrs, size_t conns_per_server) {
+    if (n_addrs == 0 || conns_per_server == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    MrShards *shards = calloc(1, sizeof(MrShards));
+    size_t n_conns = n_addrs * conns_per_server;
+    MrConn **conns = calloc(n_conns, sizeof(MrConn *));
+    struct pollfd *pfds = calloc(n_conns, sizeof(struct pollfd));
+    if (!shards || !conns || !pfds) {
+        die("Memory allocation failed");
+    }
+    shards->n_servers = n_addrs;
+    shards->pool_size = conns_per_server;
+    shards->conns = conns;
+    shards->pfds = pfds;
+    for (size_t i = 0; i < n_addrs; i++) {
+        char host[64];
+        const char *colon = strrchr(addrs[i], ':');
+        size_t host_len = colon ? (size_t)(colon - addrs[i]) : 0;
+        char *end = NULL;
+        unsigned long port = colon ? strtoul(colon + 1, &end, 10) : 0;
+        if (!colon || host_len >= sizeof(host) || *end != '\0' || port == 0 || port > 65535) {
+            mr_shards_free(shards);
+            errno = EINVAL;
+            return NULL;
+        }
+        memcpy(host, addrs[i], host_len);
+        host[host_len] = '\0';
+        for (size_t k = 0; k < conns_per_server; k++) {
+            MrConn *conn = mr_connect(host, (uint16_t)port);
+            if (!conn) {
+                int err = errno;
+                mr_shards_free(shards);
+                errno = err;
+                return NULL;
+            }
+            conns[i * conns_per_server + k] = conn;
+        }
+    }
+    return shards;
+}
+
+void mr_shards_free(MrShards *shards) {
+    if (!shards) {
+        return;
+    }
+    for (size_t i = 0; i < shards->n_servers * shards->pool_size; i++) {
+        mr_close(shards->conns[i]);
+    }
+    free(shards->conns);
+    free(shards->pfds);
+    free(shards);
+}
+
+MrConn *mr_shards_conn(MrShards *shards, size_t server) {
+    MrConn **pool = &shards->conns[server * shards->pool_size];
+    MrConn *best = pool[0];
+    for (size_t i = 1; i < shards->pool_size; i++) {
+        if (pool[i]->n_pending < best->n_pending) {
+            best = pool[i];
+        }
+    }
+    return best;
+}
+
+bool mr_shards_send(MrShards *shards, const char **argv, const uint32_t *lens, size_t argc,
+                    mr_reply_fn cb, void *arg) {
+    size_t server = 0;
+    if (argc >= 2) {
+        server = mr_shards_pick(shards, argv[1], lens ? lens[1] : strlen(argv[1]));
+    }
+    MrConn *conn = mr_shards_conn(shards, server);
+    if (!mr_send(conn, argv, lens, argc, cb, arg)) {
+        shards->err = mr_error(conn);
+        return false;
+    }
+    return true;
+}
+
+// One multi-key command split over servers
+typedef struct Fanout {
+    mr_reply_fn cb;
+    void *arg;
+    size_t n_groups;
+    size_t n_parts;
+    size_t n_waiting;  // parts queued and not replied yet
+    bool lost;         // a connection closed before replying
+    bool abandoned;    // queueing failed, cb is not called
+    struct FanoutPart *parts;
+} Fanout;
+
+// The groups one server got, and its reply, kept until all have replied
+typedef struct FanoutPart {
+    Fanout *fan;
+    size_t server;
+    size_t *groups;  // group indices, in the order they were sent
+    size_t n_groups;
+    Buffer reply;
+} FanoutPart;
+
+static void fanout_free(Fanout *fan) {
+    for (size_t i = 0; i < fan->n_parts; i++) {
+        free(fan->parts[i].groups);
+        buffer_destroy(&fan->parts[i].reply);
+    }
+    free(fan->parts);
+    free(fan);
+}
+
+// True if the part replied an array with one element per group
+static bool part_is_array(FanoutPart *part) {
+    MrReader r = {buf_read_ptr(&part->reply), buf_read_ptr(&part->reply) + buf_read_size(&part->reply)};
+    MrValue v;
+    return mr_read(&r, &v) && v.type == MR_ARR && v.len == part->n_groups;
+}
+
+static void fanout_merge(Fanout *fan, Buffer *out) {
+    bool arrays = true;
+    for (size_t i = 0; i < fan->n_parts; i++) {
+        FanoutPart *part = &fan->parts[i];
+        if (buf_read_size(&part->reply) > 0 && buf_read_ptr(&part->reply)[0] == TAG_ERR) {
+            buf_append(out, buf_read_ptr(&part->reply), buf_read_size(&part->reply));
+            return;
+        }
+        arrays = arrays && part_is_array(part);
+    }
+    if (!arrays) {
+        FanoutPart *first = &fan->parts[0];
+        buf_append(out, buf_read_ptr(&first->reply), buf_read_size(&first->reply));
+        return;
+    }
+    // Each group's element: where it starts in its part's reply, its size
+    const uint8_t **at = malloc(fan->n_groups * sizeof(uint8_t *));
+    size_t *len = malloc(fan->n_groups * sizeof(size_t));
+    if (!at || !len) {
+        die("Memory allocation failed");
+    }
+    for (size_t i = 0; i < fan->n_parts; i++) {
+        FanoutPart *part = &fan->parts[i];
+        MrReader r = {buf_read_ptr(&part->reply), buf_read_ptr(&part->reply) + buf_read_size(&part->reply)};
+        r.p += 5;  // the array header, checked by part_is_array()
+        for (size_t k = 0; k < part->n_groups; k++) {
+            const uint8_t *start = r.p;
+            mr_skip(&r);
+            at[part->groups[k]] = start;
+            len[part->groups[k]] = (size_t)(r.p - start);
+        }
+    }
+    buf_append_u8(out, TAG_ARR);
+    buf_append_u32(out, (uint32_t)fan->n_groups);
+    for (size_t g = 0; g < fan->n_groups; g++) {
+        buf_append(out, at[g], len[g]);
+    }
+    free(at);
+    free(len);
+}
+
+static void on_fanout_part(MrConn *conn, MrReader *reply, void *arg) {
+    FanoutPart *part = (FanoutPart *)arg;
+    Fanout *fan = part->fan;
+    if (reply) {
+        buf_append(&part->reply, reply->p, (size_t)(reply->end - reply->p));
+    } else {
+        fan->lost = true;
+    }
+    if (--fan->n_waiting > 0) {
+        return;
+    }
+    if (fan->abandoned) {
+        fanout_free(fan);  // mr_shards_fanout() returned false, nobody waits
+        return;
+    }
+    if (fan->lost) {
+        fan->cb(conn, NULL, fan->arg);
+    } else {
+        Buffer merged;
+        buffer_init(&merged, 256);
+        fanout_merge(fan, &merged);
+        MrReader r = {buf_read_ptr(&merged), buf_read_ptr(&merged) + buf_read_size(&merged)};
+        fan->cb(conn, &r, fan->arg);
+        buffer_destroy(&merged);
+    }
+    fanout_free(fan);
+}
+
+bool mr_shards_fanout(MrShards *shards, const char *cmd, const char **args,
+                      const uint32_t *lens, size_t n_args, size_t step,
+                      mr_reply_fn cb, void *arg) {
+    if (step == 0 || n_args == 0 || n_args % step != 0) {
+        return false;
+    }
+    size_t n_groups = n_args / step;
+    size_t *server_of = malloc(n_groups * sizeof(size_t));
+    size_t *per_server = calloc(shards->n_servers, sizeof(size_t));
+    size_t *part_of = malloc(shards->n_servers * sizeof(size_t));
+    Fanout *fan = calloc(1, sizeof(Fanout));
+    if (!server_of || !per_server || !part_of || !fan) {
+        die("Memory allocation failed");
+    }
+    for (size_t g = 0; g < n_groups; g++) {
+        const char *key = args[g * step];
+        server_of[g] = mr_shards_pick(shards, key, lens ? lens[g * step] : strlen(key));
+        fan->n_parts += per_server[server_of[g]]++ == 0;
+    }
+    fan->cb = cb;
+    fan->arg = arg;
+    fan->n_groups = n_groups;
+    fan->parts = calloc(fan->n_parts, sizeof(FanoutPart));
+    if (!fan->parts) {
+        die("Memory allocation failed");
+    }
+    // A part per server, in order of first appearance
+    size_t n_parts = 0;
+    for (size_t i = 0; i < shards->n_servers; i++) {
+        part_of[i] = SIZE_MAX;
+    }
+    for (size_t g = 0; g < n_groups; g++) {
+        size_t server = server_of[g];
+        if (part_of[server] == SIZE_MAX) {
+            FanoutPart *part = &fan->parts[n_parts];
+            part->fan = fan;
+            part->server = server;
+            part->groups = malloc(per_server[server] * sizeof(size_t));
+            if (!part->groups) {
+                die("Memory allocation failed");
+            }
+            buffer_init(&part->reply, 256);
+            part_of[server] = n_parts++;
+        }
+        FanoutPart *part = &fan->parts[part_of[server]];
+        part->groups[part->n_groups++] = g;
+    }
+    free(server_of);
+    free(per_server);
+    free(part_of);
+
+    // One command per server: cmd, then that server's groups in order
+    const char **argv = malloc((1 + n_args) * sizeof(char *));
+    uint32_t *argl = malloc((1 + n_args) * sizeof(uint32_t));
+    if (!argv || !argl) {
+        die("Memory allocation failed");
+    }
+    bool ok = true;
+    for (size_t i = 0; i < fan->n_parts && ok; i++) {
+        FanoutPart *part = &fan->parts[i];
+        size_t argc = 0;
+        argv[argc] = cmd;
+        argl[argc++] = (uint32_t)strlen(cmd);
+        for (size_t k = 0; k < part->n_groups; k++) {
+            for (size_t j = 0; j < step; j++) {
+                size_t a = part->groups[k] * step + j;
+                argv[argc] = args[a];
+                argl[argc++] = lens ? lens[a] : (uint32_t)strlen(args[a]);
+            }
+        }
+        MrConn *conn = mr_shards_conn(shards, part->server);
+        ok = mr_send(conn, argv, argl, argc, on_fanout_part, part);
+        if (ok) {
+            fan->n_waiting++;
+        } else {
+            shards->err = mr_error(conn);
+        }
+    }
+    free(argv);
+    free(argl);
+    if (!ok) {
+        // the parts already queued still reply, but nobody is told
+        fan->abandoned = true;
+        if (fan->n_waiting == 0) {
+            fanout_free(fan);
+        }
+    }
+    return ok;
+}
+
+int mr_shards_wait(MrShards *shards) {
+    size_t n_conns = shards->n_servers * shards->pool_size;
+    for (;;) {
+        size_t n_pending = 0;
+        for (size_t i = 0; i < n_conns; i++) {
+            MrConn *conn = shards->conns[i];
+            if (mr_flush(conn) < 0) {
+                shards->err = mr_error(conn);
+                return -1;
+            }
+            n_pending += conn->n_pending;
+            shards->pfds[i] = (struct pollfd){conn->fd, mr_events(conn), 0};
+        }
+        if (n_pending == 0) {
+            return 0;
+        }
+        if (poll(shards->pfds, n_conns, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            shards->err = "poll() failed";
+            return -1;
+        }
+        for (size_t i = 0; i < n_conns; i++) {
+            if (mr_handle(shards->conns[i], shards->pfds[i].revents) < 0) {
+                shards->err = mr_error(shards->conns[i]);
+                return -1;
+            }
+        }
+    }
+}
+
+const char *mr_shards_error(const MrShards *shards) {
+    return shards->err ? shards->err : "";
+}
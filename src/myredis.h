@@ -0,0 +1,138 @@
+#ifndef MYREDIS_H
+#define MYREDIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// libmyredis: the client side of the binary protocol, shared by the CLI
+// and the load generator.
+//
+// A connection queues requests and calls back when their replies arrive,
+// in order. Nothing is written until mr_flush(), so everything queued in
+// between goes out in one write(). The socket is non-blocking: drive it
+// from your own poll() loop with mr_events() and mr_handle(), or block
+// with mr_wait().
+//
+//   MrConn *c = mr_connect("127.0.0.1", 6379);
+//   const char *argv[] = {"get", "k"};
+//   mr_send(c, argv, NULL, 2, on_reply, NULL);
+//   mr_wait(c);
+//   mr_close(c);
+//
+// Replies are not copied or decoded up front: a callback gets a view of
+// the reply in the receive buffer, and mr_read() walks it value by value.
+// The view and every string read from it are only valid during the
+// callback.
+
+typedef enum {
+    MR_NIL = 0,
+    MR_ERR,
+    MR_STR,
+    MR_INT,
+    MR_DBL,
+    MR_ARR,
+} MrType;
+
+// One value of a reply
+typedef struct MrValue {
+    MrType type;
+    const char *str;  // MR_STR, MR_ERR: not NUL-terminated
+    uint32_t len;     // MR_STR, MR_ERR: bytes. MR_ARR: elements, read next
+    int64_t i;        // MR_INT, MR_ERR: the error code
+    double d;         // MR_DBL
+} MrValue;
+
+// Position in a reply. Values come out depth-first: an array is followed
+// by its elements.
+typedef struct MrReader {
+    const uint8_t *p;
+    const uint8_t *end;
+} MrReader;
+
+// Next value, false if the reply is truncated or malformed
+bool mr_read(MrReader *r, MrValue *v);
+// Skip the next value, with the elements of an array
+bool mr_skip(MrReader *r);
+
+typedef struct MrConn MrConn;
+
+// reply is NULL when the connection is closed before the reply came
+typedef void (*mr_reply_fn)(MrConn *conn, MrReader *reply, void *arg);
+
+// Connect over TCP (blocking), then switch the socket to non-blocking.
+// NULL on failure, with errno set.
+MrConn *mr_connect(const char *host, uint16_t port);
+// Same over an AF_UNIX socket, for a server on this host (--unixsocket)
+MrConn *mr_connect_unix(const char *path);
+// Callbacks still pending are called with a NULL reply
+void mr_close(MrConn *conn);
+
+int mr_fd(const MrConn *conn);
+size_t mr_pending(const MrConn *conn);      // requests without a reply yet
+const char *mr_error(const MrConn *conn);   // why the last call failed
+
+// Queue one request. lens may be NULL for NUL-terminated arguments.
+// Returns false if the request is too big or the connection has failed.
+bool mr_send(MrConn *conn, const char **argv, const uint32_t *lens, size_t argc,
+             mr_reply_fn cb, void *arg);
+
+// Write queued requests, as far as the socket takes them.
+// -1 on error, else the number of bytes still queued.
+int64_t mr_flush(MrConn *conn);
+// Read what has arrived and run the callbacks of complete replies.
+// -1 on error or EOF, else the number of replies handled.
+int64_t mr_read_replies(MrConn *conn);
+
+// poll() events the connection is waiting for
+short mr_events(const MrConn *conn);
+// React to poll() results: mr_flush() and/or mr_read_replies(). -1 on error.
+int mr_handle(MrConn *conn, short revents);
+// Block until every pending request has its reply. -1 on error.
+int mr_wait(MrConn *conn);
+
+// --- Sharding ---
+//
+// Spreads keys over several servers that know nothing of each other.
+// A key goes to jump_hash(fnv1a(key), n_servers): no ring to build, an
+// even spread, and appending a server moves only 1/n of the keys. Servers
+// are identified by their position, so only append to the list: removing
+// or reordering entries remaps most keys. As in cluster mode, only the
+// part of a key between '{' and '}' is hashed when it is not empty, so
+// related keys can be kept together.
+//
+// Each server has a pool of connections. A request goes to the one with
+// the fewest replies outstanding.
+
+typedef struct MrShards MrShards;
+
+// addrs are "host:port". NULL on failure, with errno set.
+MrShards *mr_shards_new(const char **addrs, size_t n_addrs, size_t conns_per_server);
+// Callbacks still pending are called with a NULL reply
+void mr_shards_free(MrShards *shards);
+
+size_t mr_shards_pick(const MrShards *shards, const char *key, size_t len);  // server index
+MrConn *mr_shards_conn(MrShards *shards, size_t server);  // least loaded in its pool
+
+// Queue a single-key command, routed by argv[1] (by server 0 if there is
+// no argv[1]). lens may be NULL.
+bool mr_shards_send(MrShards *shards, const char **argv, const uint32_t *lens, size_t argc,
+                    mr_reply_fn cb, void *arg);
+
+// Queue a multi-key command: args are groups of `step` strings, each
+// starting with a key (MGET: step 1, MSET: step 2). The groups are split
+// by server and sent as one command per server, all in parallel. cb gets
+// one merged reply: if every server replied an array with an element per
+// group, the elements are put back in the order of the groups; otherwise
+// the first error, or else the first reply. False if the command could
+// not be queued, and cb is then not called.
+bool mr_shards_fanout(MrShards *shards, const char *cmd, const char **args,
+                      const uint32_t *lens, size_t n_args, size_t step,
+                      mr_reply_fn cb, void *arg);
+
+// Block until every pending request on every server has its reply.
+// -1 on error, with the failing connection's message in mr_shards_error().
+int mr_shards_wait(MrShards *shards);
+const char *mr_shards_error(const MrShards *shards);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// Wire constants shared by the server, the client and server-to-server
+// traffic (e.g. cluster key migration).
+
+// Largest request or response body (the u32 after the length header)
+#define k_max_msg (32 << 20)
+// Most strings in one request (command name included)
+#define k_max_args (1 << 20)
+
+// --- Error codes carried by TAG_ERR ---
+enum {
+    ERR_UNKNOWN = 1,
+    ERR_TOO_BIG = 2,
+    ERR_MOVED = 3,   // key belongs to another node: "MOVED <slot> <host>:<port>"
+    ERR_ASK = 4,     // slot is being migrated: "ASK <slot> <host>:<port>"
+    ERR_CLUSTER = 5, // slot unassigned or cross-node request
+    ERR_OOM = 6,     // write refused, maxmemory reached
+    ERR_TYPE = 7     // key holds a value of another type
+};
+
+// --- Serialization Tags ---
+enum {
+    TAG_NIL = 0,
+    TAG_ERR = 1,
+    TAG_STR = 2,
+    TAG_INT = 3,
+    TAG_DBL = 4,
+    TAG_ARR = 5,
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "pubsub.h"
+#include "kv.h"
+#include "common.h"
+
+#define container_of(ptr, T, member) \
+    ((T *)( (char *)ptr - offsetof(T, member) ))
+
+static HMap g_channels;
+static HMap g_patterns;
+
+// --- Shared messages ---
+
+SharedMsg *msg_new(const uint8_t *data, size_t len) {
+    SharedMsg *msg = malloc(sizeof(SharedMsg) + len);
+    if (!msg) {
+        die("Memory allocation failed");
+    }
+    msg->refcnt = 1;
+    msg->len = (uint32_t)len;
+    memcpy(msg->data, data, len);
+    return msg;
+}
+
+void msg_ref(SharedMsg *msg) {
+    msg->refcnt++;
+}
+
+void msg_unref(SharedMsg *msg) {
+    if (--msg->refcnt == 0) {
+        free(msg);
+    }
+}
+
+// --- Topics ---
+
+static bool topic_eq(HNode *lhs, HNode *rhs) {
+    Topic *l = container_of(lhs, Topic, node);
+    Topic *r = container_of(rhs, Topic, node);
+    return strcmp(l->name, r->name) == 0;
+}
+
+static Topic *topic_lookup(HMap *map, const char *name) {
+    Topic probe;
+    probe.name = (char *)name;
+    probe.node.hcode = kv_hash(name, strlen(name));
+    HNode *node = hm_lookup(map, &probe.node, topic_eq);
+    return node ? container_of(node, Topic, node) : NULL;
+}
+
+// Grow an array of pointers to hold one more
+static void *grow(void *arr, size_t n, size_t *cap) {
+    if (n < *cap) {
+        return arr;
+    }
+    *cap = *cap ? *cap * 2 : 4;
+    arr = realloc(arr, *cap * sizeof(void *));
+    if (!arr) {
+        die("Memory allocation failed");
+    }
+    return arr;
+}
+
+bool ps_subscribe(PubSubClient *client, const char *name, bool pattern) {
+    HMap *map = pattern ? &g_patterns : &g_channels;
+    Topic *topic = topic_lookup(map, name);
+    if (!topic) {
+        topic = calloc(1, sizeof(Topic));
+        if (!topic) {
+            die("Memory allocation failed");
+        }
+        topic->name = strdup(name);
+        topic->pattern = pattern;
+        topic->node.hcode = kv_hash(name, strlen(name));
+        hm_insert(map, &topic->node);
+    } else {
+        for (size_t i = 0; i < client->n_subs; i++) {
+            if (client->subs[i]->topic == topic) {
+                return false;  // already subscribed
+            }
+        }
+    }
+
+    Subscription *sub = malloc(sizeof(Subscription));
+    if (!sub) {
+        die("Memory allocation failed");
+    }
+    sub->topic = topic;
+    sub->client = client;
+    sub->idx = topic->n_subs;
+    topic->subs = grow(topic->subs, topic->n_subs, &topic->cap_subs);
+    topic->subs[topic->n_subs++] = sub;
+    client->subs = grow(client->subs, client->n_subs, &client->cap_subs);
+    client->subs[client->n_subs++] = sub;
+    return true;
+}
+
+// Detach the subscription at client->subs[i] from its topic and free it
+static void sub_remove(PubSubClient *client, size_t i) {
+    Subscription *sub = client->subs[i];
+    Topic *topic = sub->topic;
+
+    // swap-remove from the topic, fixing the moved subscription's index
+    Subscription *last = topic->subs[--topic->n_subs];
+    topic->subs[sub->idx] = last;
+    last->idx = sub->idx;
+    if (topic->n_subs == 0) {
+        hm_delete(topic->pattern ? &g_patterns : &g_channels, &topic->node, topic_eq);
+        free(topic->subs);
+        free(topic->name);
+        free(topic);
+    }
+
+    // keep the client's order: UNSUBSCRIBE without arguments lists them
+    memmove(&client->subs[i], &client->subs[i + 1], (client->n_subs - i - 1) * sizeof(Subscription *));
+    client->n_subs--;
+    free(sub);
+}
+
+bool ps_unsubscribe(PubSubClient *client, const char *name, bool pattern) {
+    for (size_t i = 0; i < client->n_subs; i++) {
+        Topic *topic = client->subs[i]->topic;
+        if (topic->pattern == pattern && strcmp(topic->name, name) == 0) {
+            sub_remove(client, i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ps_unsubscribe_all(PubSubClient *client) {
+    while (client->n_subs) {
+        sub_remove(client, client->n_subs - 1);
+    }
+    free(client->subs);
+    client->subs = NULL;
+    client->cap_subs = 0;
+}
+
+struct match_arg {
+    const char *channel;
+    void (*deliver)(Topic *topic, void *arg);
+    void *arg;
+    size_t receivers;
+};
+
+static bool cb_match_pattern(HNode *node, void *arg) {
+    struct match_arg *m = (struct match_arg *)arg;
+    Topic *topic = container_of(node, Topic, node);
+    if (fnmatch(topic->name, m->channel, 0) == 0) {
+        m->receivers += topic->n_subs;
+        m->deliver(topic, m->arg);
+    }
+    return true;
+}
+
+size_t ps_publish(const char *channel,
+                  void (*deliver)(Topic *topic, void *arg), void *arg) {
+    struct match_arg m = {channel, deliver, arg, 0};
+    Topic *topic = topic_lookup(&g_channels, channel);
+    if (topic) {
+        m.receivers += topic->n_subs;
+        deliver(topic, arg);
+    }
+    if (hm_size(&g_patterns)) {
+        hm_foreach(&g_patterns, cb_match_pattern, &m);
+    }
+    return m.receivers;
+}
+
+size_t ps_channels(void) {
+    return hm_size(&g_channels);
+}
+
+size_t ps_patterns(void) {
+    return hm_size(&g_patterns);
+}
@@ -0,0 +1,60 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hashtable.h"
+
+// A serialized message shared by every connection it is queued on.
+// Publishing encodes the frame once; each subscriber takes a reference
+// instead of copying the bytes into its own write buffer.
+typedef struct SharedMsg {
+    uint32_t refcnt;
+    uint32_t len;
+    uint8_t data[];
+} SharedMsg;
+
+SharedMsg *msg_new(const uint8_t *data, size_t len);  // refcnt starts at 1
+void msg_ref(SharedMsg *msg);
+void msg_unref(SharedMsg *msg);  // frees on the last reference
+
+// A channel or a glob pattern with its subscribers
+typedef struct Topic {
+    HNode node;
+    char *name;
+    bool pattern;
+    struct Subscription **subs;
+    size_t n_subs;
+    size_t cap_subs;
+} Topic;
+
+// One client subscribed to one topic. Both sides point at it, and it
+// knows its slot in the topic's array, so unsubscribing is O(1).
+typedef struct Subscription {
+    Topic *topic;
+    struct PubSubClient *client;
+    size_t idx;  // position in topic->subs
+} Subscription;
+
+// Per-connection state, embedded in the server's Conn
+typedef struct PubSubClient {
+    Subscription **subs;
+    size_t n_subs;  // channels + patterns
+    size_t cap_subs;
+} PubSubClient;
+
+// Both return false when nothing changed
+bool ps_subscribe(PubSubClient *client, const char *name, bool pattern);
+bool ps_unsubscribe(PubSubClient *client, const char *name, bool pattern);
+void ps_unsubscribe_all(PubSubClient *client);
+
+// Calls deliver() once per topic matching the channel: the channel itself,
+// then every matching pattern. Returns the number of receivers.
+size_t ps_publish(const char *channel,
+                  void (*deliver)(Topic *topic, void *arg), void *arg);
+
+size_t ps_channels(void);
+size_t ps_patterns(void);
+
+#endif
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include "quicklist.h"
+#include "listpack.h"
+#include "common.h"
+
+QuickList *ql_new(void) {
+    QuickList *ql = calloc(1, sizeof(QuickList));
+    if (!ql) {
+        die("Memory allocation failed");
+    }
+    return ql;
+}
+
+void ql_free(QuickList *ql) {
+    QuickNode *node = ql->head;
+    while (node) {
+        QuickNode *next = node->next;
+        lp_free(node->lp);
+        free(node);
+        node = next;
+    }
+    free(ql);
+}
+
+size_t ql_len(const QuickList *ql) {
+    return ql->count;
+}
+
+size_t ql_mem(const QuickList *ql) {
+    return sizeof(QuickList) + ql->nodes * sizeof(QuickNode) + ql->bytes;
+}
+
+// Allocate an empty chunk and link it at one end
+static QuickNode *node_link(QuickList *ql, bool head) {
+    QuickNode *node = malloc(sizeof(QuickNode));
+    if (!node) {
+        die("Memory allocation failed");
+    }
+    node->lp = lp_new();
+    if (head) {
+        node->prev = NULL;
+        node->next = ql->head;
+        if (ql->head) {
+            ql->head->prev = node;
+        } else {
+            ql->tail = node;
+        }
+        ql->head = node;
+    } else {
+        node->next = NULL;
+        node->prev = ql->tail;
+        if (ql->tail) {
+            ql->tail->next = node;
+        } else {
+            ql->head = node;
+        }
+        ql->tail = node;
+    }
+    ql->nodes++;
+    ql->bytes += lp_bytes(node->lp);
+    return node;
+}
+
+static void node_unlink(QuickList *ql, QuickNode *node) {
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        ql->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        ql->tail = node->prev;
+    }
+    ql->nodes--;
+    ql->bytes -= lp_bytes(node->lp);
+    lp_free(node->lp);
+    free(node);
+}
+
+void ql_push(QuickList *ql, bool head, const char *s, uint32_t len) {
+    QuickNode *node = head ? ql->head : ql->tail;
+    // 10 bytes covers the largest len + backlen headers
+    if (!node || lp_bytes(node->lp) + len + 10 > k_quicklist_chunk_bytes) {
+        node = node_link(ql, head);
+    }
+    ql->bytes -= lp_bytes(node->lp);
+    node->lp = head ? lp_prepend(node->lp, s, len) : lp_append(node->lp, s, len);
+    ql->bytes += lp_bytes(node->lp);
+    ql->count++;
+}
+
+const char *ql_peek(QuickList *ql, bool head, uint32_t *len) {
+    QuickNode *node = head ? ql->head : ql->tail;
+    if (!node) {
+        return NULL;
+    }
+    return lp_get(head ? lp_first(node->lp) : lp_last(node->lp), len);
+}
+
+void ql_pop(QuickList *ql, bool head) {
+    QuickNode *node = head ? ql->head : ql->tail;
+    if (!node) {
+        return;
+    }
+    if (lp_count(node->lp) == 1) {
+        node_unlink(ql, node);
+    } else {
+        uint8_t *p = head ? lp_first(node->lp) : lp_last(node->lp);
+        ql->bytes -= lp_bytes(node->lp);
+        node->lp = lp_delete(node->lp, &p);
+        ql->bytes += lp_bytes(node->lp);
+    }
+    ql->count--;
+}
+
+// Find the chunk holding element `index` (0 <= index < count),
+// walking from the nearer end. *offset is the index inside the chunk.
+static QuickNode *node_at(QuickList *ql, size_t index, size_t *offset) {
+    if (index < ql->count / 2) {
+        QuickNode *node = ql->head;
+        while (index >= lp_count(node->lp)) {
+            index -= lp_count(node->lp);
+            node = node->next;
+        }
+        *offset = index;
+        return node;
+    }
+    size_t from_tail = ql->count - 1 - index;
+    QuickNode *node = ql->tail;
+    while (from_tail >= lp_count(node->lp)) {
+        from_tail -= lp_count(node->lp);
+        node = node->prev;
+    }
+    *offset = lp_count(node->lp) - 1 - from_tail;
+    return node;
+}
+
+const char *ql_index(QuickList *ql, int64_t index, uint32_t *len) {
+    if (index < 0) {
+        index += (int64_t)ql->count;
+    }
+    if (index < 0 || index >= (int64_t)ql->count) {
+        return NULL;
+    }
+    size_t offset = 0;
+    QuickNode *node = node_at(ql, (size_t)index, &offset);
+    return lp_get(lp_seek(node->lp, (int64_t)offset), len);
+}
+
+void ql_range(QuickList *ql, size_t start, size_t stop,
+              bool (*cb)(const char *s, uint32_t len, void *arg), void *arg) {
+    if (start > stop || stop >= ql->count) {
+        return;
+    }
+    size_t offset = 0;
+    QuickNode *node = node_at(ql, start, &offset);
+    uint8_t *p = lp_seek(node->lp, (int64_t)offset);
+    for (size_t i = start; i <= stop; i++) {
+        if (!p) {
+            node = node->next;
+            p = lp_first(node->lp);
+        }
+        uint32_t len = 0;
+        const char *s = lp_get(p, &len);
+        if (!cb(s, len, arg)) {
+            return;
+        }
+        p = lp_next(node->lp, p);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef QUICKLIST_H
+#define QUICKLIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// List value type: a doubly-linked list of listpack chunks.
+// Elements are packed back to back inside each chunk, so a long list costs
+// two pointers per chunk instead of three per element, and range reads walk
+// contiguous memory. A chunk is split off once it would exceed
+// k_quicklist_chunk_bytes; a bigger element gets a chunk of its own.
+#define k_quicklist_chunk_bytes 4096
+
+typedef struct QuickNode {
+    struct QuickNode *prev;
+    struct QuickNode *next;
+    uint8_t *lp;
+} QuickNode;
+
+typedef struct QuickList {
+    QuickNode *head;
+    QuickNode *tail;
+    size_t count;   // elements
+    size_t nodes;   // chunks
+    size_t bytes;   // sum of the listpack sizes
+} QuickList;
+
+QuickList *ql_new(void);
+void ql_free(QuickList *ql);
+size_t ql_len(const QuickList *ql);
+size_t ql_mem(const QuickList *ql);  // estimated bytes, for maxmemory
+
+void ql_push(QuickList *ql, bool head, const char *s, uint32_t len);
+// Peek at an end without copying, NULL if empty. Valid until the next write.
+const char *ql_peek(QuickList *ql, bool head, uint32_t *len);
+void ql_pop(QuickList *ql, bool head);  // no-op if empty
+// Element by index, negative counts from the tail. NULL if out of range.
+const char *ql_index(QuickList *ql, int64_t index, uint32_t *len);
+// Visit elements start..stop (inclusive, already clamped to the list)
+void ql_range(QuickList *ql, size_t start, size_t stop,
+              bool (*cb)(const char *s, uint32_t len, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <string.h>
+#include "resp.h"
+#include "protocol.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// An inline command must fit in one line of this size
+#define k_inline_max (64 << 10)
+// Digits of a length line, sign included
+#define k_max_digits 20
+
+Proto resp_detect(const uint8_t *data, size_t len, uint32_t max_msg) {
+    if (len < 4) {
+        return PROTO_UNKNOWN;
+    }
+    uint8_t c = data[0];
+    bool resp_start = c == '*' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    uint32_t frame_len = 0;
+    memcpy(&frame_len, data, 4);
+    return resp_start && frame_len > max_msg ? PROTO_RESP2 : PROTO_BINARY;
+}
+
+// --- Requests ---
+
+// First '\r' in s[0, n). Length lines are a few bytes, so one 16-byte
+// compare usually finds it, without the setup of a memchr() call.
+static const uint8_t *find_cr(const uint8_t *s, size_t n) {
+#ifdef __SSE2__
+    const __m128i cr = _mm_set1_epi8('\r');
+    while (n >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)s);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, cr));
+        if (mask) {
+            return s + __builtin_ctz(mask);
+        }
+        s += 16;
+        n -= 16;
+    }
+#endif
+    return memchr(s, '\r', n);
+}
+
+// "<int>\r\n" at p. RESP_INCOMPLETE if the line has not fully arrived.
+static RespStatus parse_int_line(const uint8_t **p, const uint8_t *end, int64_t *out,
+                                 const char **err) {
+    const uint8_t *s = *p;
+    size_t avail = (size_t)(end - s);
+    const uint8_t *cr = find_cr(s, avail < k_max_digits + 1 ? avail : k_max_digits + 1);
+    if (!cr) {
+        if (avail > k_max_digits) {
+            *err = "invalid length";
+            return RESP_ERROR;
+        }
+        return RESP_INCOMPLETE;
+    }
+    if (cr + 1 >= end) {
+        return RESP_INCOMPLETE;
+    }
+    if (cr[1] != '\n') {
+        *err = "expected '\\r\\n'";
+        return RESP_ERROR;
+    }
+    bool neg = s < cr && *s == '-';
+    const uint8_t *d = neg ? s + 1 : s;
+    if (d == cr) {
+        *err = "invalid length";
+        return RESP_ERROR;
+    }
+    int64_t v = 0;
+    for (; d < cr; d++) {
+        if (*d < '0' || *d > '9') {
+            *err = "invalid length";
+            return RESP_ERROR;
+        }
+        v = v * 10 + (*d - '0');  // at most 19 digits, cannot overflow
+    }
+    *out = neg ? -v : v;
+    *p = cr + 2;
+    return RESP_OK;
+}
+
+// *<n>\r\n then n times $<len>\r\n<bytes>\r\n
+static RespStatus parse_multibulk(const uint8_t *data, size_t len, char **args, size_t *lens,
+                                  size_t cap, size_t *n_args, size_t *used, const char **err) {
+    const uint8_t *p = data + 1;
+    const uint8_t *end = data + len;
+    int64_t n = 0;
+    RespStatus rs = parse_int_line(&p, end, &n, err);
+    if (rs != RESP_OK) {
+        *used = len + 1;
+        return rs;
+    }
+    if (n > k_max_args) {
+        *err = "too many arguments";
+        return RESP_ERROR;
+    }
+    if (n <= 0) {  // "*0" and "*-1" are empty requests
+        *n_args = 0;
+        *used = (size_t)(p - data);
+        return RESP_OK;
+    }
+    *n_args = (size_t)n;
+    if ((size_t)n > cap) {
+        return RESP_OK;  // the caller retries with a bigger array
+    }
+
+    for (int64_t i = 0; i < n; i++) {
+        if (p >= end) {
+            *used = (size_t)(p - data) + 4 * (size_t)(n - i);
+            return RESP_INCOMPLETE;
+        }
+        if (*p != '$') {
+            *err = "expected '$'";
+            return RESP_ERROR;
+        }
+        p++;
+        int64_t blen = 0;
+        rs = parse_int_line(&p, end, &blen, err);
+        if (rs == RESP_INCOMPLETE) {
+            *used = (size_t)(p - data) + 2;
+            return rs;
+        }
+        if (rs != RESP_OK) {
+            return rs;
+        }
+        if (blen < 0 || blen > k_max_msg) {
+            *err = "invalid bulk length";
+            return RESP_ERROR;
+        }
+        if ((size_t)(end - p) < (size_t)blen + 2) {
+            *used = (size_t)(p - data) + (size_t)blen + 2;
+            return RESP_INCOMPLETE;
+        }
+        if (p[blen] != '\r' || p[blen + 1] != '\n') {
+            *err = "expected '\\r\\n' after the bulk string";
+            return RESP_ERROR;
+        }
+        args[i] = (char *)p;
+        lens[i] = (size_t)blen;
+        p += blen + 2;
+    }
+    *used = (size_t)(p - data);
+    return RESP_OK;
+}
+
+static bool is_space(uint8_t c) {
+    return c == ' ' || c == '\t';
+}
+
+// Space separated words up to "\n" (or "\r\n"), as typed into telnet
+static RespStatus parse_inline(const uint8_t *data, size_t len, char **args, size_t *lens,
+                               size_t cap, size_t *n_args, size_t *used, const char **err) {
+    size_t scan = len < k_inline_max ? len : k_inline_max;
+    const uint8_t *nl = memchr(data, '\n', scan);
+    if (!nl) {
+        if (len >= k_inline_max) {
+            *err = "too big inline request";
+            return RESP_ERROR;
+        }
+        *used = len + 1;
+        return RESP_INCOMPLETE;
+    }
+    const uint8_t *end = nl > data && nl[-1] == '\r' ? nl - 1 : nl;
+    size_t n = 0;
+    for (const uint8_t *p = data; p < end; ) {
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        const uint8_t *word = p;
+        while (p < end && !is_space(*p)) {
+            p++;
+        }
+        if (n < cap) {
+            args[n] = (char *)word;
+            lens[n] = (size_t)(p - word);
+        }
+        n++;
+    }
+    *n_args = n;
+    *used = (size_t)(nl - data) + 1;
+    return RESP_OK;
+}
+
+RespStatus resp_parse(const uint8_t *data, size_t len, char **args, size_t *lens, size_t cap,
+                      size_t *n_args, size_t *used, const char **err) {
+    *n_args = 0;
+    *used = 0;
+    if (len == 0) {
+        *used = 1;
+        return RESP_INCOMPLETE;
+    }
+    if (data[0] == '*') {
+        return parse_multibulk(data, len, args, lens, cap, n_args, used, err);
+    }
+    return parse_inline(data, len, args, lens, cap, n_args, used, err);
+}
+
+// --- Replies ---
+
+static void put_line(Buffer *out, char type, long long n) {
+    char line[32];
+    int len = snprintf(line, sizeof(line), "%c%lld\r\n", type, n);
+    buf_append(out, (const uint8_t *)line, (size_t)len);
+}
+
+static void put_bulk(Buffer *out, const uint8_t *s, size_t len) {
+    put_line(out, '$', (long long)len);
+    buf_append(out, s, len);
+    buf_append(out, (const uint8_t *)"\r\n", 2);
+}
+
+// The text of a simple string or an error, which has no line breaks
+static void put_simple_text(Buffer *out, const uint8_t *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf_append_u8(out, s[i] == '\r' || s[i] == '\n' ? ' ' : s[i]);
+    }
+    buf_append(out, (const uint8_t *)"\r\n", 2);
+}
+
+// Codes whose messages already start with their own error name
+static const char *k_err_names[] = {"NOSCRIPT ", "EXECABORT ", "NOPROTO ", "BUSYKEY "};
+
+static void put_error(Buffer *out, uint32_t code, const uint8_t *msg, size_t len) {
+    buf_append_u8(out, '-');
+    bool named = code != ERR_UNKNOWN && code != ERR_TOO_BIG;
+    for (size_t i = 0; i < sizeof(k_err_names) / sizeof(k_err_names[0]) && !named; i++) {
+        size_t n = strlen(k_err_names[i]);
+        named = len >= n && memcmp(msg, k_err_names[i], n) == 0;
+    }
+    if (!named) {
+        buf_append(out, (const uint8_t *)"ERR ", 4);
+    }
+    put_simple_text(out, msg, len);
+}
+
+typedef struct Reader {
+    const uint8_t *p;
+    const uint8_t *end;
+} Reader;
+
+static bool read_bytes(Reader *r, void *dst, size_t n) {
+    if ((size_t)(r->end - r->p) < n) {
+        return false;
+    }
+    memcpy(dst, r->p, n);
+    r->p += n;
+    return true;
+}
+
+// One value. push: a top-level array of Pub/Sub data in RESP3.
+static bool encode_value(Reader *r, Proto proto, bool push, Buffer *out) {
+    uint8_t tag = 0;
+    uint32_t n = 0;
+    if (!read_bytes(r, &tag, 1)) {
+        return false;
+    }
+    switch (tag) {
+    case TAG_NIL:
+        if (proto == PROTO_RESP3) {
+            buf_append(out, (const uint8_t *)"_\r\n", 3);
+        } else {
+            buf_append(out, (const uint8_t *)"$-1\r\n", 5);
+        }
+        return true;
+    case TAG_ERR: {
+        uint32_t code = 0;
+        if (!read_bytes(r, &code, 4) || !read_bytes(r, &n, 4) || (size_t)(r->end - r->p) < n) {
+            return false;
+        }
+        put_error(out, code, r->p, n);
+        r->p += n;
+        return true;
+    }
+    case TAG_STR:
+        if (!read_bytes(r, &n, 4) || (size_t)(r->end - r->p) < n) {
+            return false;
+        }
+        put_bulk(out, r->p, n);
+        r->p += n;
+        return true;
+    case TAG_INT: {
+        int64_t v = 0;
+        if (!read_bytes(r, &v, 8)) {
+            return false;
+        }
+        put_line(out, ':', (long long)v);
+        return true;
+    }
+    case TAG_DBL: {
+        double d = 0;
+        if (!read_bytes(r, &d, 8)) {
+            return false;
+        }
+        char text[32];
+        int len = snprintf(text, sizeof(text), "%.17g", d);
+        if (proto == PROTO_RESP3) {
+            buf_append_u8(out, ',');
+            buf_append(out, (const uint8_t *)text, (size_t)len);
+            buf_append(out, (const uint8_t *)"\r\n", 2);
+        } else {
+            put_bulk(out, (const uint8_t *)text, (size_t)len);  // RESP2 has no doubles
+        }
+        return true;
+    }
+    case TAG_ARR:
+        if (!read_bytes(r, &n, 4)) {
+            return false;
+        }
+        put_line(out, push && proto == PROTO_RESP3 ? '>' : '*', n);
+        for (uint32_t i = 0; i < n; i++) {
+            if (!encode_value(r, proto, false, out)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// One reply at r->p, transcoded as flags say
+static bool encode_reply(Reader *r, Proto proto, uint32_t flags, Buffer *out) {
+    size_t avail = (size_t)(r->end - r->p);
+    uint8_t tag = avail ? r->p[0] : 0xff;
+    uint32_t n = 0;
+    if ((flags & RESP_NIL_OK) && tag == TAG_NIL) {
+        buf_append(out, (const uint8_t *)"+OK\r\n", 5);
+        r->p++;
+        return true;
+    }
+    if ((flags & RESP_EXISTS) && tag == TAG_INT && avail >= 9) {
+        int64_t status = 0;
+        memcpy(&status, r->p + 1, 8);
+        buf_append(out, (const uint8_t *)(status == 0 ? ":1\r\n" : ":0\r\n"), 4);
+        r->p += 9;
+        return true;
+    }
+    if ((flags & RESP_STATUS) && tag == TAG_STR && avail >= 5) {
+        memcpy(&n, r->p + 1, 4);
+        if (avail - 5 < n) {
+            return false;
+        }
+        buf_append_u8(out, '+');
+        put_simple_text(out, r->p + 5, n);
+        r->p += 5 + (size_t)n;
+        return true;
+    }
+    if ((flags & RESP_MAP) && proto == PROTO_RESP3 && tag == TAG_ARR && avail >= 5) {
+        memcpy(&n, r->p + 1, 4);
+        put_line(out, '%', n / 2);
+        r->p += 5;
+        for (uint32_t i = 0; i < n; i++) {
+            if (!encode_value(r, proto, false, out)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    bool push = flags & RESP_PUSH;
+    if ((flags & RESP_SPLIT) && tag == TAG_ARR) {
+        r->p++;
+        if (!read_bytes(r, &n, 4)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (!encode_value(r, proto, push, out)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return encode_value(r, proto, push, out);
+}
+
+void resp_encode(const uint8_t *data, size_t len, Proto proto, uint32_t flags, Buffer *out) {
+    Reader r = {data, data + len};
+    encode_reply(&r, proto, flags, out);
+}
+
+void resp_encode_each(const uint8_t *data, size_t len, Proto proto, const uint32_t *elem_flags,
+                      size_t n_elems, Buffer *out) {
+    Reader r = {data, data + len};
+    uint32_t n = 0;
+    if (len < 5 || data[0] != TAG_ARR) {
+        encode_reply(&r, proto, 0, out);
+        return;
+    }
+    memcpy(&n, data + 1, 4);
+    r.p += 5;
+    put_line(out, '*', n);
+    for (uint32_t i = 0; i < n; i++) {
+        if (!encode_reply(&r, proto, i < n_elems ? elem_flags[i] : 0, out)) {
+            return;
+        }
+    }
+}
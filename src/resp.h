@@ -0,0 +1,63 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "buffer.h"
+
+// RESP (the Redis protocol), spoken next to our own binary protocol so
+// redis-cli, redis-benchmark and stock client libraries can connect.
+//
+// Requests are framed in place: each argument is a pointer into the read
+// buffer plus a length, nothing is copied. Replies are built by the
+// command handlers in the tagged binary format and transcoded here.
+
+typedef enum {
+    PROTO_UNKNOWN = 0,  // nothing read yet
+    PROTO_BINARY,
+    PROTO_RESP2,
+    PROTO_RESP3,
+} Proto;
+
+// Pick the protocol from the first bytes of a connection, PROTO_UNKNOWN
+// until enough bytes are there. RESP starts with '*' (multibulk) or a
+// letter (inline command). A binary frame can start with those bytes too,
+// but its u32 length is then far above max_msg: the 4th byte of any RESP
+// request is '\n', '\r', a digit or a letter, never below 0x0A.
+Proto resp_detect(const uint8_t *data, size_t len, uint32_t max_msg);
+
+typedef enum {
+    RESP_OK = 0,
+    RESP_INCOMPLETE,
+    RESP_ERROR,
+} RespStatus;
+
+// Frame one request without modifying it. On RESP_OK args[0..*n_args)
+// point into data with their lengths in lens, and the request used *used
+// bytes. A request with more than cap arguments returns RESP_OK with
+// *n_args > cap and nothing written: call again with room for them.
+// On RESP_INCOMPLETE, *used is a lower bound of the bytes needed, so the
+// caller can skip parsing until that much has arrived.
+RespStatus resp_parse(const uint8_t *data, size_t len, char **args, size_t *lens, size_t cap,
+                      size_t *n_args, size_t *used, const char **err);
+
+// resp_encode() flags
+enum {
+    RESP_SPLIT = 1,  // the elements of the top-level array are separate replies
+    RESP_PUSH = 2,   // out-of-band Pub/Sub data, a push type in RESP3
+    RESP_MAP = 4,    // a top-level array of key/value pairs, a map in RESP3
+    RESP_NIL_OK = 8, // a top-level nil means success: "+OK"
+    RESP_EXISTS = 16, // a top-level int is a status code: 0 (found) is ":1", others ":0"
+    RESP_STATUS = 32, // a top-level string is a status: "+QUEUED", not a bulk string
+};
+
+// Transcode one tagged reply (without its length header) to RESP
+void resp_encode(const uint8_t *data, size_t len, Proto proto, uint32_t flags, Buffer *out);
+// Same for a reply made of the replies of other commands (EXEC): element
+// i of the top-level array is transcoded with elem_flags[i]. Any other
+// reply is transcoded without flags.
+void resp_encode_each(const uint8_t *data, size_t len, Proto proto, const uint32_t *elem_flags,
+                      size_t n_elems, Buffer *out);
+
+#endif
@@ -0,0 +1,1312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include "script.h"
+#include "hashtable.h"
+#include "kv.h"
+#include "protocol.h"
+#include "common.h"
+
+#define container_of(ptr, T, member) \
+    ((T *)( (char *)ptr - offsetof(T, member) ))
+
+#define k_script_max_vars 256
+#define k_script_stack 256
+#define k_script_max_depth 512
+#define k_script_max_call_args 1024
+#define k_script_max_nesting 32  // arrays in call() replies and results
+#define k_arena_chunk (64 << 10)
+
+// --- Bytecode ---
+
+enum {
+    OP_CONST,      // push consts[arg]
+    OP_NIL,
+    OP_LOAD,       // push vars[arg]
+    OP_STORE,      // vars[arg] = pop
+    OP_POP,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_CONCAT,
+    OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE,
+    OP_NOT, OP_NEG,
+    OP_JMP,        // pc = arg
+    OP_JMPF,       // pop, jump if false
+    OP_JMPF_KEEP,  // &&: jump if false keeping the value, else pop
+    OP_JMPT_KEEP,  // ||: jump if true keeping the value, else pop
+    OP_INDEX,      // a[i]
+    OP_SETINDEX,   // a[i] = v, pops all three
+    OP_ARRAY,      // pop arg values into a new array
+    OP_CALL,       // call() with arg values
+    OP_LEN, OP_INT, OP_STR, OP_PUSH,
+    OP_RETURN,
+};
+
+typedef struct Instr {
+    uint8_t op;
+    int32_t arg;
+} Instr;
+
+struct ScriptProgram {
+    HNode node;  // in the cache, by sha
+    char sha[SHA1_HEX_SIZE];
+    Instr *code;
+    uint32_t *lines;  // source line of each instruction, for errors
+    size_t n_code;
+    size_t cap_code;
+    ScriptValue *consts;  // strings are owned by the program
+    size_t n_consts;
+    size_t cap_consts;
+    uint32_t n_vars;
+};
+
+static void prog_free(ScriptProgram *prog) {
+    for (size_t i = 0; i < prog->n_consts; i++) {
+        if (prog->consts[i].type == SV_STR) {
+            free(prog->consts[i].s);
+        }
+    }
+    free(prog->consts);
+    free(prog->code);
+    free(prog->lines);
+    free(prog);
+}
+
+// --- Lexer ---
+
+enum {
+    TOK_EOF = 0,
+    TOK_INT,
+    TOK_STR,
+    TOK_NAME,
+    TOK_IF, TOK_ELSE, TOK_WHILE, TOK_BREAK, TOK_RETURN, TOK_NIL,
+    TOK_EQ, TOK_NE, TOK_LE, TOK_GE, TOK_AND, TOK_OR, TOK_CONCAT,
+    // single characters are their own token types, all below 128
+};
+
+typedef struct Token {
+    int type;
+    const char *start;
+    size_t len;
+    int64_t ival;
+    uint32_t line;
+} Token;
+
+typedef struct Compiler {
+    const char *p;
+    const char *end;
+    uint32_t line;
+    Token tok;  // current
+    ScriptProgram *prog;
+    // variable names point into the source, only needed while compiling
+    const char *var_names[k_script_max_vars];
+    size_t var_lens[k_script_max_vars];
+    // pending break jumps of the enclosing loops
+    size_t *breaks;
+    size_t n_breaks;
+    size_t cap_breaks;
+    size_t loop_depth;
+    size_t depth;  // nesting of expressions and blocks
+    char *err;
+    size_t err_size;
+    bool failed;
+} Compiler;
+
+static void compile_error(Compiler *c, const char *fmt, ...) {
+    if (c->failed) {
+        return;  // keep the first error
+    }
+    c->failed = true;
+    int n = snprintf(c->err, c->err_size, "line %u: ", c->tok.line);
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(c->err + n, c->err_size - (size_t)n, fmt, ap);
+    va_end(ap);
+}
+
+static bool is_name_char(char ch, bool first) {
+    return ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+        || (!first && ch >= '0' && ch <= '9');
+}
+
+static const struct {
+    const char *word;
+    int type;
+} k_keywords[] = {
+    {"if", TOK_IF}, {"else", TOK_ELSE}, {"while", TOK_WHILE}, {"break", TOK_BREAK},
+    {"return", TOK_RETURN}, {"nil", TOK_NIL},
+};
+
+static void lex(Compiler *c) {
+    Token *t = &c->tok;
+    // skip spaces and "//" comments
+    while (c->p < c->end) {
+        if (*c->p == '\n') {
+            c->line++;
+            c->p++;
+        } else if (*c->p == ' ' || *c->p == '\t' || *c->p == '\r') {
+            c->p++;
+        } else if (*c->p == '/' && c->p + 1 < c->end && c->p[1] == '/') {
+            while (c->p < c->end && *c->p != '\n') {
+                c->p++;
+            }
+        } else {
+            break;
+        }
+    }
+    t->start = c->p;
+    t->line = c->line;
+    t->len = 0;
+    if (c->p >= c->end || c->failed) {
+        t->type = TOK_EOF;
+        return;
+    }
+
+    char ch = *c->p;
+    if (ch >= '0' && ch <= '9') {
+        uint64_t v = 0;
+        while (c->p < c->end && *c->p >= '0' && *c->p <= '9') {
+            uint64_t d = (uint64_t)(*c->p++ - '0');
+            // checked before the multiply, which could wrap back into range
+            if (v > ((uint64_t)INT64_MAX - d) / 10) {
+                compile_error(c, "integer literal out of range");
+                t->type = TOK_EOF;
+                return;
+            }
+            v = v * 10 + d;
+        }
+        t->type = TOK_INT;
+        t->ival = (int64_t)v;
+    } else if (is_name_char(ch, true)) {
+        while (c->p < c->end && is_name_char(*c->p, false)) {
+            c->p++;
+        }
+        t->type = TOK_NAME;
+        size_t len = (size_t)(c->p - t->start);
+        for (size_t i = 0; i < sizeof(k_keywords) / sizeof(k_keywords[0]); i++) {
+            if (strlen(k_keywords[i].word) == len && memcmp(k_keywords[i].word, t->start, len) == 0) {
+                t->type = k_keywords[i].type;
+            }
+        }
+    } else if (ch == '"') {
+        // the raw text, escapes are decoded when the constant is made
+        c->p++;
+        while (c->p < c->end && *c->p != '"') {
+            if (*c->p == '\\' && c->p + 1 < c->end) {
+                c->p++;
+            }
+            if (*c->p == '\n') {
+                c->line++;
+            }
+            c->p++;
+        }
+        if (c->p >= c->end) {
+            compile_error(c, "unterminated string");
+            t->type = TOK_EOF;
+            return;
+        }
+        c->p++;
+        t->type = TOK_STR;
+    } else {
+        static const struct {
+            char text[3];
+            int type;
+        } k_pairs[] = {
+            {"==", TOK_EQ}, {"!=", TOK_NE}, {"<=", TOK_LE}, {">=", TOK_GE},
+            {"&&", TOK_AND}, {"||", TOK_OR}, {"..", TOK_CONCAT},
+        };
+        t->type = 0;
+        for (size_t i = 0; i < sizeof(k_pairs) / sizeof(k_pairs[0]); i++) {
+            if (c->p + 1 < c->end && c->p[0] == k_pairs[i].text[0] && c->p[1] == k_pairs[i].text[1]) {
+                t->type = k_pairs[i].type;
+                c->p += 2;
+                break;
+            }
+        }
+        if (!t->type) {
+            if (!strchr("(){}[],;=<>+-*/%!", ch)) {
+                compile_error(c, "unexpected character '%c'", ch);
+                t->type = TOK_EOF;
+                return;
+            }
+            t->type = ch;
+            c->p++;
+        }
+    }
+    t->len = (size_t)(c->p - t->start);
+}
+
+// The type of the token after the current one
+static int peek(Compiler *c) {
+    const char *p = c->p;
+    uint32_t line = c->line;
+    Token saved = c->tok;
+    lex(c);
+    int type = c->tok.type;
+    c->p = p;
+    c->line = line;
+    c->tok = saved;
+    return type;
+}
+
+static bool accept(Compiler *c, int type) {
+    if (c->tok.type == type) {
+        lex(c);
+        return true;
+    }
+    return false;
+}
+
+static void expect(Compiler *c, int type, const char *what) {
+    if (!accept(c, type)) {
+        compile_error(c, "expected %s", what);
+    }
+}
+
+// --- Code generation ---
+
+static size_t emit(Compiler *c, uint8_t op, int32_t arg) {
+    ScriptProgram *prog = c->prog;
+    if (prog->n_code == prog->cap_code) {
+        prog->cap_code = prog->cap_code ? prog->cap_code * 2 : 64;
+        prog->code = realloc(prog->code, prog->cap_code * sizeof(Instr));
+        prog->lines = realloc(prog->lines, prog->cap_code * sizeof(uint32_t));
+        if (!prog->code || !prog->lines) {
+            die("Memory allocation failed");
+        }
+    }
+    prog->code[prog->n_code].op = op;
+    prog->code[prog->n_code].arg = arg;
+    prog->lines[prog->n_code] = c->tok.line;
+    return prog->n_code++;
+}
+
+static void patch(Compiler *c, size_t at) {
+    c->prog->code[at].arg = (int32_t)c->prog->n_code;
+}
+
+static void emit_const(Compiler *c, ScriptValue v) {
+    ScriptProgram *prog = c->prog;
+    if (prog->n_consts == prog->cap_consts) {
+        prog->cap_consts = prog->cap_consts ? prog->cap_consts * 2 : 16;
+        prog->consts = realloc(prog->consts, prog->cap_consts * sizeof(ScriptValue));
+        if (!prog->consts) {
+            die("Memory allocation failed");
+        }
+    }
+    prog->consts[prog->n_consts] = v;
+    emit(c, OP_CONST, (int32_t)prog->n_consts++);
+}
+
+// String literal with \n, \t, \\ and \" decoded
+static void emit_str_const(Compiler *c) {
+    const char *s = c->tok.start + 1;
+    size_t raw = c->tok.len - 2;
+    ScriptStr *str = malloc(sizeof(ScriptStr) + raw + 1);
+    if (!str) {
+        die("Memory allocation failed");
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < raw; i++) {
+        char ch = s[i];
+        if (ch == '\\' && i + 1 < raw) {
+            ch = s[++i];
+            ch = ch == 'n' ? '\n' : ch == 't' ? '\t' : ch;
+        }
+        str->data[n++] = ch;
+    }
+    str->data[n] = '\0';
+    str->len = (uint32_t)n;
+    ScriptValue v = {.type = SV_STR, .s = str};
+    emit_const(c, v);
+}
+
+static int find_var(Compiler *c, const char *name, size_t len) {
+    for (uint32_t i = 0; i < c->prog->n_vars; i++) {
+        if (c->var_lens[i] == len && memcmp(c->var_names[i], name, len) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int add_var(Compiler *c, const char *name, size_t len) {
+    if (c->prog->n_vars == k_script_max_vars) {
+        compile_error(c, "too many variables");
+        return 0;
+    }
+    c->var_names[c->prog->n_vars] = name;
+    c->var_lens[c->prog->n_vars] = len;
+    return (int)c->prog->n_vars++;
+}
+
+// --- Parser ---
+
+// The parser recurses once per nesting level, bounded like the VM stack
+static bool enter(Compiler *c) {
+    if (++c->depth > k_script_max_depth) {
+        compile_error(c, "script nested too deeply");
+        return false;
+    }
+    return true;
+}
+
+static void parse_expr(Compiler *c);
+
+static const struct {
+    const char *name;
+    uint8_t op;
+    int arity;  // -1: one or more
+} k_builtins[] = {
+    {"call", OP_CALL, -1}, {"len", OP_LEN, 1}, {"int", OP_INT, 1},
+    {"str", OP_STR, 1}, {"push", OP_PUSH, 2},
+};
+
+static void parse_builtin(Compiler *c, size_t b) {
+    lex(c);  // the name
+    expect(c, '(', "'('");
+    int n = 0;
+    if (c->tok.type != ')') {
+        do {
+            parse_expr(c);
+            n++;
+        } while (!c->failed && accept(c, ','));
+    }
+    expect(c, ')', "')'");
+    int arity = k_builtins[b].arity;
+    if ((arity < 0 && n < 1) || (arity >= 0 && n != arity)) {
+        compile_error(c, "wrong number of arguments to %s()", k_builtins[b].name);
+    } else if (n > k_script_max_call_args) {
+        compile_error(c, "too many arguments");
+    }
+    emit(c, k_builtins[b].op, n);
+}
+
+static void parse_primary(Compiler *c) {
+    Token t = c->tok;
+    switch (t.type) {
+    case TOK_INT: {
+        ScriptValue v = {.type = SV_INT, .i = t.ival};
+        emit_const(c, v);
+        lex(c);
+        return;
+    }
+    case TOK_STR:
+        emit_str_const(c);
+        lex(c);
+        return;
+    case TOK_NIL:
+        emit(c, OP_NIL, 0);
+        lex(c);
+        return;
+    case '(':
+        lex(c);
+        parse_expr(c);
+        expect(c, ')', "')'");
+        return;
+    case '[': {
+        lex(c);
+        int n = 0;
+        if (c->tok.type != ']') {
+            do {
+                parse_expr(c);
+                n++;
+            } while (!c->failed && accept(c, ','));
+        }
+        expect(c, ']', "']'");
+        emit(c, OP_ARRAY, n);
+        return;
+    }
+    case TOK_NAME: {
+        if (peek(c) == '(') {
+            for (size_t i = 0; i < sizeof(k_builtins) / sizeof(k_builtins[0]); i++) {
+                if (strlen(k_builtins[i].name) == t.len && memcmp(k_builtins[i].name, t.start, t.len) == 0) {
+                    parse_builtin(c, i);
+                    return;
+                }
+            }
+            compile_error(c, "unknown function '%.*s'", (int)t.len, t.start);
+            return;
+        }
+        int slot = find_var(c, t.start, t.len);
+        if (slot < 0) {
+            if (peek(c) != '=') {
+                compile_error(c, "undefined variable '%.*s'", (int)t.len, t.start);
+                return;
+            }
+            slot = add_var(c, t.start, t.len);  // first assignment declares it
+        }
+        emit(c, OP_LOAD, slot);
+        lex(c);
+        return;
+    }
+    default:
+        compile_error(c, "unexpected %s", t.type == TOK_EOF ? "end of script" : "token");
+    }
+}
+
+static void parse_postfix(Compiler *c) {
+    parse_primary(c);
+    while (!c->failed && accept(c, '[')) {
+        parse_expr(c);
+        expect(c, ']', "']'");
+        emit(c, OP_INDEX, 0);
+    }
+}
+
+static void parse_unary(Compiler *c) {
+    if (!enter(c)) {
+        return;
+    }
+    if (accept(c, '-')) {
+        parse_unary(c);
+        emit(c, OP_NEG, 0);
+    } else if (accept(c, '!')) {
+        parse_unary(c);
+        emit(c, OP_NOT, 0);
+    } else {
+        parse_postfix(c);
+    }
+    c->depth--;
+}
+
+static void parse_mul(Compiler *c) {
+    parse_unary(c);
+    while (!c->failed) {
+        uint8_t op = c->tok.type == '*' ? OP_MUL : c->tok.type == '/' ? OP_DIV
+                   : c->tok.type == '%' ? OP_MOD : 0;
+        if (!op) {
+            return;
+        }
+        lex(c);
+        parse_unary(c);
+        emit(c, op, 0);
+    }
+}
+
+static void parse_add(Compiler *c) {
+    parse_mul(c);
+    while (!c->failed) {
+        uint8_t op = c->tok.type == '+' ? OP_ADD : c->tok.type == '-' ? OP_SUB
+                   : c->tok.type == TOK_CONCAT ? OP_CONCAT : 0;
+        if (!op) {
+            return;
+        }
+        lex(c);
+        parse_mul(c);
+        emit(c, op, 0);
+    }
+}
+
+static void parse_cmp(Compiler *c) {
+    parse_add(c);
+    while (!c->failed) {
+        int t = c->tok.type;
+        uint8_t op = t == TOK_EQ ? OP_EQ : t == TOK_NE ? OP_NE : t == '<' ? OP_LT
+                   : t == TOK_LE ? OP_LE : t == '>' ? OP_GT : t == TOK_GE ? OP_GE : 0;
+        if (!op) {
+            return;
+        }
+        lex(c);
+        parse_add(c);
+        emit(c, op, 0);
+    }
+}
+
+static void parse_and(Compiler *c) {
+    parse_cmp(c);
+    while (!c->failed && accept(c, TOK_AND)) {
+        size_t jump = emit(c, OP_JMPF_KEEP, 0);
+        parse_cmp(c);
+        patch(c, jump);
+    }
+}
+
+static void parse_expr(Compiler *c) {
+    if (!enter(c)) {
+        return;
+    }
+    parse_and(c);
+    while (!c->failed && accept(c, TOK_OR)) {
+        size_t jump = emit(c, OP_JMPT_KEEP, 0);
+        parse_and(c);
+        patch(c, jump);
+    }
+    c->depth--;
+}
+
+static void parse_stmt(Compiler *c);
+
+static void parse_block(Compiler *c) {
+    if (!enter(c)) {
+        return;
+    }
+    expect(c, '{', "'{'");
+    while (!c->failed && c->tok.type != '}' && c->tok.type != TOK_EOF) {
+        parse_stmt(c);
+    }
+    expect(c, '}', "'}'");
+    c->depth--;
+}
+
+static void parse_if(Compiler *c) {
+    if (!enter(c)) {
+        return;  // a long else-if chain recurses too
+    }
+    expect(c, '(', "'('");
+    parse_expr(c);
+    expect(c, ')', "')'");
+    size_t skip_then = emit(c, OP_JMPF, 0);
+    parse_block(c);
+    if (accept(c, TOK_ELSE)) {
+        size_t skip_else = emit(c, OP_JMP, 0);
+        patch(c, skip_then);
+        if (accept(c, TOK_IF)) {
+            parse_if(c);
+        } else {
+            parse_block(c);
+        }
+        patch(c, skip_else);
+    } else {
+        patch(c, skip_then);
+    }
+    c->depth--;
+}
+
+static void parse_while(Compiler *c) {
+    size_t top = c->prog->n_code;
+    size_t breaks_base = c->n_breaks;
+    expect(c, '(', "'('");
+    parse_expr(c);
+    expect(c, ')', "')'");
+    size_t exit = emit(c, OP_JMPF, 0);
+    c->loop_depth++;
+    parse_block(c);
+    c->loop_depth--;
+    emit(c, OP_JMP, (int32_t)top);
+    patch(c, exit);
+    while (c->n_breaks > breaks_base) {
+        patch(c, c->breaks[--c->n_breaks]);
+    }
+}
+
+static void parse_stmt(Compiler *c) {
+    if (accept(c, TOK_IF)) {
+        parse_if(c);
+    } else if (accept(c, TOK_WHILE)) {
+        parse_while(c);
+    } else if (c->tok.type == '{') {
+        parse_block(c);
+    } else if (accept(c, TOK_BREAK)) {
+        if (!c->loop_depth) {
+            compile_error(c, "break outside a loop");
+            return;
+        }
+        if (c->n_breaks == c->cap_breaks) {
+            c->cap_breaks = c->cap_breaks ? c->cap_breaks * 2 : 8;
+            c->breaks = realloc(c->breaks, c->cap_breaks * sizeof(size_t));
+            if (!c->breaks) {
+                die("Memory allocation failed");
+            }
+        }
+        c->breaks[c->n_breaks++] = emit(c, OP_JMP, 0);
+        expect(c, ';', "';'");
+    } else if (accept(c, TOK_RETURN)) {
+        if (c->tok.type == ';') {
+            emit(c, OP_NIL, 0);
+        } else {
+            parse_expr(c);
+        }
+        emit(c, OP_RETURN, 0);
+        expect(c, ';', "';'");
+    } else {
+        parse_expr(c);
+        if (accept(c, '=')) {
+            // turn the load that was just emitted into a store
+            ScriptProgram *prog = c->prog;
+            Instr last = prog->n_code ? prog->code[prog->n_code - 1] : (Instr){OP_POP, 0};
+            if (c->failed || (last.op != OP_LOAD && last.op != OP_INDEX)) {
+                compile_error(c, "invalid assignment target");
+                return;
+            }
+            prog->n_code--;
+            parse_expr(c);
+            emit(c, last.op == OP_LOAD ? OP_STORE : OP_SETINDEX, last.arg);
+        } else {
+            emit(c, OP_POP, 0);
+        }
+        expect(c, ';', "';'");
+    }
+}
+
+static ScriptProgram *compile(const char *src, size_t len, char *err, size_t err_size) {
+    Compiler c = {0};
+    c.p = src;
+    c.end = src + len;
+    c.line = 1;
+    c.err = err;
+    c.err_size = err_size;
+    c.prog = calloc(1, sizeof(ScriptProgram));
+    if (!c.prog) {
+        die("Memory allocation failed");
+    }
+    add_var(&c, "KEYS", 4);  // slot 0
+    add_var(&c, "ARGV", 4);  // slot 1
+    lex(&c);
+    while (!c.failed && c.tok.type != TOK_EOF) {
+        parse_stmt(&c);
+    }
+    emit(&c, OP_NIL, 0);
+    emit(&c, OP_RETURN, 0);
+    free(c.breaks);
+    if (c.failed) {
+        prog_free(c.prog);
+        return NULL;
+    }
+    return c.prog;
+}
+
+// --- Cache ---
+
+static HMap g_scripts;
+
+static bool prog_eq(HNode *lhs, HNode *rhs) {
+    return strcmp(container_of(lhs, ScriptProgram, node)->sha,
+                  container_of(rhs, ScriptProgram, node)->sha) == 0;
+}
+
+ScriptProgram *script_find(const char *sha) {
+    if (strlen(sha) != SHA1_HEX_SIZE - 1) {
+        return NULL;
+    }
+    ScriptProgram probe;
+    memcpy(probe.sha, sha, SHA1_HEX_SIZE);
+    probe.node.hcode = kv_hash(sha, SHA1_HEX_SIZE - 1);
+    HNode *node = hm_lookup(&g_scripts, &probe.node, prog_eq);
+    return node ? container_of(node, ScriptProgram, node) : NULL;
+}
+
+ScriptProgram *script_load(const char *src, size_t len, char sha[SHA1_HEX_SIZE],
+                           char *err, size_t err_size) {
+    sha1_hex(src, len, sha);
+    ScriptProgram *prog = script_find(sha);
+    if (prog) {
+        return prog;  // compiled before
+    }
+    prog = compile(src, len, err, err_size);
+    if (!prog) {
+        return NULL;
+    }
+    memcpy(prog->sha, sha, SHA1_HEX_SIZE);
+    prog->node.hcode = kv_hash(sha, SHA1_HEX_SIZE - 1);
+    prog->node.next = NULL;
+    hm_insert(&g_scripts, &prog->node);
+    return prog;
+}
+
+static bool cb_collect(HNode *node, void *arg) {
+    ScriptProgram ***pos = (ScriptProgram ***)arg;
+    *(*pos)++ = container_of(node, ScriptProgram, node);
+    return true;
+}
+
+void script_flush(void) {
+    size_t n = hm_size(&g_scripts);
+    ScriptProgram **all = malloc((n ? n : 1) * sizeof(ScriptProgram *));
+    if (!all) {
+        die("Memory allocation failed");
+    }
+    ScriptProgram **pos = all;
+    hm_foreach(&g_scripts, cb_collect, &pos);
+    hm_clear(&g_scripts);
+    for (size_t i = 0; i < n; i++) {
+        prog_free(all[i]);
+    }
+    free(all);
+}
+
+size_t script_count(void) {
+    return hm_size(&g_scripts);
+}
+
+// --- Runtime values ---
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t used;
+    size_t cap;
+    uint8_t data[];
+} ArenaChunk;
+
+typedef struct VM {
+    ScriptProgram *prog;
+    ScriptRun *run;
+    size_t pc;
+    ScriptValue stack[k_script_stack];
+    size_t sp;
+    ScriptValue *vars;
+} VM;
+
+static bool vm_error(VM *vm, const char *fmt, ...) {
+    size_t at = vm->pc ? vm->pc - 1 : 0;
+    int n = snprintf(vm->run->err, sizeof(vm->run->err), "line %u: ", vm->prog->lines[at]);
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(vm->run->err + n, sizeof(vm->run->err) - (size_t)n, fmt, ap);
+    va_end(ap);
+    return false;
+}
+
+// NULL once the run has used its memory cap
+static void *arena_alloc(ScriptRun *run, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaChunk *chunk = run->arena;
+    if (!chunk || chunk->cap - chunk->used < size) {
+        size_t cap = size > k_arena_chunk ? size : k_arena_chunk;
+        if (run->arena_bytes + cap > k_script_max_mem) {
+            return NULL;
+        }
+        chunk = malloc(sizeof(ArenaChunk) + cap);
+        if (!chunk) {
+            die("Memory allocation failed");
+        }
+        chunk->next = run->arena;
+        chunk->used = 0;
+        chunk->cap = cap;
+        run->arena = chunk;
+        run->arena_bytes += cap;
+    }
+    void *p = chunk->data + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+static bool new_str(VM *vm, const char *s, size_t len, ScriptValue *out) {
+    ScriptStr *str = arena_alloc(vm->run, sizeof(ScriptStr) + len + 1);
+    if (!str) {
+        return vm_error(vm, "script memory limit reached");
+    }
+    str->len = (uint32_t)len;
+    if (s) {
+        memcpy(str->data, s, len);  // else the caller fills it in
+    }
+    str->data[len] = '\0';
+    out->type = SV_STR;
+    out->s = str;
+    return true;
+}
+
+static bool new_arr(VM *vm, uint32_t cap, ScriptValue *out) {
+    ScriptArr *arr = arena_alloc(vm->run, sizeof(ScriptArr));
+    ScriptValue *items = arr ? arena_alloc(vm->run, (cap ? cap : 1) * sizeof(ScriptValue)) : NULL;
+    if (!items) {
+        return vm_error(vm, "script memory limit reached");
+    }
+    arr->n = 0;
+    arr->cap = cap ? cap : 1;
+    arr->items = items;
+    out->type = SV_ARR;
+    out->a = arr;
+    return true;
+}
+
+static bool arr_push(VM *vm, ScriptArr *arr, ScriptValue v) {
+    if (arr->n == arr->cap) {
+        // the old items stay in the arena until the run ends
+        ScriptValue *items = arena_alloc(vm->run, 2 * (size_t)arr->cap * sizeof(ScriptValue));
+        if (!items) {
+            return vm_error(vm, "script memory limit reached");
+        }
+        memcpy(items, arr->items, arr->n * sizeof(ScriptValue));
+        arr->items = items;
+        arr->cap *= 2;
+    }
+    arr->items[arr->n++] = v;
+    return true;
+}
+
+static const char *type_name(ScriptType type) {
+    static const char *names[] = {"nil", "integer", "string", "array"};
+    return names[type];
+}
+
+// Integers, and strings spelling one in full
+static bool as_int(const ScriptValue *v, int64_t *out) {
+    if (v->type == SV_INT) {
+        *out = v->i;
+        return true;
+    }
+    if (v->type != SV_STR || v->s->len == 0) {
+        return false;
+    }
+    char *end = NULL;
+    errno = 0;
+    long long n = strtoll(v->s->data, &end, 10);
+    if (errno || end != v->s->data + v->s->len || v->s->data[0] == ' ') {
+        return false;
+    }
+    *out = n;
+    return true;
+}
+
+// Strings, and integers formatted as one
+static bool as_str(VM *vm, const ScriptValue *v, ScriptStr **out) {
+    if (v->type == SV_STR) {
+        *out = v->s;
+        return true;
+    }
+    if (v->type == SV_INT) {
+        char buf[KV_INT_BUFSIZE];
+        int n = snprintf(buf, sizeof(buf), "%lld", (long long)v->i);
+        ScriptValue s = {.type = SV_NIL};
+        if (!new_str(vm, buf, (size_t)n, &s)) {
+            return false;
+        }
+        *out = s.s;
+        return true;
+    }
+    return vm_error(vm, "expected a string, got %s", type_name(v->type));
+}
+
+static bool truthy(const ScriptValue *v) {
+    return v->type == SV_INT ? v->i != 0 : v->type != SV_NIL;
+}
+
+static bool values_equal(const ScriptValue *a, const ScriptValue *b) {
+    if (a->type == SV_STR && b->type == SV_STR) {
+        return a->s->len == b->s->len && memcmp(a->s->data, b->s->data, a->s->len) == 0;
+    }
+    if (a->type == SV_ARR || b->type == SV_ARR) {
+        return a->type == b->type && a->a == b->a;
+    }
+    if (a->type == SV_NIL || b->type == SV_NIL) {
+        return a->type == b->type;
+    }
+    int64_t x, y;
+    return as_int(a, &x) && as_int(b, &y) && x == y;
+}
+
+static bool arith(VM *vm, uint8_t op, const ScriptValue *a, const ScriptValue *b, ScriptValue *out) {
+    int64_t x, y, r = 0;
+    if (!as_int(a, &x) || !as_int(b, &y)) {
+        return vm_error(vm, "arithmetic on %s and %s",
+                        type_name(as_int(a, &x) ? SV_INT : a->type),
+                        type_name(as_int(b, &y) ? SV_INT : b->type));
+    }
+    bool overflow = false;
+    switch (op) {
+    case OP_ADD:
+        overflow = __builtin_add_overflow(x, y, &r);
+        break;
+    case OP_SUB:
+        overflow = __builtin_sub_overflow(x, y, &r);
+        break;
+    case OP_MUL:
+        overflow = __builtin_mul_overflow(x, y, &r);
+        break;
+    case OP_DIV:
+    case OP_MOD:
+        if (y == 0) {
+            return vm_error(vm, "division by zero");
+        }
+        overflow = x == INT64_MIN && y == -1;
+        r = overflow ? 0 : op == OP_DIV ? x / y : x % y;
+        break;
+    }
+    if (overflow) {
+        return vm_error(vm, "integer overflow");
+    }
+    out->type = SV_INT;
+    out->i = r;
+    return true;
+}
+
+// <0, 0, >0 for ordering comparisons: strings by bytes, otherwise as integers
+static bool compare(VM *vm, const ScriptValue *a, const ScriptValue *b, int *out) {
+    if (a->type == SV_STR && b->type == SV_STR) {
+        uint32_t n = a->s->len < b->s->len ? a->s->len : b->s->len;
+        int rv = memcmp(a->s->data, b->s->data, n);
+        *out = rv ? rv : (a->s->len > b->s->len) - (a->s->len < b->s->len);
+        return true;
+    }
+    int64_t x, y;
+    if (!as_int(a, &x) || !as_int(b, &y)) {
+        return vm_error(vm, "cannot compare %s with %s", type_name(a->type), type_name(b->type));
+    }
+    *out = (x > y) - (x < y);
+    return true;
+}
+
+// --- Replies of call() ---
+
+static bool decode_reply(VM *vm, const uint8_t **p, const uint8_t *end, int depth, ScriptValue *out) {
+    if (*p >= end || depth > k_script_max_nesting) {
+        return vm_error(vm, "malformed reply");
+    }
+    uint8_t tag = *(*p)++;
+    uint32_t len = 0;
+    switch (tag) {
+    case TAG_NIL:
+        out->type = SV_NIL;
+        return true;
+    case TAG_INT:
+    case TAG_DBL:
+        if (end - *p < 8) {
+            return vm_error(vm, "malformed reply");
+        }
+        if (tag == TAG_INT) {
+            out->type = SV_INT;
+            memcpy(&out->i, *p, 8);
+        } else {
+            double d;
+            memcpy(&d, *p, 8);
+            char buf[32];
+            int n = snprintf(buf, sizeof(buf), "%.17g", d);
+            if (!new_str(vm, buf, (size_t)n, out)) {
+                return false;
+            }
+        }
+        *p += 8;
+        return true;
+    case TAG_ERR:
+        // a failed command fails the script
+        if (end - *p < 8) {
+            return vm_error(vm, "malformed reply");
+        }
+        memcpy(&len, *p + 4, 4);
+        *p += 8;
+        if ((size_t)(end - *p) < len) {
+            return vm_error(vm, "malformed reply");
+        }
+        return vm_error(vm, "call() failed: %.*s", (int)len, (const char *)*p);
+    case TAG_STR:
+        if (end - *p < 4) {
+            return vm_error(vm, "malformed reply");
+        }
+        memcpy(&len, *p, 4);
+        *p += 4;
+        if ((size_t)(end - *p) < len || !new_str(vm, (const char *)*p, len, out)) {
+            return vm_error(vm, "malformed reply");
+        }
+        *p += len;
+        return true;
+    case TAG_ARR:
+        if (end - *p < 4) {
+            return vm_error(vm, "malformed reply");
+        }
+        memcpy(&len, *p, 4);
+        *p += 4;
+        if (len > (size_t)(end - *p) || !new_arr(vm, len, out)) {
+            return vm_error(vm, "malformed reply");
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            if (!decode_reply(vm, p, end, depth + 1, &out->a->items[i])) {
+                return false;
+            }
+        }
+        out->a->n = len;
+        return true;
+    }
+    return vm_error(vm, "malformed reply");
+}
+
+static bool do_call(VM *vm, ScriptValue *args, size_t n, ScriptValue *out) {
+    char *argv[k_script_max_call_args];
+    for (size_t i = 0; i < n; i++) {
+        ScriptStr *s;
+        if (args[i].type != SV_STR && args[i].type != SV_INT) {
+            return vm_error(vm, "call() argument %zu is %s", i + 1, type_name(args[i].type));
+        }
+        if (!as_str(vm, &args[i], &s)) {
+            return false;
+        }
+        argv[i] = s->data;
+    }
+    Buffer reply;
+    buffer_init(&reply, 256);
+    vm->run->call(vm->run->ctx, argv, n, &reply);
+    const uint8_t *p = buf_read_ptr(&reply);
+    bool ok = decode_reply(vm, &p, p + buf_read_size(&reply), 0, out);
+    buffer_destroy(&reply);
+    return ok;
+}
+
+// --- Interpreter ---
+
+static bool push(VM *vm, ScriptValue v) {
+    if (vm->sp == k_script_stack) {
+        return vm_error(vm, "expression too deep");
+    }
+    vm->stack[vm->sp++] = v;
+    return true;
+}
+
+static bool vm_exec(VM *vm) {
+    ScriptRun *run = vm->run;
+    const Instr *code = vm->prog->code;
+    const ScriptValue nil = {.type = SV_NIL};
+    while (true) {
+        if (++run->steps > run->max_steps) {
+            return vm_error(vm, "script exceeded the instruction budget (%llu)",
+                            (unsigned long long)run->max_steps);
+        }
+        Instr in = code[vm->pc++];
+        ScriptValue *top = vm->sp ? &vm->stack[vm->sp - 1] : NULL;
+        switch (in.op) {
+        case OP_CONST:
+            if (!push(vm, vm->prog->consts[in.arg])) {
+                return false;
+            }
+            break;
+        case OP_NIL:
+            if (!push(vm, nil)) {
+                return false;
+            }
+            break;
+        case OP_LOAD:
+            if (!push(vm, vm->vars[in.arg])) {
+                return false;
+            }
+            break;
+        case OP_STORE:
+            vm->vars[in.arg] = vm->stack[--vm->sp];
+            break;
+        case OP_POP:
+            vm->sp--;
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            if (!arith(vm, in.op, top - 1, top, top - 1)) {
+                return false;
+            }
+            vm->sp--;
+            break;
+        case OP_CONCAT: {
+            ScriptStr *a, *b;
+            ScriptValue r;
+            if (!as_str(vm, top - 1, &a) || !as_str(vm, top, &b)
+                || !new_str(vm, NULL, (size_t)a->len + b->len, &r)) {
+                return false;
+            }
+            memcpy(r.s->data, a->data, a->len);
+            memcpy(r.s->data + a->len, b->data, b->len);
+            top[-1] = r;
+            vm->sp--;
+            break;
+        }
+        case OP_EQ:
+        case OP_NE: {
+            bool eq = values_equal(top - 1, top);
+            top[-1].type = SV_INT;
+            top[-1].i = in.op == OP_EQ ? eq : !eq;
+            vm->sp--;
+            break;
+        }
+        case OP_LT: case OP_LE: case OP_GT: case OP_GE: {
+            int rv = 0;
+            if (!compare(vm, top - 1, top, &rv)) {
+                return false;
+            }
+            top[-1].type = SV_INT;
+            top[-1].i = in.op == OP_LT ? rv < 0 : in.op == OP_LE ? rv <= 0
+                      : in.op == OP_GT ? rv > 0 : rv >= 0;
+            vm->sp--;
+            break;
+        }
+        case OP_NOT:
+            top->i = !truthy(top);
+            top->type = SV_INT;
+            break;
+        case OP_NEG: {
+            ScriptValue zero = {.type = SV_INT, .i = 0};
+            if (!arith(vm, OP_SUB, &zero, top, top)) {
+                return false;
+            }
+            break;
+        }
+        case OP_JMP:
+            vm->pc = (size_t)in.arg;
+            break;
+        case OP_JMPF:
+            if (!truthy(&vm->stack[--vm->sp])) {
+                vm->pc = (size_t)in.arg;
+            }
+            break;
+        case OP_JMPF_KEEP:
+        case OP_JMPT_KEEP:
+            if (truthy(top) == (in.op == OP_JMPT_KEEP)) {
+                vm->pc = (size_t)in.arg;
+            } else {
+                vm->sp--;
+            }
+            break;
+        case OP_INDEX: {
+            int64_t i;
+            if (top[-1].type != SV_ARR) {
+                return vm_error(vm, "cannot index %s", type_name(top[-1].type));
+            }
+            if (!as_int(top, &i)) {
+                return vm_error(vm, "array index must be an integer");
+            }
+            ScriptArr *arr = top[-1].a;
+            top[-1] = i >= 1 && i <= arr->n ? arr->items[i - 1] : nil;
+            vm->sp--;
+            break;
+        }
+        case OP_SETINDEX: {
+            int64_t i;
+            ScriptValue *target = top - 2;
+            if (target->type != SV_ARR) {
+                return vm_error(vm, "cannot index %s", type_name(target->type));
+            }
+            if (!as_int(top - 1, &i) || i < 1 || i > (int64_t)target->a->n + 1) {
+                return vm_error(vm, "array index out of range");
+            }
+            if (i == target->a->n + 1) {
+                if (!arr_push(vm, target->a, *top)) {  // one past the end appends
+                    return false;
+                }
+            } else {
+                target->a->items[i - 1] = *top;
+            }
+            vm->sp -= 3;
+            break;
+        }
+        case OP_ARRAY: {
+            ScriptValue arr;
+            if (!new_arr(vm, (uint32_t)in.arg, &arr)) {
+                return false;
+            }
+            vm->sp -= (size_t)in.arg;
+            memcpy(arr.a->items, &vm->stack[vm->sp], (size_t)in.arg * sizeof(ScriptValue));
+            arr.a->n = (uint32_t)in.arg;
+            vm->stack[vm->sp++] = arr;
+            break;
+        }
+        case OP_CALL: {
+            ScriptValue r;
+            vm->sp -= (size_t)in.arg;
+            if (!do_call(vm, &vm->stack[vm->sp], (size_t)in.arg, &r)) {
+                return false;
+            }
+            vm->stack[vm->sp++] = r;
+            break;
+        }
+        case OP_LEN:
+            if (top->type != SV_STR && top->type != SV_ARR && top->type != SV_NIL) {
+                return vm_error(vm, "len() of %s", type_name(top->type));
+            }
+            top->i = top->type == SV_STR ? top->s->len : top->type == SV_ARR ? top->a->n : 0;
+            top->type = SV_INT;
+            break;
+        case OP_INT: {
+            int64_t i;
+            if (as_int(top, &i)) {
+                top->type = SV_INT;
+                top->i = i;
+            } else {
+                *top = nil;  // not a number
+            }
+            break;
+        }
+        case OP_STR: {
+            ScriptStr *s;
+            if (top->type != SV_NIL) {
+                if (!as_str(vm, top, &s)) {
+                    return false;
+                }
+                top->type = SV_STR;
+                top->s = s;
+            }
+            break;
+        }
+        case OP_PUSH:
+            if (top[-1].type != SV_ARR) {
+                return vm_error(vm, "push() onto %s", type_name(top[-1].type));
+            }
+            if (!arr_push(vm, top[-1].a, *top)) {
+                return false;
+            }
+            vm->sp--;
+            break;
+        case OP_RETURN:
+            run->result = vm->stack[--vm->sp];
+            return true;
+        }
+    }
+}
+
+static bool make_args(VM *vm, char **strs, size_t n, ScriptValue *out) {
+    if (!new_arr(vm, (uint32_t)n, out)) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!new_str(vm, strs[i], strlen(strs[i]), &out->a->items[i])) {
+            return false;
+        }
+    }
+    out->a->n = (uint32_t)n;
+    return true;
+}
+
+// The result goes out as one reply, so it must fit in k_max_msg once
+// encoded. Arrays are shared, not copied: a few pushes build a result
+// far larger than the memory cap, or one that contains itself.
+static bool check_result(VM *vm, const ScriptValue *v, int depth, size_t *size) {
+    if (depth > k_script_max_nesting) {
+        return vm_error(vm, "result nested too deeply");
+    }
+    switch (v->type) {
+    case SV_NIL:
+        *size += 1;
+        break;
+    case SV_INT:
+        *size += 1 + 8;
+        break;
+    case SV_STR:
+        *size += 1 + 4 + v->s->len;
+        break;
+    case SV_ARR:
+        *size += 1 + 4;
+        for (uint32_t i = 0; i < v->a->n && *size <= k_max_msg; i++) {
+            if (!check_result(vm, &v->a->items[i], depth + 1, size)) {
+                return false;
+            }
+        }
+        break;
+    }
+    if (*size > k_max_msg) {
+        return vm_error(vm, "result too large");
+    }
+    return true;
+}
+
+bool script_run(ScriptProgram *prog, char **keys, size_t n_keys, char **args, size_t n_args,
+                ScriptRun *run) {
+    run->result.type = SV_NIL;
+    run->err[0] = '\0';
+    run->steps = 0;
+    run->arena = NULL;
+    run->arena_bytes = 0;
+
+    VM vm = {.prog = prog, .run = run, .pc = 0, .sp = 0};
+    vm.vars = arena_alloc(run, prog->n_vars * sizeof(ScriptValue));
+    if (!vm.vars) {
+        return vm_error(&vm, "script memory limit reached");
+    }
+    memset(vm.vars, 0, prog->n_vars * sizeof(ScriptValue));  // all nil
+    if (!make_args(&vm, keys, n_keys, &vm.vars[0]) || !make_args(&vm, args, n_args, &vm.vars[1])) {
+        return false;
+    }
+    size_t size = 0;
+    return vm_exec(&vm) && check_result(&vm, &run->result, 0, &size);
+}
+
+void script_run_done(ScriptRun *run) {
+    while (run->arena) {
+        ArenaChunk *next = run->arena->next;
+        free(run->arena);
+        run->arena = next;
+    }
+    run->arena_bytes = 0;
+    run->result.type = SV_NIL;
+}
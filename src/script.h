@@ -0,0 +1,92 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "buffer.h"
+#include "sha1.h"
+
+// Server-side scripts for read-modify-write sequences that would otherwise
+// take several round trips. A script runs inside the event loop, so nothing
+// else touches the keyspace while it does.
+//
+// The language is small and C-like, compiled once to bytecode for a stack
+// VM and cached by the SHA-1 of its source:
+//
+//   n = int(call("get", KEYS[1]));
+//   if (n == nil) { n = 0; }
+//   if (n >= int(ARGV[1])) { return nil; }
+//   call("set", KEYS[1], n + 1);
+//   return n + 1;
+//
+// Values are nil, 64-bit integers, strings and arrays. Strings that hold
+// integers convert implicitly in arithmetic and comparisons. Statements are
+// assignments (to a name or to a[i]), if/else, while, break, return and
+// expression statements. Operators, lowest first:
+//   ||  &&  == != < <= > >=  + - ..  * / %  unary - !
+// Builtins: call(cmd, args...), len(x), int(x), str(x), push(arr, v).
+// KEYS and ARGV are arrays, indexed from 1. Array literals are [a, b, ...].
+//
+// Every run has an instruction budget and a memory cap: a runaway loop
+// fails with an error instead of stalling every other client. So does a
+// result nested more than 32 arrays deep or larger than one reply.
+#define k_script_max_mem (64 << 20)
+
+typedef enum {
+    SV_NIL = 0,
+    SV_INT,
+    SV_STR,
+    SV_ARR,
+} ScriptType;
+
+typedef struct ScriptValue {
+    ScriptType type;
+    union {
+        int64_t i;
+        struct ScriptStr *s;
+        struct ScriptArr *a;
+    };
+} ScriptValue;
+
+typedef struct ScriptStr {
+    uint32_t len;
+    char data[];  // NUL-terminated
+} ScriptStr;
+
+typedef struct ScriptArr {
+    uint32_t n;
+    uint32_t cap;
+    ScriptValue *items;
+} ScriptArr;
+
+typedef struct ScriptProgram ScriptProgram;
+
+// Runs one command for call(), appending its tagged reply to `reply`
+typedef void (*script_call_fn)(void *ctx, char **argv, size_t argc, Buffer *reply);
+
+typedef struct ScriptRun {
+    // in
+    script_call_fn call;
+    void *ctx;
+    uint64_t max_steps;
+    // out
+    ScriptValue result;        // valid until script_run_done()
+    char err[256];             // set when script_run() fails
+    uint64_t steps;
+    struct ArenaChunk *arena;  // every value of the run
+    size_t arena_bytes;
+} ScriptRun;
+
+// Compile and cache a script. NULL with the error in err on a syntax error.
+ScriptProgram *script_load(const char *src, size_t len, char sha[SHA1_HEX_SIZE],
+                           char *err, size_t err_size);
+ScriptProgram *script_find(const char *sha);  // NULL if not cached
+void script_flush(void);
+size_t script_count(void);
+
+bool script_run(ScriptProgram *prog, char **keys, size_t n_keys, char **args, size_t n_args,
+                ScriptRun *run);
+void script_run_done(ScriptRun *run);  // frees the values of the run
+
+#endif
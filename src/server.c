@@ -4,22 +4,55 @@
 #include <stddef.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 #include <errno.h>
 #include <poll.h>
+#include <stdarg.h>
+#include <time.h>
+#include <malloc.h>
+#include <math.h>
+#include <fnmatch.h>
+#include <ctype.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include "common.h"
 #include "buffer.h"
 #include "kv.h"
+#include "protocol.h"
+#include "cluster.h"
+#include "latency.h"
+#include "hash.h"
+#include "quicklist.h"
+#include "heap.h"
+#include "pubsub.h"
+#include "stream.h"
+#include "bitmap.h"
+#include "hll.h"
+#include "zset.h"
+#include "geo.h"
+#include "script.h"
+#include "resp.h"
+#include "dump.h"
+#include "commands.h"
+#include "cmdhash.h"
 
-#define k_max_msg 4096
-#define k_max_args 200 * 1000
+// Initial size of the per-connection buffers, they grow on demand
+#define k_buf_init 4096
+// Most pieces handed to one writev()
+#define k_max_iov 64
+
+#define container_of(ptr, T, member) \
+    ((T *)( (char *)ptr - offsetof(T, member) ))
 
 enum {
     STATE_REQ = 0,  // reading request
     STATE_RES = 1,  // sending response
-    STATE_END = 2   // mark for deletion
+    STATE_END = 2,  // mark for deletion
+    STATE_BLOCKED = 3  // parked by a blocking pop, see conn_block()
 };
 
 typedef enum {
@@ -34,25 +67,57 @@ enum {
     RES_NX = 2
 };
 
-// --- Serialization Protocol Definitions ---
-enum {
-    ERR_UNKNOWN = 1,
-    ERR_TOO_BIG = 2
-};
+// Startup options, see parse_args()
+typedef struct ServerConfig {
+    uint16_t port;
+    char unixsocket[108];    // also listen on this AF_UNIX path, "" = off
+    uint32_t unixsocket_perm;  // chmod() the socket to this, 0 = leave the umask's
+    char announce_host[64];  // how other cluster nodes and clients reach us
+    size_t maxmemory;        // 0 = unlimited
+    EvictPolicy maxmemory_policy;
+    uint32_t maxmemory_samples;
+    LatClock latency_clock;
+    uint64_t slowlog_slower_than_us;
+    size_t slowlog_max_len;
+    // Pub/Sub output limits, 0 = off. A subscriber is dropped once its
+    // unsent output passes the hard limit, or stays above the soft one
+    // for the given time: one slow reader must not pin unbounded memory.
+    size_t pubsub_limit_hard;
+    size_t pubsub_limit_soft;
+    uint32_t pubsub_limit_soft_secs;
+    bool ordered_index;  // keep a sorted key index for RANGE/PREFIX
+    uint64_t script_max_steps;  // instruction budget of one EVAL
+    bool verbose;  // echo every request to stdout
+} ServerConfig;
 
-enum {
-    TAG_NIL = 0,
-    TAG_ERR = 1,
-    TAG_STR = 2,
-    TAG_INT = 3,
-    TAG_DBL = 4,
-    TAG_ARR = 5,
+static ServerConfig g_config = {
+    .port = 6379,
+    .announce_host = "127.0.0.1",
+    .maxmemory = 0,
+    .maxmemory_policy = EVICT_NONE,
+    .maxmemory_samples = 5,
+    .latency_clock = LAT_CLOCK_MONOTONIC,
+    .slowlog_slower_than_us = 10000,
+    .slowlog_max_len = 128,
+    .pubsub_limit_hard = 32 << 20,
+    .pubsub_limit_soft = 8 << 20,
+    .pubsub_limit_soft_secs = 60,
+    .script_max_steps = 1000000,
 };
 
+// One piece of a connection's output, see conn_send_msg()
+typedef struct OutItem {
+    SharedMsg *msg;  // NULL: the next `len` bytes of wbuf
+    size_t len;      // bytes left (wbuf piece) or the message size
+    size_t off;      // bytes of msg already sent
+} OutItem;
+
 // Context of a connection
 typedef struct Conn {
     int fd;
     int state;  // STATE_REQ or STATE_RES
+    Proto proto;       // picked from the first bytes, see resp_detect()
+    size_t resp_need;  // RESP: bytes needed before parsing again
     // rbuf and wbuf are in the userspace (heap memory), not in the kernel
     /*
     // read buffer
@@ -65,8 +130,64 @@ typedef struct Conn {
     */
     Buffer rbuf;
     Buffer wbuf;
+    bool asking;  // cluster: the previous command was "asking"
+    uint32_t reply_flags;  // RESP transcoding of the reply being built, see resp_flags()
+    // Blocking pops
+    struct Waiter *waiters;  // one per key this connection waits on
+    size_t n_waiters;
+    bool block_head;         // BLPOP pops the head, BRPOP the tail
+    size_t timer_idx;        // position in g_timers, SIZE_MAX if no timeout
+    // Pub/Sub. Published messages are queued by reference; replies still
+    // go to wbuf, and outq keeps both in order once a message is queued.
+    PubSubClient ps;
+    OutItem *outq;
+    size_t outq_head;
+    size_t outq_len;
+    size_t outq_cap;
+    size_t outq_msg_bytes;     // unsent bytes of the queued messages
+    size_t wbuf_queued;        // wbuf bytes already covered by outq items
+    uint64_t soft_limit_since; // ms when it went over the soft limit, 0 if not
+    // MULTI/EXEC. Queued commands run back to back in EXEC, so no other
+    // client's command runs in between.
+    bool in_multi;
+    bool multi_failed;  // a command was refused while queueing, EXEC aborts
+    int32_t multi_slot; // cluster: slot of the keys queued so far, -1 if none
+    struct QueuedCmd *multi_cmds;
+    size_t n_multi_cmds;
+    size_t cap_multi_cmds;
+    struct WatchedKey *watched;  // EXEC aborts if any of these changed
+    size_t n_watched;
 } Conn;
 
+// Counters reported by INFO.
+// The event loop is single-threaded, so these are plain increments:
+// no atomics or locks on the hot path, cheap enough to leave on.
+typedef struct ServerStats {
+    time_t start_time;
+    size_t connected_clients;
+    size_t blocked_clients;
+    uint64_t total_connections;
+    uint64_t pubsub_limit_disconnects;
+    uint64_t total_commands;
+    uint64_t cmd_calls[CMD_COUNT];
+    uint64_t cmd_rejected[CMD_COUNT];  // wrong number of arguments
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+} ServerStats;
+
+static ServerStats g_stats;
+
+// Service time of every command, by CMD_* id
+static LatHist g_cmd_latency[CMD_COUNT];
+
+// Stats of one command run, from the event loop or from EXEC
+static void record_call(int id, uint64_t elapsed_ns, char **cmd, size_t n_cmd) {
+    g_stats.cmd_calls[id]++;
+    g_stats.total_commands++;
+    lat_record(&g_cmd_latency[id], elapsed_ns);
+    slowlog_maybe_add(elapsed_ns, cmd, n_cmd);
+}
+
 // Use fd as the index (key)
 // Use a dynamic array of pointer (Conn *) as a map <fd, Conn *>
 // fds are managed by OS kernel, live in a kernel-side table
@@ -93,7 +214,208 @@ static void conn_put(Conn *conn) {
     fd2conn[conn->fd] = conn;
 }
 
+// --- Blocked connections and timers ---
+
+// A connection waiting on one key, queued FIFO behind earlier waiters
+typedef struct Waiter {
+    struct Waiter *prev;
+    struct Waiter *next;
+    struct BlockedKey *bk;
+    Conn *conn;
+} Waiter;
+
+// Waiter queue of one key, lives in g_blocked_keys while non-empty
+typedef struct BlockedKey {
+    HNode node;
+    char *key;
+    Waiter *head;
+    Waiter *tail;
+} BlockedKey;
+
+static HMap g_blocked_keys;
+
+// Min-heap of blocking timeouts (deadline in ms); ref points at Conn::timer_idx
+static HeapItem *g_timers = NULL;
+static size_t g_timers_len = 0;
+static size_t g_timers_cap = 0;
+
+static uint64_t get_monotonic_ms(void) {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_nsec / 1000000;
+}
+
+static void timer_add(Conn *conn, uint64_t deadline_ms) {
+    if (g_timers_len == g_timers_cap) {
+        g_timers_cap = g_timers_cap ? g_timers_cap * 2 : 16;
+        g_timers = realloc(g_timers, g_timers_cap * sizeof(HeapItem));
+        if (!g_timers) {
+            die("Memory allocation failed");
+        }
+    }
+    g_timers[g_timers_len].val = deadline_ms;
+    g_timers[g_timers_len].ref = &conn->timer_idx;
+    g_timers_len++;
+    heap_update(g_timers, g_timers_len - 1, g_timers_len);
+}
+
+static void timer_remove(Conn *conn) {
+    size_t pos = conn->timer_idx;
+    if (pos == SIZE_MAX) {
+        return;
+    }
+    // fill the hole with the last item
+    g_timers[pos] = g_timers[--g_timers_len];
+    if (pos < g_timers_len) {
+        heap_update(g_timers, pos, g_timers_len);
+    }
+    conn->timer_idx = SIZE_MAX;
+}
+
+// poll() timeout: -1 (forever) without timers
+static int next_timer_ms(void) {
+    if (g_timers_len == 0) {
+        return -1;
+    }
+    uint64_t now = get_monotonic_ms();
+    uint64_t next = g_timers[0].val;
+    if (next <= now) {
+        return 0;
+    }
+    uint64_t wait = next - now;
+    return wait > INT32_MAX ? INT32_MAX : (int)wait;
+}
+
+static bool blocked_key_eq(HNode *lhs, HNode *rhs) {
+    BlockedKey *l = container_of(lhs, BlockedKey, node);
+    BlockedKey *r = container_of(rhs, BlockedKey, node);
+    return strcmp(l->key, r->key) == 0;
+}
+
+static BlockedKey *blocked_key_lookup(const char *key) {
+    BlockedKey probe;
+    probe.key = (char *)key;
+    probe.node.hcode = kv_hash(key, strlen(key));
+    HNode *node = hm_lookup(&g_blocked_keys, &probe.node, blocked_key_eq);
+    return node ? container_of(node, BlockedKey, node) : NULL;
+}
+
+// Park the connection on the waiter queue of every key.
+// timeout_ms == 0 blocks forever.
+static void conn_block(Conn *conn, char **keys, size_t n_keys, bool head, uint64_t timeout_ms) {
+    conn->waiters = calloc(n_keys, sizeof(Waiter));
+    if (!conn->waiters) {
+        die("Memory allocation failed");
+    }
+    conn->n_waiters = n_keys;
+    conn->block_head = head;
+    for (size_t i = 0; i < n_keys; i++) {
+        BlockedKey *bk = blocked_key_lookup(keys[i]);
+        if (!bk) {
+            bk = calloc(1, sizeof(BlockedKey));
+            if (!bk) {
+                die("Memory allocation failed");
+            }
+            bk->key = strdup(keys[i]);
+            bk->node.hcode = kv_hash(keys[i], strlen(keys[i]));
+            hm_insert(&g_blocked_keys, &bk->node);
+        }
+        Waiter *w = &conn->waiters[i];
+        w->conn = conn;
+        w->bk = bk;
+        w->prev = bk->tail;
+        if (bk->tail) {
+            bk->tail->next = w;
+        } else {
+            bk->head = w;
+        }
+        bk->tail = w;
+    }
+    if (timeout_ms) {
+        timer_add(conn, get_monotonic_ms() + timeout_ms);
+    }
+    conn->state = STATE_BLOCKED;
+    g_stats.blocked_clients++;
+}
+
+// Leave every waiter queue and drop the timeout.
+// The caller decides the next state.
+static void conn_unblock(Conn *conn) {
+    for (size_t i = 0; i < conn->n_waiters; i++) {
+        Waiter *w = &conn->waiters[i];
+        BlockedKey *bk = w->bk;
+        if (w->prev) {
+            w->prev->next = w->next;
+        } else {
+            bk->head = w->next;
+        }
+        if (w->next) {
+            w->next->prev = w->prev;
+        } else {
+            bk->tail = w->prev;
+        }
+        if (!bk->head) {
+            hm_delete(&g_blocked_keys, &bk->node, blocked_key_eq);
+            free(bk->key);
+            free(bk);
+        }
+    }
+    free(conn->waiters);
+    conn->waiters = NULL;
+    conn->n_waiters = 0;
+    timer_remove(conn);
+    g_stats.blocked_clients--;
+}
+
+// --- Transaction state ---
+
+// A command queued between MULTI and EXEC: argv and its strings are one block
+typedef struct QueuedCmd {
+    char **argv;
+    size_t argc;
+} QueuedCmd;
+
+typedef struct WatchedKey {
+    char *key;
+    uint32_t version;  // kv_version() when it was watched
+} WatchedKey;
+
+static void multi_reset(Conn *conn) {
+    for (size_t i = 0; i < conn->n_multi_cmds; i++) {
+        free(conn->multi_cmds[i].argv);
+    }
+    conn->n_multi_cmds = 0;
+    conn->in_multi = false;
+    conn->multi_failed = false;
+    conn->multi_slot = -1;
+}
+
+static void unwatch_all(Conn *conn) {
+    for (size_t i = 0; i < conn->n_watched; i++) {
+        free(conn->watched[i].key);
+    }
+    free(conn->watched);
+    conn->watched = NULL;
+    conn->n_watched = 0;
+}
+
 static void conn_destroy(Conn *conn) {
+    if (conn->waiters) {  // state is already STATE_END here
+        conn_unblock(conn);
+    }
+    ps_unsubscribe_all(&conn->ps);
+    for (size_t i = conn->outq_head; i < conn->outq_len; i++) {
+        if (conn->outq[i].msg) {
+            msg_unref(conn->outq[i].msg);
+        }
+    }
+    free(conn->outq);
+    multi_reset(conn);
+    free(conn->multi_cmds);
+    unwatch_all(conn);
+    g_stats.connected_clients--;
+    buffer_destroy(&conn->rbuf);
+    buffer_destroy(&conn->wbuf);
     if (conn->fd >= 0) {
         close(conn->fd);
         if ((size_t)conn->fd < fd2conn_size) {
@@ -103,8 +425,9 @@ static void conn_destroy(Conn *conn) {
     free(conn);
 }
 
+// Serves both listeners: a TCP or AF_UNIX connection is the same Conn
 static int32_t accept_new_conn(int fd) {
-    struct sockaddr_in client_addr = {0};
+    struct sockaddr_storage client_addr = {0};
     socklen_t addrlen = sizeof(client_addr);
     int conn_fd = accept(fd, (struct sockaddr *)&client_addr, &addrlen);
     if (conn_fd < 0) {
@@ -122,42 +445,111 @@ static int32_t accept_new_conn(int fd) {
     }
     conn->fd = conn_fd;
     conn->state = STATE_REQ;
+    conn->proto = PROTO_UNKNOWN;
+    conn->resp_need = 0;
+    conn->asking = false;
+    conn->waiters = NULL;
+    conn->n_waiters = 0;
+    conn->block_head = false;
+    conn->timer_idx = SIZE_MAX;
+    conn->ps = (PubSubClient){0};
+    conn->outq = NULL;
+    conn->outq_head = 0;
+    conn->outq_len = 0;
+    conn->outq_cap = 0;
+    conn->outq_msg_bytes = 0;
+    conn->wbuf_queued = 0;
+    conn->soft_limit_since = 0;
+    conn->in_multi = false;
+    conn->multi_failed = false;
+    conn->multi_cmds = NULL;
+    conn->n_multi_cmds = 0;
+    conn->cap_multi_cmds = 0;
+    conn->watched = NULL;
+    conn->n_watched = 0;
     /*
     conn->rbuf_size = 0;
     conn->wbuf_size = 0;
     conn->wbuf_sent = 0;
     */
-    buffer_init(&conn->rbuf, k_max_msg);
-    buffer_init(&conn->wbuf, k_max_msg);
+    buffer_init(&conn->rbuf, k_buf_init);
+    buffer_init(&conn->wbuf, k_buf_init);
 
     conn_put(conn);
+    g_stats.connected_clients++;
+    g_stats.total_connections++;
     return 0;
 }
 
-static bool read_u32(const uint8_t **curr, const uint8_t *end, uint32_t *out) {
-    if (*curr + 4 > end) {
-        return false;
+// --- Output queue ---
+
+static bool conn_has_output(Conn *conn) {
+    return buf_read_size(&conn->wbuf) > 0 || conn->outq_head < conn->outq_len;
+}
+
+static void outq_push(Conn *conn, SharedMsg *msg, size_t len) {
+    if (conn->outq_len == conn->outq_cap) {
+        if (conn->outq_head > 0) {  // reuse the sent prefix first
+            conn->outq_len -= conn->outq_head;
+            memmove(conn->outq, conn->outq + conn->outq_head, conn->outq_len * sizeof(OutItem));
+            conn->outq_head = 0;
+        } else {
+            conn->outq_cap = conn->outq_cap ? conn->outq_cap * 2 : 8;
+            conn->outq = realloc(conn->outq, conn->outq_cap * sizeof(OutItem));
+            if (!conn->outq) {
+                die("Memory allocation failed");
+            }
+        }
     }
-    memcpy(out, *curr, 4);
-    *curr += 4;
-    return true;
+    conn->outq[conn->outq_len++] = (OutItem){msg, len, 0};
 }
 
-static bool read_str(const uint8_t **curr, const uint8_t *end, char **out) {
-    uint32_t len = 0;
-    if (!read_u32(curr, end, &len)) {
-        return false;
+// Drop subscribers that fall too far behind
+static void conn_check_output_limit(Conn *conn) {
+    size_t pending = buf_read_size(&conn->wbuf) + conn->outq_msg_bytes;
+    bool over = false;
+    if (g_config.pubsub_limit_hard && pending > g_config.pubsub_limit_hard) {
+        over = true;
+    } else if (g_config.pubsub_limit_soft && pending > g_config.pubsub_limit_soft) {
+        uint64_t now = get_monotonic_ms();
+        if (!conn->soft_limit_since) {
+            conn->soft_limit_since = now;
+        } else if (now - conn->soft_limit_since >= g_config.pubsub_limit_soft_secs * 1000ull) {
+            over = true;
+        }
+    } else {
+        conn->soft_limit_since = 0;
     }
-    if (*curr + len > end) {
-        return false;
+    if (over) {
+        msg("pubsub output limit reached, dropping subscriber");
+        g_stats.pubsub_limit_disconnects++;
+        conn->state = STATE_END;  // destroyed by the event loop
+    }
+}
+
+// Queue a published message without copying it. Replies written to wbuf
+// before it are first wrapped in an item of their own to keep the order.
+static void conn_send_msg(Conn *conn, SharedMsg *msg) {
+    size_t loose = buf_read_size(&conn->wbuf) - conn->wbuf_queued;
+    if (loose) {
+        outq_push(conn, NULL, loose);
+        conn->wbuf_queued += loose;
     }
-    *out = (char *)malloc(len + 1);
-    if (!*out) {
+    msg_ref(msg);
+    outq_push(conn, msg, msg->len);
+    conn->outq_msg_bytes += msg->len;
+    if (conn->state == STATE_REQ) {
+        conn->state = STATE_RES;
+    }
+    conn_check_output_limit(conn);
+}
+
+static bool read_u32(const uint8_t **curr, const uint8_t *end, uint32_t *out) {
+    if (*curr + 4 > end) {
         return false;
     }
-    memcpy(*out, *curr, len);
-    (*out)[len] = '\0';
-    *curr += len;
+    memcpy(out, *curr, 4);
+    *curr += 4;
     return true;
 }
 
@@ -178,6 +570,11 @@ static void out_int(Buffer *out, int64_t val) {
     buf_append_i64(out, val);
 }
 
+static void out_dbl(Buffer *out, double val) {
+    buf_append_u8(out, TAG_DBL);
+    buf_append(out, (const uint8_t *)&val, 8);
+}
+
 static void out_err(Buffer *out, uint32_t code, const char* msg) {
     buf_append_u8(out, TAG_ERR);
     buf_append_u32(out, code);
@@ -193,35 +590,95 @@ static void out_arr(Buffer *out, uint32_t n) {
 
 // --- Response Framing Helpers ---
 
+// header_pos is relative to the read pointer, which stays valid when
+// appending compacts the buffer
 static void response_begin(Buffer *out, size_t *header_pos) {
-    *header_pos = out->w_pos;  // remember where the length header goes
+    *header_pos = buf_read_size(out);  // remember where the length header goes
     buf_append_u32(out, 0);    // reserve 4 bytes for total length (set 0 for now)
 }
 
 static void response_end(Buffer *out, size_t *header_pos) {
     // Calculate how many bytes are written after the 4-bytes header
-    size_t msg_size = out->w_pos - *header_pos - 4;
+    size_t msg_size = buf_read_size(out) - *header_pos - 4;
 
-    // Safety check: has msg_size exceeded the buffer capacity?
-    if (msg_size > out->capacity) {
+    // Safety check: clients refuse replies over k_max_msg, and the length
+    // header has only 32 bits
+    if (msg_size > k_max_msg) {
         // Roll back the write pointer to delete the massive data
-        out->w_pos = *header_pos + 4;
+        out->w_pos = out->r_pos + *header_pos + 4;
         // Write a short error message instead
         out_err(out, ERR_TOO_BIG, "response is too big");
         // Recalculate the newer size
-        msg_size = out->w_pos - *header_pos - 4;
+        msg_size = buf_read_size(out) - *header_pos - 4;
     }
 
     // Go back to the bootmark and overrite the 4-bytes dummy header with the actual size
     uint32_t len = (uint32_t)msg_size;
-    memcpy(out->data + *header_pos, &len, 4);
+    memcpy(buf_read_ptr(out) + *header_pos, &len, 4);
+}
+
+// A connection's replies are built in the tagged format like any other;
+// for a RESP connection the finished reply is then transcoded in place
+static Buffer g_resp_scratch;
+
+static void reply_begin(Conn *conn, size_t *header_pos) {
+    response_begin(&conn->wbuf, header_pos);
+}
+
+// elem_flags: the flags of each element of an EXEC reply, else NULL
+static void reply_end(Conn *conn, size_t header_pos, uint32_t resp_flags,
+                      const uint32_t *elem_flags, size_t n_elems) {
+    response_end(&conn->wbuf, &header_pos);
+    if (conn->proto == PROTO_BINARY) {
+        return;
+    }
+    Buffer *scratch = &g_resp_scratch;
+    if (!scratch->data) {
+        buffer_init(scratch, k_buf_init);
+    }
+    scratch->r_pos = scratch->w_pos = 0;
+    uint8_t *tagged = buf_read_ptr(&conn->wbuf) + header_pos + 4;
+    size_t len = buf_read_size(&conn->wbuf) - header_pos - 4;
+    if (elem_flags) {
+        resp_encode_each(tagged, len, conn->proto, elem_flags, n_elems, scratch);
+    } else {
+        resp_encode(tagged, len, conn->proto, resp_flags, scratch);
+    }
+    conn->wbuf.w_pos = conn->wbuf.r_pos + header_pos;
+    buf_append(&conn->wbuf, buf_read_ptr(scratch), buf_read_size(scratch));
 }
 
 // --- Command Execution ---
 
+static void out_wrongtype(Buffer *out) {
+    out_err(out, ERR_TYPE, "WRONGTYPE Operation against a key holding the wrong kind of value");
+}
+
+static void out_oom(Buffer *out) {
+    out_err(out, ERR_OOM, "OOM command not allowed when used memory > 'maxmemory'");
+}
+
+// Strict base-10 int64, the whole string must be consumed
+static bool parse_int(const char *s, int64_t *out) {
+    char *end = NULL;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    if (errno || end == s || *end != '\0') {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
 static void do_get(char **cmd, Buffer *out) {
-    // Call the logic layer
-    char *val = kv_get(cmd[1]);
+    Entry *ent = kv_find(cmd[1]);
+    if (ent && ent->type != T_STR) {
+        out_wrongtype(out);
+        return;
+    }
+    // Call the logic layer; integers are formatted on demand
+    char ibuf[KV_INT_BUFSIZE];
+    const char *val = ent ? kv_entry_str(ent, ibuf) : NULL;
 
     /*
     // Format the network response
@@ -248,7 +705,10 @@ static void do_get(char **cmd, Buffer *out) {
 }
 
 static void do_set(char **cmd, Buffer *out) {
-    kv_put(cmd[1], cmd[2]);
+    if (!kv_put(cmd[1], cmd[2])) {
+        out_oom(out);
+        return;
+    }
 
     /*
     // Response: OK
@@ -276,6 +736,81 @@ static void do_delete(char **cmd, Buffer *out) {
     out_int(out, existed ? RES_OK : RES_NX);
 }
 
+// mget <key> [key ...], nil for missing and non-string keys
+static void do_mget(char **cmd, size_t n_cmd, Buffer *out) {
+    size_t n = n_cmd - 1;
+    Entry **ents = malloc(n * sizeof(Entry *));
+    if (!ents) {
+        die("Memory allocation failed");
+    }
+    kv_find_many((const char *const *)cmd + 1, n, ents);
+    out_arr(out, (uint32_t)n);
+    char ibuf[KV_INT_BUFSIZE];
+    for (size_t i = 0; i < n; i++) {
+        if (ents[i] && ents[i]->type == T_STR) {
+            const char *val = kv_entry_str(ents[i], ibuf);
+            out_str(out, val, strlen(val));
+        } else {
+            out_nil(out);
+        }
+    }
+    free(ents);
+}
+
+// mset <key> <value> [key value ...], all keys are written or none (OOM)
+static void do_mset(char **cmd, size_t n_cmd, Buffer *out) {
+    size_t n = (n_cmd - 1) / 2;
+    const char **keys = malloc(n * 2 * sizeof(char *));
+    if (!keys) {
+        die("Memory allocation failed");
+    }
+    const char **vals = keys + n;
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = cmd[1 + 2 * i];
+        vals[i] = cmd[2 + 2 * i];
+    }
+    if (kv_put_many(keys, vals, n)) {
+        out_nil(out);
+    } else {
+        out_oom(out);
+    }
+    free(keys);
+}
+
+// incr|decr <key>, incrby|decrby <key> <delta>
+static void do_incr(char **cmd, size_t n_cmd, int64_t sign, Buffer *out) {
+    int64_t delta = 1;
+    if (n_cmd == 3 && !parse_int(cmd[2], &delta)) {
+        out_err(out, ERR_UNKNOWN, "value is not an integer or out of range");
+        return;
+    }
+    if (sign < 0) {
+        if (delta == INT64_MIN) {
+            out_err(out, ERR_UNKNOWN, "decrement would overflow");
+            return;
+        }
+        delta = -delta;
+    }
+    int64_t result = 0;
+    switch (kv_incr(cmd[1], delta, &result)) {
+    case INCR_OK:
+        out_int(out, result);
+        break;
+    case INCR_OOM:
+        out_oom(out);
+        break;
+    case INCR_WRONGTYPE:
+        out_wrongtype(out);
+        break;
+    case INCR_NOT_INT:
+        out_err(out, ERR_UNKNOWN, "value is not an integer or out of range");
+        break;
+    case INCR_OVERFLOW:
+        out_err(out, ERR_UNKNOWN, "increment or decrement would overflow");
+        break;
+    }
+}
+
 // The callback: takes a string and appends it to the Buffer (*arg).
 static bool cb_keys(const char *key, void *arg) {
     Buffer *out = (Buffer *)arg;
@@ -291,185 +826,3071 @@ static void do_keys(Buffer *out) {
     kv_foreach(cb_keys, out);
 }
 
-static void do_request(char **cmd, size_t n_cmd, Buffer *wbuf) {
-    if (n_cmd == 2 && strcmp(cmd[0], "get") == 0) {
-        do_get(cmd, wbuf);
-    } else if (n_cmd == 3 && strcmp(cmd[0], "set") == 0) {
-        do_set(cmd, wbuf);
-    } else if (n_cmd == 2 && strcmp(cmd[0], "del") == 0) {
-        do_delete(cmd, wbuf);
-    } else if (n_cmd == 1 && strcmp(cmd[0], "keys") == 0) {
-        do_keys(wbuf);
-    } else {
-        /*
-        uint32_t status = RES_ERR;
-        char *msg = "Unknown command";
-        uint32_t msg_len = strlen(msg);
-        uint32_t total_len = 4 + msg_len;
+// --- Typed keys ---
 
-        buf_append(wbuf, (uint8_t *)&total_len, 4);
-        buf_append(wbuf, (uint8_t *)&status, 4);
-        buf_append(wbuf, (uint8_t *)msg, msg_len);
-        */
-        out_err(wbuf, ERR_UNKNOWN, "unknown command");
+// Look up a key that must hold `type` (or not exist).
+// Writes WRONGTYPE and returns false otherwise.
+static bool lookup_typed(const char *key, uint32_t type, Entry **ent, Buffer *out) {
+    *ent = kv_find(key);
+    if (*ent && (*ent)->type != type) {
+        out_wrongtype(out);
+        return false;
     }
+    return true;
 }
 
-// Main parsing loop
-static ReqStatus try_one_request(Conn *conn) {
-    Buffer *rbuf = &conn->rbuf;
-    // Buffer *wbuf = &conn->wbuf;
+// Find or create the key a write goes to, evicting first if needed.
+// `incoming` is the worst-case growth in bytes. NULL after writing an error.
+static Entry *lookup_for_write(const char *key, uint32_t type, size_t incoming, Buffer *out) {
+    if (!kv_reserve(sizeof(Entry) + strlen(key) + 1 + incoming)) {
+        out_oom(out);
+        return NULL;
+    }
+    Entry *ent = NULL;
+    if (!lookup_typed(key, type, &ent, out)) {
+        return NULL;
+    }
+    if (!ent) {
+        void *value = NULL;
+        switch (type) {
+        case T_HASH:
+            value = hash_new();
+            break;
+        case T_LIST:
+            value = ql_new();
+            break;
+        case T_STREAM:
+            value = stream_new();
+            break;
+        case T_BITMAP:
+            value = bm_new();
+            break;
+        case T_HLL:
+            value = hll_new();
+            break;
+        case T_ZSET:
+            value = zset_new();
+            break;
+        }
+        ent = kv_insert(key, type, value);
+    }
+    return ent;
+}
 
-    // 1. Check for the 4-byte header
-    if (buf_read_size(rbuf) < 4) {
-        return REQ_INCOMPLETE;
+// Bytes taken by cmd[from..n_cmd), used to size kv_reserve()
+static size_t args_size(char **cmd, size_t from, size_t n_cmd) {
+    size_t total = 0;
+    for (size_t i = from; i < n_cmd; i++) {
+        total += strlen(cmd[i]) + 1;
     }
+    return total;
+}
 
-    uint32_t len = 0;
-    memcpy(&len, buf_read_ptr(rbuf), 4);
-    if (len > k_max_msg) {
-        msg("too long");
-        conn->state = STATE_END;
-        return REQ_ERROR;
+// --- Hashes ---
+
+// hset <key> <field> <value> [field value ...], returns the number of new fields
+static void do_hset(char **cmd, size_t n_cmd, Buffer *out) {
+    size_t incoming = sizeof(Hash) + args_size(cmd, 2, n_cmd);
+    Entry *ent = lookup_for_write(cmd[1], T_HASH, incoming, out);
+    if (!ent) {
+        return;
     }
-    // Do not proceed to parse until we read the full message
-    if (4 + len > buf_read_size(rbuf)) {
-        return REQ_INCOMPLETE;  // wait for more data
+    size_t old_mem = kv_entry_mem(ent);
+    int64_t added = 0;
+    for (size_t i = 2; i + 1 < n_cmd; i += 2) {
+        added += hash_set(ent->hash, cmd[i], (uint32_t)strlen(cmd[i]),
+                          cmd[i + 1], (uint32_t)strlen(cmd[i + 1]));
     }
+    kv_entry_changed(ent, old_mem);
+    out_int(out, added);
+}
 
-    // 2. Parse payload
-    const uint8_t *curr = buf_read_ptr(rbuf) + 4;
-    const uint8_t *end = curr + len;
-
-    uint32_t n_cmd = 0;
-    if (!read_u32(&curr, end, &n_cmd)) {
-        conn->state = STATE_END;
-        return REQ_ERROR;
+static void do_hget(char **cmd, Buffer *out) {
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_HASH, &ent, out)) {
+        return;
     }
-    if (n_cmd > 16) {  // safety limit on args
-        conn->state = STATE_END;
-        return REQ_ERROR;
+    Hash *hash = ent ? ent->hash : NULL;
+    uint32_t len = 0;
+    const char *val = hash ? hash_get(hash, cmd[2], (uint32_t)strlen(cmd[2]), &len) : NULL;
+    if (val) {
+        out_str(out, val, len);
+    } else {
+        out_nil(out);
     }
+}
 
-    // Parse list of strings
-    char *cmd[16];
-    for (uint32_t i = 0; i < n_cmd; i++) {
-        if (!read_str(&curr, end, &cmd[i])) {
-            // Cleanup already parsed strings on error
-            for (uint32_t j = 0; j < i; j++) {
-                free(cmd[j]);
-            }
-            conn->state = STATE_END;
-            return REQ_ERROR;
+// hdel <key> <field> [field ...], returns the number of removed fields
+static void do_hdel(char **cmd, size_t n_cmd, Buffer *out) {
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_HASH, &ent, out)) {
+        return;
+    }
+    int64_t removed = 0;
+    if (ent) {
+        size_t old_mem = kv_entry_mem(ent);
+        for (size_t i = 2; i < n_cmd; i++) {
+            removed += hash_del(ent->hash, cmd[i], (uint32_t)strlen(cmd[i]));
+        }
+        kv_entry_changed(ent, old_mem);
+        if (hash_len(ent->hash) == 0) {
+            kv_del(cmd[1]);  // empty hashes do not exist
         }
     }
+    out_int(out, removed);
+}
 
-    // 3. Got a full message
-    printf("client says: %.*s\n", len, buf_read_ptr(rbuf) + 4);
-
-    // 4. Execute command (Generate response)
-    /*
-    const char *reply = "world";
-    uint32_t reply_len = (uint32_t)strlen(reply);
-
-    memcpy(&conn->wbuf[0], &reply_len, 4);
-    memcpy(&conn->wbuf[4], reply, reply_len);
-    conn->wbuf_size = 4 + reply_len;
-    conn->wbuf_sent = 0;
-
-    buf_append(wbuf, (const uint8_t *)&reply_len, 4);
-    buf_append(wbuf, (const uint8_t *)reply, reply_len);
+static bool cb_hgetall(const char *field, uint32_t field_len,
+                       const char *val, uint32_t val_len, void *arg) {
+    Buffer *out = (Buffer *)arg;
+    out_str(out, field, field_len);
+    out_str(out, val, val_len);
+    return true;
+}
 
-    // 5. Remove the request from rbuf (left shift)
-    size_t remain = conn->rbuf_size - (4 + len);
-    if (remain) {
-        memmove(conn->rbuf, &conn->rbuf[4 + len], remain);
+// Flat array of field/value pairs
+static void do_hgetall(char **cmd, Buffer *out) {
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_HASH, &ent, out)) {
+        return;
     }
-    conn->rbuf_size = remain;
-
-    // 6. Change connection state to response
-    conn->state = STATE_RES;
-
-    // Commit the write
-    wbuf->w_pos += (4 + reply_len);
-    */
-    // Use serialization formats
-    // Total length + Serialized payload (depending on the response data type)
-    size_t header_pos = 0;
-    response_begin(&conn->wbuf, &header_pos);
-    do_request(cmd, n_cmd, &conn->wbuf);
-    response_end(&conn->wbuf, &header_pos);
-
-    // 5. Cleanup
-    for (uint32_t i = 0; i < n_cmd; i++) {
-        free(cmd[i]);
+    Hash *hash = ent ? ent->hash : NULL;
+    out_arr(out, hash ? (uint32_t)hash_len(hash) * 2 : 0);
+    if (hash) {
+        hash_foreach(hash, cb_hgetall, out);
     }
-
-    // Consume request from rbuf
-    buf_consume(rbuf, 4 + len);
-
-    return REQ_PROCESSED;
 }
 
-static void handle_read(Conn *conn) {
-    /*
-    assert(conn->rbuf_size < sizeof(conn->rbuf));
-    ssize_t rv = read(conn->fd, &conn->rbuf[conn->rbuf_size], sizeof(conn->rbuf) - conn->rbuf_size);
-    */
-    buf_reserve(&conn->rbuf, 1024);
-    ssize_t rv = read(conn->fd, buf_write_ptr(&conn->rbuf), buf_write_space(&conn->rbuf));
-
-    if (rv <= 0) {
-        if (rv == 0) {  // Handle EOF
-            msg("client closed connection");
-        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {  // Not ready, try again later.
-            return;
-        } else {
-            msg("read error");
-        }
-        conn->state = STATE_END;
+static void do_hlen(char **cmd, Buffer *out) {
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_HASH, &ent, out)) {
         return;
     }
+    Hash *hash = ent ? ent->hash : NULL;
+    out_int(out, hash ? (int64_t)hash_len(hash) : 0);
+}
 
-    // Mark bytes as written
-    // conn->rbuf_size += (size_t)rv;
-    conn->rbuf.w_pos += (size_t)rv;
-
-    // Pipelining loop
-    // While there is enough data for a full request, keep processing.
-    while (try_one_request(conn) == REQ_PROCESSED) {
-        /*
-        ReqStatus status = try_one_request(conn);
+// --- Lists ---
 
-        if (status == REQ_INCOMPLETE) break;  // Normal break
-        if (status == REQ_ERROR) {
-            conn->state = STATE_END;  // Mark for closing
-            break;
-        }
-        // If REQ_PROCESSED, continue looping to see if there is another request
+// Pop one element off an existing list into `out` as [key, value];
+// deletes the key once the list is empty
+static void pop_reply(Entry *ent, bool head, Buffer *out) {
+    uint32_t len = 0;
+    const char *val = ql_peek(ent->list, head, &len);
+    out_arr(out, 2);
+    out_str(out, ent->key, strlen(ent->key));
+    out_str(out, val, len);
+    size_t old_mem = kv_entry_mem(ent);
+    ql_pop(ent->list, head);
+    kv_entry_changed(ent, old_mem);
+    if (ql_len(ent->list) == 0) {
+        kv_del(ent->key);
+    }
+}
 
-        // Check: If a response is generated and the connection is switched to "Response Mode"
-        // stop reading and go send the response.
-        if (conn->state == STATE_RES) {
-            break;  // Stop processing new requests so the wbuf is not overwritten
+// Hand elements of a list that just grew to the connections blocked on it,
+// oldest waiter first, one element each
+static void serve_blocked(const char *key) {
+    BlockedKey *bk = NULL;
+    while ((bk = blocked_key_lookup(key)) != NULL) {
+        Entry *ent = kv_find(key);
+        if (!ent || ent->type != T_LIST) {
+            return;
         }
-        */
+        Conn *conn = bk->head->conn;
+        size_t header_pos = 0;
+        reply_begin(conn, &header_pos);
+        pop_reply(ent, conn->block_head, &conn->wbuf);  // may free ent
+        reply_end(conn, header_pos, 0, NULL, 0);
+        conn_unblock(conn);  // may free bk
+        conn->state = STATE_RES;
     }
+}
 
-    // If we have data in wbuf, we want to write it out
-    if (buf_read_size(&conn->wbuf) > 0) {
+// Reply nil to connections whose blocking timeout has passed
+static void process_timers(void) {
+    uint64_t now = get_monotonic_ms();
+    while (g_timers_len > 0 && g_timers[0].val <= now) {
+        Conn *conn = container_of(g_timers[0].ref, Conn, timer_idx);
+        size_t header_pos = 0;
+        reply_begin(conn, &header_pos);
+        out_nil(&conn->wbuf);
+        reply_end(conn, header_pos, 0, NULL, 0);
+        conn_unblock(conn);  // also removes the timer
         conn->state = STATE_RES;
     }
 }
 
-static void handle_write(Conn *conn) {
-    /*
-    assert(conn->wbuf_size > conn->wbuf_sent);
-    ssize_t rv = write(conn->fd, &conn->wbuf[conn->wbuf_sent], conn->wbuf_size - conn->wbuf_sent);
-    */
-    ssize_t rv = write(conn->fd, buf_read_ptr(&conn->wbuf), buf_read_size(&conn->wbuf));
+// lpush|rpush <key> <value> [value ...], returns the new length
+static void do_push(char **cmd, size_t n_cmd, bool head, Buffer *out) {
+    // a chunk header per element is a loose upper bound
+    size_t incoming = sizeof(QuickList) + sizeof(QuickNode) + args_size(cmd, 2, n_cmd) + 10 * n_cmd;
+    Entry *ent = lookup_for_write(cmd[1], T_LIST, incoming, out);
+    if (!ent) {
+        return;
+    }
+    size_t old_mem = kv_entry_mem(ent);
+    for (size_t i = 2; i < n_cmd; i++) {
+        ql_push(ent->list, head, cmd[i], (uint32_t)strlen(cmd[i]));
+    }
+    kv_entry_changed(ent, old_mem);
+    out_int(out, (int64_t)ql_len(ent->list));
+    serve_blocked(cmd[1]);
+}
 
-    if (rv <= 0) {
+// lpop|rpop <key>
+static void do_pop(char **cmd, bool head, Buffer *out) {
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_LIST, &ent, out)) {
+        return;
+    }
+    if (!ent) {
+        out_nil(out);
+        return;
+    }
+    uint32_t len = 0;
+    const char *val = ql_peek(ent->list, head, &len);
+    out_str(out, val, len);
+    size_t old_mem = kv_entry_mem(ent);
+    ql_pop(ent->list, head);
+    kv_entry_changed(ent, old_mem);
+    if (ql_len(ent->list) == 0) {
+        kv_del(cmd[1]);  // empty lists do not exist
+    }
+}
+
+// blpop|brpop <key> [key ...] <timeout>
+// Pops from the first non-empty list, or parks the connection until a push
+// or the timeout (seconds, 0 = forever) and then replies nil.
+static void do_bpop(Conn *conn, char **cmd, size_t n_cmd, bool head, Buffer *out) {
+    char *end = NULL;
+    double timeout = strtod(cmd[n_cmd - 1], &end);
+    if (*end != '\0' || end == cmd[n_cmd - 1] || !(timeout >= 0) || timeout > 1e9) {
+        out_err(out, ERR_UNKNOWN, "timeout is not a float or out of range");
+        return;
+    }
+    for (size_t i = 1; i < n_cmd - 1; i++) {
+        Entry *ent = NULL;
+        if (!lookup_typed(cmd[i], T_LIST, &ent, out)) {
+            return;
+        }
+        if (ent) {
+            pop_reply(ent, head, out);
+            return;
+        }
+    }
+    uint64_t timeout_ms = (uint64_t)(timeout * 1000);
+    if (timeout > 0 && timeout_ms == 0) {
+        timeout_ms = 1;  // sub-millisecond timeouts still expire
+    }
+    conn_block(conn, cmd + 1, n_cmd - 2, head, timeout_ms);
+}
+
+static bool cb_lrange(const char *s, uint32_t len, void *arg) {
+    out_str((Buffer *)arg, s, len);
+    return true;
+}
+
+// lrange <key> <start> <stop>, inclusive, negative indexes count from the tail
+static void do_lrange(char **cmd, Buffer *out) {
+    int64_t start = 0, stop = 0;
+    if (!parse_int(cmd[2], &start) || !parse_int(cmd[3], &stop)) {
+        out_err(out, ERR_UNKNOWN, "value is not an integer or out of range");
+        return;
+    }
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_LIST, &ent, out)) {
+        return;
+    }
+    int64_t len = ent ? (int64_t)ql_len(ent->list) : 0;
+    if (start < 0) {
+        start = start + len < 0 ? 0 : start + len;
+    }
+    if (stop < 0) {
+        stop += len;
+    }
+    if (stop >= len) {
+        stop = len - 1;
+    }
+    if (start > stop) {
+        out_arr(out, 0);
+        return;
+    }
+    out_arr(out, (uint32_t)(stop - start + 1));
+    ql_range(ent->list, (size_t)start, (size_t)stop, cb_lrange, out);
+}
+
+// lindex <key> <index>
+static void do_lindex(char **cmd, Buffer *out) {
+    int64_t index = 0;
+    if (!parse_int(cmd[2], &index)) {
+        out_err(out, ERR_UNKNOWN, "value is not an integer or out of range");
+        return;
+    }
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_LIST, &ent, out)) {
+        return;
+    }
+    uint32_t len = 0;
+    const char *val = ent ? ql_index(ent->list, index, &len) : NULL;
+    if (val) {
+        out_str(out, val, len);
+    } else {
+        out_nil(out);
+    }
+}
+
+static void do_llen(char **cmd, Buffer *out) {
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_LIST, &ent, out)) {
+        return;
+    }
+    out_int(out, ent ? (int64_t)ql_len(ent->list) : 0);
+}
+
+// --- Bitmaps ---
+
+// Bit offsets: 0 <= offset < k_bitmap_max_bits
+static bool parse_bit_offset(const char *s, uint64_t *out, Buffer *out_buf) {
+    int64_t v = 0;
+    if (!parse_int(s, &v) || v < 0 || (uint64_t)v >= k_bitmap_max_bits) {
+        out_err(out_buf, ERR_UNKNOWN, "bit offset is not an integer or out of range");
+        return false;
+    }
+    *out = (uint64_t)v;
+    return true;
+}
+
+// setbit <key> <offset> <0|1>, returns the previous bit
+static void do_setbit(char **cmd, Buffer *out) {
+    uint64_t offset = 0;
+    if (!parse_bit_offset(cmd[2], &offset, out)) {
+        return;
+    }
+    if (strcmp(cmd[3], "0") != 0 && strcmp(cmd[3], "1") != 0) {
+        out_err(out, ERR_UNKNOWN, "bit is not an integer or out of range");
+        return;
+    }
+    // only the growth needs room; the pointer is not kept across kv_reserve()
+    Entry *ent = kv_find(cmd[1]);
+    size_t have = ent && ent->type == T_BITMAP ? ent->bitmap->cap : 0;
+    size_t need = (size_t)(offset >> 3) + 1;
+    size_t incoming = sizeof(Bitmap) + (need > have ? 2 * need - have : 0);
+    if (!(ent = lookup_for_write(cmd[1], T_BITMAP, incoming, out))) {
+        return;
+    }
+    size_t old_mem = kv_entry_mem(ent);
+    bool old = bm_set(ent->bitmap, offset, cmd[3][0] == '1');
+    kv_entry_changed(ent, old_mem);
+    out_int(out, old);
+}
+
+// getbit <key> <offset>
+static void do_getbit(char **cmd, Buffer *out) {
+    uint64_t offset = 0;
+    if (!parse_bit_offset(cmd[2], &offset, out)) {
+        return;
+    }
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_BITMAP, &ent, out)) {
+        return;
+    }
+    out_int(out, ent && bm_get(ent->bitmap, offset));
+}
+
+// bitcount <key> [start end], byte range, negative indexes count from the end
+static void do_bitcount(char **cmd, size_t n_cmd, Buffer *out) {
+    int64_t start = 0, end = -1;
+    if (n_cmd == 4 && (!parse_int(cmd[2], &start) || !parse_int(cmd[3], &end))) {
+        out_err(out, ERR_UNKNOWN, "value is not an integer or out of range");
+        return;
+    }
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_BITMAP, &ent, out)) {
+        return;
+    }
+    if (!ent) {
+        out_int(out, 0);
+        return;
+    }
+    int64_t len = (int64_t)bm_len(ent->bitmap);
+    if (start < 0) {
+        start = start + len < 0 ? 0 : start + len;
+    }
+    if (end < 0) {
+        end += len;
+    }
+    if (end < start || start >= len) {
+        out_int(out, 0);
+        return;
+    }
+    out_int(out, (int64_t)bm_count(ent->bitmap, (size_t)start, (size_t)end));
+}
+
+// --- HyperLogLog ---
+
+// pfadd <key> [element ...], 1 if the estimate may have changed
+static void do_pfadd(char **cmd, size_t n_cmd, Buffer *out) {
+    bool existed = kv_find(cmd[1]) != NULL;
+    Entry *ent = lookup_for_write(cmd[1], T_HLL, sizeof(HLL) + k_hll_dense_bytes, out);
+    if (!ent) {
+        return;
+    }
+    size_t old_mem = kv_entry_mem(ent);
+    bool changed = !existed;
+    for (size_t i = 2; i < n_cmd; i++) {
+        changed |= hll_add(ent->hll, cmd[i], strlen(cmd[i]));
+    }
+    kv_entry_changed(ent, old_mem);
+    out_int(out, changed);
+}
+
+// pfcount <key> [key ...], the estimate for the union of the keys
+static void do_pfcount(char **cmd, size_t n_cmd, Buffer *out) {
+    if (n_cmd == 2) {
+        Entry *ent = NULL;
+        if (!lookup_typed(cmd[1], T_HLL, &ent, out)) {
+            return;
+        }
+        out_int(out, ent ? (int64_t)hll_count(ent->hll) : 0);
+        return;
+    }
+    uint8_t *raw = calloc(1, k_hll_registers);
+    if (!raw) {
+        die("Memory allocation failed");
+    }
+    for (size_t i = 1; i < n_cmd; i++) {
+        Entry *ent = NULL;
+        if (!lookup_typed(cmd[i], T_HLL, &ent, out)) {
+            free(raw);
+            return;
+        }
+        if (ent) {
+            hll_max_into(ent->hll, raw);
+        }
+    }
+    out_int(out, (int64_t)hll_count_raw(raw));
+    free(raw);
+}
+
+// pfmerge <dest> [source ...]: dest becomes the union of itself and the sources
+static void do_pfmerge(char **cmd, size_t n_cmd, Buffer *out) {
+    if (!kv_reserve(sizeof(Entry) + strlen(cmd[1]) + 1 + sizeof(HLL) + k_hll_dense_bytes)) {
+        out_oom(out);
+        return;
+    }
+    uint8_t *raw = calloc(1, k_hll_registers);
+    if (!raw) {
+        die("Memory allocation failed");
+    }
+    for (size_t i = 1; i < n_cmd; i++) {
+        Entry *ent = NULL;
+        if (!lookup_typed(cmd[i], T_HLL, &ent, out)) {
+            free(raw);
+            return;
+        }
+        if (ent) {
+            hll_max_into(ent->hll, raw);
+        }
+    }
+    Entry *ent = kv_find(cmd[1]);
+    if (!ent) {
+        ent = kv_insert(cmd[1], T_HLL, hll_new());
+    }
+    size_t old_mem = kv_entry_mem(ent);
+    hll_load_raw(ent->hll, raw);
+    kv_entry_changed(ent, old_mem);
+    free(raw);
+    out_nil(out);
+}
+
+// --- Geo ---
+
+// Meters per unit, false for an unknown unit
+static bool parse_geo_unit(const char *s, double *out) {
+    if (strcasecmp(s, "m") == 0) {
+        *out = 1.0;
+    } else if (strcasecmp(s, "km") == 0) {
+        *out = 1000.0;
+    } else if (strcasecmp(s, "mi") == 0) {
+        *out = 1609.34;
+    } else if (strcasecmp(s, "ft") == 0) {
+        *out = 0.3048;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_dbl(const char *s, double *out) {
+    char *end = NULL;
+    *out = strtod(s, &end);
+    return end != s && *end == '\0' && !isnan(*out);
+}
+
+// geoadd <key> <lon> <lat> <member> [lon lat member ...], returns how many were new
+static void do_geoadd(char **cmd, size_t n_cmd, Buffer *out) {
+    for (size_t i = 2; i < n_cmd; i += 3) {
+        double lon = 0, lat = 0;
+        if (!parse_dbl(cmd[i], &lon) || !parse_dbl(cmd[i + 1], &lat) || !geo_valid(lon, lat)) {
+            out_err(out, ERR_UNKNOWN, "invalid longitude,latitude pair");
+            return;
+        }
+    }
+    size_t incoming = sizeof(ZSet) + (n_cmd / 3) * (sizeof(ZNode) + 2 * sizeof(HNode *))
+                    + args_size(cmd, 2, n_cmd);
+    Entry *ent = lookup_for_write(cmd[1], T_ZSET, incoming, out);
+    if (!ent) {
+        return;
+    }
+    size_t old_mem = kv_entry_mem(ent);
+    int64_t added = 0;
+    for (size_t i = 2; i < n_cmd; i += 3) {
+        double lon = strtod(cmd[i], NULL), lat = strtod(cmd[i + 1], NULL);
+        added += zset_add(ent->zset, cmd[i + 2], strlen(cmd[i + 2]), (double)geo_encode(lon, lat));
+    }
+    kv_entry_changed(ent, old_mem);
+    out_int(out, added);
+}
+
+// Position of a member, false if the key or member is missing
+static bool geo_member_pos(Entry *ent, const char *member, double *lon, double *lat) {
+    ZNode *node = ent ? zset_lookup(ent->zset, member, strlen(member)) : NULL;
+    if (!node) {
+        return false;
+    }
+    geo_decode((uint64_t)node->score, lon, lat);
+    return true;
+}
+
+// geopos <key> <member> [member ...] -> [[lon, lat] | nil, ...]
+static void do_geopos(char **cmd, size_t n_cmd, Buffer *out) {
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_ZSET, &ent, out)) {
+        return;
+    }
+    out_arr(out, (uint32_t)(n_cmd - 2));
+    for (size_t i = 2; i < n_cmd; i++) {
+        double lon = 0, lat = 0;
+        if (geo_member_pos(ent, cmd[i], &lon, &lat)) {
+            out_arr(out, 2);
+            out_dbl(out, lon);
+            out_dbl(out, lat);
+        } else {
+            out_nil(out);
+        }
+    }
+}
+
+// geodist <key> <member1> <member2> [m|km|mi|ft], nil if one is missing
+static void do_geodist(char **cmd, size_t n_cmd, Buffer *out) {
+    double unit = 1.0;
+    if (n_cmd == 5 && !parse_geo_unit(cmd[4], &unit)) {
+        out_err(out, ERR_UNKNOWN, "unsupported unit provided. please use m, km, ft, mi");
+        return;
+    }
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_ZSET, &ent, out)) {
+        return;
+    }
+    double lon1, lat1, lon2, lat2;
+    if (!geo_member_pos(ent, cmd[2], &lon1, &lat1) || !geo_member_pos(ent, cmd[3], &lon2, &lat2)) {
+        out_nil(out);
+        return;
+    }
+    out_dbl(out, geo_distance(lon1, lat1, lon2, lat2) / unit);
+}
+
+typedef struct GeoMatch {
+    const ZNode *node;
+    double dist;  // meters
+    double lon;
+    double lat;
+} GeoMatch;
+
+static int cmp_geo_asc(const void *a, const void *b) {
+    double l = ((const GeoMatch *)a)->dist, r = ((const GeoMatch *)b)->dist;
+    return l < r ? -1 : l > r;
+}
+
+static int cmp_geo_desc(const void *a, const void *b) {
+    return cmp_geo_asc(b, a);
+}
+
+// geosearch <key> frommember <member> | fromlonlat <lon> <lat>
+//           byradius <radius> <unit> | bybox <width> <height> <unit>
+//           [asc|desc] [count <n> [any]] [withcoord] [withdist]
+// Scans the score ranges of at most 9 geohash cells around the center,
+// then keeps the points actually inside the circle or box.
+static void do_geosearch(char **cmd, size_t n_cmd, Buffer *out) {
+    double lon = 0, lat = 0, radius = -1, width = -1, height = -1, unit = 1.0;
+    const char *from_member = NULL;
+    bool from_lonlat = false, any = false, with_coord = false, with_dist = false;
+    int order = 0;  // -1 desc, 0 none, 1 asc
+    size_t count = 0;
+    for (size_t i = 2; i < n_cmd; i++) {
+        const char *opt = cmd[i];
+        size_t left = n_cmd - i - 1;
+        if (strcasecmp(opt, "frommember") == 0 && left >= 1) {
+            from_member = cmd[++i];
+        } else if (strcasecmp(opt, "fromlonlat") == 0 && left >= 2) {
+            if (!parse_dbl(cmd[i + 1], &lon) || !parse_dbl(cmd[i + 2], &lat) || !geo_valid(lon, lat)) {
+                out_err(out, ERR_UNKNOWN, "invalid longitude,latitude pair");
+                return;
+            }
+            from_lonlat = true;
+            i += 2;
+        } else if (strcasecmp(opt, "byradius") == 0 && left >= 2) {
+            if (!parse_dbl(cmd[i + 1], &radius) || radius < 0 || !parse_geo_unit(cmd[i + 2], &unit)) {
+                out_err(out, ERR_UNKNOWN, "invalid radius or unit");
+                return;
+            }
+            i += 2;
+        } else if (strcasecmp(opt, "bybox") == 0 && left >= 3) {
+            if (!parse_dbl(cmd[i + 1], &width) || width < 0 || !parse_dbl(cmd[i + 2], &height)
+                || height < 0 || !parse_geo_unit(cmd[i + 3], &unit)) {
+                out_err(out, ERR_UNKNOWN, "invalid box size or unit");
+                return;
+            }
+            i += 3;
+        } else if (strcasecmp(opt, "asc") == 0) {
+            order = 1;
+        } else if (strcasecmp(opt, "desc") == 0) {
+            order = -1;
+        } else if (strcasecmp(opt, "count") == 0 && left >= 1) {
+            int64_t n = 0;
+            if (!parse_int(cmd[++i], &n) || n <= 0) {
+                out_err(out, ERR_UNKNOWN, "COUNT must be > 0");
+                return;
+            }
+            count = (size_t)n;
+        } else if (strcasecmp(opt, "any") == 0) {
+            any = true;
+        } else if (strcasecmp(opt, "withcoord") == 0) {
+            with_coord = true;
+        } else if (strcasecmp(opt, "withdist") == 0) {
+            with_dist = true;
+        } else {
+            out_err(out, ERR_UNKNOWN, "syntax error");
+            return;
+        }
+    }
+    if (!from_member == !from_lonlat || (radius < 0) == (width < 0) || (any && !count)) {
+        out_err(out, ERR_UNKNOWN, "syntax error");
+        return;
+    }
+
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_ZSET, &ent, out)) {
+        return;
+    }
+    if (from_member && !geo_member_pos(ent, from_member, &lon, &lat)) {
+        if (ent) {
+            out_err(out, ERR_UNKNOWN, "could not decode requested zset member");
+        } else {
+            out_arr(out, 0);
+        }
+        return;
+    }
+    if (!ent) {
+        out_arr(out, 0);
+        return;
+    }
+    if (count && !any && !order) {
+        order = 1;  // COUNT keeps the nearest ones
+    }
+
+    double half_w = radius >= 0 ? radius * unit : width * unit / 2;
+    double half_h = radius >= 0 ? radius * unit : height * unit / 2;
+    GeoRange ranges[9];
+    size_t n_ranges = geo_area_ranges(lon, lat, half_w, half_h, ranges);
+
+    GeoMatch *matches = NULL;
+    size_t n_matches = 0, cap = 0;
+    for (size_t r = 0; r < n_ranges && !(any && n_matches >= count); r++) {
+        ZIter it;
+        ZNode *node = zset_seekge(ent->zset, (double)ranges[r].min, "", 0, &it);
+        for (; node && node->score < (double)ranges[r].max; node = zset_next(&it)) {
+            GeoMatch m = {node, 0, 0, 0};
+            geo_decode((uint64_t)node->score, &m.lon, &m.lat);
+            if (radius >= 0) {
+                m.dist = geo_distance(lon, lat, m.lon, m.lat);
+                if (m.dist > half_w) {
+                    continue;
+                }
+            } else {
+                // north-south along the meridian, east-west along the point's parallel
+                if (geo_distance(lon, lat, lon, m.lat) > half_h
+                    || geo_distance(lon, m.lat, m.lon, m.lat) > half_w) {
+                    continue;
+                }
+                m.dist = geo_distance(lon, lat, m.lon, m.lat);
+            }
+            if (n_matches == cap) {
+                cap = cap ? cap * 2 : 16;
+                matches = realloc(matches, cap * sizeof(GeoMatch));
+                if (!matches) {
+                    die("Memory allocation failed");
+                }
+            }
+            matches[n_matches++] = m;
+            if (any && n_matches >= count) {
+                break;
+            }
+        }
+    }
+    if (order) {
+        qsort(matches, n_matches, sizeof(GeoMatch), order > 0 ? cmp_geo_asc : cmp_geo_desc);
+    }
+    if (count && n_matches > count) {
+        n_matches = count;
+    }
+
+    out_arr(out, (uint32_t)n_matches);
+    for (size_t i = 0; i < n_matches; i++) {
+        const GeoMatch *m = &matches[i];
+        if (!with_coord && !with_dist) {
+            out_str(out, m->node->name, m->node->len);
+            continue;
+        }
+        out_arr(out, 1 + with_dist + with_coord);
+        out_str(out, m->node->name, m->node->len);
+        if (with_dist) {
+            out_dbl(out, m->dist / unit);
+        }
+        if (with_coord) {
+            out_arr(out, 2);
+            out_dbl(out, m->lon);
+            out_dbl(out, m->lat);
+        }
+    }
+    free(matches);
+}
+
+// --- Pub/Sub ---
+
+// The reply to a (un)subscribe command is one array with a
+// [kind, name, subscriptions left] row per channel or pattern
+static void out_sub_row(Buffer *out, const char *kind, const char *name, Conn *conn) {
+    out_arr(out, 3);
+    out_str(out, kind, strlen(kind));
+    if (name) {
+        out_str(out, name, strlen(name));
+    } else {
+        out_nil(out);
+    }
+    out_int(out, (int64_t)conn->ps.n_subs);
+}
+
+// subscribe <channel>... | psubscribe <pattern>...
+static void do_subscribe(Conn *conn, char **cmd, size_t n_cmd, bool pattern, Buffer *out) {
+    out_arr(out, (uint32_t)(n_cmd - 1));
+    for (size_t i = 1; i < n_cmd; i++) {
+        ps_subscribe(&conn->ps, cmd[i], pattern);
+        out_sub_row(out, pattern ? "psubscribe" : "subscribe", cmd[i], conn);
+    }
+}
+
+// unsubscribe [channel]... | punsubscribe [pattern]...
+// Without arguments, leaves every channel (or every pattern)
+static void do_unsubscribe(Conn *conn, char **cmd, size_t n_cmd, bool pattern, Buffer *out) {
+    const char *kind = pattern ? "punsubscribe" : "unsubscribe";
+    if (n_cmd > 1) {
+        out_arr(out, (uint32_t)(n_cmd - 1));
+        for (size_t i = 1; i < n_cmd; i++) {
+            ps_unsubscribe(&conn->ps, cmd[i], pattern);
+            out_sub_row(out, kind, cmd[i], conn);
+        }
+        return;
+    }
+
+    uint32_t n = 0;
+    for (size_t i = 0; i < conn->ps.n_subs; i++) {
+        n += conn->ps.subs[i]->topic->pattern == pattern;
+    }
+    if (n == 0) {
+        out_arr(out, 1);
+        out_sub_row(out, kind, NULL, conn);
+        return;
+    }
+    out_arr(out, n);
+    size_t i = 0;
+    while (i < conn->ps.n_subs) {
+        Topic *topic = conn->ps.subs[i]->topic;
+        if (topic->pattern != pattern) {
+            i++;
+            continue;
+        }
+        // the name goes out first: it is freed with the topic
+        out_arr(out, 3);
+        out_str(out, kind, strlen(kind));
+        out_str(out, topic->name, strlen(topic->name));
+        ps_unsubscribe(&conn->ps, topic->name, pattern);
+        out_int(out, (int64_t)conn->ps.n_subs);
+    }
+}
+
+typedef struct PublishArg {
+    const char *channel;
+    const char *payload;
+    Buffer frame;  // scratch, reused for each matching topic
+    Buffer resp;   // scratch for the RESP encodings
+} PublishArg;
+
+// The message as a RESP subscriber receives it, made on first use
+static SharedMsg *resp_msg(PublishArg *pa, Proto proto, SharedMsg **cache) {
+    if (!*cache) {
+        Buffer *resp = &pa->resp;
+        if (!resp->data) {
+            buffer_init(resp, buf_read_size(&pa->frame) + 64);
+        }
+        resp->r_pos = resp->w_pos = 0;
+        resp_encode(buf_read_ptr(&pa->frame) + 4, buf_read_size(&pa->frame) - 4, proto,
+                    RESP_PUSH, resp);
+        *cache = msg_new(buf_read_ptr(resp), buf_read_size(resp));
+    }
+    return *cache;
+}
+
+// Encode the message once per matching topic, as a complete response
+// frame, and queue the same bytes to all of its subscribers
+static void cb_deliver(Topic *topic, void *arg) {
+    PublishArg *pa = (PublishArg *)arg;
+    Buffer *frame = &pa->frame;
+    frame->r_pos = frame->w_pos = 0;
+
+    size_t header_pos = 0;
+    response_begin(frame, &header_pos);
+    if (topic->pattern) {
+        out_arr(frame, 4);
+        out_str(frame, "pmessage", 8);
+        out_str(frame, topic->name, strlen(topic->name));
+    } else {
+        out_arr(frame, 3);
+        out_str(frame, "message", 7);
+    }
+    out_str(frame, pa->channel, strlen(pa->channel));
+    out_str(frame, pa->payload, strlen(pa->payload));
+    response_end(frame, &header_pos);
+
+    SharedMsg *msg = msg_new(buf_read_ptr(frame), buf_read_size(frame));
+    SharedMsg *resp2 = NULL, *resp3 = NULL;
+    for (size_t i = 0; i < topic->n_subs; i++) {
+        Conn *conn = container_of(topic->subs[i]->client, Conn, ps);
+        if (conn->state == STATE_END) {  // already over its output limit
+            continue;
+        }
+        if (conn->proto == PROTO_RESP2) {
+            conn_send_msg(conn, resp_msg(pa, PROTO_RESP2, &resp2));
+        } else if (conn->proto == PROTO_RESP3) {
+            conn_send_msg(conn, resp_msg(pa, PROTO_RESP3, &resp3));
+        } else {
+            conn_send_msg(conn, msg);
+        }
+    }
+    msg_unref(msg);
+    if (resp2) {
+        msg_unref(resp2);
+    }
+    if (resp3) {
+        msg_unref(resp3);
+    }
+}
+
+// publish <channel> <message>
+static void do_publish(char **cmd, Buffer *out) {
+    PublishArg pa = {cmd[1], cmd[2], {0}, {0}};
+    buffer_init(&pa.frame, 64 + strlen(cmd[1]) + strlen(cmd[2]));
+    size_t receivers = ps_publish(cmd[1], cb_deliver, &pa);
+    buffer_destroy(&pa.frame);
+    if (pa.resp.data) {
+        buffer_destroy(&pa.resp);
+    }
+    out_int(out, (int64_t)receivers);
+}
+
+// memory usage <key> | memory stats
+static void do_memory(char **cmd, size_t n_cmd, Buffer *out) {
+    if (n_cmd == 3 && strcasecmp(cmd[1], "usage") == 0) {
+        size_t usage = kv_mem_usage(cmd[2]);
+        if (usage) {
+            out_int(out, (int64_t)usage);
+        } else {
+            out_nil(out);
+        }
+    } else if (n_cmd == 2 && strcasecmp(cmd[1], "stats") == 0) {
+        KVStats st;
+        kv_stats(&st);
+        // flat array of name/value pairs
+        const char *policy = kv_policy_name(g_config.maxmemory_policy);
+        out_arr(out, 10);
+        out_str(out, "used_memory", 11);
+        out_int(out, (int64_t)st.used_memory);
+        out_str(out, "maxmemory", 9);
+        out_int(out, (int64_t)st.maxmemory);
+        out_str(out, "maxmemory_policy", 16);
+        out_str(out, policy, strlen(policy));
+        out_str(out, "evicted_keys", 12);
+        out_int(out, (int64_t)st.evicted_keys);
+        out_str(out, "rejected_writes", 15);
+        out_int(out, (int64_t)st.rejected_writes);
+    } else {
+        out_err(out, ERR_UNKNOWN, "unknown memory subcommand");
+    }
+}
+
+// --- Cluster ---
+
+// Returns true if this node serves the key, otherwise writes a redirect
+static bool check_key_slot(bool asking, const char *key, Buffer *out) {
+    if (!cluster_enabled()) {
+        return true;
+    }
+    uint16_t slot = 0;
+    const ClusterNode *node = NULL;
+    char msg[128];
+    switch (cluster_route(key, asking, &slot, &node)) {
+    case ROUTE_SELF:
+        return true;
+    case ROUTE_MOVED:
+        snprintf(msg, sizeof(msg), "MOVED %u %s:%u", slot, node->host, node->port);
+        out_err(out, ERR_MOVED, msg);
+        return false;
+    case ROUTE_ASK:
+        snprintf(msg, sizeof(msg), "ASK %u %s:%u", slot, node->host, node->port);
+        out_err(out, ERR_ASK, msg);
+        return false;
+    default:
+        snprintf(msg, sizeof(msg), "CLUSTERDOWN hash slot %u is not served", slot);
+        out_err(out, ERR_CLUSTER, msg);
+        return false;
+    }
+}
+
+// Multi-key commands: every key must map to the same slot, which must be ours.
+// Keys are cmd[first], cmd[first + step], ...
+static bool check_keys_slot(bool asking, char **cmd, size_t n_cmd, size_t first, size_t step,
+                            Buffer *out) {
+    if (!cluster_enabled()) {
+        return true;
+    }
+    uint16_t slot = cluster_key_slot(cmd[first]);
+    for (size_t i = first + step; i < n_cmd; i += step) {
+        if (cluster_key_slot(cmd[i]) != slot) {
+            out_err(out, ERR_CLUSTER, "CROSSSLOT Keys in request don't hash to the same slot");
+            return false;
+        }
+    }
+    return check_key_slot(asking, cmd[first], out);
+}
+
+// Keys of one slot, collected before replying so the array size is known
+typedef struct SlotKeys {
+    uint16_t slot;
+    size_t limit;
+    size_t n;
+    const char **keys;
+} SlotKeys;
+
+static bool cb_slot_keys(const char *key, void *arg) {
+    SlotKeys *sk = (SlotKeys *)arg;
+    if (cluster_key_slot(key) != sk->slot) {
+        return true;
+    }
+    if (sk->keys) {
+        sk->keys[sk->n] = key;
+    }
+    sk->n++;
+    return sk->n < sk->limit;
+}
+
+static bool parse_slot(const char *s, uint16_t *slot) {
+    uint16_t hi = 0;
+    return cluster_parse_range(s, slot, &hi) && *slot == hi;
+}
+
+static int parse_node(const char *s) {
+    char host[64];
+    uint16_t port = 0;
+    if (!cluster_parse_addr(s, host, sizeof(host), &port)) {
+        return CLUSTER_NO_NODE;
+    }
+    return cluster_node_intern(host, port);
+}
+
+// End of the run of slots starting at lo that share one owner
+static uint32_t slot_run_end(uint32_t lo) {
+    int owner = cluster_slot_owner((uint16_t)lo);
+    uint32_t hi = lo;
+    while (hi + 1 < CLUSTER_SLOTS && cluster_slot_owner((uint16_t)(hi + 1)) == owner) {
+        hi++;
+    }
+    return hi;
+}
+
+// Returns an array of [lo, hi, "host:port"] for every assigned slot range
+static void do_cluster_slots(Buffer *out) {
+    uint32_t n_ranges = 0;
+    for (uint32_t lo = 0; lo < CLUSTER_SLOTS; lo = slot_run_end(lo) + 1) {
+        n_ranges += cluster_slot_owner((uint16_t)lo) != CLUSTER_NO_NODE;
+    }
+    out_arr(out, n_ranges);
+    for (uint32_t lo = 0; lo < CLUSTER_SLOTS; lo = slot_run_end(lo) + 1) {
+        const ClusterNode *node = cluster_node(cluster_slot_owner((uint16_t)lo));
+        if (!node) {
+            continue;
+        }
+        char addr[96];
+        int len = snprintf(addr, sizeof(addr), "%s:%u", node->host, node->port);
+        out_arr(out, 3);
+        out_int(out, lo);
+        out_int(out, slot_run_end(lo));
+        out_str(out, addr, (size_t)len);
+    }
+}
+
+static void do_cluster_setslot(char **cmd, size_t n_cmd, Buffer *out) {
+    uint16_t slot = 0;
+    if (!parse_slot(cmd[2], &slot)) {
+        out_err(out, ERR_UNKNOWN, "invalid slot");
+        return;
+    }
+    if (n_cmd == 4 && strcasecmp(cmd[3], "stable") == 0) {
+        cluster_set_stable(slot);
+        out_nil(out);
+        return;
+    }
+    int node = n_cmd == 5 ? parse_node(cmd[4]) : CLUSTER_NO_NODE;
+    if (node == CLUSTER_NO_NODE) {
+        out_err(out, ERR_UNKNOWN, "expected: cluster setslot <slot> migrating|importing|node <host:port>");
+        return;
+    }
+    if (strcasecmp(cmd[3], "migrating") == 0) {
+        if (cluster_slot_owner(slot) != CLUSTER_SELF) {
+            out_err(out, ERR_CLUSTER, "slot is not owned by this node");
+            return;
+        }
+        cluster_set_migrating(slot, node);
+    } else if (strcasecmp(cmd[3], "importing") == 0) {
+        cluster_set_importing(slot, node);
+    } else if (strcasecmp(cmd[3], "node") == 0) {
+        cluster_assign(slot, slot, node);  // also ends any migration
+    } else {
+        out_err(out, ERR_UNKNOWN, "unknown setslot action");
+        return;
+    }
+    out_nil(out);
+}
+
+static void do_cluster(char **cmd, size_t n_cmd, Buffer *out) {
+    const char *sub = n_cmd >= 2 ? cmd[1] : "";
+    if (n_cmd == 3 && strcasecmp(sub, "keyslot") == 0) {
+        out_int(out, cluster_key_slot(cmd[2]));
+        return;
+    }
+    if (!cluster_enabled()) {
+        out_err(out, ERR_CLUSTER, "cluster support disabled");
+        return;
+    }
+
+    uint16_t slot = 0;
+    if (n_cmd == 2 && strcasecmp(sub, "slots") == 0) {
+        do_cluster_slots(out);
+    } else if (n_cmd == 2 && strcasecmp(sub, "info") == 0) {
+        uint32_t assigned = 0, owned = 0;
+        for (uint32_t i = 0; i < CLUSTER_SLOTS; i++) {
+            assigned += cluster_slot_owner((uint16_t)i) != CLUSTER_NO_NODE;
+            owned += cluster_slot_owner((uint16_t)i) == CLUSTER_SELF;
+        }
+        char info[256];
+        int len = snprintf(info, sizeof(info),
+            "cluster_state:%s\r\ncluster_slots_assigned:%u\r\ncluster_slots_owned:%u\r\n",
+            assigned == CLUSTER_SLOTS ? "ok" : "fail", assigned, owned);
+        out_str(out, info, (size_t)len);
+    } else if (n_cmd == 3 && strcasecmp(sub, "countkeysinslot") == 0 && parse_slot(cmd[2], &slot)) {
+        SlotKeys sk = {slot, SIZE_MAX, 0, NULL};
+        kv_foreach(cb_slot_keys, &sk);
+        out_int(out, (int64_t)sk.n);
+    } else if (n_cmd == 4 && strcasecmp(sub, "getkeysinslot") == 0 && parse_slot(cmd[2], &slot)) {
+        int64_t limit = 0;
+        if (!parse_int(cmd[3], &limit) || limit < 0) {
+            out_err(out, ERR_UNKNOWN, "Invalid or out of range count");
+            return;
+        }
+        // The slot cannot hold more keys than the keyspace
+        if ((uint64_t)limit > kv_size()) {
+            limit = (int64_t)kv_size();
+        }
+        if (limit == 0) {
+            out_arr(out, 0);
+            return;
+        }
+        SlotKeys sk = {slot, (size_t)limit, 0, NULL};
+        sk.keys = malloc(sk.limit * sizeof(const char *));
+        if (!sk.keys) {
+            die("Memory allocation failed");
+        }
+        kv_foreach(cb_slot_keys, &sk);
+        out_arr(out, (uint32_t)sk.n);
+        for (size_t i = 0; i < sk.n; i++) {
+            out_str(out, sk.keys[i], strlen(sk.keys[i]));
+        }
+        free(sk.keys);
+    } else if ((n_cmd == 4 || n_cmd == 5) && strcasecmp(sub, "setslot") == 0) {
+        do_cluster_setslot(cmd, n_cmd, out);
+    } else {
+        out_err(out, ERR_UNKNOWN, "unknown cluster subcommand");
+    }
+}
+
+// dump <key>: the value as a RESTORE payload, nil if missing
+static void do_dump(char **cmd, Buffer *out) {
+    Entry *ent = kv_find(cmd[1]);
+    if (!ent) {
+        out_nil(out);
+        return;
+    }
+    char *payload = dump_value(ent);
+    out_str(out, payload, strlen(payload));
+    free(payload);
+}
+
+// restore <key> <payload> [replace]
+// Recreates a key from its DUMP payload. An existing key is only
+// overwritten with REPLACE.
+static void do_restore(char **cmd, size_t n_cmd, Buffer *out) {
+    bool replace = n_cmd == 4 && strcasecmp(cmd[3], "replace") == 0;
+    if (n_cmd > 4 || (n_cmd == 4 && !replace)) {
+        out_err(out, ERR_UNKNOWN, "syntax error");
+        return;
+    }
+    // The decoded value takes about half the payload's bytes
+    if (!kv_reserve(sizeof(Entry) + strlen(cmd[1]) + 1 + strlen(cmd[2]) / 2)) {
+        out_oom(out);
+        return;
+    }
+    if (!replace && kv_find(cmd[1])) {
+        out_err(out, ERR_UNKNOWN, "BUSYKEY Target key name already exists");
+        return;
+    }
+    uint32_t type = 0;
+    void *value = NULL;
+    if (!restore_value(cmd[2], &type, &value)) {
+        out_err(out, ERR_UNKNOWN, "DUMP payload version or format are wrong");
+        return;
+    }
+    kv_del(cmd[1]);
+    if (type == T_STR) {
+        bool ok = kv_put(cmd[1], value);
+        free(value);
+        if (!ok) {
+            out_oom(out);
+            return;
+        }
+    } else {
+        kv_insert(cmd[1], type, value);
+        if (type == T_LIST) {
+            serve_blocked(cmd[1]);
+        }
+    }
+    out_nil(out);
+}
+
+// migrate <host> <port> <key> [key ...]
+// Copies the keys to the target node, then deletes them locally.
+static void do_migrate(char **cmd, size_t n_cmd, Buffer *out) {
+    ClusterNode dst = {0};
+    char *end = NULL;
+    long port = strtol(cmd[2], &end, 10);
+    if (*end != '\0' || port <= 0 || port > 65535 || strlen(cmd[1]) >= sizeof(dst.host)) {
+        out_err(out, ERR_UNKNOWN, "invalid target address");
+        return;
+    }
+    strcpy(dst.host, cmd[1]);
+    dst.port = (uint16_t)port;
+
+    size_t n_keys = n_cmd - 3;
+    char **keys = malloc(n_keys * sizeof(char *));
+    char **payloads = malloc(n_keys * sizeof(char *));
+    bool *done = malloc(n_keys * sizeof(bool));
+    if (!keys || !payloads || !done) {
+        die("Memory allocation failed");
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < n_keys; i++) {
+        Entry *ent = kv_find(cmd[3 + i]);
+        if (ent) {  // missing keys are skipped
+            keys[n] = cmd[3 + i];
+            payloads[n] = dump_value(ent);
+            n++;
+        }
+    }
+
+    char err[128] = "";
+    int32_t moved = n ? cluster_migrate(&dst, keys, payloads, n, done, err, sizeof(err)) : 0;
+    if (moved < 0) {
+        out_err(out, ERR_UNKNOWN, err);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            if (done[i]) {
+                kv_del(keys[i]);
+            }
+        }
+        if ((size_t)moved < n) {
+            out_err(out, ERR_UNKNOWN, err[0] ? err : "target rejected some keys");
+        } else {
+            out_int(out, moved);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        free(payloads[i]);
+    }
+    free(keys);
+    free(payloads);
+    free(done);
+}
+
+// Map a command name to its CMD_* id. The slot table is a perfect hash
+// (see gen_cmdhash.c): each name can only be in one slot, so one compare
+// tells a command from any other string.
+static int lookup_cmd(const char *name) {
+    uint32_t slot = cmd_hash(name, k_cmdhash_seed) & ((1u << k_cmdhash_bits) - 1);
+    int id = k_cmdhash_slots[slot];
+    return id != CMD_UNKNOWN && strcasecmp(name, k_cmds[id].name) == 0 ? id : CMD_UNKNOWN;
+}
+
+// --- Streams ---
+
+static uint64_t get_wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void out_stream_id(Buffer *out, const StreamID *id) {
+    char buf[STREAM_ID_BUFSIZE];
+    stream_format_id(id, buf);
+    out_str(out, buf, strlen(buf));
+}
+
+static void out_bad_id(Buffer *out) {
+    out_err(out, ERR_UNKNOWN, "Invalid stream ID specified as stream command argument");
+}
+
+// Range bounds: "-", "+" or an ID. A bare <ms> covers the whole millisecond.
+static bool parse_range_id(const char *s, bool is_end, StreamID *out) {
+    if (strcmp(s, "-") == 0) {
+        *out = (StreamID){0, 0};
+        return true;
+    }
+    if (strcmp(s, "+") == 0) {
+        *out = (StreamID){UINT64_MAX, UINT64_MAX};
+        return true;
+    }
+    return stream_parse_id(s, is_end ? UINT64_MAX : 0, out);
+}
+
+// The smallest ID above id, false if there is none
+static bool stream_id_incr(StreamID *id) {
+    if (++id->seq == 0) {
+        return ++id->ms != 0;
+    }
+    return true;
+}
+
+// [id, [field, value, ...]]
+static bool cb_out_entry(const StreamEntry *e, void *arg) {
+    Buffer *out = (Buffer *)arg;
+    out_arr(out, 2);
+    out_stream_id(out, &e->id);
+    out_arr(out, e->n_strs);
+    const uint8_t *p = e->strs;
+    for (uint32_t i = 0; i < e->n_strs; i++) {
+        const char *s = NULL;
+        uint32_t len = 0;
+        p = stream_next_str(p, &s, &len);
+        out_str(out, s, len);
+    }
+    return true;
+}
+
+// xadd <key> <id|*> <field> <value> [field value ...]
+static void do_xadd(char **cmd, size_t n_cmd, Buffer *out) {
+    StreamID id;
+    bool auto_id = strcmp(cmd[2], "*") == 0;
+    if (!auto_id && !stream_parse_id(cmd[2], 0, &id)) {
+        out_bad_id(out);
+        return;
+    }
+    size_t incoming = sizeof(Stream) + sizeof(StreamBlock) + 256 + args_size(cmd, 3, n_cmd) + 10 * n_cmd;
+    Entry *ent = lookup_for_write(cmd[1], T_STREAM, incoming, out);
+    if (!ent) {
+        return;
+    }
+    size_t old_mem = kv_entry_mem(ent);
+    StreamID added;
+    bool ok = stream_add(ent->stream, auto_id ? NULL : &id, get_wall_ms(),
+                         cmd + 3, n_cmd - 3, &added);
+    kv_entry_changed(ent, old_mem);
+    if (!ok) {
+        if (stream_len(ent->stream) == 0 && !ent->stream->n_groups) {
+            kv_del(cmd[1]);  // do not leave the key we just created
+        }
+        out_err(out, ERR_UNKNOWN,
+                "The ID specified in XADD is equal or smaller than the target stream top item");
+        return;
+    }
+    out_stream_id(out, &added);
+}
+
+static void do_xlen(char **cmd, Buffer *out) {
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_STREAM, &ent, out)) {
+        return;
+    }
+    out_int(out, ent ? (int64_t)stream_len(ent->stream) : 0);
+}
+
+// Parse "count <n>" at cmd[*i], if present
+static bool parse_count_opt(char **cmd, size_t n_cmd, size_t *i, size_t *count, Buffer *out) {
+    if (*i + 1 < n_cmd && strcasecmp(cmd[*i], "count") == 0) {
+        int64_t n = 0;
+        if (!parse_int(cmd[*i + 1], &n) || n < 0) {
+            out_err(out, ERR_UNKNOWN, "value is not an integer or out of range");
+            return false;
+        }
+        *count = (size_t)n;
+        *i += 2;
+    }
+    return true;
+}
+
+// For arrays whose length is only known at the end. The position is
+// relative to the read pointer: appending may compact the buffer.
+static size_t out_arr_begin(Buffer *out) {
+    out_arr(out, 0);
+    return buf_read_size(out) - 4;
+}
+
+static void out_arr_end(Buffer *out, size_t pos, uint32_t n) {
+    memcpy(buf_read_ptr(out) + pos, &n, 4);
+}
+
+typedef struct RangeReply {
+    Buffer *out;
+    uint32_t n;
+} RangeReply;
+
+static bool cb_range_reply(const StreamEntry *e, void *arg) {
+    RangeReply *rr = (RangeReply *)arg;
+    rr->n++;
+    return cb_out_entry(e, rr->out);
+}
+
+// xrange <key> <start> <end> [count <n>]
+static void do_xrange(char **cmd, size_t n_cmd, Buffer *out) {
+    StreamID start, end;
+    if (!parse_range_id(cmd[2], false, &start) || !parse_range_id(cmd[3], true, &end)) {
+        out_bad_id(out);
+        return;
+    }
+    size_t i = 4, count = 0;
+    if (!parse_count_opt(cmd, n_cmd, &i, &count, out)) {
+        return;
+    }
+    if (i != n_cmd) {
+        out_err(out, ERR_UNKNOWN, "syntax error");
+        return;
+    }
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_STREAM, &ent, out)) {
+        return;
+    }
+    RangeReply rr = {out, 0};
+    size_t pos = out_arr_begin(out);
+    if (ent && !(n_cmd > 4 && count == 0)) {
+        stream_range(ent->stream, &start, &end, count, cb_range_reply, &rr);
+    }
+    out_arr_end(out, pos, rr.n);
+}
+
+// Locate "streams <key>... <id>..." starting at cmd[i]. Writes an error
+// and returns false if the keys and IDs do not pair up.
+static bool parse_streams_opt(char **cmd, size_t n_cmd, size_t i, size_t *first_key, size_t *n_keys,
+                              Buffer *out) {
+    if (i >= n_cmd || strcasecmp(cmd[i], "streams") != 0 || (n_cmd - i - 1) == 0 || (n_cmd - i - 1) % 2) {
+        out_err(out, ERR_UNKNOWN, "syntax error");
+        return false;
+    }
+    *first_key = i + 1;
+    *n_keys = (n_cmd - i - 1) / 2;
+    return true;
+}
+
+// xread [count <n>] streams <key>... <id>...
+// Entries after each ID ("$" = the current last one), only for streams
+// that have some; nil if none has.
+static void do_xread(bool asking, char **cmd, size_t n_cmd, Buffer *out) {
+    size_t i = 1, count = 0, first = 0, n_keys = 0;
+    if (!parse_count_opt(cmd, n_cmd, &i, &count, out)
+        || !parse_streams_opt(cmd, n_cmd, i, &first, &n_keys, out)
+        || !check_keys_slot(asking, cmd, first + n_keys, first, 1, out)) {
+        return;
+    }
+
+    size_t start_pos = buf_read_size(out);
+    size_t pos = out_arr_begin(out);
+    uint32_t n_streams = 0;
+    for (size_t k = 0; k < n_keys; k++) {
+        const char *key = cmd[first + k];
+        const char *id_arg = cmd[first + n_keys + k];
+        Entry *ent = kv_find(key);
+        if (ent && ent->type != T_STREAM) {
+            out->w_pos = out->r_pos + start_pos;
+            out_wrongtype(out);
+            return;
+        }
+        StreamID after;
+        if (strcmp(id_arg, "$") == 0) {
+            after = ent ? ent->stream->last_id : (StreamID){0, 0};
+        } else if (!stream_parse_id(id_arg, 0, &after)) {
+            out->w_pos = out->r_pos + start_pos;
+            out_bad_id(out);
+            return;
+        }
+        if (!ent || stream_id_cmp(&ent->stream->last_id, &after) <= 0 || !stream_id_incr(&after)) {
+            continue;  // nothing new
+        }
+        out_arr(out, 2);
+        out_str(out, key, strlen(key));
+        RangeReply rr = {out, 0};
+        size_t entries_pos = out_arr_begin(out);
+        StreamID end = {UINT64_MAX, UINT64_MAX};
+        stream_range(ent->stream, &after, &end, count, cb_range_reply, &rr);
+        out_arr_end(out, entries_pos, rr.n);
+        n_streams++;
+    }
+    if (n_streams == 0) {
+        out->w_pos = out->r_pos + start_pos;
+        out_nil(out);
+        return;
+    }
+    out_arr_end(out, pos, n_streams);
+}
+
+static void out_nogroup(Buffer *out) {
+    out_err(out, ERR_UNKNOWN, "NOGROUP No such key or consumer group");
+}
+
+// Find the group of a stream key, writing the error if there is none
+static StreamGroup *lookup_group(const char *key, const char *group, Entry **ent, Buffer *out) {
+    if (!lookup_typed(key, T_STREAM, ent, out)) {
+        return NULL;
+    }
+    StreamGroup *g = *ent ? stream_group_find((*ent)->stream, group) : NULL;
+    if (!g) {
+        out_nogroup(out);
+    }
+    return g;
+}
+
+// xgroup create <key> <group> <id|$> [mkstream] | xgroup destroy <key> <group>
+static void do_xgroup(char **cmd, size_t n_cmd, Buffer *out) {
+    if (strcasecmp(cmd[1], "destroy") == 0 && n_cmd == 4) {
+        Entry *ent = NULL;
+        if (!lookup_typed(cmd[2], T_STREAM, &ent, out)) {
+            return;
+        }
+        if (!ent) {
+            out_nogroup(out);
+            return;
+        }
+        size_t old_mem = kv_entry_mem(ent);
+        bool destroyed = stream_group_destroy(ent->stream, cmd[3]);
+        kv_entry_changed(ent, old_mem);
+        out_int(out, destroyed ? 1 : 0);
+        return;
+    }
+    bool mkstream = n_cmd == 6 && strcasecmp(cmd[5], "mkstream") == 0;
+    if (strcasecmp(cmd[1], "create") != 0 || (n_cmd != 5 && !mkstream)) {
+        out_err(out, ERR_UNKNOWN, "syntax error");
+        return;
+    }
+    StreamID last = {0, 0};
+    bool dollar = strcmp(cmd[4], "$") == 0;
+    if (!dollar && !stream_parse_id(cmd[4], 0, &last)) {
+        out_bad_id(out);
+        return;
+    }
+
+    Entry *ent = NULL;
+    if (mkstream) {
+        size_t incoming = sizeof(Stream) + sizeof(StreamGroup) + strlen(cmd[3]) + 1;
+        if (!(ent = lookup_for_write(cmd[2], T_STREAM, incoming, out))) {
+            return;
+        }
+    } else {
+        if (!lookup_typed(cmd[2], T_STREAM, &ent, out)) {
+            return;
+        }
+        if (!ent) {
+            out_err(out, ERR_UNKNOWN, "The XGROUP subcommand requires the key to exist");
+            return;
+        }
+    }
+    if (dollar) {
+        last = ent->stream->last_id;
+    }
+    size_t old_mem = kv_entry_mem(ent);
+    StreamGroup *g = stream_group_create(ent->stream, cmd[3], &last);
+    kv_entry_changed(ent, old_mem);
+    if (!g) {
+        out_err(out, ERR_UNKNOWN, "BUSYGROUP Consumer Group name already exists");
+        return;
+    }
+    out_nil(out);
+}
+
+typedef struct GroupRead {
+    Stream *stream;
+    StreamGroup *group;
+    StreamConsumer *consumer;
+    bool noack;
+    uint64_t now_ms;
+    RangeReply rr;
+} GroupRead;
+
+// New entries: hand them to the consumer and remember them as pending
+static bool cb_group_deliver(const StreamEntry *e, void *arg) {
+    GroupRead *gr = (GroupRead *)arg;
+    gr->group->last_delivered = e->id;
+    if (!gr->noack) {
+        stream_pel_add(gr->stream, gr->group, gr->consumer, &e->id, gr->now_ms);
+    }
+    return cb_range_reply(e, &gr->rr);
+}
+
+// History: re-read the consumer's pending entries from the stream
+static bool cb_group_history(StreamPending *p, void *arg) {
+    GroupRead *gr = (GroupRead *)arg;
+    uint32_t before = gr->rr.n;
+    stream_range(gr->stream, &p->id, &p->id, 1, cb_range_reply, &gr->rr);
+    if (gr->rr.n == before) {  // gone from the stream: [id, nil]
+        out_arr(gr->rr.out, 2);
+        out_stream_id(gr->rr.out, &p->id);
+        out_nil(gr->rr.out);
+        gr->rr.n++;
+    }
+    return true;
+}
+
+// xreadgroup group <group> <consumer> [count <n>] [noack] streams <key>... <id>...
+// ">" reads entries never delivered to the group; any other ID reads back
+// this consumer's pending entries after it.
+static void do_xreadgroup(bool asking, char **cmd, size_t n_cmd, Buffer *out) {
+    if (n_cmd < 4 || strcasecmp(cmd[1], "group") != 0) {
+        out_err(out, ERR_UNKNOWN, "syntax error");
+        return;
+    }
+    size_t i = 4, count = 0, first = 0, n_keys = 0;
+    if (!parse_count_opt(cmd, n_cmd, &i, &count, out)) {
+        return;
+    }
+    bool noack = i < n_cmd && strcasecmp(cmd[i], "noack") == 0;
+    i += noack;
+    if (!parse_streams_opt(cmd, n_cmd, i, &first, &n_keys, out)
+        || !check_keys_slot(asking, cmd, first + n_keys, first, 1, out)) {
+        return;
+    }
+
+    // pending entries and consumers, a loose upper bound.
+    // Before the lookups: it may evict.
+    size_t incoming = sizeof(StreamConsumer) + strlen(cmd[3]) + 1
+                    + n_keys * (count ? count : 1024) * sizeof(StreamPending);
+    if (!noack && !kv_reserve(incoming)) {
+        out_oom(out);
+        return;
+    }
+    // Validate everything first: the reads below change group state
+    for (size_t k = 0; k < n_keys; k++) {
+        StreamID id;
+        const char *id_arg = cmd[first + n_keys + k];
+        if (strcmp(id_arg, ">") != 0 && !stream_parse_id(id_arg, 0, &id)) {
+            out_bad_id(out);
+            return;
+        }
+        Entry *ent = NULL;
+        if (!lookup_group(cmd[first + k], cmd[2], &ent, out)) {
+            return;
+        }
+    }
+
+    uint64_t now_ms = get_wall_ms();
+    size_t start_pos = buf_read_size(out);
+    size_t pos = out_arr_begin(out);
+    uint32_t n_streams = 0;
+    for (size_t k = 0; k < n_keys; k++) {
+        const char *key = cmd[first + k];
+        const char *id_arg = cmd[first + n_keys + k];
+        Entry *ent = kv_find(key);
+        Stream *s = ent->stream;
+        size_t old_mem = kv_entry_mem(ent);
+        StreamGroup *g = stream_group_find(s, cmd[2]);
+        GroupRead gr = {s, g, stream_consumer_get(s, g, cmd[3], now_ms), noack, now_ms, {out, 0}};
+
+        size_t stream_pos = buf_read_size(out);
+        out_arr(out, 2);
+        out_str(out, key, strlen(key));
+        size_t entries_pos = out_arr_begin(out);
+        StreamID end = {UINT64_MAX, UINT64_MAX};
+        bool history = strcmp(id_arg, ">") != 0;
+        if (history) {
+            StreamID after;
+            stream_parse_id(id_arg, 0, &after);
+            if (stream_id_incr(&after)) {
+                stream_pel_range(g, &after, &end, count, gr.consumer, cb_group_history, &gr);
+            }
+        } else {
+            StreamID after = g->last_delivered;
+            if (stream_id_incr(&after)) {
+                stream_range(s, &after, &end, count, cb_group_deliver, &gr);
+            }
+        }
+        kv_entry_changed(ent, old_mem);
+        if (gr.rr.n == 0 && !history) {
+            out->w_pos = out->r_pos + stream_pos;  // nothing new on this one
+            continue;
+        }
+        out_arr_end(out, entries_pos, gr.rr.n);
+        n_streams++;
+    }
+    if (n_streams == 0) {
+        out->w_pos = out->r_pos + start_pos;
+        out_nil(out);
+        return;
+    }
+    out_arr_end(out, pos, n_streams);
+}
+
+// xack <key> <group> <id> [id ...], returns how many were pending
+static void do_xack(char **cmd, size_t n_cmd, Buffer *out) {
+    for (size_t i = 3; i < n_cmd; i++) {
+        StreamID id;
+        if (!stream_parse_id(cmd[i], 0, &id)) {
+            out_bad_id(out);
+            return;
+        }
+    }
+    Entry *ent = NULL;
+    if (!lookup_typed(cmd[1], T_STREAM, &ent, out)) {
+        return;
+    }
+    StreamGroup *g = ent ? stream_group_find(ent->stream, cmd[2]) : NULL;
+    if (!g) {
+        out_int(out, 0);
+        return;
+    }
+    size_t old_mem = kv_entry_mem(ent);
+    int64_t acked = 0;
+    for (size_t i = 3; i < n_cmd; i++) {
+        StreamID id;
+        stream_parse_id(cmd[i], 0, &id);
+        acked += stream_ack(ent->stream, g, &id);
+    }
+    kv_entry_changed(ent, old_mem);
+    out_int(out, acked);
+}
+
+typedef struct PendingReply {
+    Buffer *out;
+    uint64_t now_ms;
+    uint32_t n;
+} PendingReply;
+
+// [id, consumer, idle ms, deliveries]
+static bool cb_pending_row(StreamPending *p, void *arg) {
+    PendingReply *pr = (PendingReply *)arg;
+    out_arr(pr->out, 4);
+    out_stream_id(pr->out, &p->id);
+    out_str(pr->out, p->consumer->name, strlen(p->consumer->name));
+    out_int(pr->out, pr->now_ms > p->delivery_ms ? (int64_t)(pr->now_ms - p->delivery_ms) : 0);
+    out_int(pr->out, p->deliveries);
+    pr->n++;
+    return true;
+}
+
+// xpending <key> <group>
+//   -> [pending, smallest id, largest id, [[consumer, pending], ...]]
+// xpending <key> <group> <start> <end> <count> [consumer]
+//   -> [[id, consumer, idle ms, deliveries], ...]
+static void do_xpending(char **cmd, size_t n_cmd, Buffer *out) {
+    StreamID start, end;
+    int64_t count = 0;
+    bool extended = n_cmd >= 6;
+    if (extended && (!parse_range_id(cmd[3], false, &start) || !parse_range_id(cmd[4], true, &end))) {
+        out_bad_id(out);
+        return;
+    }
+    if (extended && (!parse_int(cmd[5], &count) || count < 0)) {
+        out_err(out, ERR_UNKNOWN, "value is not an integer or out of range");
+        return;
+    }
+    Entry *ent = NULL;
+    StreamGroup *g = lookup_group(cmd[1], cmd[2], &ent, out);
+    if (!g) {
+        return;
+    }
+
+    if (extended) {
+        const StreamConsumer *only = NULL;
+        if (n_cmd == 7) {
+            for (size_t i = 0; i < g->n_consumers && !only; i++) {
+                if (strcmp(g->consumers[i]->name, cmd[6]) == 0) {
+                    only = g->consumers[i];
+                }
+            }
+            if (!only) {
+                out_arr(out, 0);
+                return;
+            }
+        }
+        PendingReply pr = {out, get_wall_ms(), 0};
+        size_t pos = out_arr_begin(out);
+        if (count > 0) {
+            stream_pel_range(g, &start, &end, (size_t)count, only, cb_pending_row, &pr);
+        }
+        out_arr_end(out, pos, pr.n);
+        return;
+    }
+
+    out_arr(out, 4);
+    out_int(out, (int64_t)g->pel_count);
+    if (g->pel_count == 0) {
+        out_nil(out);
+        out_nil(out);
+        out_arr(out, 0);
+        return;
+    }
+    out_stream_id(out, &stream_pel_first(g)->id);
+    out_stream_id(out, &stream_pel_last(g)->id);
+    size_t pos = out_arr_begin(out);
+    uint32_t n = 0;
+    for (size_t i = 0; i < g->n_consumers; i++) {
+        StreamConsumer *c = g->consumers[i];
+        if (c->pending) {
+            out_arr(out, 2);
+            out_str(out, c->name, strlen(c->name));
+            out_int(out, (int64_t)c->pending);
+            n++;
+        }
+    }
+    out_arr_end(out, pos, n);
+}
+
+// --- Ordered keys ---
+
+// "[key" inclusive, "(key" exclusive, "-" and "+" for no bound
+static bool parse_key_bound(const char *s, bool is_end, KeyBound *out) {
+    if (strcmp(s, is_end ? "+" : "-") == 0) {
+        out->key = NULL;
+        out->exclusive = false;
+        return true;
+    }
+    if (s[0] != '[' && s[0] != '(') {
+        return false;
+    }
+    out->key = s + 1;
+    out->exclusive = s[0] == '(';
+    return true;
+}
+
+struct scan_arg {
+    Buffer *out;
+    uint32_t n;
+};
+
+// Keys go straight into the reply as the index is walked
+static bool cb_scan_key(const char *key, void *arg) {
+    struct scan_arg *scan = (struct scan_arg *)arg;
+    out_str(scan->out, key, strlen(key));
+    scan->n++;
+    return true;
+}
+
+static bool check_index(Buffer *out) {
+    if (!kv_index_enabled()) {
+        out_err(out, ERR_UNKNOWN, "ordered index is disabled, start the server with --ordered-index");
+        return false;
+    }
+    return true;
+}
+
+// range <start> <end> [count <n>], keys in order
+static void do_range(char **cmd, size_t n_cmd, Buffer *out) {
+    KeyBound start, end;
+    if (!parse_key_bound(cmd[1], false, &start) || !parse_key_bound(cmd[2], true, &end)) {
+        out_err(out, ERR_UNKNOWN, "min or max not valid string range item");
+        return;
+    }
+    size_t i = 3, count = 0;
+    if (!parse_count_opt(cmd, n_cmd, &i, &count, out)) {
+        return;
+    }
+    if (i != n_cmd) {
+        out_err(out, ERR_UNKNOWN, "syntax error");
+        return;
+    }
+    if (!check_index(out)) {
+        return;
+    }
+    struct scan_arg scan = {out, 0};
+    size_t pos = out_arr_begin(out);
+    kv_scan_range(&start, &end, count, cb_scan_key, &scan);
+    out_arr_end(out, pos, scan.n);
+}
+
+// prefix <prefix> [count <n>], keys starting with prefix, in order
+static void do_prefix(char **cmd, size_t n_cmd, Buffer *out) {
+    size_t i = 2, count = 0;
+    if (!parse_count_opt(cmd, n_cmd, &i, &count, out)) {
+        return;
+    }
+    if (i != n_cmd) {
+        out_err(out, ERR_UNKNOWN, "syntax error");
+        return;
+    }
+    if (!check_index(out)) {
+        return;
+    }
+    struct scan_arg scan = {out, 0};
+    size_t pos = out_arr_begin(out);
+    kv_scan_prefix(cmd[1], count, cb_scan_key, &scan);
+    out_arr_end(out, pos, scan.n);
+}
+
+// --- Latency ---
+
+static void out_latency_row(Buffer *out, int id) {
+    const LatHist *hist = &g_cmd_latency[id];
+    out_arr(out, 6);
+    out_str(out, k_cmds[id].name, strlen(k_cmds[id].name));
+    out_int(out, (int64_t)hist->count);
+    out_dbl(out, (double)lat_percentile(hist, 50.0) / 1000.0);
+    out_dbl(out, (double)lat_percentile(hist, 99.0) / 1000.0);
+    out_dbl(out, (double)lat_percentile(hist, 99.9) / 1000.0);
+    out_dbl(out, (double)hist->max / 1000.0);
+}
+
+// latency [command ...]
+//   -> [[name, calls, p50_us, p99_us, p999_us, max_us], ...]
+// latency reset [command ...]
+//   -> number of histograms cleared
+static void do_latency(char **cmd, size_t n_cmd, Buffer *out) {
+    bool reset = n_cmd >= 2 && strcasecmp(cmd[1], "reset") == 0;
+    size_t first = reset ? 2 : 1;
+    bool all = first == n_cmd;
+
+    bool want[CMD_COUNT] = {false};
+    uint32_t n_want = 0;
+    for (int id = 0; id < CMD_COUNT; id++) {
+        want[id] = all && (reset || g_cmd_latency[id].count > 0);
+    }
+    for (size_t i = first; i < n_cmd; i++) {
+        int id = lookup_cmd(cmd[i]);
+        want[id] = true;
+    }
+    for (int id = 0; id < CMD_COUNT; id++) {
+        n_want += want[id];
+    }
+
+    if (reset) {
+        for (int id = 0; id < CMD_COUNT; id++) {
+            if (want[id]) {
+                lat_reset(&g_cmd_latency[id]);
+            }
+        }
+        out_int(out, n_want);
+        return;
+    }
+    out_arr(out, n_want);
+    for (int id = 0; id < CMD_COUNT; id++) {
+        if (want[id]) {
+            out_latency_row(out, id);
+        }
+    }
+}
+
+// slowlog get [n] | slowlog len | slowlog reset
+// Each entry: [id, unix_time, duration_us, [arg, ...]]
+static void do_slowlog(char **cmd, size_t n_cmd, Buffer *out) {
+    if (strcasecmp(cmd[1], "len") == 0 && n_cmd == 2) {
+        out_int(out, (int64_t)slowlog_len());
+    } else if (strcasecmp(cmd[1], "reset") == 0 && n_cmd == 2) {
+        slowlog_reset();
+        out_nil(out);
+    } else if (strcasecmp(cmd[1], "get") == 0 && n_cmd <= 3) {
+        size_t n = n_cmd == 3 ? strtoul(cmd[2], NULL, 10) : 10;
+        if (n > slowlog_len()) {
+            n = slowlog_len();
+        }
+        out_arr(out, (uint32_t)n);
+        for (size_t i = 0; i < n; i++) {
+            const SlowlogEntry *ent = slowlog_at(i);
+            bool truncated = ent->argc > ent->n_saved;
+            out_arr(out, 4);
+            out_int(out, (int64_t)ent->id);
+            out_int(out, ent->timestamp);
+            out_int(out, (int64_t)(ent->duration_ns / 1000));
+            out_arr(out, ent->n_saved + truncated);
+            for (uint32_t j = 0; j < ent->n_saved; j++) {
+                out_str(out, ent->argv[j], strlen(ent->argv[j]));
+            }
+            if (truncated) {
+                char more[64];
+                int len = snprintf(more, sizeof(more), "... (%u more arguments)",
+                                   ent->argc - ent->n_saved);
+                out_str(out, more, (size_t)len);
+            }
+        }
+    } else {
+        out_err(out, ERR_UNKNOWN, "unknown slowlog subcommand");
+    }
+}
+
+// --- INFO ---
+
+static void info_append(Buffer *out, const char *fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len > 0) {
+        buf_append(out, (const uint8_t *)line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+}
+
+static bool info_want(const char *section, const char *name) {
+    return !section || strcasecmp(section, "all") == 0 || strcasecmp(section, name) == 0;
+}
+
+// info [section]
+// Human-readable "name:value" lines grouped into "# Section" blocks
+static void do_info(char **cmd, size_t n_cmd, Buffer *out) {
+    const char *section = n_cmd == 2 ? cmd[1] : NULL;
+    Buffer text;
+    buffer_init(&text, 2048);
+
+    if (info_want(section, "server")) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        info_append(&text, "# Server\r\n");
+        info_append(&text, "tcp_port:%u\r\n", g_config.port);
+        info_append(&text, "uptime_in_seconds:%ld\r\n", (long)(now.tv_sec - g_stats.start_time));
+        info_append(&text, "cluster_enabled:%d\r\n", cluster_enabled() ? 1 : 0);
+        info_append(&text, "latency_clock:%s\r\n", lat_clock_name(g_lat_clock));
+        info_append(&text, "\r\n");
+    }
+    if (info_want(section, "clients")) {
+        info_append(&text, "# Clients\r\n");
+        info_append(&text, "connected_clients:%zu\r\n", g_stats.connected_clients);
+        info_append(&text, "blocked_clients:%zu\r\n", g_stats.blocked_clients);
+        info_append(&text, "total_connections_received:%llu\r\n",
+                    (unsigned long long)g_stats.total_connections);
+        info_append(&text, "pubsub_channels:%zu\r\n", ps_channels());
+        info_append(&text, "pubsub_patterns:%zu\r\n", ps_patterns());
+        info_append(&text, "pubsub_limit_disconnects:%llu\r\n",
+                    (unsigned long long)g_stats.pubsub_limit_disconnects);
+        info_append(&text, "\r\n");
+    }
+    if (info_want(section, "stats")) {
+        info_append(&text, "# Stats\r\n");
+        info_append(&text, "total_commands_processed:%llu\r\n",
+                    (unsigned long long)g_stats.total_commands);
+        info_append(&text, "total_net_input_bytes:%llu\r\n", (unsigned long long)g_stats.bytes_in);
+        info_append(&text, "total_net_output_bytes:%llu\r\n", (unsigned long long)g_stats.bytes_out);
+        info_append(&text, "scripts_cached:%zu\r\n", script_count());
+        info_append(&text, "\r\n");
+    }
+    if (info_want(section, "commandstats")) {
+        info_append(&text, "# Commandstats\r\n");
+        for (int id = 0; id < CMD_COUNT; id++) {
+            if (g_stats.cmd_calls[id] || g_stats.cmd_rejected[id]) {
+                info_append(&text, "cmdstat_%s:calls=%llu,rejected_calls=%llu\r\n",
+                            k_cmds[id].name, (unsigned long long)g_stats.cmd_calls[id],
+                            (unsigned long long)g_stats.cmd_rejected[id]);
+            }
+        }
+        info_append(&text, "\r\n");
+    }
+    if (info_want(section, "memory")) {
+        KVStats st;
+        kv_stats(&st);
+        // Client buffers are only summed here, never tracked on the hot path
+        size_t rbuf_cap = 0, wbuf_cap = 0, rbuf_used = 0, wbuf_used = 0;
+        for (size_t i = 0; i < fd2conn_size; i++) {
+            Conn *conn = fd2conn[i];
+            if (conn) {
+                rbuf_cap += conn->rbuf.capacity;
+                wbuf_cap += conn->wbuf.capacity;
+                rbuf_used += buf_read_size(&conn->rbuf);
+                wbuf_used += buf_read_size(&conn->wbuf);
+            }
+        }
+        struct mallinfo2 mi = mallinfo2();
+        info_append(&text, "# Memory\r\n");
+        info_append(&text, "used_memory_dataset:%zu\r\n", st.used_memory);
+        info_append(&text, "allocator_allocated:%zu\r\n", mi.uordblks + mi.hblkhd);
+        info_append(&text, "allocator_arena:%zu\r\n", mi.arena + mi.hblkhd);
+        info_append(&text, "allocator_free:%zu\r\n", mi.fordblks);
+        info_append(&text, "client_rbuf_capacity:%zu\r\n", rbuf_cap);
+        info_append(&text, "client_rbuf_used:%zu\r\n", rbuf_used);
+        info_append(&text, "client_wbuf_capacity:%zu\r\n", wbuf_cap);
+        info_append(&text, "client_wbuf_used:%zu\r\n", wbuf_used);
+        info_append(&text, "maxmemory:%zu\r\n", st.maxmemory);
+        info_append(&text, "maxmemory_policy:%s\r\n", kv_policy_name(g_config.maxmemory_policy));
+        info_append(&text, "evicted_keys:%llu\r\n", (unsigned long long)st.evicted_keys);
+        info_append(&text, "rejected_writes:%llu\r\n", (unsigned long long)st.rejected_writes);
+        info_append(&text, "\r\n");
+    }
+    if (info_want(section, "keyspace")) {
+        KVStats st;
+        kv_stats(&st);
+        info_append(&text, "# Keyspace\r\n");
+        info_append(&text, "keys:%zu\r\n", st.keys);
+        info_append(&text, "ordered_index:%d\r\n", kv_index_enabled() ? 1 : 0);
+        info_append(&text, "table_capacity:%zu\r\n", st.table_capacity);
+        info_append(&text, "table_old_capacity:%zu\r\n", st.table_old_capacity);
+        info_append(&text, "rehashing:%d\r\n", st.rehashing ? 1 : 0);
+        info_append(&text, "rehash_migrate_pos:%zu\r\n", st.migrate_pos);
+        info_append(&text, "\r\n");
+    }
+
+    out_str(out, (const char *)buf_read_ptr(&text), buf_read_size(&text));
+    buffer_destroy(&text);
+}
+
+// --- Scripting ---
+
+static int do_request(Conn *conn, char **cmd, size_t n_cmd, Buffer *wbuf);
+
+// call() runs commands as this connection, which is never subscribed
+static Conn g_script_conn;
+
+static void script_call(void *ctx, char **argv, size_t argc, Buffer *reply) {
+    (void)ctx;
+    int id = lookup_cmd(argv[0]);
+    // Nothing that blocks, subscribes or talks to other nodes: the script
+    // must finish within this event loop iteration
+    if (k_cmds[id].flags & CMDF_NOSCRIPT) {
+        out_err(reply, ERR_UNKNOWN, "command not allowed from scripts");
+        return;
+    }
+    do_request(&g_script_conn, argv, argc, reply);
+}
+
+// script_run() checked the result's depth and size
+static void out_script_value(Buffer *out, const ScriptValue *v) {
+    switch (v->type) {
+    case SV_NIL:
+        out_nil(out);
+        break;
+    case SV_INT:
+        out_int(out, v->i);
+        break;
+    case SV_STR:
+        out_str(out, v->s->data, v->s->len);
+        break;
+    case SV_ARR:
+        out_arr(out, v->a->n);
+        for (uint32_t i = 0; i < v->a->n; i++) {
+            out_script_value(out, &v->a->items[i]);
+        }
+        break;
+    }
+}
+
+// eval <script> <numkeys> key... arg..., same tail for evalsha <sha>
+static void do_eval(bool asking, char **cmd, size_t n_cmd, bool by_sha, Buffer *out) {
+    int64_t n_keys = 0;
+    if (!parse_int(cmd[2], &n_keys) || n_keys < 0 || (size_t)n_keys > n_cmd - 3) {
+        out_err(out, ERR_UNKNOWN, "numkeys must be between 0 and the number of arguments");
+        return;
+    }
+    if (n_keys > 0 && !check_keys_slot(asking, cmd, 3 + (size_t)n_keys, 3, 1, out)) {
+        return;
+    }
+
+    ScriptProgram *prog = NULL;
+    char err[256];
+    if (by_sha) {
+        prog = script_find(cmd[1]);
+        if (!prog) {
+            out_err(out, ERR_UNKNOWN, "NOSCRIPT no matching script, use SCRIPT LOAD");
+            return;
+        }
+    } else {
+        char sha[SHA1_HEX_SIZE];
+        prog = script_load(cmd[1], strlen(cmd[1]), sha, err, sizeof(err));
+        if (!prog) {
+            out_err(out, ERR_UNKNOWN, err);
+            return;
+        }
+    }
+
+    ScriptRun run = {.call = script_call, .max_steps = g_config.script_max_steps};
+    if (script_run(prog, cmd + 3, (size_t)n_keys, cmd + 3 + n_keys,
+                   n_cmd - 3 - (size_t)n_keys, &run)) {
+        out_script_value(out, &run.result);
+    } else {
+        out_err(out, ERR_UNKNOWN, run.err);
+    }
+    script_run_done(&run);
+}
+
+// script load <source> | exists <sha>... | flush
+static void do_script(char **cmd, size_t n_cmd, Buffer *out) {
+    if (strcasecmp(cmd[1], "load") == 0 && n_cmd == 3) {
+        char sha[SHA1_HEX_SIZE];
+        char err[256];
+        if (!script_load(cmd[2], strlen(cmd[2]), sha, err, sizeof(err))) {
+            out_err(out, ERR_UNKNOWN, err);
+            return;
+        }
+        out_str(out, sha, SHA1_HEX_SIZE - 1);
+    } else if (strcasecmp(cmd[1], "exists") == 0 && n_cmd >= 3) {
+        out_arr(out, (uint32_t)(n_cmd - 2));
+        for (size_t i = 2; i < n_cmd; i++) {
+            out_int(out, script_find(cmd[i]) ? 1 : 0);
+        }
+    } else if (strcasecmp(cmd[1], "flush") == 0 && n_cmd == 2) {
+        script_flush();
+        out_nil(out);
+    } else {
+        out_err(out, ERR_UNKNOWN, "unknown SCRIPT subcommand");
+    }
+}
+
+// --- Transactions ---
+
+// Between MULTI and EXEC a command is only looked up, routed and copied.
+// Commands that would block or change the connection's mode are refused
+// up front, and any refusal makes EXEC discard the whole transaction.
+static void multi_queue(Conn *conn, int id, char **cmd, size_t n_cmd, Buffer *out) {
+    if (k_cmds[id].flags & CMDF_NOMULTI) {
+        conn->multi_failed = true;
+        out_err(out, ERR_UNKNOWN, "command not allowed inside MULTI");
+        return;
+    }
+    // In cluster mode EXEC runs everything on this node, so all the keys
+    // of the transaction must be in one slot
+    int first_key = k_cmds[id].first_key;
+    if (cluster_enabled() && first_key) {
+        int32_t slot = cluster_key_slot(cmd[first_key]);
+        if (conn->multi_slot >= 0 && slot != conn->multi_slot) {
+            conn->multi_failed = true;
+            out_err(out, ERR_CLUSTER, "CROSSSLOT Keys in request don't hash to the same slot");
+            return;
+        }
+        conn->multi_slot = slot;
+    }
+
+    size_t size = n_cmd * sizeof(char *);
+    for (size_t i = 0; i < n_cmd; i++) {
+        size += strlen(cmd[i]) + 1;
+    }
+    char **argv = malloc(size);
+    if (!argv) {
+        die("Memory allocation failed");
+    }
+    char *pos = (char *)(argv + n_cmd);
+    for (size_t i = 0; i < n_cmd; i++) {
+        size_t len = strlen(cmd[i]) + 1;
+        memcpy(pos, cmd[i], len);
+        argv[i] = pos;
+        pos += len;
+    }
+    if (conn->n_multi_cmds == conn->cap_multi_cmds) {
+        conn->cap_multi_cmds = conn->cap_multi_cmds ? conn->cap_multi_cmds * 2 : 8;
+        conn->multi_cmds = realloc(conn->multi_cmds, conn->cap_multi_cmds * sizeof(QueuedCmd));
+        if (!conn->multi_cmds) {
+            die("Memory allocation failed");
+        }
+    }
+    conn->multi_cmds[conn->n_multi_cmds++] = (QueuedCmd){argv, n_cmd};
+    out_str(out, "QUEUED", 6);
+    conn->reply_flags = RESP_STATUS;
+}
+
+// watch <key>...
+static void do_watch(bool asking, Conn *conn, char **cmd, size_t n_cmd, Buffer *out) {
+    if (conn->in_multi) {
+        out_err(out, ERR_UNKNOWN, "WATCH inside MULTI is not allowed");
+        return;
+    }
+    if (!check_keys_slot(asking, cmd, n_cmd, 1, 1, out)) {
+        return;
+    }
+    conn->watched = realloc(conn->watched, (conn->n_watched + n_cmd - 1) * sizeof(WatchedKey));
+    if (!conn->watched) {
+        die("Memory allocation failed");
+    }
+    for (size_t i = 1; i < n_cmd; i++) {
+        WatchedKey *wk = &conn->watched[conn->n_watched++];
+        wk->key = strdup(cmd[i]);
+        if (!wk->key) {
+            die("Memory allocation failed");
+        }
+        wk->version = kv_version(cmd[i]);
+    }
+    out_nil(out);
+}
+
+// The RESP flags of each command EXEC ran: every element of its reply is
+// transcoded as the reply of its own command. Filled by do_exec(), used
+// and cleared when the reply is framed.
+static struct {
+    uint32_t *flags;
+    size_t n;
+    size_t cap;
+} g_exec_flags;
+
+static void exec_flags_reserve(size_t n) {
+    if (n <= g_exec_flags.cap) {
+        return;
+    }
+    g_exec_flags.cap = n;
+    g_exec_flags.flags = realloc(g_exec_flags.flags, n * sizeof(uint32_t));
+    if (!g_exec_flags.flags) {
+        die("Memory allocation failed");
+    }
+}
+
+static void do_exec(Conn *conn, Buffer *out) {
+    if (!conn->in_multi) {
+        out_err(out, ERR_UNKNOWN, "EXEC without MULTI");
+        return;
+    }
+    bool changed = false;
+    for (size_t i = 0; i < conn->n_watched && !changed; i++) {
+        changed = kv_version(conn->watched[i].key) != conn->watched[i].version;
+    }
+    unwatch_all(conn);
+
+    if (conn->multi_failed) {
+        out_err(out, ERR_UNKNOWN, "EXECABORT Transaction discarded because of previous errors");
+    } else if (changed) {
+        out_nil(out);  // a watched key was written since WATCH
+    } else {
+        conn->in_multi = false;  // run the commands instead of queueing them
+        exec_flags_reserve(conn->n_multi_cmds);
+        out_arr(out, (uint32_t)conn->n_multi_cmds);
+        for (size_t i = 0; i < conn->n_multi_cmds; i++) {
+            char **argv = conn->multi_cmds[i].argv;
+            size_t argc = conn->multi_cmds[i].argc;
+            uint64_t t0 = lat_now();
+            int id = do_request(conn, argv, argc, out);
+            record_call(id, lat_ticks_to_ns(lat_now() - t0), argv, argc);
+            g_exec_flags.flags[g_exec_flags.n++] = conn->reply_flags;
+        }
+    }
+    multi_reset(conn);
+}
+
+// --- Connection ---
+
+// hello [protover [auth <user> <pass>] [setname <name>]]
+// Switches a RESP connection between RESP2 and RESP3. The reply is the
+// first one in the new protocol.
+static void do_hello(Conn *conn, char **cmd, size_t n_cmd, Buffer *out) {
+    size_t i = 1;
+    if (i < n_cmd) {
+        int64_t ver = 0;
+        if (!parse_int(cmd[i], &ver) || (ver != 2 && ver != 3)) {
+            out_err(out, ERR_UNKNOWN, "NOPROTO unsupported protocol version");
+            return;
+        }
+        if (conn->proto == PROTO_BINARY) {
+            out_err(out, ERR_UNKNOWN, "NOPROTO this connection uses the binary protocol");
+            return;
+        }
+        i++;
+        // there are no users or client names: both options are accepted
+        // and ignored, so stock clients can send them
+        while (i < n_cmd) {
+            if (strcasecmp(cmd[i], "auth") == 0 && i + 2 < n_cmd) {
+                i += 3;
+            } else if (strcasecmp(cmd[i], "setname") == 0 && i + 1 < n_cmd) {
+                i += 2;
+            } else {
+                out_err(out, ERR_UNKNOWN, "syntax error in HELLO option");
+                return;
+            }
+        }
+        conn->proto = ver == 3 ? PROTO_RESP3 : PROTO_RESP2;
+    }
+    int64_t proto = conn->proto == PROTO_RESP3 ? 3 : conn->proto == PROTO_RESP2 ? 2 : 0;
+    const char *mode = cluster_enabled() ? "cluster" : "standalone";
+    out_arr(out, 14);
+    out_str(out, "server", 6);
+    out_str(out, "my-redis", 8);
+    out_str(out, "version", 7);
+    out_str(out, "1.0.0", 5);
+    out_str(out, "proto", 5);
+    out_int(out, proto);
+    out_str(out, "id", 2);
+    out_int(out, conn->fd);
+    out_str(out, "mode", 4);
+    out_str(out, mode, strlen(mode));
+    out_str(out, "role", 4);
+    out_str(out, "master", 6);
+    out_str(out, "modules", 7);
+    out_arr(out, 0);
+}
+
+// config get <pattern>, name/value pairs of the startup options.
+// "save" and "appendonly" are there for redis-benchmark, which asks.
+static void do_config(char **cmd, size_t n_cmd, Buffer *out) {
+    if (strcasecmp(cmd[1], "get") != 0 || n_cmd != 3) {
+        out_err(out, ERR_UNKNOWN, "only CONFIG GET <pattern> is supported");
+        return;
+    }
+    char vals[8][32];
+    snprintf(vals[0], sizeof(vals[0]), "%u", g_config.port);
+    snprintf(vals[1], sizeof(vals[1]), "%zu", g_config.maxmemory);
+    snprintf(vals[2], sizeof(vals[2]), "%u", g_config.maxmemory_samples);
+    snprintf(vals[3], sizeof(vals[3]), "%llu", (unsigned long long)g_config.slowlog_slower_than_us);
+    snprintf(vals[4], sizeof(vals[4]), "%zu", g_config.slowlog_max_len);
+    snprintf(vals[5], sizeof(vals[5]), "%llu", (unsigned long long)g_config.script_max_steps);
+    snprintf(vals[6], sizeof(vals[6]), "%o", g_config.unixsocket_perm);
+    const struct {
+        const char *name;
+        const char *val;
+    } params[] = {
+        {"port", vals[0]},
+        {"unixsocket", g_config.unixsocket},
+        {"unixsocketperm", vals[6]},
+        {"maxmemory", vals[1]},
+        {"maxmemory-policy", kv_policy_name(g_config.maxmemory_policy)},
+        {"maxmemory-samples", vals[2]},
+        {"slowlog-log-slower-than", vals[3]},
+        {"slowlog-max-len", vals[4]},
+        {"script-max-steps", vals[5]},
+        {"save", ""},
+        {"appendonly", "no"},
+    };
+    for (char *c = cmd[2]; *c; c++) {  // the names are lowercase
+        *c = (char)tolower((unsigned char)*c);
+    }
+    size_t pos = out_arr_begin(out);
+    uint32_t n = 0;
+    for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+        if (fnmatch(cmd[2], params[i].name, 0) == 0) {
+            out_str(out, params[i].name, strlen(params[i].name));
+            out_str(out, params[i].val, strlen(params[i].val));
+            n += 2;
+        }
+    }
+    out_arr_end(out, pos, n);
+}
+
+// ping [message]
+// Also a health check on subscribed connections, which get it as a
+// Pub/Sub style ["pong", message] array unless they speak RESP3 (where
+// replies and pushes cannot be confused).
+static void do_ping(Conn *conn, char **cmd, size_t n_cmd, Buffer *out) {
+    const char *msg = n_cmd == 2 ? cmd[1] : "";
+    conn->reply_flags = 0;
+    if (conn->ps.n_subs > 0 && conn->proto != PROTO_RESP3) {
+        out_arr(out, 2);
+        out_str(out, "pong", 4);
+        out_str(out, msg, strlen(msg));
+    } else if (n_cmd == 2) {
+        out_str(out, msg, strlen(msg));
+    } else {
+        out_str(out, "PONG", 4);
+        conn->reply_flags = RESP_STATUS;
+    }
+}
+
+// Names of the CmdSpec flags that mean something to clients
+static const struct {
+    uint32_t flag;
+    const char *name;
+} k_cmd_flag_names[] = {
+    {CMDF_WRITE, "write"},
+    {CMDF_READONLY, "readonly"},
+    {CMDF_ADMIN, "admin"},
+    {CMDF_PUBSUB, "pubsub"},
+    {CMDF_NOSCRIPT, "noscript"},
+    {CMDF_NOMULTI, "no_multi"},
+    {CMDF_MOVABLEKEYS, "movablekeys"},
+};
+
+// [name, arity, [flag, ...], first_key, last_key, key_step]
+static void out_cmd_info(Buffer *out, int id) {
+    const CmdSpec *spec = &k_cmds[id];
+    out_arr(out, 6);
+    out_str(out, spec->name, strlen(spec->name));
+    out_int(out, spec->arity);
+    size_t pos = out_arr_begin(out);
+    uint32_t n = 0;
+    for (size_t i = 0; i < sizeof(k_cmd_flag_names) / sizeof(k_cmd_flag_names[0]); i++) {
+        if (spec->flags & k_cmd_flag_names[i].flag) {
+            out_str(out, k_cmd_flag_names[i].name, strlen(k_cmd_flag_names[i].name));
+            n++;
+        }
+    }
+    out_arr_end(out, pos, n);
+    out_int(out, spec->first_key);
+    out_int(out, spec->last_key);
+    out_int(out, spec->key_step);
+}
+
+// command                 -> info of every command
+// command count
+// command list            -> names
+// command info <name>...  -> info or nil for each name
+static void do_command(char **cmd, size_t n_cmd, Buffer *out) {
+    if (n_cmd == 1) {
+        out_arr(out, CMD_UNKNOWN);
+        for (int id = 0; id < CMD_UNKNOWN; id++) {
+            out_cmd_info(out, id);
+        }
+    } else if (strcasecmp(cmd[1], "count") == 0 && n_cmd == 2) {
+        out_int(out, CMD_UNKNOWN);
+    } else if (strcasecmp(cmd[1], "list") == 0 && n_cmd == 2) {
+        out_arr(out, CMD_UNKNOWN);
+        for (int id = 0; id < CMD_UNKNOWN; id++) {
+            out_str(out, k_cmds[id].name, strlen(k_cmds[id].name));
+        }
+    } else if (strcasecmp(cmd[1], "info") == 0) {
+        out_arr(out, (uint32_t)(n_cmd - 2));
+        for (size_t i = 2; i < n_cmd; i++) {
+            int id = lookup_cmd(cmd[i]);
+            if (id == CMD_UNKNOWN) {
+                out_nil(out);
+            } else {
+                out_cmd_info(out, id);
+            }
+        }
+    } else {
+        out_err(out, ERR_UNKNOWN, "unknown COMMAND subcommand");
+    }
+}
+
+// --- Dispatch ---
+
+// How a reply is transcoded for RESP, see resp_encode().
+// Handlers may change conn->reply_flags for replies the table cannot
+// describe, like "+QUEUED".
+static uint32_t resp_flags(int id) {
+    uint32_t flags = k_cmds[id].flags;
+    uint32_t out = 0;
+    if (flags & CMDF_PUBSUB) {
+        out |= RESP_SPLIT | RESP_PUSH;  // one confirmation per channel
+    }
+    if (flags & CMDF_MAP) {
+        out |= RESP_MAP;
+    }
+    if (flags & CMDF_OK) {
+        out |= RESP_NIL_OK;
+    }
+    if (flags & CMDF_EXISTS) {
+        out |= RESP_EXISTS;
+    }
+    return out;
+}
+
+static bool arity_ok(const CmdSpec *spec, size_t n_cmd) {
+    return spec->arity >= 0 ? n_cmd == (size_t)spec->arity : n_cmd >= (size_t)-spec->arity;
+}
+
+// Cluster routing for the keys at the fixed positions of the command table
+static bool check_cmd_keys(bool asking, const CmdSpec *spec, char **cmd, size_t n_cmd,
+                           Buffer *out) {
+    int last = spec->last_key < 0 ? (int)n_cmd + spec->last_key : spec->last_key;
+    if (last < spec->first_key) {
+        return true;
+    }
+    return check_keys_slot(asking, cmd, (size_t)last + 1, (size_t)spec->first_key,
+                           (size_t)spec->key_step, out);
+}
+
+static int reject_args(int id, Buffer *out) {
+    char msg[96];
+    snprintf(msg, sizeof(msg), "wrong number of arguments for '%s' command", k_cmds[id].name);
+    out_err(out, ERR_UNKNOWN, msg);
+    g_stats.cmd_rejected[id]++;
+    return CMD_UNKNOWN;
+}
+
+// Returns the CMD_* id used for the per-command stats
+static int do_request(Conn *conn, char **cmd, size_t n_cmd, Buffer *wbuf) {
+    // "asking" only applies to the very next command
+    bool asking = conn->asking;
+    conn->asking = false;
+
+    int id = n_cmd ? lookup_cmd(cmd[0]) : CMD_UNKNOWN;
+    const CmdSpec *spec = &k_cmds[id];
+    conn->reply_flags = resp_flags(id);
+
+    // A subscribed connection only manages its subscriptions
+    if (conn->ps.n_subs > 0 && !(spec->flags & CMDF_PUBSUB)) {
+        out_err(wbuf, ERR_UNKNOWN,
+                "only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING are allowed in this context");
+        return id;
+    }
+
+    // Refused before queueing too: EXEC then discards the transaction
+    if (id == CMD_UNKNOWN || !arity_ok(spec, n_cmd)) {
+        conn->multi_failed |= conn->in_multi;
+        if (id == CMD_UNKNOWN) {
+            out_err(wbuf, ERR_UNKNOWN, "unknown command");
+            return id;
+        }
+        return reject_args(id, wbuf);
+    }
+
+    // Routed before queueing too, so a transaction is refused as a whole
+    // rather than partly run when its keys live on another node
+    if (spec->first_key && !check_cmd_keys(asking, spec, cmd, n_cmd, wbuf)) {
+        conn->multi_failed |= conn->in_multi && !(spec->flags & CMDF_TXN);
+        return id;
+    }
+
+    if (conn->in_multi && !(spec->flags & CMDF_TXN)) {
+        multi_queue(conn, id, cmd, n_cmd, wbuf);
+        return id;
+    }
+
+    // The table checked the argument count, the cases below only check
+    // what it cannot express
+    switch (id) {
+    case CMD_GET:
+        do_get(cmd, wbuf);
+        return id;
+    case CMD_SET:
+        do_set(cmd, wbuf);
+        return id;
+    case CMD_DEL:
+        do_delete(cmd, wbuf);
+        return id;
+    case CMD_KEYS:
+        do_keys(wbuf);
+        return id;
+    case CMD_ASKING:
+        conn->asking = true;
+        out_nil(wbuf);
+        return id;
+    case CMD_MEMORY:
+        do_memory(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_CLUSTER:
+        do_cluster(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_MIGRATE:
+        do_migrate(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_DUMP:
+        do_dump(cmd, wbuf);
+        return id;
+    case CMD_RESTORE:
+        do_restore(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_INFO:
+        if (n_cmd <= 2) {
+            do_info(cmd, n_cmd, wbuf);
+            return id;
+        }
+        break;
+    case CMD_LATENCY:
+        do_latency(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_SLOWLOG:
+        do_slowlog(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_HSET:
+        if (n_cmd % 2 == 0) {
+            do_hset(cmd, n_cmd, wbuf);
+            return id;
+        }
+        break;
+    case CMD_HGET:
+        do_hget(cmd, wbuf);
+        return id;
+    case CMD_HDEL:
+        do_hdel(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_HGETALL:
+        do_hgetall(cmd, wbuf);
+        return id;
+    case CMD_HLEN:
+        do_hlen(cmd, wbuf);
+        return id;
+    case CMD_LPUSH:
+    case CMD_RPUSH:
+        do_push(cmd, n_cmd, id == CMD_LPUSH, wbuf);
+        return id;
+    case CMD_LPOP:
+    case CMD_RPOP:
+        do_pop(cmd, id == CMD_LPOP, wbuf);
+        return id;
+    case CMD_LRANGE:
+        do_lrange(cmd, wbuf);
+        return id;
+    case CMD_LINDEX:
+        do_lindex(cmd, wbuf);
+        return id;
+    case CMD_LLEN:
+        do_llen(cmd, wbuf);
+        return id;
+    case CMD_BLPOP:
+    case CMD_BRPOP:
+        do_bpop(conn, cmd, n_cmd, id == CMD_BLPOP, wbuf);
+        return id;
+    case CMD_INCR:
+    case CMD_DECR:
+        do_incr(cmd, n_cmd, id == CMD_INCR ? 1 : -1, wbuf);
+        return id;
+    case CMD_INCRBY:
+    case CMD_DECRBY:
+        do_incr(cmd, n_cmd, id == CMD_INCRBY ? 1 : -1, wbuf);
+        return id;
+    case CMD_MGET:
+        do_mget(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_MSET:
+        if (n_cmd % 2 == 1) {
+            do_mset(cmd, n_cmd, wbuf);
+            return id;
+        }
+        break;
+    case CMD_SUBSCRIBE:
+    case CMD_PSUBSCRIBE:
+        do_subscribe(conn, cmd, n_cmd, id == CMD_PSUBSCRIBE, wbuf);
+        return id;
+    case CMD_UNSUBSCRIBE:
+    case CMD_PUNSUBSCRIBE:
+        do_unsubscribe(conn, cmd, n_cmd, id == CMD_PUNSUBSCRIBE, wbuf);
+        return id;
+    case CMD_PUBLISH:
+        do_publish(cmd, wbuf);
+        return id;
+    case CMD_XADD:
+        if (n_cmd % 2 == 1) {
+            do_xadd(cmd, n_cmd, wbuf);
+            return id;
+        }
+        break;
+    case CMD_XLEN:
+        do_xlen(cmd, wbuf);
+        return id;
+    case CMD_XRANGE:
+        do_xrange(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_XACK:
+        do_xack(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_XPENDING:
+        if (n_cmd == 3 || n_cmd == 6 || n_cmd == 7) {
+            do_xpending(cmd, n_cmd, wbuf);
+            return id;
+        }
+        break;
+    case CMD_XGROUP:
+        do_xgroup(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_XREAD:
+        do_xread(asking, cmd, n_cmd, wbuf);
+        return id;
+    case CMD_XREADGROUP:
+        do_xreadgroup(asking, cmd, n_cmd, wbuf);
+        return id;
+    case CMD_SETBIT:
+        do_setbit(cmd, wbuf);
+        return id;
+    case CMD_GETBIT:
+        do_getbit(cmd, wbuf);
+        return id;
+    case CMD_BITCOUNT:
+        if (n_cmd == 2 || n_cmd == 4) {
+            do_bitcount(cmd, n_cmd, wbuf);
+            return id;
+        }
+        break;
+    case CMD_PFADD:
+        do_pfadd(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_PFCOUNT:
+        do_pfcount(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_PFMERGE:
+        do_pfmerge(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_GEOADD:
+        if ((n_cmd - 2) % 3 == 0) {
+            do_geoadd(cmd, n_cmd, wbuf);
+            return id;
+        }
+        break;
+    case CMD_GEOPOS:
+        do_geopos(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_GEODIST:
+        if (n_cmd <= 5) {
+            do_geodist(cmd, n_cmd, wbuf);
+            return id;
+        }
+        break;
+    case CMD_GEOSEARCH:
+        do_geosearch(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_RANGE:
+        do_range(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_PREFIX:
+        do_prefix(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_EVAL:
+    case CMD_EVALSHA:
+        do_eval(asking, cmd, n_cmd, id == CMD_EVALSHA, wbuf);
+        return id;
+    case CMD_SCRIPT:
+        do_script(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_MULTI:
+        if (conn->in_multi) {
+            out_err(wbuf, ERR_UNKNOWN, "MULTI calls can not be nested");
+        } else {
+            conn->in_multi = true;
+            conn->multi_slot = -1;
+            out_nil(wbuf);
+        }
+        return id;
+    case CMD_EXEC:
+        do_exec(conn, wbuf);
+        return id;
+    case CMD_DISCARD:
+        if (conn->in_multi) {
+            multi_reset(conn);
+            unwatch_all(conn);
+            out_nil(wbuf);
+        } else {
+            out_err(wbuf, ERR_UNKNOWN, "DISCARD without MULTI");
+        }
+        return id;
+    case CMD_WATCH:
+        do_watch(asking, conn, cmd, n_cmd, wbuf);
+        return id;
+    case CMD_UNWATCH:
+        unwatch_all(conn);
+        out_nil(wbuf);
+        return id;
+    case CMD_PING:
+        if (n_cmd <= 2) {
+            do_ping(conn, cmd, n_cmd, wbuf);
+            return id;
+        }
+        break;
+    case CMD_ECHO:
+        out_str(wbuf, cmd[1], strlen(cmd[1]));
+        return id;
+    case CMD_HELLO:
+        do_hello(conn, cmd, n_cmd, wbuf);
+        return id;
+    case CMD_CONFIG:
+        do_config(cmd, n_cmd, wbuf);
+        return id;
+    case CMD_COMMAND:
+        do_command(cmd, n_cmd, wbuf);
+        return id;
+    }
+    /*
+    uint32_t status = RES_ERR;
+    char *msg = "Unknown command";
+    uint32_t msg_len = strlen(msg);
+    uint32_t total_len = 4 + msg_len;
+
+    buf_append(wbuf, (uint8_t *)&total_len, 4);
+    buf_append(wbuf, (uint8_t *)&status, 4);
+    buf_append(wbuf, (uint8_t *)msg, msg_len);
+    */
+    return reject_args(id, wbuf);
+}
+
+// Execute one parsed request and frame its reply
+static void run_request(Conn *conn, char **cmd, size_t n_cmd) {
+    size_t header_pos = 0;
+    reply_begin(conn, &header_pos);
+    bool queueing = conn->in_multi;
+    uint64_t t0 = lat_now();
+    int id = do_request(conn, cmd, n_cmd, &conn->wbuf);
+    uint64_t elapsed = lat_ticks_to_ns(lat_now() - t0);
+    if (conn->state == STATE_BLOCKED) {
+        conn->wbuf.w_pos = conn->wbuf.r_pos + header_pos;  // the reply is sent when it unblocks
+    } else {
+        bool each = id == CMD_EXEC && g_exec_flags.n;
+        reply_end(conn, header_pos, conn->reply_flags, each ? g_exec_flags.flags : NULL,
+                  g_exec_flags.n);
+        g_exec_flags.n = 0;
+    }
+    // A queued command is recorded when EXEC runs it
+    if (!queueing || id == CMD_UNKNOWN || (k_cmds[id].flags & CMDF_TXN)) {
+        record_call(id, elapsed, cmd, n_cmd);
+    }
+}
+
+// --- Request batches ---
+
+// Every complete request in rbuf is framed in one pass, then the batch
+// runs back to back. Arguments are not copied: each one points into rbuf
+// and is NUL-terminated in place by overwriting the byte after it (the
+// next length header in the binary protocol, the "\r" or separator in
+// RESP). Those bytes are saved and put back afterwards, so requests left
+// over when a batch stops early can be framed again.
+#define k_batch_max 1024  // requests per batch, bounds the descriptors
+
+typedef struct ReqDesc {
+    size_t first;  // index of its first argument in the batch
+    size_t argc;
+    size_t end;    // offset in rbuf just past the request
+} ReqDesc;
+
+typedef struct Batch {
+    ReqDesc reqs[k_batch_max];
+    size_t n_reqs;
+    char **args;
+    size_t *lens;
+    uint8_t *saved;  // the byte each argument's NUL replaced
+    size_t n_args;
+    size_t cap_args;
+} Batch;
+
+static Batch g_batch;
+
+static void batch_reserve(Batch *b, size_t n) {
+    if (b->n_args + n <= b->cap_args) {
+        return;
+    }
+    while (b->cap_args < b->n_args + n) {
+        b->cap_args = b->cap_args ? b->cap_args * 2 : 256;
+    }
+    b->args = realloc(b->args, b->cap_args * sizeof(char *));
+    b->lens = realloc(b->lens, b->cap_args * sizeof(size_t));
+    b->saved = realloc(b->saved, b->cap_args);
+    if (!b->args || !b->lens || !b->saved) {
+        die("Memory allocation failed");
+    }
+}
+
+static void batch_push(Batch *b, size_t argc, size_t end) {
+    b->reqs[b->n_reqs++] = (ReqDesc){b->n_args, argc, end};
+    b->n_args += argc;
+}
+
+// Frame the binary request at data[*off, len)
+static ReqStatus frame_binary(uint8_t *data, size_t len, size_t *off, Batch *b) {
+    // 1. Check for the 4-byte header
+    if (len - *off < 4) {
+        return REQ_INCOMPLETE;
+    }
+    uint32_t frame_len = 0;
+    memcpy(&frame_len, data + *off, 4);
+    if (frame_len > k_max_msg) {
+        msg("too long");
+        return REQ_ERROR;
+    }
+    // Do not proceed to parse until we read the full message
+    if (4 + (size_t)frame_len > len - *off) {
+        return REQ_INCOMPLETE;  // wait for more data
+    }
+
+    // 2. Parse payload: the count, then length-prefixed strings
+    const uint8_t *curr = data + *off + 4;
+    const uint8_t *end = curr + frame_len;
+    uint32_t n_cmd = 0;
+    if (!read_u32(&curr, end, &n_cmd)) {
+        return REQ_ERROR;
+    }
+    // safety limit on args; each one takes at least its 4-byte length
+    if (n_cmd > k_max_args || n_cmd > (frame_len - 4) / 4) {
+        return REQ_ERROR;
+    }
+    batch_reserve(b, n_cmd);
+    for (uint32_t i = 0; i < n_cmd; i++) {
+        uint32_t arg_len = 0;
+        if (!read_u32(&curr, end, &arg_len) || arg_len > (size_t)(end - curr)) {
+            return REQ_ERROR;
+        }
+        b->args[b->n_args + i] = (char *)curr;
+        b->lens[b->n_args + i] = arg_len;
+        curr += arg_len;
+    }
+
+    // 3. Got a full message
+    // Echoing is off by default: stdout writes would dominate any benchmark
+    if (g_config.verbose) {
+        printf("client says: %.*s\n", frame_len, data + *off + 4);
+    }
+    *off += 4 + (size_t)frame_len;
+    batch_push(b, n_cmd, *off);
+    return REQ_PROCESSED;
+}
+
+// Frame the RESP request at data[*off, len)
+static ReqStatus frame_resp(Conn *conn, uint8_t *data, size_t len, size_t *off, Batch *b) {
+    size_t n_cmd = 0, used = 0;
+    const char *err = NULL;
+    RespStatus rs = RESP_OK;
+    do {  // a second round when the arguments did not fit
+        batch_reserve(b, n_cmd);
+        rs = resp_parse(data + *off, len - *off, b->args + b->n_args, b->lens + b->n_args,
+                        b->cap_args - b->n_args, &n_cmd, &used, &err);
+    } while (rs == RESP_OK && n_cmd > b->cap_args - b->n_args);
+
+    if (rs == RESP_INCOMPLETE) {
+        conn->resp_need = *off + used;
+        return REQ_INCOMPLETE;
+    }
+    if (rs == RESP_ERROR) {
+        fprintf(stderr, "protocol error: %s\n", err);
+        return REQ_ERROR;
+    }
+    *off += used;
+    batch_push(b, n_cmd, *off);  // blank lines are empty requests
+    return REQ_PROCESSED;
+}
+
+// Frame and run one batch. False when no request was complete.
+static bool run_batch(Conn *conn) {
+    Buffer *rbuf = &conn->rbuf;
+    if (conn->proto == PROTO_UNKNOWN) {
+        conn->proto = resp_detect(buf_read_ptr(rbuf), buf_read_size(rbuf), k_max_msg);
+        if (conn->proto == PROTO_UNKNOWN) {
+            return false;
+        }
+    }
+    bool resp = conn->proto != PROTO_BINARY;
+    if (resp && buf_read_size(rbuf) < conn->resp_need) {
+        return false;  // the last attempt showed more is needed
+    }
+    conn->resp_need = 0;
+
+    buf_reserve(rbuf, 1);  // room for the NUL after the last argument
+    uint8_t *data = buf_read_ptr(rbuf);
+    size_t len = buf_read_size(rbuf);
+    Batch *b = &g_batch;
+    b->n_reqs = 0;
+    b->n_args = 0;
+    size_t off = 0;
+    ReqStatus status = REQ_PROCESSED;
+    while (b->n_reqs < k_batch_max && status == REQ_PROCESSED) {
+        status = resp ? frame_resp(conn, data, len, &off, b) : frame_binary(data, len, &off, b);
+    }
+
+    // Every header is decoded, so the bytes after the arguments are free
+    for (size_t i = 0; i < b->n_args; i++) {
+        b->saved[i] = (uint8_t)b->args[i][b->lens[i]];
+        b->args[i][b->lens[i]] = '\0';
+    }
+    size_t done = 0;
+    for (size_t i = 0; i < b->n_reqs && conn->state == STATE_REQ; i++) {
+        // A blocking command parks the connection: later requests wait in rbuf
+        ReqDesc *req = &b->reqs[i];
+        if (req->argc > 0) {
+            run_request(conn, b->args + req->first, req->argc);
+        }
+        done = req->end;
+    }
+    for (size_t i = b->n_args; i-- > 0; ) {
+        b->args[i][b->lens[i]] = (char)b->saved[i];
+    }
+    buf_consume(rbuf, done);
+
+    if (done < off) {
+        conn->resp_need = 0;  // stopped early, frame the rest again later
+    } else if (resp) {
+        conn->resp_need -= conn->resp_need > done ? done : conn->resp_need;
+    }
+    if (status == REQ_ERROR && done == off) {
+        conn->state = STATE_END;  // after running what came before it
+    }
+    return done > 0 && conn->state == STATE_REQ;
+}
+
+// Run every complete request sitting in rbuf
+static void process_requests(Conn *conn) {
+    // Pipelining loop
+    // While there is enough data for a full request, keep processing.
+    while (conn->state == STATE_REQ && run_batch(conn)) {
+    }
+
+    // If we have data in wbuf, we want to write it out
+    if (conn->state == STATE_REQ && conn_has_output(conn)) {
+        conn->state = STATE_RES;
+    }
+}
+
+static void handle_read(Conn *conn) {
+    /*
+    assert(conn->rbuf_size < sizeof(conn->rbuf));
+    ssize_t rv = read(conn->fd, &conn->rbuf[conn->rbuf_size], sizeof(conn->rbuf) - conn->rbuf_size);
+    */
+    buf_reserve(&conn->rbuf, 1024);
+    ssize_t rv = read(conn->fd, buf_write_ptr(&conn->rbuf), buf_write_space(&conn->rbuf));
+
+    if (rv <= 0) {
+        if (rv == 0) {  // Handle EOF
+            msg("client closed connection");
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {  // Not ready, try again later.
+            return;
+        } else {
+            msg("read error");
+        }
+        conn->state = STATE_END;
+        return;
+    }
+
+    // Mark bytes as written
+    // conn->rbuf_size += (size_t)rv;
+    conn->rbuf.w_pos += (size_t)rv;
+    g_stats.bytes_in += (uint64_t)rv;
+
+    process_requests(conn);
+}
+
+static void handle_write(Conn *conn) {
+    /*
+    assert(conn->wbuf_size > conn->wbuf_sent);
+    ssize_t rv = write(conn->fd, &conn->wbuf[conn->wbuf_sent], conn->wbuf_size - conn->wbuf_sent);
+    */
+    // Gather the queued pieces in order: wbuf segments and shared
+    // messages, then whatever wbuf holds past the last item
+    struct iovec iov[k_max_iov];
+    int n_iov = 0;
+    size_t wbuf_off = 0;
+    for (size_t i = conn->outq_head; i < conn->outq_len && n_iov < k_max_iov; i++) {
+        OutItem *it = &conn->outq[i];
+        if (it->msg) {
+            iov[n_iov].iov_base = it->msg->data + it->off;
+            iov[n_iov].iov_len = it->msg->len - it->off;
+        } else {
+            iov[n_iov].iov_base = buf_read_ptr(&conn->wbuf) + wbuf_off;
+            iov[n_iov].iov_len = it->len;
+            wbuf_off += it->len;
+        }
+        n_iov++;
+    }
+    size_t loose = buf_read_size(&conn->wbuf) - conn->wbuf_queued;
+    if (loose && n_iov < k_max_iov) {
+        iov[n_iov].iov_base = buf_read_ptr(&conn->wbuf) + conn->wbuf_queued;
+        iov[n_iov].iov_len = loose;
+        n_iov++;
+    }
+    ssize_t rv = writev(conn->fd, iov, n_iov);
+
+    if (rv <= 0) {
         if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {  // Not ready, try again later.
             return;
         }
@@ -481,20 +3902,224 @@ static void handle_write(Conn *conn) {
     conn->wbuf_sent += (size_t)rv;
     assert(conn->wbuf_sent <= conn->wbuf_size);
     */
-    buf_consume(&conn->wbuf, (size_t)rv);
+    g_stats.bytes_out += (uint64_t)rv;
+    size_t left = (size_t)rv;
+    while (left > 0 && conn->outq_head < conn->outq_len) {
+        OutItem *it = &conn->outq[conn->outq_head];
+        if (it->msg) {
+            size_t n = it->msg->len - it->off;
+            n = n < left ? n : left;
+            it->off += n;
+            conn->outq_msg_bytes -= n;
+            left -= n;
+            if (it->off < it->msg->len) {
+                break;
+            }
+            msg_unref(it->msg);
+        } else {
+            size_t n = it->len < left ? it->len : left;
+            buf_consume(&conn->wbuf, n);
+            it->len -= n;
+            conn->wbuf_queued -= n;
+            left -= n;
+            if (it->len > 0) {
+                break;
+            }
+        }
+        conn->outq_head++;
+    }
+    if (conn->outq_head == conn->outq_len) {
+        conn->outq_head = conn->outq_len = 0;
+    }
+    buf_consume(&conn->wbuf, left);
+    if (conn->soft_limit_since
+        && buf_read_size(&conn->wbuf) + conn->outq_msg_bytes <= g_config.pubsub_limit_soft) {
+        conn->soft_limit_since = 0;
+    }
 
     // If finished sending the whole response, switch back to the reading mode
-    if (buf_read_size(&conn->wbuf) == 0) {
-        conn->state = STATE_REQ;
+    // (a blocked connection flushes earlier replies but stays blocked)
+    if (!conn_has_output(conn)) {
         conn->wbuf.r_pos = 0;
         conn->wbuf.w_pos = 0;
+        if (conn->state == STATE_RES) {
+            conn->state = STATE_REQ;
+            // requests pipelined behind a blocking command
+            process_requests(conn);
+        }
     }
 }
 
 // static int32_t one_request(int conn_fd);
 // static void do_something(int conn_fd);
 
-int main() {
+// "100mb", "1gb", "4096", ...
+static bool parse_memory(const char *s, size_t *out) {
+    char *end = NULL;
+    unsigned long long val = strtoull(s, &end, 10);
+    if (end == s) {
+        return false;
+    }
+    if (strcasecmp(end, "kb") == 0) {
+        val <<= 10;
+    } else if (strcasecmp(end, "mb") == 0) {
+        val <<= 20;
+    } else if (strcasecmp(end, "gb") == 0) {
+        val <<= 30;
+    } else if (*end != '\0') {
+        return false;
+    }
+    *out = (size_t)val;
+    return true;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [--port N] [--announce-host HOST] [--verbose] [--ordered-index]\n"
+        "          [--unixsocket PATH] [--unixsocket-perm OCTAL]\n"
+        "          [--maxmemory BYTES[kb|mb|gb]] [--maxmemory-policy POLICY]\n"
+        "          [--maxmemory-samples N] [--latency-clock monotonic|coarse|tsc]\n"
+        "          [--slowlog-log-slower-than USEC] [--slowlog-max-len N]\n"
+        "          [--pubsub-limit-hard BYTES] [--pubsub-limit-soft BYTES]\n"
+        "          [--pubsub-limit-soft-seconds N] [--script-max-steps N]\n"
+        "          [--cluster-slots LO-HI]... [--cluster-node HOST:PORT LO-HI]...\n"
+        "Any --cluster-* option enables cluster mode; this node then only\n"
+        "serves the slots given by --cluster-slots.\n"
+        "POLICY: noeviction, allkeys-lru, allkeys-lfu, allkeys-random\n", prog);
+    exit(1);
+}
+
+static void parse_args(int argc, char **argv) {
+    bool cluster = false;
+    // Pass 1: our own address, which must be known before the slot table
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--verbose") == 0) {
+            g_config.verbose = true;
+        } else if (strcmp(argv[i], "--ordered-index") == 0) {
+            g_config.ordered_index = true;
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            long port = strtol(argv[++i], NULL, 10);
+            if (port <= 0 || port > 65535) {
+                usage(argv[0]);
+            }
+            g_config.port = (uint16_t)port;
+        } else if (strcmp(argv[i], "--unixsocket") == 0 && i + 1 < argc) {
+            if (strlen(argv[++i]) >= sizeof(g_config.unixsocket)) {
+                usage(argv[0]);
+            }
+            strcpy(g_config.unixsocket, argv[i]);
+        } else if (strcmp(argv[i], "--unixsocket-perm") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            g_config.unixsocket_perm = (uint32_t)strtoul(argv[++i], &end, 8);
+            if (*end != '\0' || g_config.unixsocket_perm > 0777) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--announce-host") == 0 && i + 1 < argc) {
+            snprintf(g_config.announce_host, sizeof(g_config.announce_host), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--maxmemory") == 0 && i + 1 < argc) {
+            if (!parse_memory(argv[++i], &g_config.maxmemory)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--maxmemory-policy") == 0 && i + 1 < argc) {
+            if (!kv_parse_policy(argv[++i], &g_config.maxmemory_policy)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--maxmemory-samples") == 0 && i + 1 < argc) {
+            g_config.maxmemory_samples = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--latency-clock") == 0 && i + 1 < argc) {
+            if (!lat_parse_clock(argv[++i], &g_config.latency_clock)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--slowlog-log-slower-than") == 0 && i + 1 < argc) {
+            g_config.slowlog_slower_than_us = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--slowlog-max-len") == 0 && i + 1 < argc) {
+            g_config.slowlog_max_len = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--pubsub-limit-hard") == 0 && i + 1 < argc) {
+            if (!parse_memory(argv[++i], &g_config.pubsub_limit_hard)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--pubsub-limit-soft") == 0 && i + 1 < argc) {
+            if (!parse_memory(argv[++i], &g_config.pubsub_limit_soft)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--pubsub-limit-soft-seconds") == 0 && i + 1 < argc) {
+            g_config.pubsub_limit_soft_secs = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--script-max-steps") == 0 && i + 1 < argc) {
+            g_config.script_max_steps = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--cluster-slots") == 0 && i + 1 < argc) {
+            cluster = true;
+            i++;
+        } else if (strcmp(argv[i], "--cluster-node") == 0 && i + 2 < argc) {
+            cluster = true;
+            i += 2;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    kv_set_maxmemory(g_config.maxmemory, g_config.maxmemory_policy,
+                     g_config.maxmemory_samples);
+    lat_clock_init(g_config.latency_clock);
+    slowlog_init(g_config.slowlog_slower_than_us, g_config.slowlog_max_len);
+    if (g_config.ordered_index) {
+        kv_enable_index();
+    }
+    if (!cluster) {
+        return;
+    }
+
+    // Pass 2: the slot table
+    cluster_init(g_config.announce_host, g_config.port);
+    for (int i = 1; i < argc; i++) {
+        uint16_t lo = 0, hi = 0;
+        if (strcmp(argv[i], "--cluster-slots") == 0) {
+            if (!cluster_parse_range(argv[++i], &lo, &hi)) {
+                usage(argv[0]);
+            }
+            cluster_assign(lo, hi, CLUSTER_SELF);
+        } else if (strcmp(argv[i], "--cluster-node") == 0) {
+            int node = parse_node(argv[++i]);
+            if (node == CLUSTER_NO_NODE || !cluster_parse_range(argv[++i], &lo, &hi)) {
+                usage(argv[0]);
+            }
+            cluster_assign(lo, hi, node);
+        } else if (strncmp(argv[i], "--", 2) == 0 && strcmp(argv[i], "--verbose") != 0
+                   && strcmp(argv[i], "--ordered-index") != 0) {
+            i++;  // every other option takes exactly one value
+        }
+    }
+}
+
+// For callers on the same host. Skipping the TCP/IP stack makes a round
+// trip cheaper than over loopback.
+static int listen_unix(const char *path, uint32_t perm) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);  // length checked by parse_args()
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket creation failed");
+    }
+    unlink(path);  // left over from a previous run
+    if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        die("bind failed");
+    }
+    if (perm && chmod(path, (mode_t)perm) < 0) {
+        die("chmod failed");
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        die("listen failed");
+    }
+    fd_set_nb(fd);
+    printf("Server listening on %s...\n", path);
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    parse_args(argc, argv);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    g_stats.start_time = start.tv_sec;
+
     /* 1. Obtain a socket handle */
     // AF_INET for IPv4, AF_INET6 for IPv6
     // SOCK_STREAM for TCP, SOCK_DGRAM for UDP
@@ -517,7 +4142,7 @@ int main() {
     /* 3. Bind to an address */
     struct sockaddr_in addr = {0}; // zero out this entire struct
     addr.sin_family = AF_INET;  // IPv4
-    addr.sin_port = htons(6379);  // port number
+    addr.sin_port = htons(g_config.port);  // port number
     addr.sin_addr.s_addr = htonl(0);  // 0.0.0.0
     int rv = bind(fd, (const struct sockaddr *)&addr, sizeof(addr));
     if (rv) {
@@ -530,10 +4155,19 @@ int main() {
     }
     // Make the main listener non-blocking
     fd_set_nb(fd);
-    printf("Server listening on port 6379...\n");
+    printf("Server listening on port %u...\n", g_config.port);
+
+    // The listeners take the first poll slots
+    int listeners[2] = {fd, -1};
+    size_t n_listeners = 1;
+    if (g_config.unixsocket[0]) {
+        listeners[n_listeners++] = listen_unix(g_config.unixsocket, g_config.unixsocket_perm);
+    }
 
     // Event Loop
-    struct pollfd poll_args[64];  // can handle up to 64 connections
+    // One slot per possible fd plus the listeners, grown with fd2conn
+    struct pollfd *poll_args = NULL;
+    size_t poll_cap = 0;
 
     /* 5. Accept connections */
     // Each iteration is a cycle of
@@ -543,19 +4177,33 @@ int main() {
     while (1) {
         // Reset poll arguments
         size_t n_poll = 0;
+        if (poll_cap < fd2conn_size + n_listeners) {
+            poll_cap = fd2conn_size + n_listeners;
+            poll_args = realloc(poll_args, poll_cap * sizeof(struct pollfd));
+            if (!poll_args) {
+                die("Memory allocation failed");
+            }
+        }
 
-        // Add the listening socket
-        poll_args[n_poll].fd = fd;
-        poll_args[n_poll].events = POLLIN;  // wake up if a client connects
-        poll_args[n_poll].revents = 0;  // clear previous results
-        n_poll++;
+        // Add the listening sockets
+        for (size_t i = 0; i < n_listeners; i++) {
+            poll_args[n_poll].fd = listeners[i];
+            poll_args[n_poll].events = POLLIN;  // wake up if a client connects
+            poll_args[n_poll].revents = 0;  // clear previous results
+            n_poll++;
+        }
 
         // Add all active client connections
         for (size_t i = 0; i < fd2conn_size; i++) {
             Conn *conn = fd2conn[i];
             if (!conn) continue;
 
-            if (n_poll >= 64) break;
+            // Dropped by someone else's command (e.g. a slow subscriber
+            // hitting its output limit), so it may have no events at all
+            if (conn->state == STATE_END) {
+                conn_destroy(conn);
+                continue;
+            }
 
             poll_args[n_poll].fd = conn->fd;
             poll_args[n_poll].revents = 0;
@@ -567,22 +4215,33 @@ int main() {
                 poll_args[n_poll].events |= POLLIN;
             } else if (conn->state == STATE_RES) {
                 poll_args[n_poll].events |= POLLOUT;
+            } else if (conn->state == STATE_BLOCKED) {
+                // keep reading to notice a disconnect; flush earlier replies
+                poll_args[n_poll].events |= POLLIN;
+                if (conn_has_output(conn)) {
+                    poll_args[n_poll].events |= POLLOUT;
+                }
             }
             n_poll++;
         }
 
         // Wait (the only blocking call)
-        int rv = poll(poll_args, (nfds_t)n_poll, -1);
+        // Sleep no longer than the nearest blocking timeout
+        int rv = poll(poll_args, (nfds_t)n_poll, next_timer_ms());
         if (rv < 0 && errno == EINTR) continue;
         if (rv < 0) die("poll");
+        kv_clock_tick();  // one clock read per loop iteration, not per access
+        process_timers();
 
-        // Handle listening socket
-        if (poll_args[0].revents & POLLIN) {
-            accept_new_conn(fd);
+        // Handle listening sockets
+        for (size_t i = 0; i < n_listeners; i++) {
+            if (poll_args[i].revents & POLLIN) {
+                accept_new_conn(listeners[i]);
+            }
         }
 
         // Handle client sockets
-        for (size_t i = 1; i < n_poll; i++) {
+        for (size_t i = n_listeners; i < n_poll; i++) {
             if (poll_args[i].revents == 0) continue;
 
             // Find the connection using fd as the index
@@ -0,0 +1,13 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-1, only used to name cached scripts (as EVALSHA expects), not for security
+#define SHA1_HEX_SIZE 41  // 40 hex digits and the NUL
+
+void sha1(const void *data, size_t len, uint8_t out[20]);
+void sha1_hex(const void *data, size_t len, char out[SHA1_HEX_SIZE]);
+
+#endif
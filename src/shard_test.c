@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "myredis.h"
+
+// Tests the client-side sharding in libmyredis (mr_shards_*) against real
+// server processes. Starts k_n_servers servers on consecutive ports, runs
+// the tests, and kills them again, so it needs nothing running.
+//
+// Usage: shard_test [server binary] [first port]
+
+#define k_n_servers 4
+#define k_n_keys 20000      // stored by test_spread(), read back by test_fanout_order()
+#define k_mget_keys 20      // keys per MGET in test_fanout_order()
+
+static pid_t g_pids[k_n_servers];
+static char g_addrs[k_n_servers][32];
+
+static void stop_servers(void) {
+    for (size_t i = 0; i < k_n_servers; i++) {
+        if (g_pids[i] > 0) {
+            kill(g_pids[i], SIGKILL);
+            waitpid(g_pids[i], NULL, 0);
+            g_pids[i] = 0;
+        }
+    }
+}
+
+// Like assert(), but takes the servers down with it
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "shard_test: %s\n", what);
+        stop_servers();
+        exit(1);
+    }
+}
+
+static void start_servers(const char *server, unsigned port) {
+    for (size_t i = 0; i < k_n_servers; i++) {
+        char port_str[16];
+        snprintf(port_str, sizeof(port_str), "%u", port + (unsigned)i);
+        snprintf(g_addrs[i], sizeof(g_addrs[i]), "127.0.0.1:%u", port + (unsigned)i);
+        pid_t pid = fork();
+        check(pid >= 0, "fork() failed");
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            execl(server, server, "--port", port_str, (char *)NULL);
+            _exit(127);
+        }
+        g_pids[i] = pid;
+    }
+    // Wait until every one of them accepts connections
+    for (size_t i = 0; i < k_n_servers; i++) {
+        MrConn *conn = NULL;
+        for (int tries = 0; !conn && tries < 250; tries++) {
+            conn = mr_connect("127.0.0.1", (uint16_t)(port + i));
+            if (!conn) {
+                usleep(20 * 1000);
+            }
+        }
+        check(conn != NULL, "a server did not start");
+        mr_close(conn);
+    }
+}
+
+static MrShards *connect_shards(size_t n_servers, size_t conns_per_server) {
+    const char *addrs[k_n_servers];
+    for (size_t i = 0; i < n_servers; i++) {
+        addrs[i] = g_addrs[i];
+    }
+    MrShards *shards = mr_shards_new(addrs, n_servers, conns_per_server);
+    check(shards != NULL, "mr_shards_new() failed");
+    return shards;
+}
+
+static size_t pick(const MrShards *shards, const char *key) {
+    return mr_shards_pick(shards, key, strlen(key));
+}
+
+// --- Key spread ---
+
+static void cb_expect_ok(MrConn *conn, MrReader *reply, void *arg) {
+    (void)conn;
+    (void)arg;
+    MrValue v;
+    check(reply && mr_read(reply, &v) && v.type != MR_ERR, "MSET failed");
+}
+
+static void cb_count_keys(MrConn *conn, MrReader *reply, void *arg) {
+    (void)conn;
+    MrValue v;
+    check(reply && mr_read(reply, &v) && v.type == MR_ARR, "KEYS failed");
+    *(size_t *)arg = v.len;
+}
+
+// Stores key:0..k_n_keys-1 with MSET fan-outs and counts what each server
+// got: the keys must be where mr_shards_pick() says, and evenly spread.
+static void test_spread(void) {
+    MrShards *shards = connect_shards(k_n_servers, 2);
+    static char keys[k_n_keys][16], vals[k_n_keys][16];
+    size_t expected[k_n_servers] = {0};
+    for (size_t i = 0; i < k_n_keys; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "key:%zu", i);
+        snprintf(vals[i], sizeof(vals[i]), "val:%zu", i);
+        expected[pick(shards, keys[i])]++;
+    }
+    const char *args[2 * 1000];
+    for (size_t i = 0; i < k_n_keys; i += 1000) {
+        for (size_t k = 0; k < 1000; k++) {
+            args[2 * k] = keys[i + k];
+            args[2 * k + 1] = vals[i + k];
+        }
+        check(mr_shards_fanout(shards, "mset", args, NULL, 2 * 1000, 2, cb_expect_ok, NULL),
+              "MSET fan-out not queued");
+    }
+    check(mr_shards_wait(shards) == 0, "waiting for MSET failed");
+
+    size_t got[k_n_servers] = {0};
+    for (size_t s = 0; s < k_n_servers; s++) {
+        const char *argv[] = {"keys"};
+        check(mr_send(mr_shards_conn(shards, s), argv, NULL, 1, cb_count_keys, &got[s]),
+              "KEYS not queued");
+    }
+    check(mr_shards_wait(shards) == 0, "waiting for KEYS failed");
+    for (size_t s = 0; s < k_n_servers; s++) {
+        check(got[s] == expected[s], "a server holds keys it does not own");
+        // 1/4 each, give or take 3%: the binomial spread is about 0.4%
+        check(got[s] > k_n_keys / 4 * 97 / 100 && got[s] < k_n_keys / 4 * 103 / 100,
+              "keys are not spread evenly");
+    }
+
+    // Hash tags: only the part between the braces counts, unless empty
+    check(pick(shards, "{user:7}.name") == pick(shards, "user:7"), "hash tag ignored");
+    check(pick(shards, "{user:7}.mail") == pick(shards, "user:7"), "hash tag ignored");
+    size_t differ = 0;
+    for (size_t i = 0; i < 100; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "{}%zu", i);
+        differ += pick(shards, key) != pick(shards, "");
+    }
+    check(differ > 0, "empty hash tag used as the key");
+    mr_shards_free(shards);
+}
+
+// --- Remapping ---
+
+// Appending a fourth server must move about 1/4 of the keys, all of them
+// to the new server.
+static void test_remap(void) {
+    MrShards *three = connect_shards(3, 1);
+    MrShards *four = connect_shards(4, 1);
+    size_t n = 100000, moved = 0;
+    for (size_t i = 0; i < n; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "key:%zu", i);
+        size_t from = pick(three, key), to = pick(four, key);
+        if (from != to) {
+            check(to == 3, "a key moved between two old servers");
+            moved++;
+        }
+    }
+    check(moved > n * 24 / 100 && moved < n * 26 / 100, "3 -> 4 servers did not move 1/4 of the keys");
+    mr_shards_free(three);
+    mr_shards_free(four);
+}
+
+// --- Fan-out ordering ---
+
+typedef struct MgetCheck {
+    size_t keys[k_mget_keys];  // indexes into key:<n>, some past k_n_keys
+    bool done;
+} MgetCheck;
+
+// The merged reply must list the values in the order the keys were given
+static void cb_check_mget(MrConn *conn, MrReader *reply, void *arg) {
+    (void)conn;
+    MgetCheck *mc = (MgetCheck *)arg;
+    MrValue v;
+    check(reply && mr_read(reply, &v) && v.type == MR_ARR && v.len == k_mget_keys,
+          "MGET did not merge into one array");
+    for (size_t k = 0; k < k_mget_keys; k++) {
+        check(mr_read(reply, &v), "MGET reply truncated");
+        if (mc->keys[k] >= k_n_keys) {
+            check(v.type == MR_NIL, "MGET found a key never set");
+            continue;
+        }
+        char want[16];
+        int len = snprintf(want, sizeof(want), "val:%zu", mc->keys[k]);
+        check(v.type == MR_STR && v.len == (uint32_t)len && memcmp(v.str, want, v.len) == 0,
+              "MGET values out of order");
+    }
+    check(!mc->done, "MGET callback called twice");
+    mc->done = true;
+}
+
+// Pipelines many MGET fan-outs over a pool of connections per server, so
+// the parts of one fan-out come back on different connections and out of
+// step with each other.
+static void test_fanout_order(void) {
+    MrShards *shards = connect_shards(k_n_servers, 4);
+    size_t n_mgets = 2000;
+    MgetCheck *checks = calloc(n_mgets, sizeof(MgetCheck));
+    if (!checks) {
+        die("Memory allocation failed");
+    }
+    srand(49);
+    for (size_t i = 0; i < n_mgets; i++) {
+        char keys[k_mget_keys][16];
+        const char *args[k_mget_keys];
+        for (size_t k = 0; k < k_mget_keys; k++) {
+            checks[i].keys[k] = (size_t)rand() % (k_n_keys + k_n_keys / 4);
+            snprintf(keys[k], sizeof(keys[k]), "key:%zu", checks[i].keys[k]);
+            args[k] = keys[k];
+        }
+        check(mr_shards_fanout(shards, "mget", args, NULL, k_mget_keys, 1, cb_check_mget, &checks[i]),
+              "MGET fan-out not queued");
+    }
+    check(mr_shards_wait(shards) == 0, "waiting for MGET failed");
+    for (size_t i = 0; i < n_mgets; i++) {
+        check(checks[i].done, "MGET callback never called");
+    }
+    free(checks);
+    mr_shards_free(shards);
+}
+
+// --- A server dies ---
+
+static void cb_count_null(MrConn *conn, MrReader *reply, void *arg) {
+    (void)conn;
+    size_t *counts = (size_t *)arg;  // NULL replies, then others
+    counts[reply ? 1 : 0]++;
+}
+
+// Requests in flight to a dead server get exactly one NULL callback each,
+// including fan-outs whose other parts did reply.
+static void test_server_death(void) {
+    MrShards *shards = connect_shards(k_n_servers, 2);
+    size_t counts[2] = {0, 0};
+    size_t n_fanouts = 50, n_gets = 0;
+    for (size_t i = 0; i < n_fanouts; i++) {
+        char keys[40][16];
+        const char *args[40];
+        bool hits_dead = false;
+        for (size_t k = 0; k < 40; k++) {
+            snprintf(keys[k], sizeof(keys[k]), "key:%zu", i * 40 + k);
+            args[k] = keys[k];
+            hits_dead = hits_dead || pick(shards, keys[k]) == k_n_servers - 1;
+        }
+        check(hits_dead, "a fan-out misses the server to kill");
+        check(mr_shards_fanout(shards, "mget", args, NULL, 40, 1, cb_count_null, counts),
+              "MGET fan-out not queued");
+    }
+    for (size_t i = 0; n_gets < 10; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "key:%zu", i);
+        if (pick(shards, key) == k_n_servers - 1) {
+            const char *argv[] = {"get", key};
+            check(mr_shards_send(shards, argv, NULL, 2, cb_count_null, counts), "GET not queued");
+            n_gets++;
+        }
+    }
+
+    kill(g_pids[k_n_servers - 1], SIGKILL);
+    waitpid(g_pids[k_n_servers - 1], NULL, 0);
+    g_pids[k_n_servers - 1] = 0;
+
+    check(mr_shards_wait(shards) == -1, "waiting on a dead server succeeded");
+    check(mr_shards_error(shards)[0] != '\0', "no error for the dead server");
+    // Whatever is still pending gets its NULL now
+    mr_shards_free(shards);
+    check(counts[0] == n_fanouts + n_gets, "a request lost to the dead server was not told");
+    check(counts[1] == 0, "a request to the dead server got a reply");
+}
+
+int main(int argc, char **argv) {
+    const char *server = argc > 1 ? argv[1] : "./server";
+    unsigned port = argc > 2 ? (unsigned)atoi(argv[2]) : 7400;
+    // writes to the server killed below must fail, not end the test
+    signal(SIGPIPE, SIG_IGN);
+    start_servers(server, port);
+
+    test_spread();
+    test_remap();
+    test_fanout_order();
+    test_server_death();
+
+    stop_servers();
+    printf("All shard tests passed successfully!\n");
+    return 0;
+}
@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stream.h"
+#include "common.h"
+
+#define container_of(ptr, T, member) \
+    ((T *)( (char *)ptr - offsetof(T, member) ))
+
+// --- IDs ---
+
+int stream_id_cmp(const StreamID *a, const StreamID *b) {
+    if (a->ms != b->ms) {
+        return a->ms < b->ms ? -1 : 1;
+    }
+    if (a->seq != b->seq) {
+        return a->seq < b->seq ? -1 : 1;
+    }
+    return 0;
+}
+
+static bool parse_u64(const char *s, size_t len, uint64_t *out) {
+    if (len == 0 || len > 20) {
+        return false;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+        uint64_t d = (uint64_t)(s[i] - '0');
+        if (v > (UINT64_MAX - d) / 10) {
+            return false;
+        }
+        v = v * 10 + d;
+    }
+    *out = v;
+    return true;
+}
+
+bool stream_parse_id(const char *s, uint64_t missing_seq, StreamID *out) {
+    const char *dash = strchr(s, '-');
+    if (!dash) {
+        out->seq = missing_seq;
+        return parse_u64(s, strlen(s), &out->ms);
+    }
+    return parse_u64(s, (size_t)(dash - s), &out->ms)
+        && parse_u64(dash + 1, strlen(dash + 1), &out->seq);
+}
+
+void stream_format_id(const StreamID *id, char buf[STREAM_ID_BUFSIZE]) {
+    snprintf(buf, STREAM_ID_BUFSIZE, "%llu-%llu",
+             (unsigned long long)id->ms, (unsigned long long)id->seq);
+}
+
+// --- Varints (LEB128) ---
+
+static size_t varint_put(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static const uint8_t *varint_get(const uint8_t *p, uint64_t *v) {
+    uint64_t out = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t b = *p++;
+        out |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    *v = out;
+    return p;
+}
+
+const uint8_t *stream_next_str(const uint8_t *p, const char **str, uint32_t *len) {
+    uint64_t n = 0;
+    p = varint_get(p, &n);
+    *str = (const char *)p;
+    *len = (uint32_t)n;
+    return p + n;
+}
+
+// --- Streams ---
+
+Stream *stream_new(void) {
+    Stream *s = calloc(1, sizeof(Stream));
+    if (!s) {
+        die("Memory allocation failed");
+    }
+    return s;
+}
+
+// Post-order, so no freed node is visited again
+static void pel_free(AVLNode *node) {
+    if (node) {
+        pel_free(node->left);
+        pel_free(node->right);
+        free(container_of(node, StreamPending, node));
+    }
+}
+
+static void blocks_free(AVLNode *node) {
+    if (node) {
+        blocks_free(node->left);
+        blocks_free(node->right);
+        StreamBlock *blk = container_of(node, StreamBlock, node);
+        free(blk->data);
+        free(blk);
+    }
+}
+
+static void group_free(StreamGroup *g) {
+    pel_free(g->pel);
+    for (size_t i = 0; i < g->n_consumers; i++) {
+        free(g->consumers[i]->name);
+        free(g->consumers[i]);
+    }
+    free(g->consumers);
+    free(g->name);
+    free(g);
+}
+
+void stream_free(Stream *s) {
+    blocks_free(s->blocks);
+    for (size_t i = 0; i < s->n_groups; i++) {
+        group_free(s->groups[i]);
+    }
+    free(s->groups);
+    free(s);
+}
+
+size_t stream_len(const Stream *s) {
+    return s->length;
+}
+
+size_t stream_mem(const Stream *s) {
+    return sizeof(Stream) + s->n_blocks * sizeof(StreamBlock) + s->bytes + s->group_bytes;
+}
+
+// Link a new empty block after the tail (IDs only grow, so it is the maximum)
+static StreamBlock *block_append(Stream *s, const StreamID *first, size_t cap) {
+    StreamBlock *blk = malloc(sizeof(StreamBlock));
+    if (!blk) {
+        die("Memory allocation failed");
+    }
+    avl_init(&blk->node);
+    blk->first = *first;
+    blk->count = 0;
+    blk->bytes = 0;
+    blk->cap = (uint32_t)cap;
+    blk->data = malloc(cap);
+    if (!blk->data) {
+        die("Memory allocation failed");
+    }
+
+    AVLNode *last = avl_last(s->blocks);
+    if (last) {
+        last->right = &blk->node;
+        blk->node.parent = last;
+        s->blocks = avl_fix(&blk->node);
+    } else {
+        s->blocks = &blk->node;
+    }
+    s->tail = blk;
+    s->n_blocks++;
+    s->bytes += cap;
+    return blk;
+}
+
+// The next automatic ID: the clock, or the last ID + 1 if the clock is behind
+static bool next_auto_id(const Stream *s, uint64_t now_ms, StreamID *out) {
+    if (now_ms > s->last_id.ms) {
+        out->ms = now_ms;
+        out->seq = 0;
+        return true;
+    }
+    out->ms = s->last_id.ms;
+    out->seq = s->last_id.seq + 1;
+    if (out->seq == 0) {  // sequence wrapped
+        out->ms++;
+        return out->ms != 0;
+    }
+    return true;
+}
+
+bool stream_add(Stream *s, const StreamID *id, uint64_t now_ms,
+                char **strs, size_t n_strs, StreamID *added) {
+    StreamID new_id;
+    if (id) {
+        new_id = *id;
+        StreamID zero = {0, 0};
+        if (stream_id_cmp(&new_id, s->length ? &s->last_id : &zero) <= 0) {
+            return false;
+        }
+    } else if (!next_auto_id(s, now_ms, &new_id)) {
+        return false;
+    }
+
+    // 10 bytes covers any varint
+    size_t need = 30;
+    for (size_t i = 0; i < n_strs; i++) {
+        need += 10 + strlen(strs[i]);
+    }
+
+    StreamBlock *blk = s->tail;
+    StreamID prev = new_id;
+    if (blk && blk->count < k_stream_block_entries && blk->bytes + need <= k_stream_block_bytes) {
+        prev = s->last_id;
+        if (blk->bytes + need > blk->cap) {  // grow up to the block size
+            size_t cap = blk->cap * 2;
+            while (cap < blk->bytes + need) {
+                cap *= 2;
+            }
+            cap = cap < k_stream_block_bytes ? cap : k_stream_block_bytes;
+            blk->data = realloc(blk->data, cap);
+            if (!blk->data) {
+                die("Memory allocation failed");
+            }
+            s->bytes += cap - blk->cap;
+            blk->cap = (uint32_t)cap;
+        }
+    } else {
+        size_t cap = need < 256 ? 256 : need;
+        cap = cap < k_stream_block_bytes || need > k_stream_block_bytes ? cap : k_stream_block_bytes;
+        blk = block_append(s, &new_id, cap);
+    }
+
+    uint8_t *p = blk->data + blk->bytes;
+    uint64_t ms_delta = new_id.ms - prev.ms;
+    p += varint_put(p, ms_delta);
+    p += varint_put(p, ms_delta ? new_id.seq : new_id.seq - prev.seq);
+    p += varint_put(p, n_strs);
+    for (size_t i = 0; i < n_strs; i++) {
+        size_t len = strlen(strs[i]);
+        p += varint_put(p, len);
+        memcpy(p, strs[i], len);
+        p += len;
+    }
+    blk->bytes = (uint32_t)(p - blk->data);
+    blk->count++;
+
+    s->length++;
+    s->last_id = new_id;
+    *added = new_id;
+    return true;
+}
+
+// Decode the entry at p, prev is the ID before it. Returns the next entry.
+static const uint8_t *entry_decode(const uint8_t *p, const StreamID *prev, StreamEntry *e) {
+    uint64_t ms_delta = 0, seq = 0, n = 0;
+    p = varint_get(p, &ms_delta);
+    p = varint_get(p, &seq);
+    p = varint_get(p, &n);
+    e->id.ms = prev->ms + ms_delta;
+    e->id.seq = ms_delta ? seq : prev->seq + seq;
+    e->n_strs = (uint32_t)n;
+    e->strs = p;
+    for (uint64_t i = 0; i < n; i++) {
+        const char *str = NULL;
+        uint32_t len = 0;
+        p = stream_next_str(p, &str, &len);
+    }
+    return p;
+}
+
+// The last block whose first ID is <= id, or the first block
+static AVLNode *block_seek(Stream *s, const StreamID *id) {
+    AVLNode *found = NULL;
+    AVLNode *node = s->blocks;
+    while (node) {
+        StreamBlock *blk = container_of(node, StreamBlock, node);
+        if (stream_id_cmp(&blk->first, id) <= 0) {
+            found = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return found ? found : avl_first(s->blocks);
+}
+
+void stream_range(Stream *s, const StreamID *start, const StreamID *end, size_t count,
+                  bool (*cb)(const StreamEntry *e, void *arg), void *arg) {
+    if (stream_id_cmp(start, end) > 0) {
+        return;
+    }
+    size_t seen = 0;
+    for (AVLNode *node = block_seek(s, start); node; node = avl_next(node)) {
+        StreamBlock *blk = container_of(node, StreamBlock, node);
+        if (stream_id_cmp(&blk->first, end) > 0) {
+            return;
+        }
+        const uint8_t *p = blk->data;
+        StreamID prev = blk->first;
+        for (uint32_t i = 0; i < blk->count; i++) {
+            StreamEntry e;
+            p = entry_decode(p, &prev, &e);
+            prev = e.id;
+            if (stream_id_cmp(&e.id, start) < 0) {
+                continue;
+            }
+            if (stream_id_cmp(&e.id, end) > 0) {
+                return;
+            }
+            if (!cb(&e, arg) || (count && ++seen == count)) {
+                return;
+            }
+        }
+    }
+}
+
+// --- Consumer groups ---
+
+// Grow an array of pointers to hold one more
+static void *grow(void *arr, size_t n, size_t *cap) {
+    if (n < *cap) {
+        return arr;
+    }
+    *cap = *cap ? *cap * 2 : 4;
+    arr = realloc(arr, *cap * sizeof(void *));
+    if (!arr) {
+        die("Memory allocation failed");
+    }
+    return arr;
+}
+
+StreamGroup *stream_group_find(Stream *s, const char *name) {
+    for (size_t i = 0; i < s->n_groups; i++) {
+        if (strcmp(s->groups[i]->name, name) == 0) {
+            return s->groups[i];
+        }
+    }
+    return NULL;
+}
+
+StreamGroup *stream_group_create(Stream *s, const char *name, const StreamID *last) {
+    if (stream_group_find(s, name)) {
+        return NULL;
+    }
+    StreamGroup *g = calloc(1, sizeof(StreamGroup));
+    if (!g) {
+        die("Memory allocation failed");
+    }
+    g->name = strdup(name);
+    g->last_delivered = *last;
+    s->groups = grow(s->groups, s->n_groups, &s->cap_groups);
+    s->groups[s->n_groups++] = g;
+    s->group_bytes += sizeof(StreamGroup) + strlen(name) + 1;
+    return g;
+}
+
+bool stream_group_destroy(Stream *s, const char *name) {
+    for (size_t i = 0; i < s->n_groups; i++) {
+        StreamGroup *g = s->groups[i];
+        if (strcmp(g->name, name) == 0) {
+            size_t mem = sizeof(StreamGroup) + strlen(g->name) + 1
+                       + g->pel_count * sizeof(StreamPending);
+            for (size_t j = 0; j < g->n_consumers; j++) {
+                mem += sizeof(StreamConsumer) + strlen(g->consumers[j]->name) + 1;
+            }
+            s->group_bytes -= mem;
+            group_free(g);
+            s->groups[i] = s->groups[--s->n_groups];
+            return true;
+        }
+    }
+    return false;
+}
+
+StreamConsumer *stream_consumer_get(Stream *s, StreamGroup *g, const char *name, uint64_t now_ms) {
+    for (size_t i = 0; i < g->n_consumers; i++) {
+        if (strcmp(g->consumers[i]->name, name) == 0) {
+            g->consumers[i]->seen_ms = now_ms;
+            return g->consumers[i];
+        }
+    }
+    StreamConsumer *c = calloc(1, sizeof(StreamConsumer));
+    if (!c) {
+        die("Memory allocation failed");
+    }
+    c->name = strdup(name);
+    c->seen_ms = now_ms;
+    g->consumers = grow(g->consumers, g->n_consumers, &g->cap_consumers);
+    g->consumers[g->n_consumers++] = c;
+    s->group_bytes += sizeof(StreamConsumer) + strlen(name) + 1;
+    return c;
+}
+
+StreamPending *stream_pel_find(StreamGroup *g, const StreamID *id) {
+    AVLNode *node = g->pel;
+    while (node) {
+        StreamPending *p = container_of(node, StreamPending, node);
+        int cmp = stream_id_cmp(id, &p->id);
+        if (cmp == 0) {
+            return p;
+        }
+        node = cmp < 0 ? node->left : node->right;
+    }
+    return NULL;
+}
+
+void stream_pel_add(Stream *s, StreamGroup *g, StreamConsumer *c, const StreamID *id, uint64_t now_ms) {
+    StreamPending *p = stream_pel_find(g, id);
+    if (p) {
+        p->consumer->pending--;
+        p->consumer = c;
+        p->delivery_ms = now_ms;
+        p->deliveries++;
+        c->pending++;
+        return;
+    }
+
+    p = malloc(sizeof(StreamPending));
+    if (!p) {
+        die("Memory allocation failed");
+    }
+    avl_init(&p->node);
+    p->id = *id;
+    p->consumer = c;
+    p->delivery_ms = now_ms;
+    p->deliveries = 1;
+
+    AVLNode *cur = NULL;
+    AVLNode **from = &g->pel;
+    while (*from) {
+        cur = *from;
+        StreamPending *q = container_of(cur, StreamPending, node);
+        from = stream_id_cmp(id, &q->id) < 0 ? &cur->left : &cur->right;
+    }
+    *from = &p->node;
+    p->node.parent = cur;
+    g->pel = avl_fix(&p->node);
+    g->pel_count++;
+    c->pending++;
+    s->group_bytes += sizeof(StreamPending);
+}
+
+bool stream_ack(Stream *s, StreamGroup *g, const StreamID *id) {
+    StreamPending *p = stream_pel_find(g, id);
+    if (!p) {
+        return false;
+    }
+    g->pel = avl_del(&p->node);
+    g->pel_count--;
+    p->consumer->pending--;
+    s->group_bytes -= sizeof(StreamPending);
+    free(p);
+    return true;
+}
+
+void stream_pel_range(StreamGroup *g, const StreamID *start, const StreamID *end, size_t count,
+                      const StreamConsumer *consumer,
+                      bool (*cb)(StreamPending *p, void *arg), void *arg) {
+    // first entry >= start
+    AVLNode *node = NULL;
+    for (AVLNode *cur = g->pel; cur; ) {
+        StreamPending *p = container_of(cur, StreamPending, node);
+        if (stream_id_cmp(&p->id, start) >= 0) {
+            node = cur;
+            cur = cur->left;
+        } else {
+            cur = cur->right;
+        }
+    }
+    size_t seen = 0;
+    for (; node; node = avl_next(node)) {
+        StreamPending *p = container_of(node, StreamPending, node);
+        if (stream_id_cmp(&p->id, end) > 0) {
+            return;
+        }
+        if (consumer && p->consumer != consumer) {
+            continue;
+        }
+        if (!cb(p, arg) || (count && ++seen == count)) {
+            return;
+        }
+    }
+}
+
+StreamPending *stream_pel_first(StreamGroup *g) {
+    AVLNode *node = avl_first(g->pel);
+    return node ? container_of(node, StreamPending, node) : NULL;
+}
+
+StreamPending *stream_pel_last(StreamGroup *g) {
+    AVLNode *node = avl_last(g->pel);
+    return node ? container_of(node, StreamPending, node) : NULL;
+}
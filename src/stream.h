@@ -0,0 +1,119 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "avl.h"
+
+// Stream value type: an append-only log of field/value entries with
+// strictly increasing <ms>-<seq> IDs.
+// Entries are packed back to back in blocks. Each entry stores its ID as
+// varint deltas from the previous one, then its strings as varint length +
+// bytes, so a typical entry costs a few bytes of overhead. The blocks are
+// indexed by an AVL tree ordered by first ID: a range read descends to the
+// first block in O(log n) and then decodes forward.
+#define k_stream_block_bytes 4096
+#define k_stream_block_entries 128
+
+typedef struct StreamID {
+    uint64_t ms;
+    uint64_t seq;
+} StreamID;
+
+// Room for "<u64>-<u64>" and the NUL
+#define STREAM_ID_BUFSIZE 42
+
+typedef struct StreamBlock {
+    AVLNode node;
+    StreamID first;
+    uint32_t count;
+    uint32_t bytes;  // used
+    uint32_t cap;    // allocated
+    uint8_t *data;
+} StreamBlock;
+
+// An entry decoded in place, valid until the next write
+typedef struct StreamEntry {
+    StreamID id;
+    uint32_t n_strs;       // field, value, field, value...
+    const uint8_t *strs;   // packed, read them with stream_next_str()
+} StreamEntry;
+
+// Consumer groups hand every entry to one consumer of the group and
+// remember it in the pending entries list (PEL) until it is acknowledged.
+typedef struct StreamConsumer {
+    char *name;
+    size_t pending;
+    uint64_t seen_ms;
+} StreamConsumer;
+
+typedef struct StreamPending {
+    AVLNode node;  // in the group's PEL, ordered by id
+    StreamID id;
+    StreamConsumer *consumer;
+    uint64_t delivery_ms;
+    uint32_t deliveries;
+} StreamPending;
+
+typedef struct StreamGroup {
+    char *name;
+    StreamID last_delivered;
+    AVLNode *pel;
+    size_t pel_count;
+    StreamConsumer **consumers;
+    size_t n_consumers;
+    size_t cap_consumers;
+} StreamGroup;
+
+typedef struct Stream {
+    AVLNode *blocks;
+    StreamBlock *tail;  // the block appends go to
+    size_t length;
+    size_t n_blocks;
+    size_t bytes;       // sum of the block capacities
+    size_t group_bytes; // groups, consumers and PEL entries
+    StreamID last_id;
+    StreamGroup **groups;
+    size_t n_groups;
+    size_t cap_groups;
+} Stream;
+
+int stream_id_cmp(const StreamID *a, const StreamID *b);
+// "<ms>-<seq>", or "<ms>" with the sequence set to missing_seq
+bool stream_parse_id(const char *s, uint64_t missing_seq, StreamID *out);
+void stream_format_id(const StreamID *id, char buf[STREAM_ID_BUFSIZE]);
+
+Stream *stream_new(void);
+void stream_free(Stream *s);
+size_t stream_len(const Stream *s);
+size_t stream_mem(const Stream *s);  // estimated bytes, for maxmemory
+
+// Append an entry of n_strs strings (field/value pairs). With id NULL the
+// ID is generated from now_ms. False if the ID is not above the last one.
+bool stream_add(Stream *s, const StreamID *id, uint64_t now_ms,
+                char **strs, size_t n_strs, StreamID *added);
+// Visit entries with start <= id <= end in order, at most count (0 = all).
+// The callback returns false to stop.
+void stream_range(Stream *s, const StreamID *start, const StreamID *end, size_t count,
+                  bool (*cb)(const StreamEntry *e, void *arg), void *arg);
+const uint8_t *stream_next_str(const uint8_t *p, const char **str, uint32_t *len);
+
+// --- Consumer groups ---
+StreamGroup *stream_group_find(Stream *s, const char *name);
+StreamGroup *stream_group_create(Stream *s, const char *name, const StreamID *last);  // NULL if it exists
+bool stream_group_destroy(Stream *s, const char *name);
+StreamConsumer *stream_consumer_get(Stream *s, StreamGroup *g, const char *name, uint64_t now_ms);
+// Record a delivery. An entry already pending moves to the new consumer.
+void stream_pel_add(Stream *s, StreamGroup *g, StreamConsumer *c, const StreamID *id, uint64_t now_ms);
+StreamPending *stream_pel_find(StreamGroup *g, const StreamID *id);
+bool stream_ack(Stream *s, StreamGroup *g, const StreamID *id);
+// Visit pending entries with start <= id <= end, only those of consumer
+// unless it is NULL, at most count (0 = all)
+void stream_pel_range(StreamGroup *g, const StreamID *start, const StreamID *end, size_t count,
+                      const StreamConsumer *consumer,
+                      bool (*cb)(StreamPending *p, void *arg), void *arg);
+StreamPending *stream_pel_first(StreamGroup *g);
+StreamPending *stream_pel_last(StreamGroup *g);
+
+#endif
@@ -5,6 +5,19 @@
 #include <stdbool.h>
 #include <stddef.h> // for offsetof
 #include "avl.h"
+#include "btree.h"
+#include "script.h"
+#include "kv.h"
+#include "buffer.h"
+#include "protocol.h"
+#include "listpack.h"
+#include "dump.h"
+#include "hash.h"
+#include "quicklist.h"
+#include "stream.h"
+#include "bitmap.h"
+#include "hll.h"
+#include "zset.h"
 
 #define container_of(ptr, type, member) ({                  \
     const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
@@ -238,6 +251,1088 @@ static void test_remove(uint32_t sz) {
     }
 }
 
+// --- B+tree, checked against the same reference ---
+
+// A coarse key, so that many entries tie and the comparator decides
+static uint64_t bt_key_of(uint32_t val) {
+    return val >> 3;
+}
+
+// Items are the values + 1 (NULL means "not found")
+static void *bt_item_of(uint32_t val) {
+    return (void *)(uintptr_t)(val + 1);
+}
+
+static uint32_t bt_val_of(const void *item) {
+    return (uint32_t)((uintptr_t)item - 1);
+}
+
+static int bt_cmp_val(const void *a, const void *b) {
+    uintptr_t l = (uintptr_t)a, r = (uintptr_t)b;
+    return l < r ? -1 : l > r;
+}
+
+// Returns the item count, checks order, separators, counts and fill.
+// *depth is the leaf depth, which must be the same everywhere.
+static uint32_t bt_verify_node(BTNode *node, bool is_root, uint32_t level, uint32_t *depth) {
+    assert(node->n <= k_btree_fanout);
+    assert(is_root || node->n >= k_btree_fanout / 2);
+    for (uint32_t i = 1; i < node->n; i++) {
+        assert(node->keys[i - 1] <= node->keys[i]);
+        assert(node->keys[i - 1] < node->keys[i] || bt_cmp_val(node->items[i - 1], node->items[i]) <= 0);
+        assert(node->keys[i] == bt_key_of(bt_val_of(node->items[i])));
+    }
+    if (node->leaf) {
+        if (*depth == UINT32_MAX) {
+            *depth = level;
+        }
+        assert(*depth == level);
+        return node->n;
+    }
+    BTInner *inner = (BTInner *)node;
+    assert(node->n >= 2);
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < node->n; i++) {
+        BTNode *child = inner->children[i];
+        assert(node->keys[i] == child->keys[0] && node->items[i] == child->items[0]);
+        uint32_t cnt = bt_verify_node(child, false, level + 1, depth);
+        assert(inner->counts[i] == cnt);
+        total += cnt;
+    }
+    return total;
+}
+
+static void bt_container_verify(BTree *tree, Multiset *ref) {
+    assert(bt_len(tree) == ref->size);
+    if (tree->root) {
+        uint32_t depth = UINT32_MAX;
+        assert(bt_verify_node(tree->root, true, 0, &depth) == ref->size);
+    }
+
+    // walk the leaf chain both ways
+    size_t i = 0;
+    for (BTIter it = bt_first(tree); bt_valid(&it); bt_next(&it)) {
+        assert(i < ref->size && bt_val_of(bt_item(&it)) == ref->arr[i]);
+        i++;
+    }
+    assert(i == ref->size);
+    for (BTIter it = bt_last(tree); bt_valid(&it); bt_prev(&it)) {
+        assert(bt_val_of(bt_item(&it)) == ref->arr[--i]);
+    }
+    assert(i == 0);
+
+    // ranks and positions
+    for (i = 0; i < ref->size; i++) {
+        uint32_t val = ref->arr[i];
+        size_t lower = i;
+        while (lower > 0 && ref->arr[lower - 1] == val) {
+            lower--;
+        }
+        assert(bt_rank(tree, bt_key_of(val), bt_item_of(val)) == lower);
+        BTIter at = bt_at(tree, i);
+        assert(bt_val_of(bt_item(&at)) == val);
+        assert(bt_find(tree, bt_key_of(val), bt_item_of(val)) == bt_item_of(val));
+    }
+}
+
+static void test_btree(uint32_t n_ops, uint32_t range) {
+    BTree tree;
+    bt_init(&tree, bt_cmp_val);
+    Multiset ref;
+    ms_init(&ref);
+
+    for (uint32_t i = 0; i < n_ops; i++) {
+        uint32_t val = (uint32_t)rand() % range;
+        if (rand() % 3) {
+            bt_insert(&tree, bt_key_of(val), bt_item_of(val));
+            ms_insert(&ref, val);
+        } else {
+            bool in_ref = ms_erase(&ref, val);
+            void *got = bt_delete(&tree, bt_key_of(val), bt_item_of(val));
+            assert(in_ref ? got == bt_item_of(val) : got == NULL);
+        }
+        if (i % 97 == 0) {
+            bt_container_verify(&tree, &ref);
+        }
+    }
+    bt_container_verify(&tree, &ref);
+
+    // seeks land on the first entry >= (or >) the probe
+    for (uint32_t val = 0; val <= range; val++) {
+        size_t lower = 0, upper = 0;
+        while (lower < ref.size && ref.arr[lower] < val) {
+            lower++;
+        }
+        upper = lower;
+        while (upper < ref.size && ref.arr[upper] == val) {
+            upper++;
+        }
+        BTIter ge = bt_seek(&tree, bt_key_of(val), bt_item_of(val), false);
+        BTIter gt = bt_seek(&tree, bt_key_of(val), bt_item_of(val), true);
+        assert(lower < ref.size ? bt_val_of(bt_item(&ge)) == ref.arr[lower] : !bt_valid(&ge));
+        assert(upper < ref.size ? bt_val_of(bt_item(&gt)) == ref.arr[upper] : !bt_valid(&gt));
+    }
+
+    // drain
+    while (ref.size) {
+        uint32_t val = ref.arr[(size_t)rand() % ref.size];
+        ms_erase(&ref, val);
+        assert(bt_delete(&tree, bt_key_of(val), bt_item_of(val)) == bt_item_of(val));
+        if (ref.size % 101 == 0) {
+            bt_container_verify(&tree, &ref);
+        }
+    }
+    assert(tree.root == NULL && tree.bytes == 0);
+    bt_clear(&tree);
+    ms_destroy(&ref);
+}
+
+// --- Listpack and quicklist ---
+
+// Reference sequence of strings
+typedef struct {
+    char **s;
+    uint32_t *len;
+    size_t n;
+    size_t cap;
+} StrSeq;
+
+// A string of len bytes derived from id. Lengths around 127/128 cross
+// the 1- to 5-byte len and backlen boundaries.
+static char *make_str(uint32_t id, uint32_t len) {
+    char *s = malloc(len + 1);
+    for (uint32_t i = 0; i < len; i++) {
+        s[i] = (char)('a' + (id + i * 7) % 26);
+    }
+    s[len] = '\0';
+    return s;
+}
+
+static uint32_t rand_len(void) {
+    static const uint32_t k_lens[] = {0, 1, 120, 121, 122, 123, 126, 127, 128, 129, 300};
+    return rand() % 2 ? (uint32_t)rand() % 20 : k_lens[rand() % 11];
+}
+
+static void seq_insert(StrSeq *seq, size_t at, char *s, uint32_t len) {
+    if (seq->n == seq->cap) {
+        seq->cap = seq->cap ? seq->cap * 2 : 16;
+        seq->s = realloc(seq->s, seq->cap * sizeof(char *));
+        seq->len = realloc(seq->len, seq->cap * sizeof(uint32_t));
+    }
+    memmove(&seq->s[at + 1], &seq->s[at], (seq->n - at) * sizeof(char *));
+    memmove(&seq->len[at + 1], &seq->len[at], (seq->n - at) * sizeof(uint32_t));
+    seq->s[at] = s;
+    seq->len[at] = len;
+    seq->n++;
+}
+
+static void seq_erase(StrSeq *seq, size_t at) {
+    free(seq->s[at]);
+    memmove(&seq->s[at], &seq->s[at + 1], (seq->n - at - 1) * sizeof(char *));
+    memmove(&seq->len[at], &seq->len[at + 1], (seq->n - at - 1) * sizeof(uint32_t));
+    seq->n--;
+}
+
+static void seq_destroy(StrSeq *seq) {
+    for (size_t i = 0; i < seq->n; i++) {
+        free(seq->s[i]);
+    }
+    free(seq->s);
+    free(seq->len);
+}
+
+static bool str_is(const char *got, uint32_t got_len, const StrSeq *seq, size_t i) {
+    return got && got_len == seq->len[i] && memcmp(got, seq->s[i], got_len) == 0;
+}
+
+static bool entry_is(const uint8_t *p, const StrSeq *seq, size_t i) {
+    uint32_t len = 0;
+    const char *s = lp_get(p, &len);
+    return str_is(s, len, seq, i);
+}
+
+static bool peek_is(QuickList *ql, bool head, const StrSeq *seq) {
+    uint32_t len = 0;
+    const char *s = ql_peek(ql, head, &len);
+    return seq->n ? str_is(s, len, seq, head ? 0 : seq->n - 1) : s == NULL;
+}
+
+static void lp_verify(uint8_t *lp, const StrSeq *ref) {
+    assert(lp_count(lp) == ref->n);
+    size_t bytes = 8;
+    size_t i = 0;
+    for (uint8_t *p = lp_first(lp); p; p = lp_next(lp, p)) {
+        uint32_t len = 0;
+        const char *s = lp_get(p, &len);
+        assert(i < ref->n && str_is(s, len, ref, i));
+        size_t head = (len < 128 ? 1 : 5) + len;
+        bytes += head + (head < 128 ? 1 : 5);
+        i++;
+    }
+    assert(i == ref->n && lp_bytes(lp) == bytes);
+    for (uint8_t *p = lp_last(lp); p; p = lp_prev(lp, p)) {
+        assert(entry_is(p, ref, --i));
+    }
+    assert(i == 0);
+    for (int64_t k = -(int64_t)ref->n - 1; k <= (int64_t)ref->n; k++) {
+        uint8_t *p = lp_seek(lp, k);
+        bool in_range = k >= -(int64_t)ref->n && k < (int64_t)ref->n;
+        assert(in_range == (p != NULL));
+        assert(!p || entry_is(p, ref, (size_t)(k < 0 ? k + (int64_t)ref->n : k)));
+    }
+}
+
+static void test_listpack(void) {
+    uint8_t *lp = lp_new();
+    StrSeq ref = {0};
+    lp_verify(lp, &ref);
+    assert(lp_first(lp) == NULL && lp_last(lp) == NULL);
+
+    for (uint32_t op = 0; op < 3000; op++) {
+        uint32_t len = rand_len();
+        char *s = make_str(op, len);
+        size_t at = ref.n ? (size_t)rand() % ref.n : 0;
+        switch (ref.n > 60 ? 4 + rand() % 2 : rand() % 6) {
+        case 0:
+            lp = lp_append(lp, s, len);
+            seq_insert(&ref, ref.n, s, len);
+            break;
+        case 1:
+            lp = lp_prepend(lp, s, len);
+            seq_insert(&ref, 0, s, len);
+            break;
+        case 2: {
+            uint8_t *p = lp_seek(lp, (int64_t)at);
+            lp = lp_insert(lp, &p, s, len);
+            seq_insert(&ref, at, s, len);
+            assert(entry_is(p, &ref, at));
+            break;
+        }
+        case 3:
+            if (ref.n) {
+                uint8_t *p = lp_seek(lp, (int64_t)at);
+                lp = lp_replace(lp, &p, s, len);
+                free(ref.s[at]);
+                ref.s[at] = s;
+                ref.len[at] = len;
+                break;
+            }
+            free(s);
+            break;
+        default:
+            free(s);
+            if (ref.n) {
+                uint8_t *p = lp_seek(lp, (int64_t)at);
+                lp = lp_delete(lp, &p);
+                seq_erase(&ref, at);
+                // p moved to the next entry
+                assert(at < ref.n ? entry_is(p, &ref, at) : p == NULL);
+            }
+        }
+        lp_verify(lp, &ref);
+    }
+
+    // lp_find with a step only looks at every step-th entry
+    lp_free(lp);
+    seq_destroy(&ref);
+    lp = lp_new();
+    for (int i = 0; i < 10; i++) {
+        char buf[4];
+        snprintf(buf, sizeof(buf), "%c%d", i % 2 ? 'v' : 'f', i / 2);
+        lp = lp_append(lp, buf, (uint32_t)strlen(buf));
+    }
+    assert(lp_find(lp, lp_first(lp), "f3", 2, 2) == lp_seek(lp, 6));
+    assert(lp_find(lp, lp_first(lp), "v3", 2, 2) == NULL);
+    assert(lp_find(lp, lp_seek(lp, 1), "v3", 2, 2) == lp_seek(lp, 7));
+    assert(lp_find(lp, lp_first(lp), "v4", 2, 1) == lp_last(lp));
+    assert(lp_find(lp, lp_first(lp), "f", 1, 1) == NULL);
+    lp_free(lp);
+}
+
+static bool cb_collect(const char *s, uint32_t len, void *arg) {
+    StrSeq *out = (StrSeq *)arg;
+    char *copy = malloc(len + 1);
+    memcpy(copy, s, len);
+    seq_insert(out, out->n, copy, len);
+    return out->n < 50;  // stop early
+}
+
+static void ql_verify(QuickList *ql, const StrSeq *ref) {
+    assert(ql_len(ql) == ref->n);
+    size_t count = 0, nodes = 0, bytes = 0;
+    for (QuickNode *node = ql->head; node; node = node->next) {
+        assert(node->prev ? node->prev->next == node : ql->head == node);
+        assert(lp_count(node->lp) > 0);
+        // only an element too big for a chunk gets one over the limit
+        assert(lp_bytes(node->lp) <= k_quicklist_chunk_bytes || lp_count(node->lp) == 1);
+        count += lp_count(node->lp);
+        bytes += lp_bytes(node->lp);
+        nodes++;
+    }
+    assert(count == ref->n && nodes == ql->nodes && bytes == ql->bytes);
+    assert(ref->n ? ql->tail && !ql->tail->next : !ql->head && !ql->tail);
+
+    for (int64_t k = -(int64_t)ref->n - 1; k <= (int64_t)ref->n; k++) {
+        uint32_t len = 0;
+        const char *s = ql_index(ql, k, &len);
+        bool in_range = k >= -(int64_t)ref->n && k < (int64_t)ref->n;
+        assert(in_range ? str_is(s, len, ref, (size_t)(k < 0 ? k + (int64_t)ref->n : k)) : !s);
+    }
+    assert(peek_is(ql, true, ref) && peek_is(ql, false, ref));
+
+    if (ref->n) {
+        size_t start = (size_t)rand() % ref->n;
+        StrSeq got = {0};
+        ql_range(ql, start, ref->n - 1, cb_collect, &got);
+        size_t want = ref->n - start < 50 ? ref->n - start : 50;
+        assert(got.n == want);
+        for (size_t i = 0; i < got.n; i++) {
+            assert(str_is(got.s[i], got.len[i], ref, start + i));
+        }
+        seq_destroy(&got);
+    }
+}
+
+static void test_quicklist(void) {
+    QuickList *ql = ql_new();
+    StrSeq ref = {0};
+    ql_pop(ql, true);  // no-op when empty
+    ql_pop(ql, false);
+    ql_verify(ql, &ref);
+
+    for (uint32_t op = 0; op < 4000; op++) {
+        bool head = rand() % 2;
+        if (rand() % 3 || !ref.n) {
+            // now and then an element bigger than a chunk
+            uint32_t len = rand() % 50 ? rand_len() : k_quicklist_chunk_bytes + (uint32_t)rand() % 100;
+            char *s = make_str(op, len);
+            ql_push(ql, head, s, len);
+            seq_insert(&ref, head ? 0 : ref.n, s, len);
+        } else {
+            ql_pop(ql, head);
+            seq_erase(&ref, head ? 0 : ref.n - 1);
+        }
+        if (op % 37 == 0) {
+            ql_verify(ql, &ref);
+        }
+    }
+    ql_verify(ql, &ref);
+    assert(ql->nodes > 1);
+
+    // drain from both ends
+    while (ref.n) {
+        bool head = rand() % 2;
+        ql_pop(ql, head);
+        seq_erase(&ref, head ? 0 : ref.n - 1);
+    }
+    ql_verify(ql, &ref);
+    assert(ql->nodes == 0);
+    ql_free(ql);
+    seq_destroy(&ref);
+}
+
+// --- Streams ---
+
+// Entry i of the reference stream: a value of i's digits, more pairs for
+// some, and now and then a value larger than a block
+static size_t stream_strs(uint64_t i, char **strs, char *num, char *big) {
+    snprintf(num, 24, "%llu", (unsigned long long)i);
+    size_t n = 0;
+    strs[n++] = "f";
+    strs[n++] = i % 50 == 7 ? big : num;
+    for (uint64_t k = 0; k < i % 4; k++) {
+        strs[n++] = "g";
+        strs[n++] = num;
+    }
+    return n;
+}
+
+typedef struct {
+    const StreamID *ids;
+    size_t at;  // next expected
+    char *big;
+} RangeCheck;
+
+static bool cb_check_entry(const StreamEntry *e, void *arg) {
+    RangeCheck *rc = (RangeCheck *)arg;
+    assert(stream_id_cmp(&e->id, &rc->ids[rc->at]) == 0);
+    char *strs[8], num[24];
+    size_t n = stream_strs(rc->at, strs, num, rc->big);
+    assert(e->n_strs == n);
+    const uint8_t *p = e->strs;
+    for (size_t i = 0; i < n; i++) {
+        const char *s = NULL;
+        uint32_t len = 0;
+        p = stream_next_str(p, &s, &len);
+        assert(len == strlen(strs[i]) && memcmp(s, strs[i], len) == 0);
+    }
+    rc->at++;
+    return true;
+}
+
+static void test_stream_ids(void) {
+    StreamID id;
+    char buf[STREAM_ID_BUFSIZE];
+    assert(stream_parse_id("5-3", 0, &id) && id.ms == 5 && id.seq == 3);
+    assert(stream_parse_id("7", 9, &id) && id.ms == 7 && id.seq == 9);
+    assert(stream_parse_id("18446744073709551615-18446744073709551615", 0, &id));
+    assert(id.ms == UINT64_MAX && id.seq == UINT64_MAX);
+    stream_format_id(&id, buf);
+    assert(strcmp(buf, "18446744073709551615-18446744073709551615") == 0);
+    static const char *const k_bad[] = {
+        "", "-", "-1", "1-", "a-1", "1-b", "1-2-3", "+1", " 1", "18446744073709551616",
+    };
+    for (size_t i = 0; i < sizeof(k_bad) / sizeof(k_bad[0]); i++) {
+        assert(!stream_parse_id(k_bad[i], 0, &id));
+    }
+
+    // automatic IDs follow the clock, or the last ID when it is behind
+    Stream *s = stream_new();
+    StreamID added, explicit_id = {100, 5};
+    char *strs[] = {"f", "v"};
+    assert(stream_add(s, NULL, 50, strs, 2, &added) && added.ms == 50 && added.seq == 0);
+    assert(stream_add(s, NULL, 50, strs, 2, &added) && added.ms == 50 && added.seq == 1);
+    assert(stream_add(s, &explicit_id, 0, strs, 2, &added));
+    assert(stream_add(s, NULL, 60, strs, 2, &added) && added.ms == 100 && added.seq == 6);
+    assert(!stream_add(s, &explicit_id, 0, strs, 2, &added));  // not above the last
+    StreamID top = {UINT64_MAX, UINT64_MAX - 1};
+    assert(stream_add(s, &top, 0, strs, 2, &added));
+    assert(stream_add(s, NULL, 0, strs, 2, &added) && added.seq == UINT64_MAX);
+    assert(!stream_add(s, NULL, 0, strs, 2, &added));  // no ID left
+    assert(stream_len(s) == 6);
+    stream_free(s);
+
+    // 0-0 is never a valid entry ID
+    s = stream_new();
+    StreamID zero = {0, 0}, one = {0, 1};
+    assert(!stream_add(s, &zero, 0, strs, 2, &added));
+    assert(stream_add(s, &one, 0, strs, 2, &added));
+    stream_free(s);
+}
+
+static void test_stream_blocks(void) {
+    enum { N = 3000 };
+    Stream *s = stream_new();
+    StreamID *ids = malloc(N * sizeof(StreamID));
+    char *big = make_str(1, k_stream_block_bytes + 100);
+
+    // deltas of every size: same ms, small steps, and jumps past 2^32
+    StreamID id = {1, 0};
+    for (uint64_t i = 0; i < N; i++) {
+        switch (rand() % 4) {
+        case 0:
+            id.seq += 1 + (uint64_t)rand() % 3;
+            break;
+        case 1:
+            id.ms += 1 + (uint64_t)rand() % 1000;
+            id.seq = (uint64_t)rand() % 3;
+            break;
+        case 2:
+            id.ms += (uint64_t)rand() << 20;
+            id.seq = (uint64_t)rand() << 16;
+            break;
+        default:
+            id.seq += (uint64_t)rand() << 12;
+        }
+        char *strs[8], num[24];
+        size_t n = stream_strs(i, strs, num, big);
+        StreamID added;
+        assert(stream_add(s, &id, 0, strs, n, &added) && stream_id_cmp(&added, &id) == 0);
+        ids[i] = id;
+    }
+    assert(stream_len(s) == N && stream_id_cmp(&s->last_id, &ids[N - 1]) == 0);
+
+    // blocks stay within their limits, except one holding a big entry
+    size_t entries = 0, blocks = 0, bytes = 0;
+    for (AVLNode *node = avl_first(s->blocks); node; node = avl_next(node)) {
+        StreamBlock *blk = container_of(node, StreamBlock, node);
+        assert(blk->count > 0 && blk->count <= k_stream_block_entries);
+        assert(blk->bytes <= blk->cap && (blk->cap <= k_stream_block_bytes || blk->count == 1));
+        assert(stream_id_cmp(&blk->first, &ids[entries]) == 0);
+        entries += blk->count;
+        bytes += blk->cap;
+        blocks++;
+    }
+    assert(entries == N && blocks == s->n_blocks && bytes == s->bytes && blocks > N / 128);
+
+    // every range against the reference, with and without a count
+    static const StreamID k_min = {0, 0};
+    static const StreamID k_max = {UINT64_MAX, UINT64_MAX};
+    RangeCheck rc = {ids, 0, big};
+    stream_range(s, &k_min, &k_max, 0, cb_check_entry, &rc);
+    assert(rc.at == N);
+    for (int t = 0; t < 300; t++) {
+        size_t lo = (size_t)rand() % N, hi = (size_t)rand() % N;
+        size_t count = rand() % 2 ? (size_t)rand() % 200 : 0;
+        // bounds exactly on an entry, or just past it
+        StreamID start = ids[lo], end = ids[hi];
+        bool start_after = rand() % 2;
+        if (start_after) {
+            start.seq++;
+        }
+        size_t first = lo + start_after;
+        size_t want = hi >= first ? hi - first + 1 : 0;
+        want = count && count < want ? count : want;
+        rc.at = first;
+        stream_range(s, &start, &end, count, cb_check_entry, &rc);
+        assert(rc.at == first + want);
+    }
+    stream_free(s);
+    free(ids);
+    free(big);
+}
+
+typedef struct {
+    const uint8_t *owner;  // reference: consumer index + 1 by entry, 0 if not pending
+    size_t at;
+    size_t seen;
+    StreamConsumer **consumers;
+    const StreamConsumer *only;
+} PelCheck;
+
+static bool cb_check_pending(StreamPending *p, void *arg) {
+    PelCheck *pc = (PelCheck *)arg;
+    while (!pc->owner[pc->at] || (pc->only && pc->consumers[pc->owner[pc->at] - 1] != pc->only)) {
+        pc->at++;
+    }
+    assert(p->id.ms == pc->at + 1 && p->id.seq == 0);
+    assert(p->consumer == pc->consumers[pc->owner[pc->at] - 1]);
+    pc->at++;
+    pc->seen++;
+    return true;
+}
+
+static void test_stream_pel(void) {
+    enum { N = 2000, N_CONSUMERS = 4 };
+    Stream *s = stream_new();
+    StreamID start = {0, 0};
+    StreamGroup *g = stream_group_create(s, "grp", &start);
+    assert(g && !stream_group_create(s, "grp", &start) && stream_group_find(s, "grp") == g);
+    StreamConsumer *cs[N_CONSUMERS];
+    for (int i = 0; i < N_CONSUMERS; i++) {
+        char name[8];
+        snprintf(name, sizeof(name), "c%d", i);
+        cs[i] = stream_consumer_get(s, g, name, 0);
+    }
+    assert(stream_consumer_get(s, g, "c2", 99) == cs[2] && cs[2]->seen_ms == 99);
+
+    // entry i has ID (i + 1)-0
+    uint8_t owner[N] = {0};
+    uint32_t deliveries[N] = {0};
+    for (int op = 0; op < 20000; op++) {
+        size_t i = (size_t)rand() % N;
+        StreamID id = {i + 1, 0};
+        if (rand() % 3) {
+            int c = rand() % N_CONSUMERS;
+            stream_pel_add(s, g, cs[c], &id, (uint64_t)op);
+            owner[i] = (uint8_t)(c + 1);
+            deliveries[i]++;
+            StreamPending *p = stream_pel_find(g, &id);
+            assert(p && p->consumer == cs[c] && p->delivery_ms == (uint64_t)op);
+            assert(p->deliveries == deliveries[i]);
+        } else {
+            assert(stream_ack(s, g, &id) == (owner[i] != 0));
+            owner[i] = 0;
+            deliveries[i] = 0;
+            assert(!stream_pel_find(g, &id));
+        }
+    }
+
+    size_t pending = 0, by_consumer[N_CONSUMERS] = {0};
+    size_t first = N, last = 0;
+    for (size_t i = 0; i < N; i++) {
+        if (owner[i]) {
+            pending++;
+            by_consumer[owner[i] - 1]++;
+            first = i < first ? i : first;
+            last = i;
+        }
+    }
+    assert(g->pel_count == pending && pending > 0);
+    for (int c = 0; c < N_CONSUMERS; c++) {
+        assert(cs[c]->pending == by_consumer[c]);
+    }
+    assert(stream_pel_first(g)->id.ms == first + 1 && stream_pel_last(g)->id.ms == last + 1);
+
+    // ranges, all consumers or one
+    for (int t = 0; t < 200; t++) {
+        size_t lo = (size_t)rand() % N, hi = lo + (size_t)rand() % (N - lo);
+        size_t count = rand() % 2 ? 1 + (size_t)rand() % 50 : 0;
+        const StreamConsumer *only = rand() % 2 ? cs[rand() % N_CONSUMERS] : NULL;
+        size_t want = 0;
+        for (size_t i = lo; i <= hi; i++) {
+            want += owner[i] && (!only || cs[owner[i] - 1] == only);
+        }
+        want = count && count < want ? count : want;
+        StreamID from = {lo + 1, 0}, to = {hi + 1, 0};
+        PelCheck pc = {owner, lo, 0, cs, only};
+        stream_pel_range(g, &from, &to, count, only, cb_check_pending, &pc);
+        assert(pc.seen == want);
+    }
+
+    // destroying the groups gives back all their memory
+    stream_group_create(s, "other", &start);
+    assert(stream_group_destroy(s, "grp") && !stream_group_destroy(s, "grp"));
+    assert(stream_group_destroy(s, "other"));
+    assert(s->n_groups == 0 && s->group_bytes == 0);
+    stream_free(s);
+}
+
+// --- HyperLogLog ---
+
+static void hll_add_range(HLL *h, uint32_t from, uint32_t to) {
+    for (uint32_t i = from; i < to; i++) {
+        char buf[16];
+        int n = snprintf(buf, sizeof(buf), "el:%u", i);
+        hll_add(h, buf, (size_t)n);
+    }
+}
+
+static void test_hll_sparse_to_dense(void) {
+    HLL *h = hll_new();
+    assert(hll_count(h) == 0 && !h->dense);
+    uint8_t *before = calloc(k_hll_registers, 1);
+    uint8_t *after = calloc(k_hll_registers, 1);
+
+    // every add raises at most one register, across the conversion too,
+    // and both encodings agree with the raw estimator
+    for (uint32_t i = 0; !h->dense || i % 1000; i++) {
+        memset(before, 0, k_hll_registers);
+        hll_max_into(h, before);
+        char buf[16];
+        int n = snprintf(buf, sizeof(buf), "el:%u", i);
+        bool changed = hll_add(h, buf, (size_t)n);
+        assert(!hll_add(h, buf, (size_t)n));  // adding again changes nothing
+        memset(after, 0, k_hll_registers);
+        hll_max_into(h, after);
+        uint32_t diffs = 0;
+        for (uint32_t r = 0; r < k_hll_registers; r++) {
+            assert(after[r] >= before[r] && after[r] <= k_hll_q + 1);
+            diffs += after[r] != before[r];
+        }
+        assert(diffs == (changed ? 1u : 0u));
+        assert(hll_count(h) == hll_count_raw(after));
+        assert(h->dense || h->n_sparse * sizeof(uint32_t) <= k_hll_sparse_max);
+    }
+    assert(hll_mem(h) == sizeof(HLL) + k_hll_dense_bytes);
+
+    // loading registers back picks the encoding by how many are set
+    HLL *copy = hll_new();
+    hll_load_raw(copy, after);
+    assert(copy->dense && hll_count(copy) == hll_count(h));
+    memset(before, 0, k_hll_registers);
+    hll_max_into(copy, before);
+    assert(memcmp(before, after, k_hll_registers) == 0);
+    memset(before, 0, k_hll_registers);
+    before[0] = 1;
+    before[k_hll_registers - 1] = k_hll_q + 1;
+    hll_load_raw(copy, before);
+    assert(!copy->dense && copy->n_sparse == 2 && hll_count(copy) == hll_count_raw(before));
+
+    // saturated registers, as a restored value may hold, stay in range
+    memset(before, k_hll_q + 1, k_hll_registers);
+    assert(hll_count_raw(before) == INT64_MAX);
+    memset(before, k_hll_q, k_hll_registers);
+    assert(hll_count_raw(before) == INT64_MAX);
+
+    hll_free(h);
+    hll_free(copy);
+    free(before);
+    free(after);
+}
+
+static void test_hll_estimate(void) {
+    // within 3 standard errors (0.81% each), exact for tiny sets
+    static const uint32_t k_sizes[] = {1, 2, 10, 100, 1000, 5000, 20000, 100000, 1000000};
+    for (size_t t = 0; t < sizeof(k_sizes) / sizeof(k_sizes[0]); t++) {
+        uint32_t n = k_sizes[t];
+        HLL *h = hll_new();
+        hll_add_range(h, 0, n);
+        double err = (double)hll_count(h) - n;
+        assert(n <= 10 ? err == 0 : (err < 0 ? -err : err) <= 0.0243 * n);
+        hll_free(h);
+    }
+
+    // a union counts each element once
+    HLL *a = hll_new(), *b = hll_new(), *all = hll_new();
+    hll_add_range(a, 0, 60000);
+    hll_add_range(b, 40000, 100000);
+    hll_add_range(all, 0, 100000);
+    uint8_t *raw = calloc(k_hll_registers, 1);
+    hll_max_into(a, raw);
+    hll_max_into(b, raw);
+    assert(hll_count_raw(raw) == hll_count(all));
+    hll_free(a);
+    hll_free(b);
+    hll_free(all);
+    free(raw);
+}
+
+// --- Scripts ---
+
+// call() without a server: a few fixed commands, one reply of each kind
+static void stub_call(void *ctx, char **argv, size_t argc, Buffer *reply) {
+    (void)ctx;
+    if (strcmp(argv[0], "echo") == 0 && argc == 2) {
+        buf_append_u8(reply, TAG_STR);
+        buf_append_u32(reply, (uint32_t)strlen(argv[1]));
+        buf_append(reply, (const uint8_t *)argv[1], strlen(argv[1]));
+    } else if (strcmp(argv[0], "int") == 0) {
+        buf_append_u8(reply, TAG_INT);
+        buf_append_i64(reply, -7);
+    } else if (strcmp(argv[0], "dbl") == 0) {
+        double d = 1.5;
+        buf_append_u8(reply, TAG_DBL);
+        buf_append(reply, (const uint8_t *)&d, 8);
+    } else if (strcmp(argv[0], "nil") == 0) {
+        buf_append_u8(reply, TAG_NIL);
+    } else if (strcmp(argv[0], "arr") == 0) {
+        // [1, ["x", nil]]
+        buf_append_u8(reply, TAG_ARR);
+        buf_append_u32(reply, 2);
+        buf_append_u8(reply, TAG_INT);
+        buf_append_i64(reply, 1);
+        buf_append_u8(reply, TAG_ARR);
+        buf_append_u32(reply, 2);
+        buf_append_u8(reply, TAG_STR);
+        buf_append_u32(reply, 1);
+        buf_append_u8(reply, 'x');
+        buf_append_u8(reply, TAG_NIL);
+    } else if (strcmp(argv[0], "short") == 0) {
+        buf_append_u8(reply, TAG_STR);  // length says 9, no bytes follow
+        buf_append_u32(reply, 9);
+    } else {
+        const char *msg = "no such command";
+        buf_append_u8(reply, TAG_ERR);
+        buf_append_u32(reply, ERR_UNKNOWN);
+        buf_append_u32(reply, (uint32_t)strlen(msg));
+        buf_append(reply, (const uint8_t *)msg, strlen(msg));
+    }
+}
+
+// Compile and run with KEYS = ["k1", "k2"] and ARGV = ["10", "x"].
+// False on a compile or run error, which goes to err.
+static bool run_script(const char *src, ScriptRun *run, char *err, size_t err_size) {
+    static char *k_keys[] = {"k1", "k2"};
+    static char *k_args[] = {"10", "x"};
+    char sha[SHA1_HEX_SIZE];
+    ScriptProgram *prog = script_load(src, strlen(src), sha, err, err_size);
+    if (!prog) {
+        return false;
+    }
+    *run = (ScriptRun){.call = stub_call, .max_steps = 100000};
+    bool ok = script_run(prog, k_keys, 2, k_args, 2, run);
+    if (!ok) {
+        snprintf(err, err_size, "%s", run->err);
+    }
+    return ok;
+}
+
+// The result as text: nil, 12, "s", [a, b]
+static void format_value(const ScriptValue *v, char *out, size_t cap) {
+    size_t n = strlen(out);
+    switch (v->type) {
+    case SV_NIL:
+        snprintf(out + n, cap - n, "nil");
+        break;
+    case SV_INT:
+        snprintf(out + n, cap - n, "%lld", (long long)v->i);
+        break;
+    case SV_STR:
+        snprintf(out + n, cap - n, "\"%s\"", v->s->data);
+        break;
+    case SV_ARR:
+        snprintf(out + n, cap - n, "[");
+        for (uint32_t i = 0; i < v->a->n; i++) {
+            if (i) {
+                n = strlen(out);
+                snprintf(out + n, cap - n, ", ");
+            }
+            format_value(&v->a->items[i], out, cap);
+        }
+        n = strlen(out);
+        snprintf(out + n, cap - n, "]");
+        break;
+    }
+}
+
+static void test_script(void) {
+    // source, then the result as text or, after "!", part of the error
+    static const char *const k_cases[][2] = {
+        // values and operators, by precedence
+        {"return 1 + 2 * 3 - 8 / 4 % 3;", "5"},
+        {"return (1 + 2) * -3;", "-9"},
+        {"return 7 % -3 .. \"|\" .. -7 / 2;", "\"1|-3\""},
+        {"return [1 < 2, 2 <= 2, \"b\" > \"abc\", 3 >= 4, 1 == \"1\", nil != 0];",
+         "[1, 1, 1, 0, 1, 1]"},
+        {"return [!nil, !0, !\"\", 0 || \"x\", 1 && nil, nil || 0];", "[1, 1, 0, \"x\", nil, 0]"},
+        {"return \"a\\\"b\\n\" .. 12;", "\"a\"b\n12\""},
+        {"return \"12\" + 1;", "13"},
+        {"return 9223372036854775807;", "9223372036854775807"},
+        {"x = 1; // comment\n return x;", "1"},
+        {"return;", "nil"},
+        {"x = 1;", "nil"},
+        // control flow
+        {"i = 0; s = 0; while (i < 10) { i = i + 1; if (i % 2) { s = s + i; } } return s;", "25"},
+        {"i = 0; while (1) { i = i + 1; if (i == 5) { break; } } return i;", "5"},
+        {"if (nil) { return 1; } else if (0) { return 2; } else { return 3; }", "3"},
+        {"i = 0; while (i < 3) { j = 0; while (1) { j = j + 1; break; } i = i + j; } return i;", "3"},
+        // arrays and builtins
+        {"a = [1, \"b\"]; a[3] = [nil]; a[1] = a[1] + 1; return [a, len(a), a[9], a[3][1]];",
+         "[[2, \"b\", [nil]], 3, nil, nil]"},
+        {"a = []; push(a, 1); push(a, a); return len(a[2]);", "2"},
+        {"return [len(\"abc\"), len(nil), int(\"42\"), int(\"4x\"), int(\" 1\"), str(5), str(nil)];",
+         "[3, 0, 42, nil, nil, \"5\", nil]"},
+        {"a = [1]; b = a; push(b, 2); return [a == b, [1] == [1], len(a)];", "[1, 0, 2]"},
+        {"return [KEYS[1], KEYS[2], KEYS[3], ARGV[1] * 2, len(ARGV)];", "[\"k1\", \"k2\", nil, 20, 2]"},
+        // call() and its replies
+        {"return [call(\"echo\", KEYS[1] .. 1), call(\"int\"), call(\"dbl\"), call(\"nil\")];",
+         "[\"k11\", -7, \"1.5\", nil]"},
+        {"return call(\"arr\");", "[1, [\"x\", nil]]"},
+        {"return call(\"echo\", 5);", "\"5\""},
+        {"return call(\"nosuch\");", "!line 1: call() failed: no such command"},
+        {"return call(\"short\");", "!malformed reply"},
+        {"return call(\"echo\", [1]);", "!call() argument 2 is array"},
+        {"return call(\"echo\", nil);", "!call() argument 2 is nil"},
+        // run-time errors
+        {"x = 1;\nreturn x / 0;", "!line 2: division by zero"},
+        {"return 5 % 0;", "!division by zero"},
+        {"return 9223372036854775807 + 1;", "!integer overflow"},
+        {"return -9223372036854775807 - 2;", "!integer overflow"},
+        {"return (0 - 9223372036854775807 - 1) / -1;", "!integer overflow"},
+        {"return [1] + 1;", "!arithmetic on array and int"},
+        {"return \"a\" + 1;", "!arithmetic on string and int"},
+        {"return [1] < 2;", "!cannot compare array with int"},
+        {"return 1[1];", "!cannot index int"},
+        {"a = [1]; return a[\"x\"];", "!array index must be an integer"},
+        {"a = [1]; a[3] = 1;", "!array index out of range"},
+        {"a = [1]; a[0] = 1;", "!array index out of range"},
+        {"return len(1);", "!len() of int"},
+        {"return push(1, 2);", "!push() onto int"},
+        {"return str([1]);", "!expected a string, got array"},
+        {"while (1) { }", "!instruction budget"},
+        {"s = \"xxxxxxxx\"; while (1) { s = s .. s; }", "!script memory limit reached"},
+        // compile errors
+        {"return \"abc;", "!line 1: unterminated string"},
+        {"return 1 # 2;", "!unexpected character '#'"},
+        {"return 9223372036854775808;", "!integer literal out of range"},
+        {"return 20000000000000000000;", "!integer literal out of range"},
+        {"return y;", "!undefined variable 'y'"},
+        {"return foo(1);", "!unknown function 'foo'"},
+        {"return len(1, 2);", "!wrong number of arguments to len()"},
+        {"return call();", "!wrong number of arguments to call()"},
+        {"break;", "!break outside a loop"},
+        {"1 = 2;", "!invalid assignment target"},
+        {"x = 1;\n\nif (x { }", "!line 3: expected ')'"},
+        {"return", "!unexpected end of script"},
+        {"x = [1, 2;", "!expected ']'"},
+    };
+    for (size_t i = 0; i < sizeof(k_cases) / sizeof(k_cases[0]); i++) {
+        ScriptRun run;
+        char err[256] = "", got[512] = "";
+        bool ok = run_script(k_cases[i][0], &run, err, sizeof(err));
+        const char *want = k_cases[i][1];
+        if (ok) {
+            format_value(&run.result, got, sizeof(got));
+        }
+        if (want[0] == '!' ? ok || !strstr(err, want + 1) : !ok || strcmp(got, want) != 0) {
+            fprintf(stderr, "script %zu: %s\n  want %s\n  got  %s\n", i, k_cases[i][0], want,
+                    ok ? got : err);
+            assert(false);
+        }
+        script_run_done(&run);
+    }
+
+    // nesting past the parser's limit is a compile error, not a crash
+    size_t depth = 2000;
+    char *src = malloc(2 * depth + 16);
+    strcpy(src, "return ");
+    memset(src + 7, '(', depth);
+    strcpy(src + 7 + depth, "1");
+    memset(src + 8 + depth, ')', depth);
+    strcpy(src + 8 + 2 * depth, ";");
+    char err[256];
+    char sha[SHA1_HEX_SIZE];
+    assert(!script_load(src, strlen(src), sha, err, sizeof(err)) && strstr(err, "nested too deeply"));
+    free(src);
+
+    // the cache: the same source compiles once, by SHA-1
+    script_flush();
+    char sha2[SHA1_HEX_SIZE];
+    ScriptProgram *prog = script_load("return 1;", 9, sha, err, sizeof(err));
+    assert(prog && script_load("return 1;", 9, sha2, err, sizeof(err)) == prog);
+    assert(strcmp(sha, sha2) == 0 && strlen(sha) == 40 && script_find(sha) == prog);
+    assert(script_load("return 2;", 9, sha2, err, sizeof(err)) && strcmp(sha, sha2) != 0);
+    assert(script_count() == 2 && !script_find("0000000000000000000000000000000000000000"));
+    script_flush();
+    assert(script_count() == 0 && !script_find(sha));
+}
+
+static void test_script_result_limits(void) {
+    ScriptRun run;
+    char err[256];
+
+    // nested arrays come back as built
+    assert(run_script("a = [1, [2, [3, nil]], \"x\"]; return a;", &run, err, sizeof(err)));
+    ScriptValue *v = &run.result;
+    assert(v->type == SV_ARR && v->a->n == 3);
+    assert(v->a->items[1].type == SV_ARR && v->a->items[1].a->items[1].a->n == 2);
+    assert(v->a->items[2].type == SV_STR && strcmp(v->a->items[2].s->data, "x") == 0);
+    script_run_done(&run);
+
+    // an array that contains itself
+    assert(!run_script("a = [1]; push(a, a); return a;", &run, err, sizeof(err)));
+    assert(strstr(err, "result nested too deeply"));
+    script_run_done(&run);
+
+    // 2^30 elements built from shared arrays, within the memory cap
+    assert(!run_script("a = [1]; i = 0; while (i < 30) { a = [a, a]; i = i + 1; } return a;",
+                       &run, err, sizeof(err)));
+    assert(strstr(err, "result too large"));
+    script_run_done(&run);
+
+    // just inside the depth limit
+    assert(run_script("a = 1; i = 0; while (i < 32) { a = [a]; i = i + 1; } return a;",
+                      &run, err, sizeof(err)));
+    script_run_done(&run);
+    assert(!run_script("a = 1; i = 0; while (i < 33) { a = [a]; i = i + 1; } return a;",
+                       &run, err, sizeof(err)));
+    script_run_done(&run);
+}
+
+// --- DUMP/RESTORE ---
+
+static bool cb_same_field(const char *field, uint32_t field_len, const char *val,
+                          uint32_t val_len, void *arg) {
+    uint32_t len = 0;
+    const char *got = hash_get((Hash *)arg, field, field_len, &len);
+    assert(got && len == val_len && memcmp(got, val, len) == 0);
+    return true;
+}
+
+// Dump, restore, and dump the copy: both payloads must match. Except
+// for large hashes, which list their fields in table order.
+static void dump_round_trip(Entry *ent) {
+    char *payload = dump_value(ent);
+    uint32_t type = 0;
+    void *value = NULL;
+    assert(restore_value(payload, &type, &value));
+    assert(type == ent->type);
+
+    Entry copy = {.type = type};
+    if (type == T_STR) {
+        copy.val = value;
+    } else {
+        copy.hash = value;  // any member of the union
+    }
+    char *again = dump_value(&copy);
+    if (type == T_HASH) {
+        assert(strlen(payload) == strlen(again) && hash_len(copy.hash) == hash_len(ent->hash));
+        hash_foreach(ent->hash, cb_same_field, copy.hash);
+    } else {
+        assert(strcmp(payload, again) == 0);
+    }
+    restore_free(type, value);
+    free(payload);
+    free(again);
+}
+
+static void test_dump(void) {
+    char buf[32];
+
+    Entry str = {.type = T_STR, .enc = ENC_RAW, .val = "hello"};
+    dump_round_trip(&str);
+    Entry num = {.type = T_STR, .enc = ENC_INT, .ival = -42};
+    dump_round_trip(&num);
+
+    // past the listpack encodings, so both sides of each conversion
+    Entry hash = {.type = T_HASH, .hash = hash_new()};
+    Entry list = {.type = T_LIST, .list = ql_new()};
+    Entry zset = {.type = T_ZSET, .zset = zset_new()};
+    for (int i = 0; i < 1000; i++) {
+        int n = snprintf(buf, sizeof(buf), "m%d", i);
+        hash_set(hash.hash, buf, (uint32_t)n, buf, (uint32_t)n);
+        ql_push(list.list, i % 2, buf, (uint32_t)n);
+        zset_add(zset.zset, buf, (size_t)n, i % 7 - 3.5);
+        if (i == 9) {
+            dump_round_trip(&hash);
+            dump_round_trip(&list);
+            dump_round_trip(&zset);
+        }
+    }
+    dump_round_trip(&hash);
+    dump_round_trip(&list);
+    dump_round_trip(&zset);
+    hash_free(hash.hash);
+    ql_free(list.list);
+    zset_free(zset.zset);
+
+    // entries over several blocks, a group with consumers and a PEL
+    Entry stream = {.type = T_STREAM, .stream = stream_new()};
+    for (uint64_t i = 1; i <= 1000; i++) {
+        snprintf(buf, sizeof(buf), "%llu", (unsigned long long)i);
+        char *strs[] = {"f", buf, "g", "v"};
+        StreamID id = {i * 10, i % 3}, added;
+        assert(stream_add(stream.stream, &id, 0, strs, i % 2 ? 2 : 4, &added));
+    }
+    StreamID last = {5000, 0};
+    StreamGroup *g = stream_group_create(stream.stream, "grp", &last);
+    StreamConsumer *c1 = stream_consumer_get(stream.stream, g, "c1", 111);
+    StreamConsumer *c2 = stream_consumer_get(stream.stream, g, "c2", 222);
+    for (uint64_t i = 1; i <= 500; i++) {
+        StreamID id = {i * 10, i % 3};
+        stream_pel_add(stream.stream, g, i % 2 ? c1 : c2, &id, 1000 + i);
+    }
+    stream_group_create(stream.stream, "empty", &last);
+    dump_round_trip(&stream);
+    stream_free(stream.stream);
+
+    Entry bitmap = {.type = T_BITMAP, .bitmap = bm_new()};
+    dump_round_trip(&bitmap);
+    for (uint64_t off = 0; off < 100000; off += 997) {
+        bm_set(bitmap.bitmap, off, true);
+    }
+    dump_round_trip(&bitmap);
+    bm_free(bitmap.bitmap);
+
+    // sparse, then dense
+    Entry hll = {.type = T_HLL, .hll = hll_new()};
+    dump_round_trip(&hll);
+    for (int i = 0; i < 20000; i++) {
+        int n = snprintf(buf, sizeof(buf), "e%d", i);
+        hll_add(hll.hll, buf, (size_t)n);
+        if (i == 100) {
+            assert(!hll.hll->dense);
+            dump_round_trip(&hll);
+        }
+    }
+    assert(hll.hll->dense);
+    dump_round_trip(&hll);
+    hll_free(hll.hll);
+
+    // malformed payloads
+    static const char *const k_bad[] = {
+        "",
+        "0100",                                // string without its length
+        "0200000000",                          // wrong version
+        "0109000000",                          // unknown type
+        "010200000000",                        // empty list
+        "010100000000",                        // empty hash
+        "010600000000",                        // empty sorted set
+        "01020100000001000000610",             // odd number of hex digits
+        "0102010000000100000061ff",            // trailing bytes
+        "01050100000034000000",                // HLL register above k_hll_q + 1
+        "01050100000000010000",                // HLL register of 0
+        "01050100000001400001",                // HLL register index out of range
+        "01010200000001000000660100000076"
+        "01000000660100000076",                // repeated hash field
+    };
+    for (size_t i = 0; i < sizeof(k_bad) / sizeof(k_bad[0]); i++) {
+        uint32_t type = 0;
+        void *value = NULL;
+        assert(!restore_value(k_bad[i], &type, &value) && value == NULL);
+    }
+}
 
 int main() {
     Container c = {NULL};
@@ -292,6 +1387,30 @@ int main() {
     dispose(&c);
     ms_destroy(&ref);
 
+    // B+tree: small trees, deep trees, heavy duplicates
+    test_btree(200, 1000);
+    test_btree(20000, 100000);
+    test_btree(20000, 50);
+
+    // listpack entries around the header size boundaries; quicklist
+    // chunks splitting and draining
+    test_listpack();
+    test_quicklist();
+
+    // stream IDs, delta-encoded blocks and range reads, the PEL
+    test_stream_ids();
+    test_stream_blocks();
+    test_stream_pel();
+
+    // HLL encodings and the estimator
+    test_hll_sparse_to_dense();
+    test_hll_estimate();
+
+    // the script compiler and VM, including their error paths
+    test_script();
+    test_script_result_limits();
+    test_dump();
+
     printf("All AVL tests passed successfully!\n");
     return 0;
 }
@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include "zset.h"
+#include "kv.h"
+#include "common.h"
+
+#define container_of(ptr, T, member) \
+    ((T *)( (char *)ptr - offsetof(T, member) ))
+
+// Longest name a seek compares without allocating
+#define k_zset_probe_name 64
+
+// The score's bits, flipped so they sort like the doubles: negative
+// scores reversed below the positive ones. -0.0 is keyed as 0.0, which
+// it equals. Scores are never NaN.
+static uint64_t score_key(double score) {
+    uint64_t bits = 0;
+    if (score != 0) {
+        memcpy(&bits, &score, 8);
+    }
+    return bits >> 63 ? ~bits : bits | (1ull << 63);
+}
+
+// (score, name) ordering
+static int zcmp(const void *a, const void *b) {
+    const ZNode *l = (const ZNode *)a, *r = (const ZNode *)b;
+    if (l->score != r->score) {
+        return l->score < r->score ? -1 : 1;
+    }
+    size_t min_len = l->len < r->len ? l->len : r->len;
+    int rv = memcmp(l->name, r->name, min_len);
+    return rv != 0 ? rv : (l->len > r->len) - (l->len < r->len);
+}
+
+ZSet *zset_new(void) {
+    ZSet *zset = calloc(1, sizeof(ZSet));
+    if (!zset) {
+        die("Memory allocation failed");
+    }
+    bt_init(&zset->tree, zcmp);
+    return zset;
+}
+
+void zset_free(ZSet *zset) {
+    for (BTIter it = bt_first(&zset->tree); bt_valid(&it); bt_next(&it)) {
+        free(bt_item(&it));  // the leaf keeps its pointer, it is not read again
+    }
+    bt_clear(&zset->tree);
+    hm_clear(&zset->hmap);
+    free(zset);
+}
+
+size_t zset_len(ZSet *zset) {
+    return hm_size(&zset->hmap);
+}
+
+size_t zset_mem(ZSet *zset) {
+    size_t slots = (zset->hmap.newer.table ? zset->hmap.newer.mask + 1 : 0)
+                 + (zset->hmap.older.table ? zset->hmap.older.mask + 1 : 0);
+    return sizeof(ZSet) + zset->bytes + zset->tree.bytes + slots * sizeof(HNode *);
+}
+
+static size_t znode_size(size_t len) {
+    return sizeof(ZNode) + len + 1;
+}
+
+static ZNode *znode_new(const char *name, size_t len, double score) {
+    ZNode *node = malloc(znode_size(len));
+    if (!node) {
+        die("Memory allocation failed");
+    }
+    node->hmap.next = NULL;
+    node->hmap.hcode = kv_hash(name, len);
+    node->score = score;
+    node->len = len;
+    memcpy(node->name, name, len);
+    node->name[len] = '\0';
+    return node;
+}
+
+typedef struct HKey {
+    HNode node;
+    const char *name;
+    size_t len;
+} HKey;
+
+static bool hcmp(HNode *node, HNode *key) {
+    ZNode *znode = container_of(node, ZNode, hmap);
+    HKey *hkey = container_of(key, HKey, node);
+    return znode->len == hkey->len && memcmp(znode->name, hkey->name, hkey->len) == 0;
+}
+
+ZNode *zset_lookup(ZSet *zset, const char *name, size_t len) {
+    if (!bt_len(&zset->tree)) {
+        return NULL;
+    }
+    HKey key;
+    key.node.hcode = kv_hash(name, len);
+    key.name = name;
+    key.len = len;
+    HNode *found = hm_lookup(&zset->hmap, &key.node, hcmp);
+    return found ? container_of(found, ZNode, hmap) : NULL;
+}
+
+bool zset_add(ZSet *zset, const char *name, size_t len, double score) {
+    ZNode *node = zset_lookup(zset, name, len);
+    if (node) {
+        if (node->score != score) {  // detach, update, reinsert
+            bt_delete(&zset->tree, score_key(node->score), node);
+            node->score = score;
+            bt_insert(&zset->tree, score_key(score), node);
+        }
+        return false;
+    }
+    node = znode_new(name, len, score);
+    hm_insert(&zset->hmap, &node->hmap);
+    bt_insert(&zset->tree, score_key(score), node);
+    zset->bytes += znode_size(len);
+    return true;
+}
+
+void zset_delete(ZSet *zset, ZNode *node) {
+    HKey key;
+    key.node.hcode = node->hmap.hcode;
+    key.name = node->name;
+    key.len = node->len;
+    hm_delete(&zset->hmap, &key.node, hcmp);
+    bt_delete(&zset->tree, score_key(node->score), node);
+    zset->bytes -= znode_size(node->len);
+    free(node);
+}
+
+ZNode *zset_seekge(ZSet *zset, double score, const char *name, size_t len, ZIter *iter) {
+    // The tree compares items, so the bound is made into a node
+    union {
+        ZNode node;
+        char bytes[sizeof(ZNode) + k_zset_probe_name];
+    } local;
+    ZNode *probe = len <= k_zset_probe_name ? &local.node : malloc(sizeof(ZNode) + len);
+    if (!probe) {
+        die("Memory allocation failed");
+    }
+    probe->score = score;
+    probe->len = len;
+    memcpy(probe->name, name, len);
+    iter->it = bt_seek(&zset->tree, score_key(score), probe, false);
+    if (probe != &local.node) {
+        free(probe);
+    }
+    return bt_valid(&iter->it) ? bt_item(&iter->it) : NULL;
+}
+
+ZNode *zset_next(ZIter *iter) {
+    bt_next(&iter->it);
+    return bt_valid(&iter->it) ? bt_item(&iter->it) : NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef ZSET_H
+#define ZSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "btree.h"
+#include "hashtable.h"
+
+// Sorted set: members ordered by (score, name) in a B+tree, plus a
+// hashtable from name to node for point lookups. Each member is a single
+// allocation, hooked into the hashtable and pointed to by the tree. The
+// tree is keyed by the score's bits, so names are only compared between
+// members of equal score.
+typedef struct ZNode {
+    HNode hmap;
+    double score;
+    size_t len;
+    char name[];
+} ZNode;
+
+typedef struct ZSet {
+    BTree tree;
+    HMap hmap;
+    size_t bytes;  // sum of the node allocations
+} ZSet;
+
+// Position in a sorted set, invalidated by any change to it
+typedef struct ZIter {
+    BTIter it;
+} ZIter;
+
+ZSet *zset_new(void);
+void zset_free(ZSet *zset);
+size_t zset_len(ZSet *zset);
+size_t zset_mem(ZSet *zset);  // estimated bytes, for maxmemory
+
+ZNode *zset_lookup(ZSet *zset, const char *name, size_t len);
+bool zset_add(ZSet *zset, const char *name, size_t len, double score);  // false if it only updated
+void zset_delete(ZSet *zset, ZNode *node);
+// First member >= (score, name), NULL if none. iter is set to it.
+ZNode *zset_seekge(ZSet *zset, double score, const char *name, size_t len, ZIter *iter);
+ZNode *zset_next(ZIter *iter);  // the member after iter's, NULL at the end
+
+#endif